@@ -21,6 +21,15 @@
 #include <libgen.h>
 #include <syslog.h>
 
+#include "framesource.h"
+#include "rtmem.h"
+#include "framepool.h"
+#include "frameshm.h"
+#include "overlay.h"
+#include "framedump.h"
+#include "framestage.h"
+#include "frameencode.h"
+
 // Macros to clear memory, set resolution, and define frame capture limits
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -39,6 +48,12 @@
 
 #define DUMP_FRAMES
 
+// Heap grown and touched at startup, large enough for the per-frame allocations
+#define RT_HEAP_RESERVE (4 * 1024 * 1024)
+
+// Default number of user pointer buffers, -b changes it up to VIDEO_MAX_FRAME
+#define USERP_BUFFERS 4
+
 // Struct to hold video format details
 static struct v4l2_format fmt;
 
@@ -61,13 +76,39 @@ static int out_buf;
 static int force_format = 1;
 static int frame_count = FRAMES_TO_ACQUIRE;
 
+// Frame source standing in for the camera when the device name is a
+// synthetic: or replay: spec, frames directory override and no frame delay
+static struct frame_source *frame_source;
+static char *output_dir;
+static int unthrottled;
+
+// User pointer buffers, page aligned slots on huge pages where available
+static unsigned int userp_buffers = USERP_BUFFERS;
+static struct frame_pool userp_pool;
+
+// Frames also published in shared memory for local readers, see frameshm.h
+static char *shm_name;
+static struct frame_shm frame_ring;
+static int publishing;
+
+// Frame count and time burned into stored frames, see overlay.h
+static int stamping;
+static struct overlay frame_stamp;
+
+// Per-frame latency log, capture and dequeue time of the frame being processed
+static char *latency_path;
+static FILE *latency_log;
+static struct timeval frame_sensor_time;
+static struct timespec frame_dequeue_time;
+
 // Timing-related variables for frame processing
 static double fnow = 0.0, fstart = 0.0, fstop = 0.0;
 static struct timespec time_now, time_start, time_stop;
 
 // Frame counter and buffer for holding the frame data
 int framecnt = -8;
-unsigned char bigbuffer[(1280 * 960)];
+// Block aligned, so O_DIRECT writes of converted frames need no bounce copy
+unsigned char bigbuffer[(1280 * 960)] __attribute__((aligned(FRAME_DUMP_ALIGN)));
 
 // Function to handle errors and exit the program with an error message
 static void errno_exit(const char *s) {
@@ -78,6 +119,9 @@ static void errno_exit(const char *s) {
 
 // Wrapper for the ioctl system call, which allows low-level control of the video device
 static int xioctl(int fh, int request, void *arg) {
+    if (frame_source)
+        return frame_source_ioctl(frame_source, request, arg);
+
     int r;
     do {
         r = ioctl(fh, request, arg);
@@ -85,11 +129,22 @@ static int xioctl(int fh, int request, void *arg) {
     return r;
 }
 
-// Headers and file name templates for saving frames as PPM or PGM files
-char ppm_header[] = "P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char ppm_dumpname[PATH_MAX];
-char pgm_header[] = "P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char pgm_dumpname[PATH_MAX];
+// Directory the frames are saved to, set once before capture starts
+static char dump_dir[PATH_MAX];
+
+// Buffered, O_DIRECT or smoothed writes of the frames, see framedump.h
+static enum frame_dump_mode write_mode = FRAME_DUMP_BUFFERED;
+static struct frame_dumper dumper;
+
+// Frames staged in RAM and flushed to the directory in the background, see framestage.h
+static unsigned int stage_slots;
+static enum frame_stage_policy stage_policy = FRAME_STAGE_DROP_NEWEST;
+static struct frame_stage stage;
+
+// Frames encoded to QOI by a pool of workers off the capture core, see frameencode.h
+static unsigned int encode_workers;
+static int rt_core = -1;
+static struct frame_encoder encoder;
 
 // Function to create a directory for saving frame images
 int create_directory(const char *path) {
@@ -107,100 +162,89 @@ int create_directory(const char *path) {
 
 // Function to set the output directory for saving frame images
 void set_output_directory(const char *dir) {
-    snprintf(ppm_dumpname, PATH_MAX, "%s/test0000.ppm", dir);
-    snprintf(pgm_dumpname, PATH_MAX, "%s/test0000.pgm", dir);
+    snprintf(dump_dir, sizeof(dump_dir), "%s", dir);
 }
 
 // Function to save a frame in PPM format (used for RGB images)
-static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time) {
-    int written, total, dumpfd;
-    snprintf(&ppm_dumpname[strlen(ppm_dumpname) - 8], 9, "%04d.ppm", tag);
-    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 0644);
-
-    if (dumpfd == -1) {
-        syslog(LOG_ERR, "Failed to open ppm file %s: %s [10Hz]\n", ppm_dumpname, strerror(errno));
-        perror("Failed to open ppm file [10Hz]");
+// The file name, header and log time are all local, the dumper belongs to the capture thread
+static void dump_ppm(const void *p, unsigned int tag, struct timespec *time) {
+    char dumpname[PATH_MAX + 32];
+    struct timespec written_time;
+    double written_at;
+    int total;
+
+    // An encoded frame is copied here and stored as QOI by a worker later
+    if (encode_workers) {
+        snprintf(dumpname, sizeof(dumpname), "%s/test%04d.qoi", dump_dir, tag);
+        if (frame_encoder_put(&encoder, dumpname, p) != 0)
+            syslog(LOG_WARNING, "%s, PPM frame %d dropped [10Hz]\n",
+                   errno == ENAMETOOLONG ? "Path too long" : "Encoders busy", framecnt);
         return;
     }
 
-    // Add the timestamp to the PPM header
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
+    snprintf(dumpname, sizeof(dumpname), "%s/test%04d.ppm", dump_dir, tag);
 
-    // Write the PPM header to the file
-    written = write(dumpfd, ppm_header, sizeof(ppm_header) - 1);
-    if (written == -1) {
-        syslog(LOG_ERR, "Failed to write ppm header: %s [10Hz]\n", strerror(errno));
-        perror("Failed to write ppm header [10Hz]");
-        close(dumpfd);
+    // A staged frame is copied to RAM here and written by the flusher later
+    if (stage_slots) {
+        if (frame_stage_put(&stage, dumpname, p, time) != 0)
+            syslog(LOG_WARNING, "%s, PPM frame %d dropped [10Hz]\n",
+                   errno == ENAMETOOLONG ? "Path too long" : "Staging full", framecnt);
         return;
     }
 
-    // Write the frame data to the file
-    total = 0;
-    do {
-        written = write(dumpfd, p, size);
-        if (written == -1) {
-            syslog(LOG_ERR, "Failed to write ppm data: %s [10Hz]\n", strerror(errno));
-            perror("Failed to write ppm data [10Hz]");
-            close(dumpfd);
-            return;
-        }
-        total += written;
-    } while (total < size);
+    // Write the header with the timestamp and the frame data in one system call
+    total = frame_dumper_ppm(&dumper, dumpname, p, HRES, VRES, time);
+    if (total < 0) {
+        syslog(LOG_ERR, "Failed to write ppm file %s: %s [10Hz]\n", dumpname, strerror(errno));
+        perror("Failed to write ppm file [10Hz]");
+        return;
+    }
 
     // Log the time at which the frame was written
-    clock_gettime(CLOCK_MONOTONIC, &time_now);
-    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    syslog(LOG_INFO, "[Course #:4] [Final Project] [Frame Count: %d] [Image Capture Start Time: %lf seconds] PPM frame written to %s at %lf, %d bytes [10Hzgrep]\n", framecnt, fnow - fstart, ppm_dumpname, (fnow - fstart), total);
-
-    close(dumpfd);
+    clock_gettime(CLOCK_MONOTONIC, &written_time);
+    written_at = (double)written_time.tv_sec + (double)written_time.tv_nsec / 1000000000.0 - fstart;
+    syslog(LOG_INFO, "[Course #:4] [Final Project] [Frame Count: %d] [Image Capture Start Time: %lf seconds] PPM frame written to %s at %lf, %d bytes [10Hzgrep]\n", framecnt, written_at, dumpname, written_at, total);
 }
 
 // Function to save a frame in PGM format (used for grayscale images)
-static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time) {
-    int written, total, dumpfd;
-    snprintf(&pgm_dumpname[strlen(pgm_dumpname) - 8], 9, "%04d.pgm", tag);
-    dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 0644);
-
-    if (dumpfd == -1) {
-        syslog(LOG_ERR, "Failed to open pgm file %s: %s [10Hz]\n", pgm_dumpname, strerror(errno));
-        perror("Failed to open pgm file [10Hz]");
+// The file name, header and log time are all local, the dumper belongs to the capture thread
+static void dump_pgm(const void *p, unsigned int tag, struct timespec *time) {
+    char dumpname[PATH_MAX + 32];
+    struct timespec written_time;
+    double written_at;
+    int total;
+
+    // An encoded frame is copied here and stored as QOI by a worker later
+    if (encode_workers) {
+        snprintf(dumpname, sizeof(dumpname), "%s/test%04d.qoi", dump_dir, tag);
+        if (frame_encoder_put(&encoder, dumpname, p) != 0)
+            syslog(LOG_WARNING, "%s, PGM frame %d dropped [10Hz]\n",
+                   errno == ENAMETOOLONG ? "Path too long" : "Encoders busy", framecnt);
         return;
     }
 
-    // Add the timestamp to the PGM header
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
+    snprintf(dumpname, sizeof(dumpname), "%s/test%04d.pgm", dump_dir, tag);
 
-    // Write the PGM header to the file
-    written = write(dumpfd, pgm_header, sizeof(pgm_header) - 1);
-    if (written == -1) {
-        syslog(LOG_ERR, "Failed to write pgm header: %s [10Hz]\n", strerror(errno));
-        perror("Failed to write pgm header [10Hz]");
-        close(dumpfd);
+    // A staged frame is copied to RAM here and written by the flusher later
+    if (stage_slots) {
+        if (frame_stage_put(&stage, dumpname, p, time) != 0)
+            syslog(LOG_WARNING, "%s, PGM frame %d dropped [10Hz]\n",
+                   errno == ENAMETOOLONG ? "Path too long" : "Staging full", framecnt);
         return;
     }
 
-    // Write the frame data to the file
-    total = 0;
-    do {
-        written = write(dumpfd, p, size);
-        if (written == -1) {
-            syslog(LOG_ERR, "Failed to write pgm data: %s [10Hz]\n", strerror(errno));
-            perror("Failed to write pgm data [10Hz]");
-            close(dumpfd);
-            return;
-        }
-        total += written;
-    } while (total < size);
+    // Write the header with the timestamp and the frame data in one system call
+    total = frame_dumper_pgm(&dumper, dumpname, p, HRES, VRES, time);
+    if (total < 0) {
+        syslog(LOG_ERR, "Failed to write pgm file %s: %s [10Hz]\n", dumpname, strerror(errno));
+        perror("Failed to write pgm file [10Hz]");
+        return;
+    }
 
     // Log the time at which the frame was written
-    clock_gettime(CLOCK_MONOTONIC, &time_now);
-    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    syslog(LOG_INFO, "[Course #:4] [Final Project] [Frame Count: %d] [Image Capture Start Time: %lf seconds] PGM frame written to %s at %lf, %d bytes [10Hz]\n", framecnt, fnow - fstart, pgm_dumpname, (fnow - fstart), total);
-
-    close(dumpfd);
+    clock_gettime(CLOCK_MONOTONIC, &written_time);
+    written_at = (double)written_time.tv_sec + (double)written_time.tv_nsec / 1000000000.0 - fstart;
+    syslog(LOG_INFO, "[Course #:4] [Final Project] [Frame Count: %d] [Image Capture Start Time: %lf seconds] PGM frame written to %s at %lf, %d bytes [10Hz]\n", framecnt, written_at, dumpname, written_at, total);
 }
 
 // Function to convert YUV format to RGB (used for processing frames from the camera)
@@ -217,11 +261,62 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
    *b = (b1 > 255) ? 255 : (b1 < 0) ? 0 : b1;
 }
 
+// Function to note when the frame about to be processed was captured and dequeued
+static void stamp_frame(const struct timeval *sensor) {
+    if (sensor)
+        frame_sensor_time = *sensor;
+    else
+        timerclear(&frame_sensor_time);
+    clock_gettime(CLOCK_MONOTONIC, &frame_dequeue_time);
+}
+
+// Function to append the capture, dequeue and written times of a frame to the latency log
+static void log_frame_latency(void) {
+    struct timespec written;
+
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    fprintf(latency_log, "%d,%llu,%llu,%llu\n", framecnt,
+            (unsigned long long)frame_sensor_time.tv_sec * 1000000000ULL + (unsigned long long)frame_sensor_time.tv_usec * 1000ULL,
+            (unsigned long long)frame_dequeue_time.tv_sec * 1000000000ULL + (unsigned long long)frame_dequeue_time.tv_nsec,
+            (unsigned long long)written.tv_sec * 1000000000ULL + (unsigned long long)written.tv_nsec);
+}
+
+// Function to publish the frame in shared memory stamped with its capture time
+static void publish_frame(const void *gray, int size) {
+    struct timespec capture_time;
+
+    if (timerisset(&frame_sensor_time)) {
+        capture_time.tv_sec = frame_sensor_time.tv_sec;
+        capture_time.tv_nsec = frame_sensor_time.tv_usec * 1000;
+    } else {
+        capture_time = frame_dequeue_time;
+    }
+
+    // A frame converted in place is already in the slot begun for it
+    if (gray)
+        frame_shm_publish(&frame_ring, gray, size, framecnt, &capture_time);
+    else
+        frame_shm_commit(&frame_ring, size, framecnt, &capture_time);
+}
+
+// Function to burn the frame count and time into a frame before it is stored
+static void burn_in_stamp(unsigned char *frame, enum overlay_format format, struct timespec *frame_time) {
+    if (!stamping || framecnt < 0)
+        return;
+
+    if (frame_stamp.format != format && overlay_init(&frame_stamp, format, 8, 8, 2) < 0)
+        return;
+
+    overlay_stamp(&frame_stamp, frame, HRES, VRES, (unsigned long long)framecnt, frame_time);
+}
+
 // Function to process each captured frame, including saving to file and converting formats
 static void process_image(const void *p, int size) {
     int i, newi;
     struct timespec frame_time;
     unsigned char *pptr = (unsigned char *)p;
+    unsigned char *gray;
+    int publish;
 
     clock_gettime(CLOCK_REALTIME, &frame_time);    
 
@@ -233,24 +328,49 @@ static void process_image(const void *p, int size) {
         fstart = (double)time_start.tv_sec + (double)time_start.tv_nsec / 1000000000.0;
     }
 
+    // Start-up frames are not published, readers see frame 0 first
+    publish = publishing && framecnt > -1;
+
 #ifdef DUMP_FRAMES
     // Save frames based on their format (GRAY, YUYV, RGB)
     if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY) {
-        dump_pgm(p, size, framecnt, &frame_time);
+        burn_in_stamp(pptr, OVERLAY_GRAY, &frame_time);
+        dump_pgm(p, framecnt, &frame_time);
+        if (publish)
+            publish_frame(p, size);
     } else if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
+        // Convert straight into the shared memory slot when publishing
+        gray = publish ? frame_shm_begin(&frame_ring) : bigbuffer;
         for (i = 0, newi = 0; i < size; i += 4, newi += 2) {
-            bigbuffer[newi] = pptr[i];
-            bigbuffer[newi + 1] = pptr[i + 2];
+            gray[newi] = pptr[i];
+            gray[newi + 1] = pptr[i + 2];
         }
+        burn_in_stamp(gray, OVERLAY_GRAY, &frame_time);
         if (framecnt > -1) {
-            dump_pgm(bigbuffer, (size / 2), framecnt, &frame_time);
+            dump_pgm(gray, framecnt, &frame_time);
         }
+        if (publish)
+            publish_frame(NULL, size / 2);
     } else if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24) {
-        dump_ppm(p, size, framecnt, &frame_time);
+        burn_in_stamp(pptr, OVERLAY_RGB, &frame_time);
+        dump_ppm(p, framecnt, &frame_time);
+        if (publish)
+            publish_frame(p, size);
     } else {
         syslog(LOG_ERR, "ERROR - unknown dump format [10Hz]\n");
     }
 #endif
+
+    if (latency_log)
+        log_frame_latency();
+
+    // How far the flusher is behind, every 100 frames
+    if (stage_slots && framecnt > 0 && framecnt % 100 == 0) {
+        unsigned long long buffered, lag;
+
+        frame_stage_counters(&stage, &buffered, &lag);
+        syslog(LOG_INFO, "Staging %llu bytes, flush lag %.1lf ms [10Hz]\n", buffered, lag / 1000000.0);
+    }
 }
 
 // Function to read a single frame of video data and process it
@@ -269,6 +389,7 @@ static int read_frame(void) {
                         errno_exit("read");
                 }
             }
+            stamp_frame(NULL);
             process_image(buffers[0].start, buffers[0].length);
             break;
 
@@ -289,6 +410,7 @@ static int read_frame(void) {
             }
 
             assert(buf.index < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -315,6 +437,7 @@ static int read_frame(void) {
                     break;
 
             assert(i < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image((void *)buf.m.userptr, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -332,7 +455,10 @@ static void mainloop(void) {
     struct timespec time_error;
 
     // Configure the read delay based on the desired frames per second
-    printf("Running at 10 frames/sec\n");
+    if (unthrottled)
+        printf("Running unthrottled\n");
+    else
+        printf("Running at 10 frames/sec\n");
     read_delay.tv_sec = 0;
     read_delay.tv_nsec = 100000000; // 10 Hz
 
@@ -365,7 +491,7 @@ static void mainloop(void) {
             }
 
             if (read_frame()) {
-                if (nanosleep(&read_delay, &time_error) != 0)
+                if (!unthrottled && nanosleep(&read_delay, &time_error) != 0)
                     perror("nanosleep");
                 else {
                     if (framecnt > 1) {
@@ -465,6 +591,8 @@ static void uninit_device(void) {
             break;
 
         case IO_METHOD_MMAP:
+            if (frame_source)
+                break; // buffers belong to the frame source
             for (i = 0; i < n_buffers; ++i)
                 if (-1 == munmap(buffers[i].start, buffers[i].length))
                     errno_exit("munmap");
@@ -472,7 +600,8 @@ static void uninit_device(void) {
 
         case IO_METHOD_USERPTR:
             for (i = 0; i < n_buffers; ++i)
-                free(buffers[i].start);
+                frame_pool_put(&userp_pool, buffers[i].start);
+            frame_pool_free(&userp_pool);
             break;
     }
 
@@ -559,7 +688,7 @@ static void init_userp(unsigned int buffer_size) {
 
     CLEAR(req);
 
-    req.count  = 4;
+    req.count  = userp_buffers;
     req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_USERPTR;
 
@@ -572,16 +701,31 @@ static void init_userp(unsigned int buffer_size) {
         }
     }
 
-    buffers = calloc(4, sizeof(*buffers));
+    // The driver may give fewer buffers than asked for
+    if (req.count < 2) {
+        syslog(LOG_ERR, "Insufficient user pointer buffers on %s [10Hz]\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    buffers = calloc(req.count, sizeof(*buffers));
 
     if (!buffers) {
         syslog(LOG_ERR, "Out of memory [10Hz]\n");
         exit(EXIT_FAILURE);
     }
 
-    for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
+    // One mapping for all buffers, every buffer page (and so cache line) aligned
+    if (frame_pool_init(&userp_pool, req.count, buffer_size) != 0) {
+        syslog(LOG_ERR, "Cannot map %u user pointer buffers [10Hz]\n", req.count);
+        exit(EXIT_FAILURE);
+    }
+
+    syslog(LOG_INFO, "%u user pointer buffers of %u bytes on %s [10Hz]\n", req.count, buffer_size,
+           frame_pool_backing_name(&userp_pool));
+
+    for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
         buffers[n_buffers].length = buffer_size;
-        buffers[n_buffers].start = malloc(buffer_size);
+        buffers[n_buffers].start = frame_pool_get(&userp_pool);
 
         if (!buffers[n_buffers].start) {
             syslog(LOG_ERR, "Out of memory [10Hz]\n");
@@ -689,6 +833,15 @@ static void init_device(void) {
 
 // Function to close the video capture device
 static void close_device(void) {
+    if (frame_source) {
+        if (frame_source_dropped(frame_source))
+            syslog(LOG_INFO, "Frame source dropped %llu frames [10Hz]\n", frame_source_dropped(frame_source));
+        frame_source_close(frame_source);
+        frame_source = NULL;
+        fd = -1;
+        return;
+    }
+
     if (-1 == close(fd))
         errno_exit("close");
 
@@ -717,34 +870,120 @@ static void open_device(void) {
     }
 }
 
+// Function to stand in for open_device() and init_device() with a synthetic or
+// replay frame source, requesting the format init_device() forces on the camera
+static void init_frame_source(void) {
+    CLEAR(fmt);
+
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = HRES;
+    fmt.fmt.pix.height = VRES;
+    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    frame_source = frame_source_open(dev_name, &fmt, 6);
+
+    if (!frame_source) {
+        syslog(LOG_ERR, "Cannot open frame source '%s' [10Hz]\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    // The frame processing and file headers are fixed at HRES x VRES
+    if (fmt.fmt.pix.width != HRES || fmt.fmt.pix.height != VRES) {
+        syslog(LOG_ERR, "%s delivers %ux%u frames, not %dx%d [10Hz]\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        fprintf(stderr, "%s delivers %ux%u frames, not %dx%d\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        exit(EXIT_FAILURE);
+    }
+
+    // Frame sources stream into their own or user pointer buffers, there is no read()
+    if (io == IO_METHOD_READ) {
+        syslog(LOG_INFO, "Using memory-mapped buffers for frame source [10Hz]\n");
+        io = IO_METHOD_MMAP;
+    }
+
+    fd = frame_source_fd(frame_source);
+
+    if (io == IO_METHOD_USERPTR) {
+        init_userp(fmt.fmt.pix.sizeimage);
+        return;
+    }
+
+    n_buffers = frame_source_buffers(frame_source);
+    buffers = calloc(n_buffers, sizeof(*buffers));
+
+    if (!buffers) {
+        syslog(LOG_ERR, "Out of memory [10Hz]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < n_buffers; ++i)
+        buffers[i].start = frame_source_buffer(frame_source, i, &buffers[i].length);
+}
+
+// Function to open the camera or frame source named by dev_name, see framesource.h
+static void open_source(void) {
+    const char *device = frame_source_v4l2_device(dev_name);
+
+    if (device == NULL) {
+        init_frame_source();
+        return;
+    }
+
+    dev_name = (char *)device;
+    open_device();
+    init_device();
+}
+
 // Function to print usage information for the program
 static void usage(FILE *fp, int argc, char **argv) {
     fprintf(fp,
              "Usage: %s [options]\n\n"
              "Version 1.3\n"
              "Options:\n"
-             "-d | --device name   Video device name [%s]\n"
+             "-d | --device name   Video device name or synthetic:/replay: source [%s]\n"
              "-h | --help          Print this message\n"
              "-m | --mmap          Use memory-mapped buffers [default]\n"
              "-r | --read          Use read() calls\n"
              "-u | --userp         Use application-allocated buffers\n"
+             "-b | --buffers count Number of application-allocated buffers [%u]\n"
              "-o | --output        Outputs stream to stdout\n"
              "-f | --format        Force format to 640x480 GREY\n"
-             "-c | --count         Number of frames to grab [%i]\n",
-             argv[0], dev_name, frame_count);
+             "-c | --count         Number of frames to grab [%i]\n"
+             "-D | --dir name      Directory to write the frames to [next to the executable]\n"
+             "-U | --unthrottled   Process frames as fast as they arrive\n"
+             "-l | --latency file  Log capture, dequeue and written times of every frame\n"
+             "-s | --shm name      Also publish every frame in shared memory /dev/shm/name\n"
+             "-t | --stamp         Burn the frame count and time into every stored frame\n"
+             "-w | --write mode    Store frames buffered, direct (O_DIRECT) or smooth [buffered]\n"
+             "-S | --stage slots   Stage frames in RAM, flushed to the directory in the background\n"
+             "-P | --policy which  Frame dropped when the staging slots are full, newest or oldest [newest]\n"
+             "-e | --encode count  Store frames as QOI, encoded by count worker threads\n"
+             "-C | --rt-core n     Keep the encoder workers off core n [any core]\n",
+             argv[0], dev_name, userp_buffers, frame_count);
 }
 
 // Options for the program, defining short and long options
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmrub:ofc:D:Ul:s:tw:S:P:e:C:";
 static const struct option long_options[] = {
-    { "device", required_argument, NULL, 'd' },
-    { "help",   no_argument,       NULL, 'h' },
-    { "mmap",   no_argument,       NULL, 'm' },
-    { "read",   no_argument,       NULL, 'r' },
-    { "userp",  no_argument,       NULL, 'u' },
-    { "output", no_argument,       NULL, 'o' },
-    { "format", no_argument,       NULL, 'f' },
-    { "count",  required_argument, NULL, 'c' },
+    { "device",      required_argument, NULL, 'd' },
+    { "help",        no_argument,       NULL, 'h' },
+    { "mmap",        no_argument,       NULL, 'm' },
+    { "read",        no_argument,       NULL, 'r' },
+    { "userp",       no_argument,       NULL, 'u' },
+    { "buffers",     required_argument, NULL, 'b' },
+    { "output",      no_argument,       NULL, 'o' },
+    { "format",      no_argument,       NULL, 'f' },
+    { "count",       required_argument, NULL, 'c' },
+    { "dir",         required_argument, NULL, 'D' },
+    { "unthrottled", no_argument,       NULL, 'U' },
+    { "latency",     required_argument, NULL, 'l' },
+    { "shm",         required_argument, NULL, 's' },
+    { "stamp",       no_argument,       NULL, 't' },
+    { "write",       required_argument, NULL, 'w' },
+    { "stage",       required_argument, NULL, 'S' },
+    { "policy",      required_argument, NULL, 'P' },
+    { "encode",      required_argument, NULL, 'e' },
+    { "rt-core",     required_argument, NULL, 'C' },
     { 0, 0, 0, 0 }
 };
 
@@ -753,6 +992,7 @@ int main(int argc, char **argv) {
     char exec_path[PATH_MAX];
     char *exec_dir;
     char frames_dir[PATH_MAX];
+    int mode;
 
     // Open syslog for debugging and set log file
     openlog("capture_app", LOG_PID | LOG_CONS, LOG_USER);
@@ -781,19 +1021,11 @@ int main(int argc, char **argv) {
     if (readlink("/proc/self/exe", exec_path, sizeof(exec_path) - 1) != -1) {
         exec_dir = dirname(exec_path);
         snprintf(frames_dir, sizeof(frames_dir), "%s/frames10hz", exec_dir);
-        set_output_directory(frames_dir);
-        syslog(LOG_INFO, "Output directory set to %s [10Hz]\n", frames_dir);
     } else {
         syslog(LOG_ERR, "Failed to determine executable path [10Hz]\n");
         exit(EXIT_FAILURE);
     }
 
-    // Create the directory for saving frames
-    if (create_directory(frames_dir) != 0) {
-        syslog(LOG_ERR, "Failed to create directory %s [10Hz]\n", frames_dir);
-        exit(EXIT_FAILURE);
-    }
-
     // Parse command-line arguments to configure the device and capture settings
     if (argc > 1)
         dev_name = argv[1];
@@ -833,6 +1065,14 @@ int main(int argc, char **argv) {
                 io = IO_METHOD_USERPTR;
                 break;
 
+            case 'b':
+                userp_buffers = strtoul(optarg, NULL, 0);
+                if (userp_buffers < 2 || userp_buffers > VIDEO_MAX_FRAME) {
+                    fprintf(stderr, "Buffer count %s not in 2..%d\n", optarg, VIDEO_MAX_FRAME);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             case 'o':
                 out_buf++;
                 break;
@@ -848,20 +1088,166 @@ int main(int argc, char **argv) {
                     errno_exit(optarg);
                 break;
 
+            case 'D':
+                output_dir = optarg;
+                break;
+
+            case 'U':
+                unthrottled++;
+                break;
+
+            case 'l':
+                latency_path = optarg;
+                break;
+
+            case 's':
+                shm_name = optarg;
+                break;
+
+            case 't':
+                stamping = 1;
+                break;
+
+            case 'w':
+                mode = frame_dump_mode_parse(optarg);
+                if (mode < 0) {
+                    fprintf(stderr, "Unknown write mode %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                write_mode = (enum frame_dump_mode)mode;
+                break;
+
+            case 'S':
+                stage_slots = strtoul(optarg, NULL, 0);
+                if (stage_slots < 2 || stage_slots > FRAME_POOL_MAX_SLOTS) {
+                    fprintf(stderr, "Staging takes 2 to %d slots\n", FRAME_POOL_MAX_SLOTS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                if (strcmp(optarg, "newest") == 0)
+                    stage_policy = FRAME_STAGE_DROP_NEWEST;
+                else if (strcmp(optarg, "oldest") == 0)
+                    stage_policy = FRAME_STAGE_DROP_OLDEST;
+                else {
+                    fprintf(stderr, "Unknown staging policy %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'e':
+                encode_workers = strtoul(optarg, NULL, 0);
+                if (encode_workers < 1 || encode_workers > FRAME_ENCODER_MAX_THREADS) {
+                    fprintf(stderr, "Encoding takes 1 to %d workers\n", FRAME_ENCODER_MAX_THREADS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'C':
+                rt_core = atoi(optarg);
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // The -D directory replaces the frames directory next to the executable
+    if (output_dir)
+        snprintf(frames_dir, sizeof(frames_dir), "%s", output_dir);
+    set_output_directory(frames_dir);
+    syslog(LOG_INFO, "Output directory set to %s [10Hz]\n", frames_dir);
+
+    // Create the directory for saving frames
+    if (create_directory(frames_dir) != 0) {
+        syslog(LOG_ERR, "Failed to create directory %s [10Hz]\n", frames_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the per-frame latency log, times are CLOCK_MONOTONIC nanoseconds
+    if (latency_path) {
+        latency_log = fopen(latency_path, "w");
+        if (!latency_log) {
+            syslog(LOG_ERR, "Failed to open latency log %s: %s [10Hz]\n", latency_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(latency_log, "# frame,sensor_ns,dequeue_ns,written_ns\n");
+    }
+
+    // Lock memory before the device buffers are allocated, malloc keeps what
+    // it frees mapped so frames never fault the heap in again
+    rtmem_init(RT_HEAP_RESERVE);
+
+    // Bounce buffer for frames that are not block aligned, large enough for RGB
+    if (frame_dumper_init(&dumper, write_mode, HRES * VRES * 3) != 0)
+        exit(EXIT_FAILURE);
+    syslog(LOG_INFO, "Frames stored %s [10Hz]\n", frame_dump_mode_name(write_mode));
+
     // Initialize the device, start capturing, and run the main loop
-    open_device();
-    init_device();
+    open_source();
+
+    // The ring is sized from the negotiated format, RGB24 frames stay RGB
+    if (shm_name) {
+        char name[NAME_MAX];
+
+        snprintf(name, sizeof(name), "%s%s", shm_name[0] == '/' ? "" : "/", shm_name);
+        if (frame_shm_create(&frame_ring, name, fmt.fmt.pix.width, fmt.fmt.pix.height,
+                             fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 ? 3 : 1) != 0) {
+            syslog(LOG_ERR, "Failed to create shared memory frames %s [10Hz]\n", name);
+            exit(EXIT_FAILURE);
+        }
+        publishing = 1;
+        syslog(LOG_INFO, "Publishing frames in shared memory %s [10Hz]\n", name);
+    }
+
+    // The flusher stores frames the way --write says, the capture thread only copies
+    if (stage_slots) {
+        if (frame_stage_start(&stage, fmt.fmt.pix.width, fmt.fmt.pix.height,
+                              fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 ? 3 : 1, stage_slots, stage_policy,
+                              write_mode) != 0) {
+            syslog(LOG_ERR, "Failed to start RAM staging [10Hz]\n");
+            exit(EXIT_FAILURE);
+        }
+        syslog(LOG_INFO, "Staging frames in %u RAM slots [10Hz]\n", stage_slots);
+    }
+
+    // Two slots per worker let each one have a frame queued behind the one it encodes
+    if (encode_workers) {
+        if (frame_encoder_start(&encoder, fmt.fmt.pix.width, fmt.fmt.pix.height,
+                                fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 ? 3 : 1, 2 * encode_workers + 2,
+                                encode_workers, rt_core) != 0) {
+            syslog(LOG_ERR, "Failed to start the QOI encoders [10Hz]\n");
+            exit(EXIT_FAILURE);
+        }
+        syslog(LOG_INFO, "Encoding frames to QOI with %u workers [10Hz]\n", encode_workers);
+    }
 
     start_capturing();
+
+    // Touch the frame buffer too, faults from here on are the steady state
+    rtmem_prefault(bigbuffer, sizeof(bigbuffer));
+    rtmem_mark_steady();
     mainloop();
 
     stop_capturing();
+    rtmem_report(stdout);
+
+    // Everything still staged is written before the program exits
+    if (stage_slots) {
+        frame_stage_stop(&stage);
+        frame_stage_report(&stage, stdout);
+        syslog(LOG_INFO, "Staged %llu frames, flushed %llu, dropped %llu, peak %llu bytes [10Hz]\n",
+               stage.staged, stage.flushed, stage.dropped, stage.peak_bytes);
+    }
+
+    // Every queued frame is encoded and written before the program exits
+    if (encode_workers) {
+        frame_encoder_stop(&encoder);
+        frame_encoder_report(&encoder, stdout);
+        syslog(LOG_INFO, "Encoded %llu frames to QOI, dropped %llu [10Hz]\n", encoder.queued, encoder.dropped);
+    }
 
     // Print the total capture time and frames per second (FPS)
     syslog(LOG_INFO, "Total capture time=%lf, for %d frames, %lf FPS [10Hz]\n", (fstop - fstart), CAPTURE_FRAMES + 1, ((double)CAPTURE_FRAMES / (fstop - fstart)));
@@ -870,6 +1256,13 @@ int main(int argc, char **argv) {
     // Uninitialize and close the device
     uninit_device();
     close_device();
+    if (publishing)
+        frame_shm_destroy(&frame_ring);
+    if (dumper.fallbacks)
+        syslog(LOG_INFO, "No O_DIRECT in %s, frames were stored smooth instead [10Hz]\n", dump_dir);
+    frame_dumper_free(&dumper);
+    if (latency_log)
+        fclose(latency_log);
     fprintf(stderr, "\n");
 
     // Close syslog
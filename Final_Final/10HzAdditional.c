@@ -18,6 +18,12 @@
 #include <syslog.h>
 #include <math.h>
 
+#include "sobel.h"
+#include "framesource.h"
+#include "rtmem.h"
+#include "framepool.h"
+#include "malloccount.h"
+
 // Macros to clear memory, set resolution, and define frame capture limits
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -36,6 +42,14 @@
 
 #define DUMP_FRAMES
 
+// Heap grown and touched at startup, for the C library's own allocations
+#define RT_HEAP_RESERVE (4 * 1024 * 1024)
+
+// Frame sized working buffers in flight at once (Sobel output), the USERPTR
+// capture buffers come from the same pool
+#define WORK_BUFFERS 2
+#define USERP_BUFFERS 4
+
 // Struct to hold video format details
 static struct v4l2_format fmt;
 
@@ -58,6 +72,18 @@ static int out_buf;
 static int force_format = 1;
 static int frame_count = FRAMES_TO_ACQUIRE;
 
+// Frame source standing in for the camera when the device name is a
+// synthetic: or replay: spec, frames directory override and no frame delay
+static struct frame_source *frame_source;
+static char *output_dir;
+static int unthrottled;
+
+// Per-frame latency log, capture and dequeue time of the frame being processed
+static char *latency_path;
+static FILE *latency_log;
+static struct timeval frame_sensor_time;
+static struct timespec frame_dequeue_time;
+
 // Timing-related variables for frame processing
 static double fnow = 0.0, fstart = 0.0, fstop = 0.0;
 static struct timespec time_now, time_start, time_stop;
@@ -66,6 +92,13 @@ static struct timespec time_now, time_start, time_stop;
 int framecnt = -8;
 unsigned char bigbuffer[(1280 * 960)];
 
+// Per-frame working buffers, allocated once the format is negotiated
+static struct frame_pool frame_pool;
+static unsigned long long steady_mallocs, steady_syslog_mallocs;
+
+// stdout buffer of our own, stdio would allocate one on the first printf
+static char stdout_buffer[BUFSIZ];
+
 // Function to handle errors and exit the program with an error message
 static void errno_exit(const char *s) {
     syslog(LOG_ERR, "%s error %d, %s [10Hz]\n", s, errno, strerror(errno));
@@ -75,6 +108,9 @@ static void errno_exit(const char *s) {
 
 // Wrapper for the ioctl system call, which allows low-level control of the video device
 static int xioctl(int fh, int request, void *arg) {
+    if (frame_source)
+        return frame_source_ioctl(frame_source, request, arg);
+
     int r;
     do {
         r = ioctl(fh, request, arg);
@@ -120,6 +156,7 @@ static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec
     // Add the timestamp to the PGM header
     snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
     snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
+    pgm_header[14] = pgm_header[29] = ' '; // put back the spaces the terminators overwrote
 
     // Write the PGM header to the file
     written = write(dumpfd, pgm_header, sizeof(pgm_header) - 1);
@@ -151,40 +188,24 @@ static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec
     close(dumpfd);
 }
 
-// Sobel filter implementation
-void sobel_filter(const unsigned char *input, unsigned char *output, int width, int height) {
-    int x, y;
-    int gx, gy;
-    int i, j;
-    const int sobel_x[3][3] = {
-        {-1, 0, 1},
-        {-2, 0, 2},
-        {-1, 0, 1}
-    };
-    const int sobel_y[3][3] = {
-        {-1, -2, -1},
-        {0,  0,  0},
-        {1,  2,  1}
-    };
-
-    for (y = 1; y < height - 1; ++y) {
-        for (x = 1; x < width - 1; ++x) {
-            gx = 0;
-            gy = 0;
-
-            for (i = -1; i <= 1; ++i) {
-                for (j = -1; j <= 1; ++j) {
-                    int pixel = input[(y + i) * width + (x + j)];
-                    gx += pixel * sobel_x[i + 1][j + 1];
-                    gy += pixel * sobel_y[i + 1][j + 1];
-                }
-            }
+// Function to note when the frame about to be processed was captured and dequeued
+static void stamp_frame(const struct timeval *sensor) {
+    if (sensor)
+        frame_sensor_time = *sensor;
+    else
+        timerclear(&frame_sensor_time);
+    clock_gettime(CLOCK_MONOTONIC, &frame_dequeue_time);
+}
 
-            int magnitude = sqrt(gx * gx + gy * gy);
-            if (magnitude > 255) magnitude = 255;
-            output[y * width + x] = magnitude;
-        }
-    }
+// Function to append the capture, dequeue and written times of a frame to the latency log
+static void log_frame_latency(void) {
+    struct timespec written;
+
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    fprintf(latency_log, "%d,%llu,%llu,%llu\n", framecnt,
+            (unsigned long long)frame_sensor_time.tv_sec * 1000000000ULL + (unsigned long long)frame_sensor_time.tv_usec * 1000ULL,
+            (unsigned long long)frame_dequeue_time.tv_sec * 1000000000ULL + (unsigned long long)frame_dequeue_time.tv_nsec,
+            (unsigned long long)written.tv_sec * 1000000000ULL + (unsigned long long)written.tv_nsec);
 }
 
 // Function to process each captured frame, including saving to file and applying Sobel filter
@@ -206,33 +227,36 @@ static void process_image(const void *p, int size) {
 #ifdef DUMP_FRAMES
     // Apply Sobel filter to the frame data
     if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY) {
-        unsigned char *sobel_output = malloc(size);
+        unsigned char *sobel_output = frame_pool_get(&frame_pool);
         if (!sobel_output) {
-            syslog(LOG_ERR, "Failed to allocate memory for Sobel output [10Hz]\n");
+            syslog(LOG_ERR, "No frame buffer free for Sobel output [10Hz]\n");
             return;
         }
         sobel_filter(pptr, sobel_output, HRES, VRES);
         dump_pgm(sobel_output, size, framecnt, &frame_time);
-        free(sobel_output);
+        frame_pool_put(&frame_pool, sobel_output);
     } else if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
         for (i = 0, newi = 0; i < size; i += 4, newi += 2) {
             bigbuffer[newi] = pptr[i];
             bigbuffer[newi + 1] = pptr[i + 2];
         }
-        unsigned char *sobel_output = malloc(size / 2);
+        unsigned char *sobel_output = frame_pool_get(&frame_pool);
         if (!sobel_output) {
-            syslog(LOG_ERR, "Failed to allocate memory for Sobel output [10Hz]\n");
+            syslog(LOG_ERR, "No frame buffer free for Sobel output [10Hz]\n");
             return;
         }
         sobel_filter(bigbuffer, sobel_output, HRES, VRES);
         if (framecnt > -1) {
             dump_pgm(sobel_output, (size / 2), framecnt, &frame_time);
         }
-        free(sobel_output);
+        frame_pool_put(&frame_pool, sobel_output);
     } else {
         syslog(LOG_ERR, "ERROR - unknown dump format [10Hz]\n");
     }
 #endif
+
+    if (latency_log)
+        log_frame_latency();
 }
 
 // Function to read a single frame of video data and process it
@@ -251,6 +275,7 @@ static int read_frame(void) {
                         errno_exit("read");
                 }
             }
+            stamp_frame(NULL);
             process_image(buffers[0].start, buffers[0].length);
             break;
 
@@ -271,6 +296,7 @@ static int read_frame(void) {
             }
 
             assert(buf.index < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -297,6 +323,7 @@ static int read_frame(void) {
                     break;
 
             assert(i < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image((void *)buf.m.userptr, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -314,7 +341,10 @@ static void mainloop(void) {
     struct timespec time_error;
 
     // Configure the read delay based on the desired frames per second
-    printf("Running at 10 frames/sec\n");
+    if (unthrottled)
+        printf("Running unthrottled\n");
+    else
+        printf("Running at 10 frames/sec\n");
     read_delay.tv_sec = 0;
     read_delay.tv_nsec = 100000000; // 10 Hz
 
@@ -347,7 +377,7 @@ static void mainloop(void) {
             }
 
             if (read_frame()) {
-                if (nanosleep(&read_delay, &time_error) != 0)
+                if (!unthrottled && nanosleep(&read_delay, &time_error) != 0)
                     perror("nanosleep");
                 else {
                     if (framecnt > 1) {
@@ -447,6 +477,8 @@ static void uninit_device(void) {
             break;
 
         case IO_METHOD_MMAP:
+            if (frame_source)
+                break; // buffers belong to the frame source
             for (i = 0; i < n_buffers; ++i)
                 if (-1 == munmap(buffers[i].start, buffers[i].length))
                     errno_exit("munmap");
@@ -454,11 +486,12 @@ static void uninit_device(void) {
 
         case IO_METHOD_USERPTR:
             for (i = 0; i < n_buffers; ++i)
-                free(buffers[i].start);
+                frame_pool_put(&frame_pool, buffers[i].start);
             break;
     }
 
     free(buffers);
+    frame_pool_free(&frame_pool);
 }
 
 // Function to initialize the device in read mode
@@ -535,13 +568,22 @@ static void init_mmap(void) {
     }
 }
 
+// Function to allocate the working buffers for the negotiated frame size, before any frame flows
+static void init_frame_pool(unsigned int frame_size) {
+    if (frame_pool_init(&frame_pool, WORK_BUFFERS + (io == IO_METHOD_USERPTR ? USERP_BUFFERS : 0), frame_size) != 0) {
+        syslog(LOG_ERR, "Failed to allocate the frame pool [10Hz]\n");
+        exit(EXIT_FAILURE);
+    }
+    syslog(LOG_INFO, "Frame pool of %u x %zu bytes on %s [10Hz]\n", frame_pool.slots, frame_pool.slot_size, frame_pool_backing_name(&frame_pool));
+}
+
 // Function to initialize the device in user pointer mode
 static void init_userp(unsigned int buffer_size) {
     struct v4l2_requestbuffers req;
 
     CLEAR(req);
 
-    req.count  = 4;
+    req.count  = USERP_BUFFERS;
     req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_USERPTR;
 
@@ -554,16 +596,17 @@ static void init_userp(unsigned int buffer_size) {
         }
     }
 
-    buffers = calloc(4, sizeof(*buffers));
+    buffers = calloc(USERP_BUFFERS, sizeof(*buffers));
 
     if (!buffers) {
         syslog(LOG_ERR, "Out of memory [10Hz]\n");
         exit(EXIT_FAILURE);
     }
 
-    for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
+    // page aligned slots of the frame pool, sized for the negotiated format
+    for (n_buffers = 0; n_buffers < USERP_BUFFERS; ++n_buffers) {
         buffers[n_buffers].length = buffer_size;
-        buffers[n_buffers].start = malloc(buffer_size);
+        buffers[n_buffers].start = frame_pool_get(&frame_pool);
 
         if (!buffers[n_buffers].start) {
             syslog(LOG_ERR, "Out of memory [10Hz]\n");
@@ -654,6 +697,8 @@ static void init_device(void) {
     if (fmt.fmt.pix.sizeimage < min)
         fmt.fmt.pix.sizeimage = min;
 
+    init_frame_pool(fmt.fmt.pix.sizeimage);
+
     switch (io) {
         case IO_METHOD_READ:
             init_read(fmt.fmt.pix.sizeimage);
@@ -671,6 +716,15 @@ static void init_device(void) {
 
 // Function to close the video capture device
 static void close_device(void) {
+    if (frame_source) {
+        if (frame_source_dropped(frame_source))
+            syslog(LOG_INFO, "Frame source dropped %llu frames [10Hz]\n", frame_source_dropped(frame_source));
+        frame_source_close(frame_source);
+        frame_source = NULL;
+        fd = -1;
+        return;
+    }
+
     if (-1 == close(fd))
         errno_exit("close");
 
@@ -699,25 +753,87 @@ static void open_device(void) {
     }
 }
 
+// Function to stand in for open_device() and init_device() with a synthetic or
+// replay frame source, requesting the format init_device() forces on the camera
+static void init_frame_source(void) {
+    CLEAR(fmt);
+
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = HRES;
+    fmt.fmt.pix.height = VRES;
+    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    frame_source = frame_source_open(dev_name, &fmt, 6);
+
+    if (!frame_source) {
+        syslog(LOG_ERR, "Cannot open frame source '%s' [10Hz]\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    // The frame processing and file headers are fixed at HRES x VRES
+    if (fmt.fmt.pix.width != HRES || fmt.fmt.pix.height != VRES) {
+        syslog(LOG_ERR, "%s delivers %ux%u frames, not %dx%d [10Hz]\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        fprintf(stderr, "%s delivers %ux%u frames, not %dx%d\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        exit(EXIT_FAILURE);
+    }
+
+    // Frame sources only provide driver owned (memory-mapped) buffers
+    if (io != IO_METHOD_MMAP)
+        syslog(LOG_INFO, "Using memory-mapped buffers for frame source [10Hz]\n");
+    io = IO_METHOD_MMAP;
+
+    fd = frame_source_fd(frame_source);
+    n_buffers = frame_source_buffers(frame_source);
+    buffers = calloc(n_buffers, sizeof(*buffers));
+
+    if (!buffers) {
+        syslog(LOG_ERR, "Out of memory [10Hz]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < n_buffers; ++i)
+        buffers[i].start = frame_source_buffer(frame_source, i, &buffers[i].length);
+
+    init_frame_pool(fmt.fmt.pix.sizeimage);
+}
+
+// Function to open the camera or frame source named by dev_name, see framesource.h
+static void open_source(void) {
+    const char *device = frame_source_v4l2_device(dev_name);
+
+    if (device == NULL) {
+        init_frame_source();
+        return;
+    }
+
+    dev_name = (char *)device;
+    open_device();
+    init_device();
+}
+
 // Function to print usage information for the program
 static void usage(FILE *fp, int argc, char **argv) {
     fprintf(fp,
              "Usage: %s [options]\n\n"
              "Version 1.3\n"
              "Options:\n"
-             "-d | --device name   Video device name [%s]\n"
+             "-d | --device name   Video device name or synthetic:/replay: source [%s]\n"
              "-h | --help          Print this message\n"
              "-m | --mmap          Use memory-mapped buffers [default]\n"
              "-r | --read          Use read() calls\n"
              "-u | --userp         Use application-allocated buffers\n"
              "-o | --output        Outputs stream to stdout\n"
              "-f | --format        Force format to 640x480 GREY\n"
-             "-c | --count         Number of frames to grab [%i]\n",
+             "-c | --count         Number of frames to grab [%i]\n"
+             "-D | --dir name      Directory to write the frames to [next to the executable]\n"
+             "-U | --unthrottled   Process frames as fast as they arrive\n"
+             "-l | --latency file  Log capture, dequeue and written times of every frame\n",
              argv[0], dev_name, frame_count);
 }
 
 // Options for the program, defining short and long options
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmruofc:D:Ul:";
 static const struct option long_options[] = {
     { "device", required_argument, NULL, 'd' },
     { "help",   no_argument,       NULL, 'h' },
@@ -727,6 +843,9 @@ static const struct option long_options[] = {
     { "output", no_argument,       NULL, 'o' },
     { "format", no_argument,       NULL, 'f' },
     { "count",  required_argument, NULL, 'c' },
+    { "dir",         required_argument, NULL, 'D' },
+    { "unthrottled", no_argument,       NULL, 'U' },
+    { "latency",     required_argument, NULL, 'l' },
     { 0, 0, 0, 0 }
 };
 
@@ -747,6 +866,7 @@ int main(int argc, char **argv) {
     }
     dup2(fileno(log_file), fileno(stdout));
     dup2(fileno(log_file), fileno(stderr));
+    setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
 
     syslog(LOG_INFO, "Starting capture application [10Hz]\n");
 
@@ -763,19 +883,11 @@ int main(int argc, char **argv) {
     if (readlink("/proc/self/exe", exec_path, sizeof(exec_path) - 1) != -1) {
         exec_dir = dirname(exec_path);
         snprintf(frames_dir, sizeof(frames_dir), "%s/frames10hzAdditional", exec_dir);
-        set_output_directory(frames_dir);
-        syslog(LOG_INFO, "Output directory set to %s [10Hz]\n", frames_dir);
     } else {
         syslog(LOG_ERR, "Failed to determine executable path [10Hz]\n");
         exit(EXIT_FAILURE);
     }
 
-    // Create the directory for saving frames
-    if (create_directory(frames_dir) != 0) {
-        syslog(LOG_ERR, "Failed to create directory %s [10Hz]\n", frames_dir);
-        exit(EXIT_FAILURE);
-    }
-
     // Parse command-line arguments to configure the device and capture settings
     if (argc > 1)
         dev_name = argv[1];
@@ -830,20 +942,72 @@ int main(int argc, char **argv) {
                     errno_exit(optarg);
                 break;
 
+            case 'D':
+                output_dir = optarg;
+                break;
+
+            case 'U':
+                unthrottled++;
+                break;
+
+            case 'l':
+                latency_path = optarg;
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // The -D directory replaces the frames directory next to the executable
+    if (output_dir)
+        snprintf(frames_dir, sizeof(frames_dir), "%s", output_dir);
+    set_output_directory(frames_dir);
+    syslog(LOG_INFO, "Output directory set to %s [10Hz]\n", frames_dir);
+
+    // Create the directory for saving frames
+    if (create_directory(frames_dir) != 0) {
+        syslog(LOG_ERR, "Failed to create directory %s [10Hz]\n", frames_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the per-frame latency log, times are CLOCK_MONOTONIC nanoseconds
+    if (latency_path) {
+        latency_log = fopen(latency_path, "w");
+        if (!latency_log) {
+            syslog(LOG_ERR, "Failed to open latency log %s: %s [10Hz]\n", latency_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(latency_log, "# frame,sensor_ns,dequeue_ns,written_ns\n");
+    }
+
+    // Lock memory before the device buffers are allocated, malloc keeps what
+    // it frees mapped so frames never fault the heap in again
+    rtmem_init(RT_HEAP_RESERVE);
+
     // Initialize the device, start capturing, and run the main loop
-    open_device();
-    init_device();
+    open_source();
 
     start_capturing();
+
+    // Touch the frame buffer too, faults from here on are the steady state
+    rtmem_prefault(bigbuffer, sizeof(bigbuffer));
+    rtmem_mark_steady();
+    steady_mallocs = malloc_count();
+    steady_syslog_mallocs = malloc_count_syslog();
     mainloop();
 
     stop_capturing();
+    rtmem_report(stdout);
+
+    // Allocations in the frame loop, there should be none outside syslog()
+    steady_mallocs = malloc_count() - steady_mallocs;
+    steady_syslog_mallocs = malloc_count_syslog() - steady_syslog_mallocs;
+    syslog(LOG_INFO, "Heap allocations in steady state: frame path=%llu, syslog=%llu, frame pool peak %u of %u [10Hz]\n",
+           steady_mallocs, steady_syslog_mallocs, frame_pool.max_in_use, frame_pool.slots);
+    printf("Heap allocations in steady state: frame path=%llu, syslog=%llu, frame pool peak %u of %u [10Hz]\n",
+           steady_mallocs, steady_syslog_mallocs, frame_pool.max_in_use, frame_pool.slots);
 
     // Print the total capture time and frames per second (FPS)
     syslog(LOG_INFO, "Total capture time=%lf, for %d frames, %lf FPS [10Hz]\n", (fstop - fstart), CAPTURE_FRAMES + 1, ((double)CAPTURE_FRAMES / (fstop - fstart)));
@@ -852,6 +1016,8 @@ int main(int argc, char **argv) {
     // Uninitialize and close the device
     uninit_device();
     close_device();
+    if (latency_log)
+        fclose(latency_log);
     fprintf(stderr, "\n");
 
     // Close syslog
@@ -21,6 +21,9 @@
 #include <libgen.h>
 #include <syslog.h>
 
+#include "framesource.h"
+#include "rtmem.h"
+
 // Macro to clear memory of a given variable or structure
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -40,6 +43,9 @@
 
 #define DUMP_FRAMES  // Enable frame dumping (saving)
 
+// Heap grown and touched at startup, large enough for the per-frame allocations
+#define RT_HEAP_RESERVE (4 * 1024 * 1024)
+
 static struct v4l2_format fmt;  // Structure to store video format information
 
 // Enumeration to define I/O methods: Read, Memory Map, or User Pointer
@@ -61,6 +67,18 @@ static int out_buf;  // Output buffer flag
 static int force_format = 1;  // Force format flag
 static int frame_count = FRAMES_TO_ACQUIRE;  // Total number of frames to acquire
 
+// Frame source standing in for the camera when the device name is a
+// synthetic: or replay: spec, frames directory override and no frame delay
+static struct frame_source *frame_source;
+static char *output_dir;
+static int unthrottled;
+
+// Per-frame latency log, capture and dequeue time of the frame being processed
+static char *latency_path;
+static FILE *latency_log;
+static struct timeval frame_sensor_time;
+static struct timespec frame_dequeue_time;
+
 // Timing variables for frame capture
 static double fnow = 0.0, fstart = 0.0, fstop = 0.0;
 static struct timespec time_now, time_start, time_stop;
@@ -76,6 +94,9 @@ static void errno_exit(const char *s) {
 
 // Function to make ioctl system calls, handling any interruptions
 static int xioctl(int fh, unsigned long request, void *arg) {
+    if (frame_source)
+        return frame_source_ioctl(frame_source, request, arg);
+
     int r;
     do {
         r = ioctl(fh, request, arg);
@@ -124,6 +145,7 @@ static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec
     // Add timestamp to the PPM header
     snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
     snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
+    ppm_header[14] = ppm_header[29] = ' '; // put back the spaces the terminators overwrote
 
     // Write the PPM header to the file
     written = write(dumpfd, ppm_header, sizeof(ppm_header) - 1);
@@ -170,6 +192,7 @@ static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec
     // Add timestamp to the PGM header
     snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
     snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
+    pgm_header[14] = pgm_header[29] = ' '; // put back the spaces the terminators overwrote
 
     // Write the PGM header to the file
     written = write(dumpfd, pgm_header, sizeof(pgm_header) - 1);
@@ -218,6 +241,26 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
 // Buffer to store larger frames for processing
 unsigned char bigbuffer[(1280 * 960)];
 
+// Function to note when the frame about to be processed was captured and dequeued
+static void stamp_frame(const struct timeval *sensor) {
+    if (sensor)
+        frame_sensor_time = *sensor;
+    else
+        timerclear(&frame_sensor_time);
+    clock_gettime(CLOCK_MONOTONIC, &frame_dequeue_time);
+}
+
+// Function to append the capture, dequeue and written times of a frame to the latency log
+static void log_frame_latency(void) {
+    struct timespec written;
+
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    fprintf(latency_log, "%d,%llu,%llu,%llu\n", framecnt,
+            (unsigned long long)frame_sensor_time.tv_sec * 1000000000ULL + (unsigned long long)frame_sensor_time.tv_usec * 1000ULL,
+            (unsigned long long)frame_dequeue_time.tv_sec * 1000000000ULL + (unsigned long long)frame_dequeue_time.tv_nsec,
+            (unsigned long long)written.tv_sec * 1000000000ULL + (unsigned long long)written.tv_nsec);
+}
+
 // Function to process captured frames and save them to a file
 static void process_image(const void *p, int size) {
     int i, newi;
@@ -253,6 +296,9 @@ static void process_image(const void *p, int size) {
         syslog(LOG_ERR, "ERROR - unknown dump format [1Hz]\n");
     }
 #endif
+
+    if (latency_log)
+        log_frame_latency();
 }
 
 // Function to read a single frame from the video device
@@ -271,6 +317,7 @@ static int read_frame(void) {
                         errno_exit("read");
                 }
             }
+            stamp_frame(NULL);
             process_image(buffers[0].start, buffers[0].length);
             break;
 
@@ -291,6 +338,7 @@ static int read_frame(void) {
             }
 
             assert(buf.index < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -317,6 +365,7 @@ static int read_frame(void) {
                     break;
 
             assert(i < n_buffers);
+            stamp_frame(&buf.timestamp);
             process_image((void *)buf.m.userptr, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -333,7 +382,10 @@ static void mainloop(void) {
     struct timespec read_delay;
     struct timespec time_error;
 
-    printf("Running at 1 frame/sec\n");
+    if (unthrottled)
+        printf("Running unthrottled\n");
+    else
+        printf("Running at 1 frame/sec\n");
     read_delay.tv_sec = 1;
     read_delay.tv_nsec = 0; // 1 Hz delay between frames
 
@@ -365,7 +417,7 @@ static void mainloop(void) {
             }
 
             if (read_frame()) {
-                if (nanosleep(&read_delay, &time_error) != 0)
+                if (!unthrottled && nanosleep(&read_delay, &time_error) != 0)
                     perror("nanosleep");
                 else {
                     if (framecnt > 1) {
@@ -465,6 +517,8 @@ static void uninit_device(void) {
             break;
 
         case IO_METHOD_MMAP:
+            if (frame_source)
+                break; // buffers belong to the frame source
             for (i = 0; i < n_buffers; ++i)
                 if (-1 == munmap(buffers[i].start, buffers[i].length))
                     errno_exit("munmap");
@@ -689,6 +743,15 @@ static void init_device(void) {
 
 // Function to close the video capture device
 static void close_device(void) {
+    if (frame_source) {
+        if (frame_source_dropped(frame_source))
+            syslog(LOG_INFO, "Frame source dropped %llu frames [1Hz]\n", frame_source_dropped(frame_source));
+        frame_source_close(frame_source);
+        frame_source = NULL;
+        fd = -1;
+        return;
+    }
+
     if (-1 == close(fd))
         errno_exit("close");
 
@@ -717,25 +780,85 @@ static void open_device(void) {
     }
 }
 
+// Function to stand in for open_device() and init_device() with a synthetic or
+// replay frame source, requesting the format init_device() forces on the camera
+static void init_frame_source(void) {
+    CLEAR(fmt);
+
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = HRES;
+    fmt.fmt.pix.height = VRES;
+    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    frame_source = frame_source_open(dev_name, &fmt, 6);
+
+    if (!frame_source) {
+        syslog(LOG_ERR, "Cannot open frame source '%s' [1Hz]\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    // The frame processing and file headers are fixed at HRES x VRES
+    if (fmt.fmt.pix.width != HRES || fmt.fmt.pix.height != VRES) {
+        syslog(LOG_ERR, "%s delivers %ux%u frames, not %dx%d [1Hz]\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        fprintf(stderr, "%s delivers %ux%u frames, not %dx%d\n", dev_name, fmt.fmt.pix.width, fmt.fmt.pix.height, HRES, VRES);
+        exit(EXIT_FAILURE);
+    }
+
+    // Frame sources only provide driver owned (memory-mapped) buffers
+    if (io != IO_METHOD_MMAP)
+        syslog(LOG_INFO, "Using memory-mapped buffers for frame source [1Hz]\n");
+    io = IO_METHOD_MMAP;
+
+    fd = frame_source_fd(frame_source);
+    n_buffers = frame_source_buffers(frame_source);
+    buffers = calloc(n_buffers, sizeof(*buffers));
+
+    if (!buffers) {
+        syslog(LOG_ERR, "Out of memory [1Hz]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < n_buffers; ++i)
+        buffers[i].start = frame_source_buffer(frame_source, i, &buffers[i].length);
+}
+
+// Function to open the camera or frame source named by dev_name, see framesource.h
+static void open_source(void) {
+    const char *device = frame_source_v4l2_device(dev_name);
+
+    if (device == NULL) {
+        init_frame_source();
+        return;
+    }
+
+    dev_name = (char *)device;
+    open_device();
+    init_device();
+}
+
 // Function to print the usage information for the program
 static void usage(FILE *fp, int argc, char **argv) {
     fprintf(fp,
              "Usage: %s [options]\n\n"
              "Version 1.3\n"
              "Options:\n"
-             "-d | --device name   Video device name [%s]\n"
+             "-d | --device name   Video device name or synthetic:/replay: source [%s]\n"
              "-h | --help          Print this message\n"
              "-m | --mmap          Use memory-mapped buffers [default]\n"
              "-r | --read          Use read() calls\n"
              "-u | --userp         Use application-allocated buffers\n"
              "-o | --output        Outputs stream to stdout\n"
              "-f | --format        Force format to 640x480 GREY\n"
-             "-c | --count         Number of frames to grab [%i]\n",
+             "-c | --count         Number of frames to grab [%i]\n"
+             "-D | --dir name      Directory to write the frames to [next to the executable]\n"
+             "-U | --unthrottled   Process frames as fast as they arrive\n"
+             "-l | --latency file  Log capture, dequeue and written times of every frame\n",
              argv[0], dev_name, frame_count);
 }
 
 // Options for the program, defining short and long options
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmruofc:D:Ul:";
 static const struct option long_options[] = {
     { "device", required_argument, NULL, 'd' },
     { "help",   no_argument,       NULL, 'h' },
@@ -745,6 +868,9 @@ static const struct option long_options[] = {
     { "output", no_argument,       NULL, 'o' },
     { "format", no_argument,       NULL, 'f' },
     { "count",  required_argument, NULL, 'c' },
+    { "dir",         required_argument, NULL, 'D' },
+    { "unthrottled", no_argument,       NULL, 'U' },
+    { "latency",     required_argument, NULL, 'l' },
     { 0, 0, 0, 0 }
 };
 
@@ -772,19 +898,11 @@ int main(int argc, char **argv) {
     if (readlink("/proc/self/exe", exec_path, sizeof(exec_path) - 1) != -1) {
         exec_dir = dirname(exec_path);
         snprintf(frames_dir, sizeof(frames_dir), "%s/frames1hz", exec_dir);
-        set_output_directory(frames_dir);
-        syslog(LOG_INFO, "Output directory set to %s [1Hz]\n", frames_dir);
     } else {
         syslog(LOG_ERR, "Failed to determine executable path [1Hz]\n");
         exit(EXIT_FAILURE);
     }
 
-    // Create the directory for saving frames
-    if (create_directory(frames_dir) != 0) {
-        syslog(LOG_ERR, "Failed to create directory %s [1Hz]\n", frames_dir);
-        exit(EXIT_FAILURE);
-    }
-
     // Parse command-line arguments to configure the device and capture settings
     if (argc > 1)
         dev_name = argv[1];
@@ -839,12 +957,46 @@ int main(int argc, char **argv) {
                     errno_exit(optarg);
                 break;
 
+            case 'D':
+                output_dir = optarg;
+                break;
+
+            case 'U':
+                unthrottled++;
+                break;
+
+            case 'l':
+                latency_path = optarg;
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // The -D directory replaces the frames directory next to the executable
+    if (output_dir)
+        snprintf(frames_dir, sizeof(frames_dir), "%s", output_dir);
+    set_output_directory(frames_dir);
+    syslog(LOG_INFO, "Output directory set to %s [1Hz]\n", frames_dir);
+
+    // Create the directory for saving frames
+    if (create_directory(frames_dir) != 0) {
+        syslog(LOG_ERR, "Failed to create directory %s [1Hz]\n", frames_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the per-frame latency log, times are CLOCK_MONOTONIC nanoseconds
+    if (latency_path) {
+        latency_log = fopen(latency_path, "w");
+        if (!latency_log) {
+            syslog(LOG_ERR, "Failed to open latency log %s: %s [1Hz]\n", latency_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(latency_log, "# frame,sensor_ns,dequeue_ns,written_ns\n");
+    }
+
     // Capture and log system information using uname
     char uname_buffer[256];
     FILE *uname_pipe = popen("uname -a", "r");
@@ -854,14 +1006,22 @@ int main(int argc, char **argv) {
         syslog(LOG_INFO, "%s [1Hz]", uname_buffer);
     }
 
+    // Lock memory before the device buffers are allocated, malloc keeps what
+    // it frees mapped so frames never fault the heap in again
+    rtmem_init(RT_HEAP_RESERVE);
+
     // Initialize the device, start capturing, and run the main loop
-    open_device();
-    init_device();
+    open_source();
 
     start_capturing();
+
+    // Touch the frame buffer too, faults from here on are the steady state
+    rtmem_prefault(bigbuffer, sizeof(bigbuffer));
+    rtmem_mark_steady();
     mainloop();
 
     stop_capturing();
+    rtmem_report(stdout);
 
     // Print the total capture time and frames per second (FPS)
     syslog(LOG_INFO, "Total capture time=%lf, for %d frames, %lf FPS [1Hz]\n", (fstop - fstart), CAPTURE_FRAMES + 1, ((double)CAPTURE_FRAMES / (fstop - fstart)));
@@ -870,6 +1030,8 @@ int main(int argc, char **argv) {
     // Uninitialize and close the device
     uninit_device();
     close_device();
+    if (latency_log)
+        fclose(latency_log);
     fprintf(stderr, "\n");
 
     // Close syslog
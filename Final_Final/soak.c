@@ -0,0 +1,544 @@
+// make soak && ./soak && ./soak -p ./10HzAdditional -c 600
+
+// Soak test for the 1Hz, 10Hz and 10HzAdditional capture programs
+//
+// Each program is run once, unthrottled (-U), on a deterministic frame source
+// instead of the camera, into a scratch directory.  The run is then checked
+// the way the syslog of an assignment run would be, in seconds instead of half
+// an hour:
+//
+//   frame count  every acquired frame was processed and every frame after
+//                the start up frames has its test####.pgm file
+//   timestamps   capture times in the latency log strictly increase and the
+//                header time stamps of the files never go backwards
+//   integrity    every file has a well formed PGM header and the full raster,
+//                and for unprocessed frames the frame number bar of the
+//                synthetic pattern counts up by one from file to file
+//
+// and throughput, per-frame latency percentiles (from the -l log of the
+// program) and peak resident set size (from wait4()) are reported.  Programs
+// linked with the malloc counting hook (malloccount.h) log their steady state
+// heap allocations, any in the frame path fails the run.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <limits.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "lathist.h"
+
+// Frame count of the assignment runs, must match FRAMES_TO_ACQUIRE and
+// START_UP_FRAMES of the capture programs
+#define START_UP_FRAMES 8
+#define FRAMES_TO_ACQUIRE (1818 + START_UP_FRAMES + 1)
+
+// Frame number bar of the synthetic pattern, see framesource.c
+#define COUNTER_BITS 32
+
+#define MAX_PIPELINES 8
+
+// Nominal rate of the known programs, used to report the headroom
+struct pipeline_rate {
+    const char *name;
+    int fps;
+};
+
+static const struct pipeline_rate pipeline_rates[] = {
+    { "1Hz",            1 },
+    { "10Hz",           10 },
+    { "10HzAdditional", 10 },
+    { NULL,             0 }
+};
+
+// One line of the latency log written by the capture program
+struct frame_times {
+    int frame;
+    unsigned long long sensor_ns;
+    unsigned long long dequeue_ns;
+    unsigned long long written_ns;
+};
+
+static const char *device = "synthetic:640x480@0";
+static int frame_count = FRAMES_TO_ACQUIRE;
+static const char *base_dir = "/tmp";
+static int keep;
+
+// Function to remove one entry of a scratch directory, called by nftw()
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+
+    if (remove(path) == -1)
+        perror(path);
+    return 0;
+}
+
+// Function to run the program in run_dir and wait for it, returns the wait status
+static int run_pipeline(const char *program, const char *run_dir, double *seconds, struct rusage *usage) {
+    char count[16], frames_dir[PATH_MAX + 16], latency[PATH_MAX + 16];
+    struct timespec start, stop;
+    int status;
+    pid_t pid;
+
+    snprintf(count, sizeof(count), "%d", frame_count);
+    snprintf(frames_dir, sizeof(frames_dir), "%s/frames", run_dir);
+    snprintf(latency, sizeof(latency), "%s/latency.csv", run_dir);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+        // The programs write their log file to the working directory, keep
+        // what 1Hz prints there too
+        if (chdir(run_dir) == -1 || !freopen("stdout.txt", "w", stdout)) {
+            perror(run_dir);
+            _exit(127);
+        }
+        execl(program, program, "-d", device, "-c", count, "-U", "-D", frames_dir, "-l", latency, (char *)NULL);
+        perror(program);
+        _exit(127);
+    }
+
+    while (wait4(pid, &status, 0, usage) == -1) {
+        if (errno != EINTR) {
+            perror("wait4");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    *seconds = (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+    return status;
+}
+
+// Function to read the latency log, returns the number of frames or -1
+static int read_latency_log(const char *path, struct frame_times *times, int max) {
+    char line[256];
+    FILE *fp;
+    int n = 0;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#')
+            continue;
+        if (n == max) {
+            n++;
+            break;
+        }
+        if (sscanf(line, "%d,%llu,%llu,%llu", &times[n].frame, &times[n].sensor_ns,
+                   &times[n].dequeue_ns, &times[n].written_ns) != 4) {
+            fprintf(stderr, "%s: bad line %s", path, line);
+            fclose(fp);
+            return -1;
+        }
+        n++;
+    }
+
+    fclose(fp);
+    return n;
+}
+
+// Function to read a test####.pgm file, returns the raster and its header time
+// stamp in msec, NULL with a message when the file is missing or malformed
+static unsigned char *read_frame_file(const char *path, int *width, int *height, long long *msec) {
+    unsigned char *data;
+    struct stat st;
+    int sec, ms, maxval, header = 0;
+    char text[64];
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fileno(fp), &st) == -1 || fread(text, 1, sizeof(text) - 1, fp) == 0) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    text[sizeof(text) - 1] = '\0';
+
+    // P5\n#%010d sec %010d msec \nW H\n255\n as written by dump_pgm()
+    if (sscanf(text, "P5 #%d sec %d msec %d %d %d%n", &sec, &ms, width, height, &maxval, &header) != 5 ||
+        maxval != 255 || *width <= 0 || *height <= 0) {
+        fprintf(stderr, "%s: bad header\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    header++;
+
+    if (st.st_size != (off_t)header + (off_t)*width * *height) {
+        fprintf(stderr, "%s: %lld bytes, expected %lld\n", path, (long long)st.st_size,
+                (long long)header + (long long)*width * *height);
+        fclose(fp);
+        return NULL;
+    }
+
+    data = malloc((size_t)*width * *height);
+    if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fseek(fp, header, SEEK_SET) == -1 || fread(data, 1, (size_t)*width * *height, fp) != (size_t)*width * *height) {
+        fprintf(stderr, "%s: short raster\n", path);
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    *msec = (long long)sec * 1000 + ms;
+    return data;
+}
+
+// Function to decode the frame number bar across the top of the synthetic
+// pattern, -1 when the luma there is not the black/white bar
+static long long decode_counter(const unsigned char *data, int width, int height) {
+    const unsigned char *row = data + (size_t)((height / 24 + 1) / 2) * width;
+    long long counter = 0;
+    int bit;
+
+    for (bit = COUNTER_BITS - 1; bit >= 0; bit--) {
+        int x = (COUNTER_BITS - 1 - bit) * width / COUNTER_BITS + width / (2 * COUNTER_BITS);
+
+        if (row[x] > 200)
+            counter |= 1LL << bit;
+        else if (row[x] > 40)
+            return -1;
+    }
+
+    return counter;
+}
+
+// Function to count the entries of a directory, not counting . and ..
+static int count_files(const char *path) {
+    struct dirent *entry;
+    DIR *dir;
+    int n = 0;
+
+    dir = opendir(path);
+    if (!dir)
+        return 0;
+
+    while ((entry = readdir(dir)) != NULL)
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, ".."))
+            n++;
+
+    closedir(dir);
+    return n;
+}
+
+// Function to find the steady state allocation counts a program logged in
+// its .txt logs, returns 0 when it does not count allocations
+static int read_allocations(const char *run_dir, unsigned long long *frame_path, unsigned long long *in_syslog) {
+    char path[PATH_MAX + 256], line[512];
+    struct dirent *entry;
+    const char *found;
+    DIR *dir;
+    FILE *fp;
+    int n = 0;
+
+    dir = opendir(run_dir);
+    if (!dir)
+        return 0;
+
+    while (!n && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".txt") != 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", run_dir, entry->d_name);
+        fp = fopen(path, "r");
+        if (!fp)
+            continue;
+
+        while (!n && fgets(line, sizeof(line), fp))
+            if ((found = strstr(line, "Heap allocations in steady state: frame path=")) != NULL &&
+                sscanf(found, "Heap allocations in steady state: frame path=%llu, syslog=%llu", frame_path, in_syslog) == 2)
+                n = 1;
+
+        fclose(fp);
+    }
+
+    closedir(dir);
+    return n;
+}
+
+// Function to print the percentiles of a histogram of nanoseconds in usec
+static void print_hist(const char *name, const struct lat_hist *h) {
+    if (h->count == 0) {
+        printf("  %-18s no samples\n", name);
+        return;
+    }
+
+    printf("  %-18s min %9.1f  p50 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f  avg %9.1f us\n", name,
+           h->min / 1000.0, lat_hist_percentile(h, 50.0) / 1000.0, lat_hist_percentile(h, 99.0) / 1000.0,
+           lat_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0, lat_hist_mean(h) / 1000.0);
+}
+
+// Function to soak one capture program, returns the number of failed checks
+static int soak(const char *pipeline) {
+    char program[PATH_MAX], run_dir[PATH_MAX], frames_dir[PATH_MAX + 16], path[PATH_MAX + 64];
+    char name_buf[PATH_MAX], *name;
+    static struct lat_hist capture_lat, process_lat, interval;
+    struct frame_times *times;
+    struct rusage usage;
+    double seconds, fps = 0.0;
+    int status, n, i, failures = 0;
+    int expected_files, bad_files = 0, files, width = 0, height = 0;
+    int late_stamps = 0, bad_counter = 0, counter_checked = 0, nominal = 0, counted;
+    unsigned long long frame_allocs = 0, syslog_allocs = 0;
+    long long msec, last_msec = -1, first_counter = -1;
+
+    if (!realpath(pipeline, program)) {
+        perror(pipeline);
+        return 1;
+    }
+
+    snprintf(name_buf, sizeof(name_buf), "%s", program);
+    name = basename(name_buf);
+    for (i = 0; pipeline_rates[i].name; i++)
+        if (strcmp(pipeline_rates[i].name, name) == 0)
+            nominal = pipeline_rates[i].fps;
+
+    snprintf(run_dir, sizeof(run_dir), "%s/soak-%s-XXXXXX", base_dir, name);
+    if (!mkdtemp(run_dir)) {
+        perror(run_dir);
+        return 1;
+    }
+    snprintf(frames_dir, sizeof(frames_dir), "%s/frames", run_dir);
+
+    printf("%s: %d frames from %s in %s\n", name, frame_count, device, run_dir);
+    fflush(stdout);
+
+    status = run_pipeline(program, run_dir, &seconds, &usage);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (WIFSIGNALED(status))
+            printf("  exit               killed by signal %d\n", WTERMSIG(status));
+        else
+            printf("  exit               status %d\n", WEXITSTATUS(status));
+        failures++;
+    }
+
+    // Every acquired frame has a line in the latency log
+    times = calloc(frame_count + 1, sizeof(*times));
+    if (!times) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(path, sizeof(path), "%s/latency.csv", run_dir);
+    n = read_latency_log(path, times, frame_count);
+    if (n != frame_count) {
+        printf("  processed          %d of %d frames\n", n < 0 ? 0 : n, frame_count);
+        failures++;
+    }
+
+    lat_hist_reset(&capture_lat);
+    lat_hist_reset(&process_lat);
+    lat_hist_reset(&interval);
+
+    for (i = 0; i < n && i < frame_count; i++) {
+        if (times[i].frame != times[0].frame + i)
+            bad_counter++;
+        if (i > 0 && (times[i].sensor_ns <= times[i - 1].sensor_ns || times[i].written_ns < times[i - 1].written_ns))
+            late_stamps++;
+
+        if (times[i].sensor_ns && times[i].written_ns >= times[i].sensor_ns)
+            lat_hist_add(&capture_lat, times[i].written_ns - times[i].sensor_ns);
+        lat_hist_add(&process_lat, times[i].written_ns - times[i].dequeue_ns);
+        if (i > 0)
+            lat_hist_add(&interval, times[i].written_ns - times[i - 1].written_ns);
+    }
+
+    if (n > 1 && times[n - 1].written_ns > times[0].dequeue_ns)
+        fps = (double)n * 1000000000.0 / (double)(times[n - 1].written_ns - times[0].dequeue_ns);
+
+    // Frames after the start up frames are written as test0000.pgm onwards
+    expected_files = frame_count - START_UP_FRAMES + 1;
+    for (i = 0; i < expected_files; i++) {
+        unsigned char *data;
+        long long counter;
+
+        snprintf(path, sizeof(path), "%s/test%04d.pgm", frames_dir, i);
+        data = read_frame_file(path, &width, &height, &msec);
+        if (!data) {
+            bad_files++;
+            continue;
+        }
+
+        if (msec < last_msec)
+            late_stamps++;
+        last_msec = msec;
+
+        // The synthetic frame number runs on from file to file unless the
+        // program transformed the frame (10HzAdditional)
+        counter = decode_counter(data, width, height);
+        if (i == 0) {
+            first_counter = counter;
+        } else if (i == 1) {
+            counter_checked = (first_counter >= 0 && counter == first_counter + 1);
+        } else if (counter_checked && counter != first_counter + i) {
+            bad_counter++;
+        }
+
+        free(data);
+    }
+
+    files = count_files(frames_dir);
+
+    printf("  frames             %d files of %d expected, %d bad, %d unexpected\n",
+           expected_files - bad_files, expected_files, bad_files, files > expected_files ? files - expected_files : 0);
+    printf("  sequence           %s\n", bad_counter ? "frames missing or out of order" :
+           counter_checked ? "frame numbers and pattern counter consecutive" : "frame numbers consecutive");
+    printf("  timestamps         %s\n", late_stamps ? "NOT monotonic" : "monotonic");
+    if (nominal)
+        printf("  throughput         %.1f frames/sec sustained, %.1fx the %d Hz requirement\n", fps, fps / nominal, nominal);
+    else
+        printf("  throughput         %.1f frames/sec sustained\n", fps);
+    print_hist("capture->written", &capture_lat);
+    print_hist("dequeue->written", &process_lat);
+    print_hist("frame interval", &interval);
+    printf("  run time           %.2f s, %.2f s user, %.2f s system\n", seconds,
+           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0,
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0);
+    printf("  peak RSS           %.1f MB, %ld major / %ld minor faults\n",
+           usage.ru_maxrss / 1024.0, usage.ru_majflt, usage.ru_minflt);
+
+    counted = read_allocations(run_dir, &frame_allocs, &syslog_allocs);
+    if (counted)
+        printf("  heap allocations   %llu in the frame path, %llu inside syslog()\n", frame_allocs, syslog_allocs);
+
+    failures += bad_files + (files > expected_files) + (bad_counter > 0) + (late_stamps > 0) + (frame_allocs > 0);
+    printf("  result             %s\n\n", failures ? "FAIL" : "PASS");
+
+    free(times);
+
+    if (!keep)
+        nftw(run_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return failures;
+}
+
+// Function to print usage information for the program
+static void usage(FILE *fp, char **argv) {
+    fprintf(fp,
+             "Usage: %s [options]\n\n"
+             "Options:\n"
+             "-p | --pipeline path Capture program to soak, repeatable [./1Hz ./10Hz ./10HzAdditional]\n"
+             "-d | --device name   Frame source [%s]\n"
+             "-c | --count         Number of frames to grab [%i]\n"
+             "-o | --output dir    Directory for the scratch run directories [%s]\n"
+             "-k | --keep          Keep the run directories\n"
+             "-h | --help          Print this message\n",
+             argv[0], device, frame_count, base_dir);
+}
+
+// Options for the program, defining short and long options
+static const char short_options[] = "p:d:c:o:kh";
+static const struct option long_options[] = {
+    { "pipeline", required_argument, NULL, 'p' },
+    { "device",   required_argument, NULL, 'd' },
+    { "count",    required_argument, NULL, 'c' },
+    { "output",   required_argument, NULL, 'o' },
+    { "keep",     no_argument,       NULL, 'k' },
+    { "help",     no_argument,       NULL, 'h' },
+    { 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv) {
+    const char *pipelines[MAX_PIPELINES];
+    int n_pipelines = 0, failures = 0, i;
+
+    for (;;) {
+        int idx;
+        int c;
+
+        c = getopt_long(argc, argv, short_options, long_options, &idx);
+
+        if (-1 == c)
+            break;
+
+        switch (c) {
+            case 'p':
+                if (n_pipelines == MAX_PIPELINES) {
+                    fprintf(stderr, "At most %d pipelines\n", MAX_PIPELINES);
+                    exit(EXIT_FAILURE);
+                }
+                pipelines[n_pipelines++] = optarg;
+                break;
+
+            case 'd':
+                device = optarg;
+                break;
+
+            case 'c':
+                frame_count = atoi(optarg);
+                if (frame_count <= START_UP_FRAMES) {
+                    fprintf(stderr, "Count must be more than the %d start up frames\n", START_UP_FRAMES);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'o':
+                base_dir = optarg;
+                break;
+
+            case 'k':
+                keep++;
+                break;
+
+            case 'h':
+                usage(stdout, argv);
+                exit(EXIT_SUCCESS);
+
+            default:
+                usage(stderr, argv);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (n_pipelines == 0) {
+        pipelines[n_pipelines++] = "./1Hz";
+        pipelines[n_pipelines++] = "./10Hz";
+        pipelines[n_pipelines++] = "./10HzAdditional";
+    }
+
+    for (i = 0; i < n_pipelines; i++)
+        failures += soak(pipelines[i]) ? 1 : 0;
+
+    printf("%d of %d pipelines passed\n", n_pipelines - failures, n_pipelines);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
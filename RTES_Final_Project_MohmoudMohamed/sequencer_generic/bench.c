@@ -0,0 +1,633 @@
+// bench - micro-benchmarks for the pixel kernels and storage paths
+//
+// Every kernel the capture programs run per frame is timed on frames of each
+// size, repeating it until --min-time has passed.  The median frame time is
+// reported as
+//
+//   ns/pixel      - median wall clock time per frame / pixels
+//   GB/s          - bytes read plus written per frame / median time
+//   cycles/pixel  - TSC cycles on x86 (see hrtime.h), otherwise time at the nominal
+//                   cpuinfo_max_freq, not reported when neither is known
+//
+// --json writes the results in the layout of Google Benchmark's JSON output
+// (real_time/cpu_time per iteration in ns plus the counters above), so runs
+// before and after a change to capturelib.c can be diffed with its
+// tools/compare.py or any script.
+//
+// capture_mmap and capture_userptr dequeue a frame from the same unthrottled
+// synthetic source, convert it to RGB and queue the buffer again, once with
+// the source's own (memory-mapped) buffers and once with user pointer buffers
+// from a frame pool (huge pages where the kernel gives them).
+//
+// usage: bench [--json] [--filter substring] [--min-time sec] [--size WxH]... [--dir frames]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "hrtime.h"
+#include "yuvlut.h"
+#include "sobel.h"
+#include "framedump.h"
+#include "framering.h"
+#include "framesource.h"
+#include "framepool.h"
+#include "overlay.h"
+
+// reference converters in capturelib.c
+void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b);
+void yuv2rgb_float(float y, float u, float v, unsigned char *r, unsigned char *g, unsigned char *b);
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define MAX_SIZES (16)
+#define MAX_SAMPLES (100000)
+#define MIN_ITERATIONS (5)
+#define RING_SLOTS (3)
+#define CAPTURE_BUFFERS (4)
+
+struct bench_frame
+{
+    int width;
+    int height;
+    int pixels;
+
+    unsigned char *yuyv;
+    unsigned char *rgb;
+    unsigned char *gray;
+    unsigned char *out;
+
+    struct frame_ring ring;
+    struct frame_source *mmap_source;
+    struct frame_source *userp_source;
+    struct frame_pool userp_pool;
+    char pgm_path[256];
+    char ppm_path[256];
+    struct timespec time_stamp;
+
+    struct overlay stamp;
+    unsigned long long stamp_frame;
+};
+
+struct bench_case
+{
+    const char *name;
+    void (*run)(struct bench_frame *f);
+    int bytes_per_pixel;        // read plus written, 0 when not every pixel is touched
+};
+
+struct bench_result
+{
+    unsigned long long iterations;
+    double real_ns;             // median wall time per frame
+    double min_ns;
+    double cpu_ns;              // mean thread CPU time per frame
+    double cycles;              // median cycles per frame, 0 when unknown
+};
+
+static unsigned long long samples[MAX_SAMPLES];
+static unsigned long long cycle_samples[MAX_SAMPLES];
+
+// kHz from cpufreq when there is no cycle counter
+static double nominal_khz = 0.0;
+static const char *cycle_source = "none";
+
+// where the frame pool behind the user pointer buffers got its memory
+static const char *userp_backing = "none";
+
+
+static unsigned long long clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+
+// the TSC counts reference cycles, the generic timer of ARM does not
+static unsigned long long cycles_now(void)
+{
+    return hrtime_ticks();
+}
+
+
+static void init_cycles(void)
+{
+    FILE *fp;
+
+    hrtime_init();
+
+    if(strcmp(hrtime_clock.source, "tsc") == 0)
+    {
+        cycle_source = "tsc";
+        return;
+    }
+
+    if((fp = fopen("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", "r")) != NULL)
+    {
+        if(fscanf(fp, "%lf", &nominal_khz) == 1 && nominal_khz > 0.0)
+            cycle_source = "cpuinfo_max_freq";
+        fclose(fp);
+    }
+}
+
+
+/* Kernels, each processes one whole frame */
+
+// per pixel pair calls as process_image() did before the lookup tables
+static void run_yuv2rgb(struct bench_frame *f)
+{
+    const unsigned char *pptr = f->yuyv;
+    int i, newi, size = f->pixels * 2;
+
+    for(i = 0, newi = 0; i < size; i = i + 4, newi = newi + 6)
+    {
+        int y_temp = (int)pptr[i], u_temp = (int)pptr[i + 1], y2_temp = (int)pptr[i + 2], v_temp = (int)pptr[i + 3];
+
+        yuv2rgb(y_temp, u_temp, v_temp, &f->rgb[newi], &f->rgb[newi + 1], &f->rgb[newi + 2]);
+        yuv2rgb(y2_temp, u_temp, v_temp, &f->rgb[newi + 3], &f->rgb[newi + 4], &f->rgb[newi + 5]);
+    }
+}
+
+
+static void run_yuv2rgb_float(struct bench_frame *f)
+{
+    const unsigned char *pptr = f->yuyv;
+    int i, newi, size = f->pixels * 2;
+
+    for(i = 0, newi = 0; i < size; i = i + 4, newi = newi + 6)
+    {
+        float y_temp = pptr[i], u_temp = pptr[i + 1], y2_temp = pptr[i + 2], v_temp = pptr[i + 3];
+
+        yuv2rgb_float(y_temp, u_temp, v_temp, &f->rgb[newi], &f->rgb[newi + 1], &f->rgb[newi + 2]);
+        yuv2rgb_float(y2_temp, u_temp, v_temp, &f->rgb[newi + 3], &f->rgb[newi + 4], &f->rgb[newi + 5]);
+    }
+}
+
+
+static void run_yuyv2rgb_lut(struct bench_frame *f)
+{
+    yuyv2rgb_lut(f->yuyv, f->rgb, f->pixels * 2);
+}
+
+
+static void run_yuyv2y(struct bench_frame *f)
+{
+    yuyv2y(f->yuyv, f->out, f->pixels * 2);
+}
+
+
+static void run_sobel(struct bench_frame *f)
+{
+    sobel_filter(f->gray, f->out, f->width, f->height);
+}
+
+
+static void run_dump_pgm(struct bench_frame *f)
+{
+    if(frame_dump_pgm(f->pgm_path, f->gray, f->width, f->height, &f->time_stamp) < 0)
+    {
+        perror(f->pgm_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void run_dump_ppm(struct bench_frame *f)
+{
+    if(frame_dump_ppm(f->ppm_path, f->rgb, f->width, f->height, &f->time_stamp) < 0)
+    {
+        perror(f->ppm_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// frame count and time as every stored frame gets them, the count moves on
+// so the changed digits are rendered again as they would be
+static void run_overlay_stamp(struct bench_frame *f)
+{
+    overlay_stamp(&f->stamp, f->out, f->width, f->height, f->stamp_frame++, &f->time_stamp);
+}
+
+
+// one acquisition copy in at the tail and one frame consumed at the head
+static void run_ring_push_pop(struct bench_frame *f)
+{
+    frame_ring_push(&f->ring, f->yuyv, f->pixels * 2, 0);
+    frame_ring_advance(&f->ring, 1);
+}
+
+
+// one frame through the source and the converter, as read_frame() and
+// process_image() handle it
+static void capture_convert(struct bench_frame *f, struct frame_source *src, enum v4l2_memory memory)
+{
+    struct v4l2_buffer buf;
+    void *frame;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = memory;
+
+    if(frame_source_ioctl(src, VIDIOC_DQBUF, &buf) < 0)
+    {
+        perror("VIDIOC_DQBUF");
+        exit(EXIT_FAILURE);
+    }
+
+    if(memory == V4L2_MEMORY_USERPTR)
+        frame = (void *)buf.m.userptr;
+    else
+        frame = frame_source_buffer(src, buf.index, NULL);
+
+    yuyv2rgb_lut(frame, f->rgb, f->pixels * 2);
+
+    if(frame_source_ioctl(src, VIDIOC_QBUF, &buf) < 0)
+    {
+        perror("VIDIOC_QBUF");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void run_capture_mmap(struct bench_frame *f)
+{
+    capture_convert(f, f->mmap_source, V4L2_MEMORY_MMAP);
+}
+
+
+static void run_capture_userptr(struct bench_frame *f)
+{
+    capture_convert(f, f->userp_source, V4L2_MEMORY_USERPTR);
+}
+
+
+static const struct bench_case bench_case[] =
+{
+    { "yuv2rgb",         run_yuv2rgb,         5 },
+    { "yuv2rgb_float",   run_yuv2rgb_float,   5 },
+    { "yuyv2rgb_lut",    run_yuyv2rgb_lut,    5 },
+    { "yuyv2y",          run_yuyv2y,          3 },
+    { "sobel_filter",    run_sobel,           2 },
+    { "dump_pgm",        run_dump_pgm,        1 },
+    { "dump_ppm",        run_dump_ppm,        3 },
+    { "overlay_stamp",   run_overlay_stamp,   0 },
+    { "ring_push_pop",   run_ring_push_pop,   4 },
+    { "capture_mmap",    run_capture_mmap,    7 },
+    { "capture_userptr", run_capture_userptr, 7 }
+};
+
+#define BENCH_CASES ((int)(sizeof(bench_case) / sizeof(bench_case[0])))
+
+
+// a streaming synthetic source of the frame size, with every buffer queued
+static struct frame_source *capture_open(struct bench_frame *f, enum v4l2_memory memory)
+{
+    struct frame_source *src;
+    struct v4l2_requestbuffers req;
+    struct v4l2_format fmt;
+    struct v4l2_buffer buf;
+    char spec[64];
+    unsigned int i;
+
+    snprintf(spec, sizeof(spec), "synthetic:%dx%d@0,yuyv", f->width, f->height);
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if((src = frame_source_open(spec, &fmt, CAPTURE_BUFFERS)) == NULL)
+        return NULL;
+
+    memset(&req, 0, sizeof(req));
+    req.count = CAPTURE_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = memory;
+
+    if(frame_source_ioctl(src, VIDIOC_REQBUFS, &req) < 0)
+        goto fail;
+
+    if(memory == V4L2_MEMORY_USERPTR)
+    {
+        if(frame_pool_init(&f->userp_pool, req.count, fmt.fmt.pix.sizeimage) < 0)
+            goto fail;
+
+        userp_backing = frame_pool_backing_name(&f->userp_pool);
+    }
+
+    for(i = 0; i < req.count; i++)
+    {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = memory;
+        buf.index = i;
+
+        if(memory == V4L2_MEMORY_USERPTR)
+        {
+            buf.m.userptr = (unsigned long)frame_pool_get(&f->userp_pool);
+            buf.length = fmt.fmt.pix.sizeimage;
+        }
+
+        if(frame_source_ioctl(src, VIDIOC_QBUF, &buf) < 0)
+            goto fail;
+    }
+
+    if(frame_source_ioctl(src, VIDIOC_STREAMON, NULL) == 0)
+        return src;
+
+fail:
+    perror(spec);
+    frame_source_close(src);
+    return NULL;
+}
+
+
+static int frame_init(struct bench_frame *f, int width, int height, const char *dir)
+{
+    unsigned int state = 0x12345678;
+    int i;
+
+    memset(f, 0, sizeof(*f));
+
+    f->width = width;
+    f->height = height;
+    f->pixels = width * height;
+
+    f->yuyv = malloc((size_t)f->pixels * 2);
+    f->rgb = malloc((size_t)f->pixels * 3);
+    f->gray = malloc((size_t)f->pixels);
+    f->out = calloc((size_t)f->pixels, 1);
+
+    if(!f->yuyv || !f->rgb || !f->gray || !f->out)
+        return -1;
+
+    if(frame_ring_init(&f->ring, RING_SLOTS, (size_t)f->pixels * 2) < 0)
+        return -1;
+
+    if(overlay_init(&f->stamp, OVERLAY_GRAY, 8, 8, 2) < 0)
+        return -1;
+
+    if((f->mmap_source = capture_open(f, V4L2_MEMORY_MMAP)) == NULL ||
+       (f->userp_source = capture_open(f, V4L2_MEMORY_USERPTR)) == NULL)
+        return -1;
+
+    // deterministic noise so no kernel sees a trivially predictable frame
+    for(i = 0; i < f->pixels * 2; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        f->yuyv[i] = (unsigned char)state;
+    }
+
+    yuyv2y(f->yuyv, f->gray, f->pixels * 2);
+    yuyv2rgb_lut(f->yuyv, f->rgb, f->pixels * 2);
+
+    snprintf(f->pgm_path, sizeof(f->pgm_path), "%s/bench%dx%d.pgm", dir, width, height);
+    snprintf(f->ppm_path, sizeof(f->ppm_path), "%s/bench%dx%d.ppm", dir, width, height);
+    clock_gettime(CLOCK_REALTIME, &f->time_stamp);
+
+    return 0;
+}
+
+
+static void frame_free(struct bench_frame *f)
+{
+    unlink(f->pgm_path);
+    unlink(f->ppm_path);
+
+    frame_ring_free(&f->ring);
+    frame_source_close(f->mmap_source);
+    frame_source_close(f->userp_source);
+    frame_pool_free(&f->userp_pool);
+    free(f->yuyv);
+    free(f->rgb);
+    free(f->gray);
+    free(f->out);
+}
+
+
+static int compare_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+
+static void run_case(const struct bench_case *bc, struct bench_frame *f, double min_time, struct bench_result *res)
+{
+    unsigned long long start, end, deadline, cpu_start, c0;
+    unsigned long long n = 0;
+
+    // warm up caches, page in the buffers and the output file
+    bc->run(f);
+
+    cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    deadline = hrtime_now() + (unsigned long long)(min_time * NSEC_PER_SEC);
+
+    do
+    {
+        c0 = cycles_now();
+        start = hrtime_now();
+
+        bc->run(f);
+
+        end = hrtime_now();
+        cycle_samples[n] = cycles_now() - c0;
+        samples[n] = end - start;
+        n++;
+    } while(n < MAX_SAMPLES && (n < MIN_ITERATIONS || end < deadline));
+
+    res->iterations = n;
+    res->cpu_ns = (double)(clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start) / (double)n;
+
+    qsort(samples, n, sizeof(samples[0]), compare_ull);
+    qsort(cycle_samples, n, sizeof(cycle_samples[0]), compare_ull);
+
+    res->min_ns = (double)samples[0];
+    res->real_ns = (double)samples[n / 2];
+
+    if(strcmp(cycle_source, "tsc") == 0)
+        res->cycles = (double)cycle_samples[n / 2];
+    else
+        res->cycles = res->real_ns * nominal_khz / 1000000.0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--json] [--filter substring] [--min-time sec] [--size WxH]... [--dir frames]\n", prog);
+    fprintf(stderr, "  default sizes 320x240 640x480 1280x720 1920x1080, min time 0.25 sec per case\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "json",     no_argument,       NULL, 'j' },
+        { "filter",   required_argument, NULL, 'f' },
+        { "min-time", required_argument, NULL, 't' },
+        { "size",     required_argument, NULL, 's' },
+        { "dir",      required_argument, NULL, 'd' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int width[MAX_SIZES] = { 320, 640, 1280, 1920 }, height[MAX_SIZES] = { 240, 480, 720, 1080 };
+    int nsizes = 4, user_sizes = 0, json = 0, first = 1;
+    const char *filter = NULL, *dir = "frames";
+    double min_time = 0.25;
+    char host[256] = "";
+    time_t now;
+    int opt, s, c;
+
+    while((opt = getopt_long(argc, argv, "jf:t:s:d:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'j': json = 1; break;
+            case 'f': filter = optarg; break;
+            case 't': min_time = atof(optarg); break;
+            case 'd': dir = optarg; break;
+            case 's':
+                if(!user_sizes) { nsizes = 0; user_sizes = 1; }
+
+                if(nsizes == MAX_SIZES || sscanf(optarg, "%dx%d", &width[nsizes], &height[nsizes]) != 2 ||
+                   width[nsizes] < 4 || height[nsizes] < 3 || (width[nsizes] & 1))
+                {
+                    fprintf(stderr, "bad size %s, want an even width WxH\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                nsizes++;
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    init_cycles();
+    yuv_lut_init(YUV_MATRIX_BT601, YUV_RANGE_LIMITED);
+
+    gethostname(host, sizeof(host) - 1);
+    now = time(NULL);
+
+    if(json)
+    {
+        char date[64];
+
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+        printf("{\n  \"context\": {\n");
+        printf("    \"date\": \"%s\",\n", date);
+        printf("    \"host_name\": \"%s\",\n", host);
+        printf("    \"executable\": \"%s\",\n", argv[0]);
+        printf("    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+        printf("    \"cycle_source\": \"%s\",\n", cycle_source);
+        printf("    \"time_source\": \"%s\",\n", hrtime_clock.source);
+        printf("    \"min_time\": %.3lf,\n", min_time);
+        printf("    \"library_build_type\": \"release\"\n");
+        printf("  },\n  \"benchmarks\": [\n");
+    }
+    else
+    {
+        printf("%-16s %10s %10s %12s %10s %8s %12s\n", "kernel", "size", "iters", "ns/frame", "ns/pixel", "GB/s", "cycles/pixel");
+    }
+
+    for(s = 0; s < nsizes; s++)
+    {
+        struct bench_frame frame;
+
+        if(frame_init(&frame, width[s], height[s], dir) < 0)
+        {
+            fprintf(stderr, "no memory for %dx%d frames\n", width[s], height[s]);
+            exit(EXIT_FAILURE);
+        }
+
+        for(c = 0; c < BENCH_CASES; c++)
+        {
+            struct bench_result res;
+            double ns_pixel, gbs, cpp;
+
+            if(filter && strstr(bench_case[c].name, filter) == NULL)
+                continue;
+
+            run_case(&bench_case[c], &frame, min_time, &res);
+
+            ns_pixel = res.real_ns / frame.pixels;
+            gbs = (double)bench_case[c].bytes_per_pixel * frame.pixels / res.real_ns;
+            cpp = res.cycles / frame.pixels;
+
+            if(json)
+            {
+                printf("%s    {\n", first ? "" : ",\n");
+                printf("      \"name\": \"%s/%dx%d\",\n", bench_case[c].name, frame.width, frame.height);
+                printf("      \"run_name\": \"%s/%dx%d\",\n", bench_case[c].name, frame.width, frame.height);
+                printf("      \"run_type\": \"iteration\",\n");
+                printf("      \"iterations\": %llu,\n", res.iterations);
+                printf("      \"real_time\": %.1lf,\n", res.real_ns);
+                printf("      \"cpu_time\": %.1lf,\n", res.cpu_ns);
+                printf("      \"time_unit\": \"ns\",\n");
+                printf("      \"min_real_time\": %.1lf,\n", res.min_ns);
+                printf("      \"pixels\": %d,\n", frame.pixels);
+                printf("      \"ns_per_pixel\": %.4lf", ns_pixel);
+
+                if(bench_case[c].bytes_per_pixel > 0)
+                    printf(",\n      \"bytes_per_second\": %.0lf,\n      \"gb_per_s\": %.4lf", gbs * 1e9, gbs);
+
+                if(res.cycles > 0.0)
+                    printf(",\n      \"cycles_per_pixel\": %.4lf", cpp);
+
+                printf("\n    }");
+
+                first = 0;
+            }
+            else
+            {
+                char size[32], bandwidth[32], cycles[32];
+
+                snprintf(size, sizeof(size), "%dx%d", frame.width, frame.height);
+
+                if(bench_case[c].bytes_per_pixel > 0)
+                    snprintf(bandwidth, sizeof(bandwidth), "%.3lf", gbs);
+                else
+                    snprintf(bandwidth, sizeof(bandwidth), "-");
+
+                if(res.cycles > 0.0)
+                    snprintf(cycles, sizeof(cycles), "%.3lf", cpp);
+                else
+                    snprintf(cycles, sizeof(cycles), "-");
+
+                printf("%-16s %10s %10llu %12.0lf %10.3lf %8s %12s\n", bench_case[c].name, size,
+                       res.iterations, res.real_ns, ns_pixel, bandwidth, cycles);
+            }
+
+            fflush(stdout);
+        }
+
+        frame_free(&frame);
+    }
+
+    if(json)
+        printf("\n  ]\n}\n");
+    else
+    {
+        printf("cycles from %s, user pointer buffers on %s\n", cycle_source, userp_backing);
+        hrtime_report(stdout);
+    }
+
+    return 0;
+}
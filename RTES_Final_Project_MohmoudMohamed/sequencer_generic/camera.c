@@ -0,0 +1,285 @@
+// Per-device capture context, see camera.h
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "camera.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+
+static int xioctl(struct camera *cam, unsigned long request, void *arg)
+{
+    int r;
+
+    if(cam->source)
+        return frame_source_ioctl(cam->source, request, arg);
+
+    do
+    {
+        r = ioctl(cam->fd, request, arg);
+
+    } while(-1 == r && EINTR == errno);
+
+    return r;
+}
+
+
+static int fail(struct camera *cam, const char *what)
+{
+    fprintf(stderr, "camera %d %s: %s: %s\n", cam->id, cam->spec, what, strerror(errno));
+    return -1;
+}
+
+
+static int open_device(struct camera *cam, const char *device, unsigned int nbuffers)
+{
+    struct v4l2_capability cap;
+    struct v4l2_cropcap cropcap;
+    struct v4l2_crop crop;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    struct stat st;
+    unsigned int min;
+
+    if(stat(device, &st) < 0 || !S_ISCHR(st.st_mode))
+    {
+        fprintf(stderr, "camera %d: %s is no device\n", cam->id, device);
+        return -1;
+    }
+
+    if((cam->fd = open(device, O_RDWR | O_NONBLOCK, 0)) < 0)
+        return fail(cam, "open");
+
+    if(xioctl(cam, VIDIOC_QUERYCAP, &cap) < 0)
+        return fail(cam, "VIDIOC_QUERYCAP");
+
+    if(!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(cap.capabilities & V4L2_CAP_STREAMING))
+    {
+        fprintf(stderr, "camera %d: %s is no streaming capture device\n", cam->id, device);
+        return -1;
+    }
+
+    // back to the default crop rectangle, drivers without cropping refuse, that is fine
+    CLEAR(cropcap);
+    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if(xioctl(cam, VIDIOC_CROPCAP, &cropcap) == 0)
+    {
+        CLEAR(crop);
+        crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        crop.c = cropcap.defrect;
+        xioctl(cam, VIDIOC_S_CROP, &crop);
+    }
+
+    if(xioctl(cam, VIDIOC_S_FMT, &cam->fmt) < 0)
+        return fail(cam, "VIDIOC_S_FMT");
+
+    // buggy driver paranoia
+    min = cam->fmt.fmt.pix.width * 2;
+    if(cam->fmt.fmt.pix.bytesperline < min)
+        cam->fmt.fmt.pix.bytesperline = min;
+    min = cam->fmt.fmt.pix.bytesperline * cam->fmt.fmt.pix.height;
+    if(cam->fmt.fmt.pix.sizeimage < min)
+        cam->fmt.fmt.pix.sizeimage = min;
+
+    CLEAR(req);
+    req.count = nbuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if(xioctl(cam, VIDIOC_REQBUFS, &req) < 0)
+        return fail(cam, "VIDIOC_REQBUFS");
+
+    if(req.count < 2)
+    {
+        fprintf(stderr, "camera %d: insufficient buffer memory on %s\n", cam->id, device);
+        return -1;
+    }
+
+    if(req.count > CAMERA_MAX_BUFFERS)
+        req.count = CAMERA_MAX_BUFFERS;
+
+    for(cam->n_buffers = 0; cam->n_buffers < req.count; cam->n_buffers++)
+    {
+        CLEAR(buf);
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = cam->n_buffers;
+
+        if(xioctl(cam, VIDIOC_QUERYBUF, &buf) < 0)
+            return fail(cam, "VIDIOC_QUERYBUF");
+
+        cam->buffers[cam->n_buffers].length = buf.length;
+        cam->buffers[cam->n_buffers].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                  cam->fd, buf.m.offset);
+
+        if(cam->buffers[cam->n_buffers].start == MAP_FAILED)
+            return fail(cam, "mmap");
+    }
+
+    return 0;
+}
+
+
+static int open_source(struct camera *cam, unsigned int nbuffers)
+{
+    unsigned int i;
+
+    if((cam->source = frame_source_open(cam->spec, &cam->fmt, nbuffers)) == NULL)
+        return -1;
+
+    cam->fd = frame_source_fd(cam->source);
+    cam->n_buffers = frame_source_buffers(cam->source);
+
+    for(i = 0; i < cam->n_buffers; i++)
+        cam->buffers[i].start = frame_source_buffer(cam->source, i, &cam->buffers[i].length);
+
+    return 0;
+}
+
+
+int camera_open(struct camera *cam, int id, const char *spec, unsigned int width, unsigned int height,
+                unsigned int nbuffers)
+{
+    const char *device;
+    int rc;
+
+    memset(cam, 0, sizeof(*cam));
+    cam->id = id;
+    cam->spec = spec;
+    cam->fd = -1;
+
+    cam->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cam->fmt.fmt.pix.width = width;
+    cam->fmt.fmt.pix.height = height;
+    cam->fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    cam->fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    if((device = frame_source_v4l2_device(spec)) != NULL)
+        rc = open_device(cam, device, nbuffers);
+    else
+        rc = open_source(cam, nbuffers);
+
+    if(rc == 0 && cam->fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)
+    {
+        fprintf(stderr, "camera %d: %s does not deliver YUYV\n", cam->id, spec);
+        rc = -1;
+    }
+
+    if(rc < 0)
+        camera_close(cam);
+
+    return rc;
+}
+
+
+void camera_close(struct camera *cam)
+{
+    unsigned int i;
+
+    if(cam->streaming)
+        camera_stop(cam);
+
+    if(cam->source)
+    {
+        // the source owns its buffers and descriptor
+        frame_source_close(cam->source);
+    }
+    else
+    {
+        for(i = 0; i < cam->n_buffers; i++)
+            munmap(cam->buffers[i].start, cam->buffers[i].length);
+
+        if(cam->fd >= 0)
+            close(cam->fd);
+    }
+
+    cam->source = NULL;
+    cam->n_buffers = 0;
+    cam->fd = -1;
+}
+
+
+int camera_start(struct camera *cam)
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    struct v4l2_buffer buf;
+    unsigned int i;
+
+    for(i = 0; i < cam->n_buffers; i++)
+    {
+        CLEAR(buf);
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+
+        if(xioctl(cam, VIDIOC_QBUF, &buf) < 0)
+            return fail(cam, "VIDIOC_QBUF");
+    }
+
+    if(xioctl(cam, VIDIOC_STREAMON, &type) < 0)
+        return fail(cam, "VIDIOC_STREAMON");
+
+    cam->streaming = 1;
+    cam->frames = 0;
+    cam->lost = 0;
+    return 0;
+}
+
+
+void camera_stop(struct camera *cam)
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if(xioctl(cam, VIDIOC_STREAMOFF, &type) < 0)
+        fail(cam, "VIDIOC_STREAMOFF");
+
+    cam->streaming = 0;
+}
+
+
+void *camera_dequeue(struct camera *cam, struct v4l2_buffer *buf)
+{
+    CLEAR(*buf);
+    buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf->memory = V4L2_MEMORY_MMAP;
+
+    if(xioctl(cam, VIDIOC_DQBUF, buf) < 0)
+    {
+        if(errno != EAGAIN)
+            fail(cam, "VIDIOC_DQBUF");
+
+        return NULL;
+    }
+
+    if(buf->index >= cam->n_buffers)
+    {
+        errno = EINVAL;
+        fail(cam, "VIDIOC_DQBUF index");
+        return NULL;
+    }
+
+    if(cam->frames > 0 && buf->sequence != cam->next_sequence)
+        cam->lost += buf->sequence - cam->next_sequence;
+
+    cam->next_sequence = buf->sequence + 1;
+    cam->frames++;
+
+    return cam->buffers[buf->index].start;
+}
+
+
+int camera_requeue(struct camera *cam, struct v4l2_buffer *buf)
+{
+    if(xioctl(cam, VIDIOC_QBUF, buf) < 0)
+        return fail(cam, "VIDIOC_QBUF");
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef _CAMERA_H_
+#define _CAMERA_H_
+
+#include <stddef.h>
+#include <linux/videodev2.h>
+
+#include "framesource.h"
+
+// Per-device capture context
+//
+// Everything one capture device needs (fd, format, mapped buffers) lives in
+// a struct camera, so one process can stream from several devices at once;
+// capturelib.c drives its single camera through it too.  A camera is opened
+// from the spec strings of framesource.h, a V4L2 device gets memory-mapped
+// driver buffers, a synthetic: or replay: source its own buffers, and both
+// are then driven the same way:
+//
+//   camera_open()      negotiate the format and map the buffers
+//   camera_start()     queue every buffer and start streaming
+//   camera_dequeue()   next filled buffer, NULL with errno EAGAIN when none
+//                      is ready, poll camera->fd for POLLIN to wait
+//   camera_requeue()   hand the buffer back to the driver
+//   camera_stop()      stop streaming, every buffer returns to the camera
+//   camera_close()     unmap and close
+//
+// Functions return -1 (or NULL) after printing what failed, nothing exits.
+// A camera is used by one thread at a time, different cameras need no
+// locking between them.
+
+#define CAMERA_MAX_BUFFERS (FRAME_SOURCE_MAX_BUFFERS)
+
+struct camera_buffer
+{
+    void   *start;
+    size_t  length;
+};
+
+struct camera
+{
+    int id;                         // tag for frames from this camera
+    const char *spec;
+    int fd;                         // pollable, device or frame source
+    struct frame_source *source;    // NULL for a V4L2 device
+
+    struct v4l2_format fmt;
+    struct camera_buffer buffers[CAMERA_MAX_BUFFERS];
+    unsigned int n_buffers;
+    int streaming;
+
+    unsigned long long frames;      // buffers dequeued
+    unsigned long long lost;        // frames the driver dropped, sequence gaps
+    unsigned int next_sequence;
+};
+
+// width and height are requested with YUYV, fmt holds what was negotiated
+int camera_open(struct camera *cam, int id, const char *spec, unsigned int width, unsigned int height,
+                unsigned int nbuffers);
+void camera_close(struct camera *cam);
+
+int camera_start(struct camera *cam);
+void camera_stop(struct camera *cam);
+
+void *camera_dequeue(struct camera *cam, struct v4l2_buffer *buf);
+int camera_requeue(struct camera *cam, struct v4l2_buffer *buf);
+
+#endif
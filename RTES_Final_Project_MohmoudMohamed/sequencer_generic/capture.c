@@ -13,17 +13,46 @@
  * see http://linuxtv.org/docs.php for more information
  */
 
+#include <stdio.h>
+#include <string.h>
+
+#include "yuvlut.h"
+
 int v4l2_frame_acquisition_loop(char *dev_name);
+void v4l2_set_color_conversion(int matrix, int range);
 
+// usage: capture [device] [601|709] [limited|full]
+//
+// The device may also be a synthetic: or replay: frame source spec (see
+// framesource.h) to run without a camera.
+//
+// The YUV to RGB matrix and range default to what the driver reports for the
+// negotiated format, the optional arguments override either one.
 int main(int argc, char **argv)
 {
     char *dev_name;
+    int matrix = -1, range = -1;
 
     if(argc > 1)
         dev_name = argv[1];
     else
         dev_name = "/dev/video0";
 
+    if(argc > 2)
+    {
+        if(strcmp(argv[2], "709") == 0) matrix = YUV_MATRIX_BT709;
+        else if(strcmp(argv[2], "601") == 0) matrix = YUV_MATRIX_BT601;
+        else fprintf(stderr, "unknown matrix %s, using driver setting\n", argv[2]);
+    }
+
+    if(argc > 3)
+    {
+        if(strcmp(argv[3], "full") == 0) range = YUV_RANGE_FULL;
+        else if(strcmp(argv[3], "limited") == 0) range = YUV_RANGE_LIMITED;
+        else fprintf(stderr, "unknown range %s, using driver setting\n", argv[3]);
+    }
+
+    v4l2_set_color_conversion(matrix, range);
     v4l2_frame_acquisition_loop(dev_name);
 
 }
@@ -16,7 +16,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
 #include <syslog.h>
 
@@ -34,6 +33,17 @@
 #include <linux/videodev2.h>
 
 #include <time.h>
+#include <pthread.h>
+
+#include "yuvlut.h"
+#include "frametrace.h"
+#include "framesource.h"
+#include "framedump.h"
+#include "framering.h"
+#include "perfctr.h"
+#include "rtmem.h"
+#include "overlay.h"
+#include "camera.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -67,45 +77,53 @@
 #define COLOR_CONVERT_RGB
 //#define COLOR_CONVERT_GRAY
 #define DUMP_FRAMES
+#define STAMP_FRAMES
 
-#define DRIVER_MMAP_BUFFERS (6)  // request buffers for delay
+// Per-frame stage timestamps, summary printed at shutdown and the trace
+// saved as Chrome trace JSON (open in chrome://tracing or ui.perfetto.dev)
+#define FRAME_TRACE
+#define FRAME_TRACE_JSON "frame_trace.json"
 
+#ifdef FRAME_TRACE
+#define TRACE_MARK(frame, stage) frame_trace_mark_now((frame), (stage))
+#else
+#define TRACE_MARK(frame, stage)
+#endif
 
-// Format is used by a number of functions, so made as a file global
-static struct v4l2_format fmt;
-struct v4l2_buffer frame_buf;
+// Hardware counter deltas (cycles, instructions, cache and branch misses)
+// charged to each pipeline stage, summary printed at shutdown
+#define PERF_COUNTERS
 
-struct buffer 
-{
-        void   *start;
-        size_t  length;
-};
+#ifdef PERF_COUNTERS
+#define PERF_SAMPLE(sample) perfctr_sample(&(sample))
+#define PERF_ACCOUNT(stage, sample) perfctr_account(&stage_perf[(stage)], &(sample))
+#else
+#define PERF_SAMPLE(sample) (void)(sample)
+#define PERF_ACCOUNT(stage, sample)
+#endif
 
+// Lock and prefault memory before frames flow, page faults of startup and
+// steady state printed at shutdown (see rtmem.h)
+#define RT_MEMORY
+#define RT_HEAP_RESERVE (8 * 1024 * 1024)
 
-struct save_frame_t
-{
-    unsigned char   frame[HRES*VRES*PIXEL_SIZE];
-    struct timespec time_stamp;
-    char identifier_str[80];
-};
+#define DRIVER_MMAP_BUFFERS (6)  // request buffers for delay
 
-struct ring_buffer_t
-{
-    unsigned int ring_size;
 
-    int tail_idx;
-    int head_idx;
-    int count;
+// The camera, or the synthetic: or replay: source standing in for it, its
+// format and mapped buffers; camera.c opens and drives it
+static struct camera camera;
+struct v4l2_buffer frame_buf;
 
-    struct save_frame_t save_frame[3*FRAMES_PER_SEC];
-};
 
-static  struct ring_buffer_t	ring_buffer;
+// copies of acquired frames awaiting processing
+#define RING_FRAMES (3*FRAMES_PER_SEC)
+
+static struct frame_ring ring_buffer;
 
-static int              camera_device_fd = -1;
-struct buffer          *buffers;
-static unsigned int     n_buffers;
-static int              force_format=1;
+// -1 means use the YCbCr encoding and quantization the driver reports
+static int              yuv_matrix_override=-1;
+static int              yuv_range_override=-1;
 
 
 static double fnow=0.0, fstart=0.0, fstop=0.0;
@@ -118,89 +136,79 @@ static void errno_exit(const char *s)
 }
 
 
-static int xioctl(int fh, int request, void *arg)
-{
-    int rc;
+// last frame file written, for the transmission service, see seq_frame_stored();
+// S2 and S3 store frames, S4 reads the path, number and time as one
+static char stored_path[32];
+static int stored_frame = -1;
+static struct timespec stored_time;
+static pthread_mutex_t stored_lock;
+static pthread_once_t stored_once = PTHREAD_ONCE_INIT;
 
-    do 
-    {
-        rc = ioctl(fh, request, arg);
-
-    } while (-1 == rc && EINTR == errno);
+// the services sharing it run SCHED_FIFO at different priorities
+static void stored_lock_init(void)
+{
+    pthread_mutexattr_t mattr;
 
-    return rc;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&stored_lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
 }
 
+static void frame_stored(const char *path, unsigned int tag, const struct timespec *time)
+{
+    pthread_once(&stored_once, stored_lock_init);
+    pthread_mutex_lock(&stored_lock);
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char ppm_dumpname[]="frames/test0000.ppm";
+    snprintf(stored_path, sizeof(stored_path), "%s", path);
+    stored_frame = tag;
+    stored_time = *time;
 
-static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
-{
-    int written, i, total, dumpfd;
-   
-    snprintf(&ppm_dumpname[11], 9, "%04d", tag);
-    strncat(&ppm_dumpname[15], ".ppm", 5);
-    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+    pthread_mutex_unlock(&stored_lock);
+}
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
 
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, ppm_header, sizeof(ppm_header)-1);
+static void dump_ppm(const void *p, unsigned int tag, struct timespec *time)
+{
+    char ppm_dumpname[32];
+    struct timespec written;
+    int total;
 
-    total=0;
+    snprintf(ppm_dumpname, sizeof(ppm_dumpname), "frames/test%04u.ppm", tag);
 
-    do
+    if((total = frame_dump_ppm(ppm_dumpname, p, HRES, VRES, time)) < 0)
     {
-        written=write(dumpfd, p, size);
-        total+=written;
-    } while(total < size);
+        perror(ppm_dumpname);
+        return;
+    }
 
-    clock_gettime(CLOCK_MONOTONIC, &time_now);
-    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
+    frame_stored(ppm_dumpname, tag, time);
 
-    close(dumpfd);
-    
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    printf("Frame written to flash at %lf, %d, bytes\n",
+           (double)written.tv_sec + (double)written.tv_nsec / 1000000000.0 - fstart, total);
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char pgm_dumpname[]="frames/test0000.pgm";
-
-static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
+static void dump_pgm(const void *p, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
-   
-    snprintf(&pgm_dumpname[11], 9, "%04d", tag);
-    strncat(&pgm_dumpname[15], ".pgm", 5);
-    dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
-
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, pgm_header, sizeof(pgm_header)-1);
+    char pgm_dumpname[32];
+    struct timespec written;
+    int total;
 
-    total=0;
+    snprintf(pgm_dumpname, sizeof(pgm_dumpname), "frames/test%04u.pgm", tag);
 
-    do
+    if((total = frame_dump_pgm(pgm_dumpname, p, HRES, VRES, time)) < 0)
     {
-        written=write(dumpfd, p, size);
-        total+=written;
-    } while(total < size);
+        perror(pgm_dumpname);
+        return;
+    }
 
-    clock_gettime(CLOCK_MONOTONIC, &time_now);
-    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
+    frame_stored(pgm_dumpname, tag, time);
 
-    close(dumpfd);
-    
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    printf("Frame written to flash at %lf, %d, bytes\n",
+           (double)written.tv_sec + (double)written.tv_nsec / 1000000000.0 - fstart, total);
 }
 
 
@@ -270,12 +278,42 @@ int read_framecnt=-STARTUP_FRAMES;
 int process_framecnt=0;
 int save_framecnt=0;
 
+// frame number of the image currently held in scratchpad_buffer
+static int scratchpad_frame=-1;
+
 unsigned char scratchpad_buffer[MAX_HRES*MAX_VRES*MAX_PIXEL_SIZE];
 
+// hardware counters charged to each stage, acquire is DQBUF plus the ring copy
+enum pipeline_stage
+{
+    STAGE_ACQUIRE = 0,
+    STAGE_CONVERT,
+    STAGE_STORE,
+    PIPELINE_STAGES
+};
+
+static struct perfctr_stats stage_perf[PIPELINE_STAGES];
+
+
+#ifdef STAMP_FRAMES
+// frame count and time stamp burned into the top left of every stored frame
+static struct overlay stamp;
+
+
+static void stamp_image(unsigned char *frame_ptr, enum overlay_format format, int framecnt, struct timespec *frame_time)
+{
+    if(stamp.format != format && overlay_init(&stamp, format, 8, 8, 2) < 0)
+        return;
+
+    overlay_stamp(&stamp, frame_ptr, HRES, VRES, (unsigned long long)framecnt, frame_time);
+}
+#else
+#define stamp_image(frame_ptr, format, framecnt, frame_time)
+#endif
+
 
 static int save_image(const void *p, int size, struct timespec *frame_time)
 {
-    int i, newi, newsize=0;
     unsigned char *frame_ptr = (unsigned char *)p;
 
     save_framecnt++;
@@ -283,36 +321,40 @@ static int save_image(const void *p, int size, struct timespec *frame_time)
     
 #ifdef DUMP_FRAMES	
 
-    if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY)
+    if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY)
     {
         printf("Dump graymap as-is size %d\n", size);
-        dump_pgm(frame_ptr, size, save_framecnt, frame_time);
+        stamp_image(frame_ptr, OVERLAY_GRAY, save_framecnt, frame_time);
+        dump_pgm(frame_ptr, save_framecnt, frame_time);
     }
 
-    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
+    else if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
     {
 
 #if defined(COLOR_CONVERT_RGB)
        
         if(save_framecnt > 0) 
         {
-            dump_ppm(frame_ptr, ((size*6)/4), save_framecnt, frame_time);
+            stamp_image(frame_ptr, OVERLAY_RGB, save_framecnt, frame_time);
+            dump_ppm(frame_ptr, save_framecnt, frame_time);
             printf("Dump YUYV converted to RGB size %d\n", size);
         }
 #elif defined(COLOR_CONVERT_GRAY)
         if(save_framecnt > 0)
         {
-            dump_pgm(frame_ptr, (size/2), process_framecnt, frame_time);
+            stamp_image(frame_ptr, OVERLAY_GRAY, process_framecnt, frame_time);
+            dump_pgm(frame_ptr, process_framecnt, frame_time);
             printf("Dump YUYV converted to YY size %d\n", size);
         }
 #endif
 
     }
 
-    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24)
+    else if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24)
     {
         printf("Dump RGB as-is size %d\n", size);
-        dump_ppm(frame_ptr, size, process_framecnt, frame_time);
+        stamp_image(frame_ptr, OVERLAY_RGB, process_framecnt, frame_time);
+        dump_ppm(frame_ptr, process_framecnt, frame_time);
     }
     else
     {
@@ -326,45 +368,31 @@ static int save_image(const void *p, int size, struct timespec *frame_time)
 
 static int process_image(const void *p, int size)
 {
-    int i, newi, newsize=0;
-    int y_temp, y2_temp, u_temp, v_temp;
     unsigned char *frame_ptr = (unsigned char *)p;
 
     process_framecnt++;
     printf("process frame %d: ", process_framecnt);
     
-    if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY)
+    if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY)
     {
         printf("NO PROCESSING for graymap as-is size %d\n", size);
     }
 
-    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
+    else if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
     {
 #if defined(COLOR_CONVERT_RGB)
        
-        // Pixels are YU and YV alternating, so YUYV which is 4 bytes
-        // We want RGB, so RGBRGB which is 6 bytes
+        // Table driven conversion without any multiplies, with the matrix
+        // and range init_color_conversion() picked; in 16.16 fixed point, so
+        // a channel can differ by 1 from what yuv2rgb() gives
         //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
-        {
-            y_temp=(int)frame_ptr[i]; u_temp=(int)frame_ptr[i+1]; y2_temp=(int)frame_ptr[i+2]; v_temp=(int)frame_ptr[i+3];
-            yuv2rgb(y_temp, u_temp, v_temp, &scratchpad_buffer[newi], &scratchpad_buffer[newi+1], &scratchpad_buffer[newi+2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &scratchpad_buffer[newi+3], &scratchpad_buffer[newi+4], &scratchpad_buffer[newi+5]);
-        }
+        yuyv2rgb_lut(frame_ptr, scratchpad_buffer, size);
 #elif defined(COLOR_CONVERT_GRAY)
-        // Pixels are YU and YV alternating, so YUYV which is 4 bytes
-        // We want Y, so YY which is 2 bytes
-        //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
-        {
-            // Y1=first byte and Y2=third byte
-            scratchpad_buffer[newi]=frame_ptr[i];
-            scratchpad_buffer[newi+1]=frame_ptr[i+2];
-        }
+        yuyv2y(frame_ptr, scratchpad_buffer, size);
 #endif
     }
 
-    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24)
+    else if(camera.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24)
     {
         printf("NO PROCESSING for RGB as-is size %d\n", size);
     }
@@ -379,12 +407,7 @@ static int process_image(const void *p, int size)
 
 static int read_frame(void)
 {
-    CLEAR(frame_buf);
-
-    frame_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    frame_buf.memory = V4L2_MEMORY_MMAP;
-
-    if (-1 == xioctl(camera_device_fd, VIDIOC_DQBUF, &frame_buf))
+    if (camera_dequeue(&camera, &frame_buf) == NULL)
     {
         switch (errno)
         {
@@ -406,6 +429,13 @@ static int read_frame(void)
 
     read_framecnt++;
 
+#ifdef FRAME_TRACE
+    TRACE_MARK(read_framecnt, TRACE_DQBUF);
+
+    if(frame_buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        frame_trace_sensor(read_framecnt, &frame_buf.timestamp);
+#endif
+
     //printf("frame %d ", read_framecnt);
 
     if(read_framecnt == 0) 
@@ -414,8 +444,6 @@ static int read_frame(void)
         fstart = (double)time_start.tv_sec + (double)time_start.tv_nsec / 1000000000.0;
     }
 
-    assert(frame_buf.index < n_buffers);
-
     return 1;
 }
 
@@ -424,26 +452,26 @@ int seq_frame_read(void)
 {
     fd_set fds;
     struct timeval tv;
+    struct perfctr_sample perf;
     int rc;
 
     FD_ZERO(&fds);
-    FD_SET(camera_device_fd, &fds);
+    FD_SET(camera.fd, &fds);
 
     /* Timeout */
     tv.tv_sec = 2;
     tv.tv_usec = 0;
 
-    rc = select(camera_device_fd + 1, &fds, NULL, NULL, &tv);
+    rc = select(camera.fd + 1, &fds, NULL, NULL, &tv);
 
+    PERF_SAMPLE(perf);
     read_frame();
 
     // save off copy of image with time-stamp here
     //printf("memcpy to %p from %p for %d bytes\n", (void *)&(ring_buffer.save_frame[ring_buffer.tail_idx].frame[0]), buffers[frame_buf.index].start, frame_buf.bytesused);
     //syslog(LOG_CRIT, "memcpy to %p from %p for %d bytes\n", (void *)&(ring_buffer.save_frame[ring_buffer.tail_idx].frame[0]), buffers[frame_buf.index].start, frame_buf.bytesused);
-    memcpy((void *)&(ring_buffer.save_frame[ring_buffer.tail_idx].frame[0]), buffers[frame_buf.index].start, frame_buf.bytesused);
-
-    ring_buffer.tail_idx = (ring_buffer.tail_idx + 1) % ring_buffer.ring_size;
-    ring_buffer.count++;
+    frame_ring_push(&ring_buffer, camera.buffers[frame_buf.index].start, frame_buf.bytesused, read_framecnt);
+    PERF_ACCOUNT(STAGE_ACQUIRE, perf);
 
     clock_gettime(CLOCK_MONOTONIC, &time_now);
     fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
@@ -460,24 +488,34 @@ int seq_frame_read(void)
         printf("at %lf\n", fnow);
     }
 
-    if (-1 == xioctl(camera_device_fd, VIDIOC_QBUF, &frame_buf))
-        errno_exit("VIDIOC_QBUF");
+    if (camera_requeue(&camera, &frame_buf) < 0)
+        exit(EXIT_FAILURE);
+
+    TRACE_MARK(read_framecnt, TRACE_QBUF);
 }
 
 
 
 int seq_frame_process(void)
 {
-    int cnt;
+    struct frame_ring_slot *slot;
+    struct perfctr_sample perf;
+    int cnt, frame;
 
     printf("processing rb.tail=%d, rb.head=%d, rb.count=%d\n", ring_buffer.tail_idx, ring_buffer.head_idx, ring_buffer.count);
 
-    ring_buffer.head_idx = (ring_buffer.head_idx + 2) % ring_buffer.ring_size;
+    // process the frame 2 past the head and drop the 5 oldest
+    slot = frame_ring_peek(&ring_buffer, 2);
+    frame = slot->frame_num;
 
-    cnt=process_image((void *)&(ring_buffer.save_frame[ring_buffer.head_idx].frame[0]), HRES*VRES*PIXEL_SIZE);
+    TRACE_MARK(frame, TRACE_PROC_START);
+    PERF_SAMPLE(perf);
+    cnt=process_image((void *)slot->frame, HRES*VRES*PIXEL_SIZE);
+    PERF_ACCOUNT(STAGE_CONVERT, perf);
+    TRACE_MARK(frame, TRACE_PROC_END);
+    scratchpad_frame = frame;
 
-    ring_buffer.head_idx = (ring_buffer.head_idx + 3) % ring_buffer.ring_size;
-    ring_buffer.count = ring_buffer.count - 5;
+    frame_ring_advance(&ring_buffer, 5);
 
      	
     printf("rb.tail=%d, rb.head=%d, rb.count=%d ", ring_buffer.tail_idx, ring_buffer.head_idx, ring_buffer.count);
@@ -499,9 +537,14 @@ int seq_frame_process(void)
 
 int seq_frame_store(void)
 {
+    struct perfctr_sample perf;
     int cnt;
 
+    TRACE_MARK(scratchpad_frame, TRACE_WRITE_SUBMIT);
+    PERF_SAMPLE(perf);
     cnt=save_image(scratchpad_buffer, HRES*VRES*PIXEL_SIZE, &time_now);
+    PERF_ACCOUNT(STAGE_STORE, perf);
+    TRACE_MARK(scratchpad_frame, TRACE_WRITE_DONE);
     printf("save_framecnt=%d ", save_framecnt);
 
 
@@ -520,8 +563,32 @@ int seq_frame_store(void)
 }
 
 
+// copies the path, number and time of the last frame file written,
+// -1 before the first one
+int seq_frame_stored(char *path, size_t size, int *frame_num, struct timespec *time_stamp)
+{
+    int rc = -1;
+
+    pthread_once(&stored_once, stored_lock_init);
+    pthread_mutex_lock(&stored_lock);
+
+    if(stored_frame >= 0)
+    {
+        snprintf(path, size, "%s", stored_path);
+        *frame_num = stored_frame;
+        *time_stamp = stored_time;
+        rc = 0;
+    }
+
+    pthread_mutex_unlock(&stored_lock);
+    return rc;
+}
+
+
 static void mainloop(void)
 {
+    struct frame_ring_slot *slot;
+    struct perfctr_sample perf;
     unsigned int count;
     struct timespec read_delay;
     struct timespec time_error;
@@ -567,13 +634,13 @@ static void mainloop(void)
             int rc;
 
             FD_ZERO(&fds);
-            FD_SET(camera_device_fd, &fds);
+            FD_SET(camera.fd, &fds);
 
             /* Timeout */
             tv.tv_sec = 2;
             tv.tv_usec = 0;
 
-            rc = select(camera_device_fd + 1, &fds, NULL, NULL, &tv);
+            rc = select(camera.fd + 1, &fds, NULL, NULL, &tv);
 
             if (-1 == rc)
             {
@@ -601,25 +668,32 @@ static void mainloop(void)
 	            {	
                         printf(" read at %lf, @ %lf FPS\n", (fnow-fstart), (double)(read_framecnt+1) / (fnow-fstart));
 
-                        memcpy((void *)&(ring_buffer.save_frame[ring_buffer.tail_idx].frame[0]), buffers[frame_buf.index].start, frame_buf.bytesused);
-			printf("memcpy to rb.tail=%d, rb.head=%d, ptr=%p\n", ring_buffer.tail_idx, ring_buffer.head_idx, (void *)&(ring_buffer.save_frame[ring_buffer.tail_idx].frame[0]));
-
-                        // advance ring buffer for next read
-                        ring_buffer.tail_idx = (ring_buffer.tail_idx + 1) % ring_buffer.ring_size;
-                        ring_buffer.count++;
+                        // save a copy and advance ring buffer for next read
+                        slot = frame_ring_push(&ring_buffer, camera.buffers[frame_buf.index].start, frame_buf.bytesused, read_framecnt);
+			printf("memcpy to rb.tail=%d, rb.head=%d, ptr=%p\n", ring_buffer.tail_idx, ring_buffer.head_idx, (void *)slot->frame);
 
+                        slot = frame_ring_peek(&ring_buffer, 0);
+                        scratchpad_frame = slot->frame_num;
+                        TRACE_MARK(scratchpad_frame, TRACE_PROC_START);
+                        PERF_SAMPLE(perf);
 
-                        process_image((void *)&(ring_buffer.save_frame[ring_buffer.head_idx].frame[0]), HRES*VRES*PIXEL_SIZE);
+                        process_image((void *)slot->frame, HRES*VRES*PIXEL_SIZE);
                         //process_image(buffers[frame_buf.index].start, frame_buf.bytesused);
 			printf("bytesused=%d, hxvxp=%d\n", frame_buf.bytesused, HRES*VRES*PIXEL_SIZE);
-                        process_image((void *)&(ring_buffer.save_frame[ring_buffer.head_idx].frame[0]), HRES*VRES*PIXEL_SIZE);
+                        process_image((void *)slot->frame, HRES*VRES*PIXEL_SIZE);
+
+                        PERF_ACCOUNT(STAGE_CONVERT, perf);
+                        TRACE_MARK(scratchpad_frame, TRACE_PROC_END);
 
-			printf("process from rb.tail=%d, rb.head=%d, ptr=%p\n", ring_buffer.tail_idx, ring_buffer.head_idx, (void *)&(ring_buffer.save_frame[ring_buffer.head_idx].frame[0]));
+			printf("process from rb.tail=%d, rb.head=%d, ptr=%p\n", ring_buffer.tail_idx, ring_buffer.head_idx, (void *)slot->frame);
+                        TRACE_MARK(scratchpad_frame, TRACE_WRITE_SUBMIT);
+                        PERF_SAMPLE(perf);
                         save_image(scratchpad_buffer, HRES*VRES*PIXEL_SIZE, &time_now);
+                        PERF_ACCOUNT(STAGE_STORE, perf);
+                        TRACE_MARK(scratchpad_frame, TRACE_WRITE_DONE);
 
                         // advance ring buffer for next write
-                        ring_buffer.head_idx = (ring_buffer.head_idx + 1) % ring_buffer.ring_size;
-                        ring_buffer.count--;
+                        frame_ring_advance(&ring_buffer, 1);
 
 		    }
 		    else 
@@ -628,8 +702,9 @@ static void mainloop(void)
 		    }
 		}
 
-                if (-1 == xioctl(camera_device_fd, VIDIOC_QBUF, &frame_buf))
-                        errno_exit("VIDIOC_QBUF");
+                if (camera_requeue(&camera, &frame_buf) < 0)
+                        exit(EXIT_FAILURE);
+                TRACE_MARK(read_framecnt, TRACE_QBUF);
                 count--;
                 break;
             }
@@ -646,15 +721,10 @@ static void mainloop(void)
 
 static void stop_capturing(void)
 {
-    enum v4l2_buf_type type;
-
     clock_gettime(CLOCK_MONOTONIC, &time_stop);
     fstop = (double)time_stop.tv_sec + (double)time_stop.tv_nsec / 1000000000.0;
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-    if(-1 == xioctl(camera_device_fd, VIDIOC_STREAMOFF, &type))
-		    errno_exit("VIDIOC_STREAMOFF");
+    camera_stop(&camera);
 
     printf("capture stopped\n");
 }
@@ -662,283 +732,158 @@ static void stop_capturing(void)
 
 static void start_capturing(void)
 {
-        unsigned int i;
-        enum v4l2_buf_type type;
-
-	printf("will capture to %d buffers\n", n_buffers);
-
-        for (i = 0; i < n_buffers; ++i) 
-        {
-                printf("allocated buffer %d\n", i);
-
-                CLEAR(frame_buf);
-                frame_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                frame_buf.memory = V4L2_MEMORY_MMAP;
-                frame_buf.index = i;
-
-                if (-1 == xioctl(camera_device_fd, VIDIOC_QBUF, &frame_buf))
-                        errno_exit("VIDIOC_QBUF");
-        }
-
-        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-        if (-1 == xioctl(camera_device_fd, VIDIOC_STREAMON, &type))
-                errno_exit("VIDIOC_STREAMON");
+        printf("will capture to %d buffers\n", camera.n_buffers);
 
+        if (camera_start(&camera) < 0)
+                exit(EXIT_FAILURE);
 }
 
 
 static void uninit_device(void)
 {
-        unsigned int i;
+        frame_ring_free(&ring_buffer);
+}
 
-        for (i = 0; i < n_buffers; ++i)
-                if (-1 == munmap(buffers[i].start, buffers[i].length))
-                        errno_exit("munmap");
 
-        free(buffers);
+static void init_ring_buffer(void)
+{
+	if(frame_ring_init(&ring_buffer, RING_FRAMES, HRES*VRES*PIXEL_SIZE) < 0)
+		exit(EXIT_FAILURE);
 }
 
 
-static void init_mmap(char *dev_name)
+// Pick the YUV to RGB tables from the negotiated format unless the caller
+// asked for a specific matrix or range with v4l2_set_color_conversion()
+static void init_color_conversion(void)
 {
-        struct v4l2_requestbuffers req;
+    enum yuv_matrix matrix = YUV_MATRIX_BT601;
+    enum yuv_range range = YUV_RANGE_LIMITED;
 
-        CLEAR(req);
+    if(camera.fmt.fmt.pix.ycbcr_enc == V4L2_YCBCR_ENC_709)
+        matrix = YUV_MATRIX_BT709;
 
-        req.count = DRIVER_MMAP_BUFFERS;
-        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        req.memory = V4L2_MEMORY_MMAP;
+    if(camera.fmt.fmt.pix.quantization == V4L2_QUANTIZATION_FULL_RANGE)
+        range = YUV_RANGE_FULL;
 
-	printf("init_mmap req.count=%d\n",req.count);
+    if(yuv_matrix_override >= 0) matrix = (enum yuv_matrix)yuv_matrix_override;
+    if(yuv_range_override >= 0) range = (enum yuv_range)yuv_range_override;
 
-	ring_buffer.tail_idx=0;
-	ring_buffer.head_idx=0;
-	ring_buffer.count=0;
-	ring_buffer.ring_size=3*FRAMES_PER_SEC;
+    yuv_lut_init(matrix, range);
+    printf("YUV to RGB conversion %s\n", yuv_lut_name());
+}
 
-        if (-1 == xioctl(camera_device_fd, VIDIOC_REQBUFS, &req)) 
-        {
-                if (EINVAL == errno) 
-                {
-                        fprintf(stderr, "%s does not support "
-                                 "memory mapping\n", dev_name);
-                        exit(EXIT_FAILURE);
-                } else 
-                {
-                        errno_exit("VIDIOC_REQBUFS");
-                }
-        }
 
-        if (req.count < 2) 
-        {
-                fprintf(stderr, "Insufficient buffer memory on %s\n", dev_name);
-                exit(EXIT_FAILURE);
-        }
-	else
-	{
-	    printf("Device supports %d mmap buffers\n", req.count);
+static void close_device(void)
+{
+        if (camera.source && frame_source_dropped(camera.source))
+                printf("frame source dropped %llu frames\n", frame_source_dropped(camera.source));
 
-	    // allocate tracking buffers array for those that are mapped
-            buffers = calloc(req.count, sizeof(*buffers));
+        camera_close(&camera);
+}
 
 
-	    // set up double buffer for frames to be safe with one time malloc her or just declare
+// dev_name is a V4L2 device or a frame source spec, see framesource.h; either
+// is opened by camera.c, asking for HRES x VRES YUYV
+static void open_source(char *dev_name)
+{
+        struct v4l2_pix_format *pix = &camera.fmt.fmt.pix;
 
-	}
+        if (camera_open(&camera, 0, dev_name, HRES, VRES, DRIVER_MMAP_BUFFERS) < 0)
+                exit(EXIT_FAILURE);
 
-        if (!buffers) 
+        // the ring buffer, scratchpad and dumps all assume HRES x VRES YUYV
+        // frames, a smaller source would have them read past its buffers
+        if (pix->width != HRES || pix->height != VRES || pix->pixelformat != V4L2_PIX_FMT_YUYV ||
+            pix->sizeimage != HRES*VRES*PIXEL_SIZE)
         {
-                fprintf(stderr, "Out of memory\n");
+                fprintf(stderr, "%s delivers %ux%u %.4s frames, not %dx%d YUYV\n", dev_name, pix->width,
+                        pix->height, (char *)&pix->pixelformat, HRES, VRES);
                 exit(EXIT_FAILURE);
         }
 
-        for (n_buffers = 0; n_buffers < req.count; ++n_buffers) 
-	{
-                CLEAR(frame_buf);
-
-                frame_buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                frame_buf.memory      = V4L2_MEMORY_MMAP;
-                frame_buf.index       = n_buffers;
-
-                if (-1 == xioctl(camera_device_fd, VIDIOC_QUERYBUF, &frame_buf))
-                        errno_exit("VIDIOC_QUERYBUF");
+        printf("%s streams %ux%u YUYV into %u buffers\n", dev_name, pix->width, pix->height, camera.n_buffers);
 
-                buffers[n_buffers].length = frame_buf.length;
-                buffers[n_buffers].start =
-                        mmap(NULL /* start anywhere */,
-                              frame_buf.length,
-                              PROT_READ | PROT_WRITE /* required */,
-                              MAP_SHARED /* recommended */,
-                              camera_device_fd, frame_buf.m.offset);
-
-                if (MAP_FAILED == buffers[n_buffers].start)
-                        errno_exit("mmap");
-
-                printf("mappped buffer %d\n", n_buffers);
-        }
+        init_color_conversion();
+        init_ring_buffer();
 }
 
 
-static void init_device(char *dev_name)
+// matrix is a YUV_MATRIX_* and range a YUV_RANGE_* value, -1 keeps the
+// driver reported setting, call before initialization of V4L2
+void v4l2_set_color_conversion(int matrix, int range)
 {
-    struct v4l2_capability cap;
-    struct v4l2_cropcap cropcap;
-    struct v4l2_crop crop;
-    unsigned int min;
-
-    if (-1 == xioctl(camera_device_fd, VIDIOC_QUERYCAP, &cap))
-    {
-        if (EINVAL == errno) {
-            fprintf(stderr, "%s is no V4L2 device\n",
-                     dev_name);
-            exit(EXIT_FAILURE);
-        }
-        else
-        {
-                errno_exit("VIDIOC_QUERYCAP");
-        }
-    }
-
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE))
-    {
-        fprintf(stderr, "%s is no video capture device\n",
-                 dev_name);
-        exit(EXIT_FAILURE);
-    }
-
-    if (!(cap.capabilities & V4L2_CAP_STREAMING))
-    {
-        fprintf(stderr, "%s does not support streaming i/o\n",
-                 dev_name);
-        exit(EXIT_FAILURE);
-    }
-
-
-    /* Select video input, video standard and tune here. */
-
-
-    CLEAR(cropcap);
-
-    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-    if (0 == xioctl(camera_device_fd, VIDIOC_CROPCAP, &cropcap))
-    {
-        crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        crop.c = cropcap.defrect; /* reset to default */
-
-        if (-1 == xioctl(camera_device_fd, VIDIOC_S_CROP, &crop))
-        {
-            switch (errno)
-            {
-                case EINVAL:
-                    /* Cropping not supported. */
-                    break;
-                default:
-                    /* Errors ignored. */
-                        break;
-            }
-        }
-
-    }
-    else
-    {
-        /* Errors ignored. */
-    }
-
-
-    CLEAR(fmt);
-
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-    if (force_format)
-    {
-        printf("FORCING FORMAT\n");
-        fmt.fmt.pix.width       = HRES;
-        fmt.fmt.pix.height      = VRES;
-
-        // Specify the Pixel Coding Formate here
-
-        // This one works for Logitech C200
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-
-        //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
-        //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_VYUY;
-
-        // Would be nice if camera supported
-        //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_GREY;
-        //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
-
-        //fmt.fmt.pix.field       = V4L2_FIELD_INTERLACED;
-        fmt.fmt.pix.field       = V4L2_FIELD_NONE;
-
-        if (-1 == xioctl(camera_device_fd, VIDIOC_S_FMT, &fmt))
-                errno_exit("VIDIOC_S_FMT");
-
-        /* Note VIDIOC_S_FMT may change width and height. */
-    }
-    else
-    {
-        printf("ASSUMING FORMAT\n");
-        /* Preserve original settings as set by v4l2-ctl for example */
-        if (-1 == xioctl(camera_device_fd, VIDIOC_G_FMT, &fmt))
-                    errno_exit("VIDIOC_G_FMT");
-    }
+    yuv_matrix_override = matrix;
+    yuv_range_override = range;
+}
 
-    /* Buggy driver paranoia. */
-    min = fmt.fmt.pix.width * 2;
-    if (fmt.fmt.pix.bytesperline < min)
-            fmt.fmt.pix.bytesperline = min;
-    min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-    if (fmt.fmt.pix.sizeimage < min)
-            fmt.fmt.pix.sizeimage = min;
 
-    init_mmap(dev_name);
+static void frame_trace_shutdown(void)
+{
+#ifdef FRAME_TRACE
+    frame_trace_report(stdout);
+    frame_trace_export_chrome(FRAME_TRACE_JSON);
+#endif
+#ifdef PERF_COUNTERS
+    perfctr_report(stdout, "frame", stage_perf, PIPELINE_STAGES);
+#endif
 }
 
 
-static void close_device(void)
+static void stage_perf_init(void)
 {
-        if (-1 == close(camera_device_fd))
-                errno_exit("close");
-
-        camera_device_fd = -1;
+#ifdef PERF_COUNTERS
+    perfctr_stats_init(&stage_perf[STAGE_ACQUIRE], "acquire");
+    perfctr_stats_init(&stage_perf[STAGE_CONVERT], "convert");
+    perfctr_stats_init(&stage_perf[STAGE_STORE], "store");
+    perfctr_enable();
+#endif
 }
 
 
-static void open_device(char *dev_name)
+// before anything is allocated, so the ring and device buffers come from
+// locked memory
+static void rt_memory_init(void)
 {
-        struct stat st;
+#ifdef RT_MEMORY
+    rtmem_init(RT_HEAP_RESERVE);
+#endif
+}
 
-        if (-1 == stat(dev_name, &st)) {
-                fprintf(stderr, "Cannot identify '%s': %d, %s\n",
-                         dev_name, errno, strerror(errno));
-                exit(EXIT_FAILURE);
-        }
 
-        if (!S_ISCHR(st.st_mode)) {
-                fprintf(stderr, "%s is no device\n", dev_name);
-                exit(EXIT_FAILURE);
-        }
+// the working buffers exist once streaming has started, touch them and
+// start counting steady state faults
+static void rt_memory_steady(void)
+{
+#ifdef RT_MEMORY
+    rtmem_prefault(scratchpad_buffer, sizeof(scratchpad_buffer));
+    rtmem_prefault(ring_buffer.storage, ring_buffer.ring_size * ring_buffer.frame_size);
+    rtmem_mark_steady();
+#endif
+}
 
-        camera_device_fd = open(dev_name, O_RDWR /* required */ | O_NONBLOCK, 0);
 
-        if (-1 == camera_device_fd) {
-                fprintf(stderr, "Cannot open '%s': %d, %s\n",
-                         dev_name, errno, strerror(errno));
-                exit(EXIT_FAILURE);
-        }
+static void rt_memory_report(void)
+{
+#ifdef RT_MEMORY
+    rtmem_report(stdout);
+#endif
 }
 
 
 int v4l2_frame_acquisition_loop(char *dev_name)
 {
 
-    // initialization of V4L2
-    open_device(dev_name);
-    init_device(dev_name);
+#ifdef FRAME_TRACE
+    frame_trace_init();
+#endif
+    stage_perf_init();
+    rt_memory_init();
+
+    // initialization of V4L2 or the frame source standing in for it
+    open_source(dev_name);
 
     start_capturing();
+    rt_memory_steady();
 
     // service loop frame read
     mainloop();
@@ -947,6 +892,8 @@ int v4l2_frame_acquisition_loop(char *dev_name)
     stop_capturing();
 
     printf("Total capture time=%lf, for %d frames, %lf FPS\n", (fstop-fstart), read_framecnt, ((double)read_framecnt / (fstop-fstart)));
+    frame_trace_shutdown();
+    rt_memory_report();
 
     uninit_device();
     close_device();
@@ -957,11 +904,17 @@ int v4l2_frame_acquisition_loop(char *dev_name)
 
 int v4l2_frame_acquisition_initialization(char *dev_name)
 {
-    // initialization of V4L2
-    open_device(dev_name);
-    init_device(dev_name);
+#ifdef FRAME_TRACE
+    frame_trace_init();
+#endif
+    stage_perf_init();
+    rt_memory_init();
+
+    // initialization of V4L2 or the frame source standing in for it
+    open_source(dev_name);
 
     start_capturing();
+    rt_memory_steady();
 }
 
 
@@ -971,6 +924,8 @@ int v4l2_frame_acquisition_shutdown(void)
     stop_capturing();
 
     printf("Total capture time=%lf, for %d frames, %lf FPS\n", (fstop-fstart), read_framecnt+1, ((double)read_framecnt / (fstop-fstart)));
+    frame_trace_shutdown();
+    rt_memory_report();
 
     uninit_device();
     close_device();
@@ -0,0 +1,498 @@
+// cheddar_export - schedulability check and Cheddar model from a measured run
+//
+// Reads the service timing written by a sequencer run (service_timing.csv,
+// see svctiming.h), which carries each service's period, SCHED_FIFO priority
+// and core affinity together with the measured worst case execution times.
+// For every core the services are checked with
+//
+//   Liu & Layland  - U <= n(2^(1/n) - 1), sufficient only
+//   RTA            - exact response time analysis with the real priorities,
+//                    R = C + sum over higher or equal priority of ceil(R/Tj)*Cj
+//
+// and the critical scaling factor, how much every WCET on the core can grow
+// before RTA fails, is found by bisection.  The schedulability margin is that
+// factor minus one and must be at least the requested margin, otherwise the
+// program exits with status 2 so it can gate a deployment script.  Deadline
+// misses observed during the run fail the check as well.
+//
+// A Cheddar model equivalent to ../../Peer_Review_Services_RMA_Timing_Diagrams/
+// Timing_Analysis.xmlv3 is written with one core, processor and address space
+// per Linux core used and capacities/periods in microseconds.
+//
+// The capacity is the worst case thread CPU time by default.  The wall clock
+// times (-c wall or p999) already include the preemption by higher priority
+// services that RTA adds again, so they are pessimistic and can report a
+// schedulable set as unschedulable.
+//
+// Usage: cheddar_export [-i service_timing.csv] [-o model.xmlv3]
+//                       [-m margin_percent] [-c cpu|wall|p999]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define MAX_SERVICES (32)
+#define MAX_NAME (64)
+
+#define DEFAULT_INPUT "service_timing.csv"
+#define DEFAULT_OUTPUT "Timing_Analysis_measured.xmlv3"
+#define DEFAULT_MARGIN_PCT (20.0)
+
+#define EXIT_NOT_SCHEDULABLE (2)
+
+enum wcet_source
+{
+    WCET_CPU = 0,   // thread CPU time, pure demand on the core
+    WCET_WALL,      // wall clock start to end, includes preemption and blocking
+    WCET_P999       // 99.9th percentile of wall clock, drops rare outliers
+};
+
+struct service
+{
+    char name[MAX_NAME];
+    double period_us;
+    int priority;
+    int cpu;
+    unsigned long long releases;
+    double wcet_cpu_us;
+    double wcet_wall_us;
+    double p999_wall_us;
+    double avg_wall_us;
+    double max_jitter_us;
+    double max_response_us;
+    unsigned long long deadline_misses;
+
+    double C;           // capacity used for the analysis
+    double R;           // response time from RTA, -1 when past the deadline
+};
+
+static struct service service[MAX_SERVICES];
+static int nservices = 0;
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-i service_timing.csv] [-o model.xmlv3] [-m margin_percent] [-c cpu|wall|p999]\n", prog);
+    fprintf(stderr, "  -i  measured service timing from seqv4l2 (default %s)\n", DEFAULT_INPUT);
+    fprintf(stderr, "  -o  Cheddar model to write (default %s)\n", DEFAULT_OUTPUT);
+    fprintf(stderr, "  -m  required margin, WCETs must be able to grow by this many percent (default %.0lf)\n", DEFAULT_MARGIN_PCT);
+    fprintf(stderr, "  -c  which measured execution time is the capacity (default cpu); wall and p999\n");
+    fprintf(stderr, "      include preemption, which RTA counts again, so they are pessimistic\n");
+}
+
+
+static int read_services(const char *path, enum wcet_source source)
+{
+    FILE *fp;
+    char line[512];
+    int lineno = 0;
+
+    if((fp = fopen(path, "r")) == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        struct service *s = &service[nservices];
+        int n;
+
+        lineno++;
+
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if(nservices == MAX_SERVICES)
+        {
+            fprintf(stderr, "%s: more than %d services\n", path, MAX_SERVICES);
+            break;
+        }
+
+        n = sscanf(line, "%63[^,],%lf,%d,%d,%llu,%lf,%lf,%lf,%lf,%lf,%lf,%llu",
+                   s->name, &s->period_us, &s->priority, &s->cpu, &s->releases,
+                   &s->wcet_cpu_us, &s->wcet_wall_us, &s->p999_wall_us, &s->avg_wall_us,
+                   &s->max_jitter_us, &s->max_response_us, &s->deadline_misses);
+
+        if(n != 12 || s->period_us <= 0.0)
+        {
+            fprintf(stderr, "%s:%d: malformed service line\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+
+        switch(source)
+        {
+            case WCET_WALL: s->C = s->wcet_wall_us; break;
+            case WCET_P999: s->C = s->p999_wall_us; break;
+            default:        s->C = s->wcet_cpu_us; break;
+        }
+
+        if(s->releases == 0)
+            fprintf(stderr, "warning: %s was never released, its WCET is unknown\n", s->name);
+
+        nservices++;
+    }
+
+    fclose(fp);
+
+    if(nservices == 0)
+    {
+        fprintf(stderr, "%s: no services\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// true when j can delay i on the same core, equal priorities are FIFO so
+// they are counted as interference to stay pessimistic
+static int interferes(const struct service *i, const struct service *j)
+{
+    return i != j && i->cpu == j->cpu && j->priority >= i->priority;
+}
+
+
+// response time of s with every capacity on its core scaled, -1 when it
+// exceeds the deadline (D = T)
+static double response_time(const struct service *s, double scale)
+{
+    double R, next;
+    int j;
+
+    R = s->C * scale;
+
+    for(;;)
+    {
+        next = s->C * scale;
+
+        for(j = 0; j < nservices; j++)
+            if(interferes(s, &service[j]))
+                next += ceil(R / service[j].period_us) * service[j].C * scale;
+
+        if(next > s->period_us)
+            return -1.0;
+
+        if(next <= R)
+            return next;
+
+        R = next;
+    }
+}
+
+
+static int core_schedulable(int cpu, double scale)
+{
+    int i;
+
+    for(i = 0; i < nservices; i++)
+        if(service[i].cpu == cpu && response_time(&service[i], scale) < 0.0)
+            return 0;
+
+    return 1;
+}
+
+
+// largest factor all WCETs on the core can be multiplied by and still pass RTA
+static double critical_scaling(int cpu, double utilization)
+{
+    double lo = 0.0, hi;
+    int iter;
+
+    if(utilization <= 0.0)
+        return INFINITY;
+
+    hi = 1.0 / utilization;   // beyond U = 1 nothing is schedulable
+
+    if(core_schedulable(cpu, hi))
+        return hi;
+
+    for(iter = 0; iter < 50; iter++)
+    {
+        double mid = (lo + hi) / 2.0;
+
+        if(core_schedulable(cpu, mid))
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+// returns 1 when the core meets the required margin
+static int analyze_core(int cpu, double margin_pct)
+{
+    double U = 0.0, bound, scaling;
+    int i, n = 0, ok = 1;
+
+    for(i = 0; i < nservices; i++)
+    {
+        if(service[i].cpu == cpu)
+        {
+            U += service[i].C / service[i].period_us;
+            n++;
+        }
+    }
+
+    bound = n * (pow(2.0, 1.0 / n) - 1.0);
+
+    printf("\nCore %d: %d services, U=%.4lf, Liu & Layland bound=%.4lf (%s)\n", cpu, n, U, bound,
+           U <= bound ? "schedulable" : "inconclusive, RTA decides");
+
+    printf("  %-24s %5s %12s %12s %12s %12s %8s\n", "service", "prio", "T usec", "C usec", "R usec", "max R run", "misses");
+
+    for(i = 0; i < nservices; i++)
+    {
+        struct service *s = &service[i];
+
+        if(s->cpu != cpu)
+            continue;
+
+        s->R = response_time(s, 1.0);
+
+        if(s->R < 0.0)
+        {
+            printf("  %-24s %5d %12.1lf %12.1lf %12s %12.1lf %8llu  MISSES DEADLINE\n", s->name, s->priority,
+                   s->period_us, s->C, "> T", s->max_response_us, s->deadline_misses);
+            ok = 0;
+        }
+        else
+        {
+            printf("  %-24s %5d %12.1lf %12.1lf %12.1lf %12.1lf %8llu\n", s->name, s->priority,
+                   s->period_us, s->C, s->R, s->max_response_us, s->deadline_misses);
+        }
+
+        // the analysis can only be as good as the measured WCETs, a miss in
+        // the run itself means they were not worst case
+        if(s->deadline_misses)
+        {
+            printf("  %s missed %llu deadlines during the measured run\n", s->name, s->deadline_misses);
+            ok = 0;
+        }
+    }
+
+    if(!ok)
+    {
+        printf("  RTA: NOT SCHEDULABLE\n");
+        return 0;
+    }
+
+    scaling = critical_scaling(cpu, U);
+
+    if(isinf(scaling))
+    {
+        printf("  RTA: schedulable, no measured load\n");
+        return 1;
+    }
+
+    printf("  RTA: schedulable, critical scaling factor %.3lf, margin %.1lf%% (required %.1lf%%)\n",
+           scaling, (scaling - 1.0) * 100.0, margin_pct);
+
+    if((scaling - 1.0) * 100.0 < margin_pct)
+    {
+        printf("  INSUFFICIENT MARGIN on core %d\n", cpu);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void write_scheduling(FILE *fp, const char *indent, const char *protocol)
+{
+    fprintf(fp, "%s<scheduling>\n", indent);
+    fprintf(fp, "%s <scheduling_parameters>\n", indent);
+    fprintf(fp, "%s  <scheduler_type>%s</scheduler_type>\n", indent, protocol);
+    fprintf(fp, "%s  <quantum>0</quantum>\n", indent);
+    fprintf(fp, "%s  <preemptive_type>PREEMPTIVE</preemptive_type>\n", indent);
+    fprintf(fp, "%s  <capacity>0</capacity>\n", indent);
+    fprintf(fp, "%s  <period>0</period>\n", indent);
+    fprintf(fp, "%s  <priority>0</priority>\n", indent);
+    fprintf(fp, "%s  <start_time>0</start_time>\n", indent);
+    fprintf(fp, "%s </scheduling_parameters>\n", indent);
+    fprintf(fp, "%s</scheduling>\n", indent);
+}
+
+
+static int write_cheddar(const char *path, const int *cpus, int ncpus)
+{
+    FILE *fp;
+    int i, c, id = 1;
+
+    if((fp = fopen(path, "w")) == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<cheddar>\n");
+
+    fprintf(fp, " <core_units>\n");
+    for(c = 0; c < ncpus; c++)
+    {
+        fprintf(fp, "  <core_unit id=\"core_%d\">\n", cpus[c]);
+        fprintf(fp, "   <object_type>CORE_OBJECT_TYPE</object_type>\n");
+        fprintf(fp, "   <name>core%d</name>\n", cpus[c]);
+        write_scheduling(fp, "   ", "RATE_MONOTONIC_PROTOCOL");
+        fprintf(fp, "   <speed>1</speed>\n");
+        fprintf(fp, "   <worstcase_perequest_intrabank_memory_interference>0</worstcase_perequest_intrabank_memory_interference>\n");
+        fprintf(fp, "   <worstcase_perequest_interbank_memory_interference>0</worstcase_perequest_interbank_memory_interference>\n");
+        fprintf(fp, "   <isa>I386</isa>\n");
+        fprintf(fp, "  </core_unit>\n");
+    }
+    fprintf(fp, " </core_units>\n");
+
+    fprintf(fp, " <processors>\n");
+    for(c = 0; c < ncpus; c++)
+    {
+        fprintf(fp, "  <mono_core_processor id=\"cpu_%d\">\n", cpus[c]);
+        fprintf(fp, "   <object_type>PROCESSOR_OBJECT_TYPE</object_type>\n");
+        fprintf(fp, "   <name>CPU%d</name>\n", cpus[c]);
+        fprintf(fp, "   <processor_type>MONOCORE_TYPE</processor_type>\n");
+        fprintf(fp, "   <migration_type>NO_MIGRATION_TYPE</migration_type>\n");
+        fprintf(fp, "   <core ref=\"core_%d\">\n", cpus[c]);
+        fprintf(fp, "   </core>\n");
+        fprintf(fp, "  </mono_core_processor>\n");
+    }
+    fprintf(fp, " </processors>\n");
+
+    fprintf(fp, " <address_spaces>\n");
+    for(c = 0; c < ncpus; c++)
+    {
+        fprintf(fp, "  <address_space id=\"as_%d\">\n", cpus[c]);
+        fprintf(fp, "   <object_type>ADDRESS_SPACE_OBJECT_TYPE</object_type>\n");
+        fprintf(fp, "   <name>SharedRAM%d</name>\n", cpus[c]);
+        fprintf(fp, "   <cpu_name>CPU%d</cpu_name>\n", cpus[c]);
+        fprintf(fp, "   <text_memory_size>0</text_memory_size>\n");
+        fprintf(fp, "   <stack_memory_size>0</stack_memory_size>\n");
+        fprintf(fp, "   <data_memory_size>0</data_memory_size>\n");
+        fprintf(fp, "   <heap_memory_size>0</heap_memory_size>\n");
+        write_scheduling(fp, "   ", "NO_SCHEDULING_PROTOCOL");
+        fprintf(fp, "   <mils_confidentiality_level>TOP_SECRET</mils_confidentiality_level>\n");
+        fprintf(fp, "   <mils_integrity_level>HIGH</mils_integrity_level>\n");
+        fprintf(fp, "   <mils_component>SLS</mils_component>\n");
+        fprintf(fp, "   <mils_partition>DEVICE</mils_partition>\n");
+        fprintf(fp, "   <mils_compliant>TRUE</mils_compliant>\n");
+        fprintf(fp, "  </address_space>\n");
+    }
+    fprintf(fp, " </address_spaces>\n");
+
+    // Cheddar works in integer time units, one unit is a microsecond here and
+    // capacities are rounded up so the model never understates the load
+    fprintf(fp, " <tasks>\n");
+    for(i = 0; i < nservices; i++)
+    {
+        const struct service *s = &service[i];
+        long period = (long)ceil(s->period_us);
+        long capacity = (long)ceil(s->C);
+
+        if(capacity < 1)
+            capacity = 1;
+
+        fprintf(fp, "  <periodic_task id=\"task_%d\">\n", id++);
+        fprintf(fp, "   <object_type>TASK_OBJECT_TYPE</object_type>\n");
+        fprintf(fp, "   <name>%s</name>\n", s->name);
+        fprintf(fp, "   <task_type>PERIODIC_TYPE</task_type>\n");
+        fprintf(fp, "   <cpu_name>CPU%d</cpu_name>\n", s->cpu);
+        fprintf(fp, "   <address_space_name>SharedRAM%d</address_space_name>\n", s->cpu);
+        fprintf(fp, "   <capacity>%ld</capacity>\n", capacity);
+        fprintf(fp, "   <capacity_low>0</capacity_low>\n");
+        fprintf(fp, "   <energy_consumption>0</energy_consumption>\n");
+        fprintf(fp, "   <deadline>%ld</deadline>\n", period);
+        fprintf(fp, "   <start_time>0</start_time>\n");
+        fprintf(fp, "   <priority>%d</priority>\n", s->priority);
+        fprintf(fp, "   <blocking_time>0</blocking_time>\n");
+        fprintf(fp, "   <policy>SCHED_FIFO</policy>\n");
+        fprintf(fp, "   <text_memory_size>0</text_memory_size>\n");
+        fprintf(fp, "   <text_memory_start_address>0</text_memory_start_address>\n");
+        fprintf(fp, "   <stack_memory_size>0</stack_memory_size>\n");
+        fprintf(fp, "   <criticality>0</criticality>\n");
+        fprintf(fp, "   <context_switch_overhead>0</context_switch_overhead>\n");
+        fprintf(fp, "   <cfg_relocatable>FALSE</cfg_relocatable>\n");
+        fprintf(fp, "   <mils_confidentiality_level>TOP_SECRET</mils_confidentiality_level>\n");
+        fprintf(fp, "   <mils_integrity_level>HIGH</mils_integrity_level>\n");
+        fprintf(fp, "   <mils_component>SLS</mils_component>\n");
+        fprintf(fp, "   <mils_task>APPLICATION</mils_task>\n");
+        fprintf(fp, "   <mils_compliant>TRUE</mils_compliant>\n");
+        fprintf(fp, "   <access_memory_number>0</access_memory_number>\n");
+        fprintf(fp, "   <maximum_number_of_memory_request_per_job>0</maximum_number_of_memory_request_per_job>\n");
+        fprintf(fp, "   <period>%ld</period>\n", period);
+        fprintf(fp, "   <jitter>%ld</jitter>\n", (long)ceil(s->max_jitter_us));
+        fprintf(fp, "   <every>0</every>\n");
+        fprintf(fp, "   <completion_time>0</completion_time>\n");
+        fprintf(fp, "  </periodic_task>\n");
+    }
+    fprintf(fp, " </tasks>\n");
+
+    fprintf(fp, "</cheddar>\n");
+    fclose(fp);
+
+    printf("\nCheddar model written to %s\n", path);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *input = DEFAULT_INPUT, *output = DEFAULT_OUTPUT;
+    double margin_pct = DEFAULT_MARGIN_PCT;
+    enum wcet_source source = WCET_CPU;
+    int cpus[MAX_SERVICES], ncpus = 0;
+    int opt, i, c, ok = 1;
+
+    while((opt = getopt(argc, argv, "i:o:m:c:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i': input = optarg; break;
+            case 'o': output = optarg; break;
+            case 'm': margin_pct = atof(optarg); break;
+            case 'c':
+                if(strcmp(optarg, "cpu") == 0) source = WCET_CPU;
+                else if(strcmp(optarg, "wall") == 0) source = WCET_WALL;
+                else if(strcmp(optarg, "p999") == 0) source = WCET_P999;
+                else { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(read_services(input, source) < 0)
+        exit(EXIT_FAILURE);
+
+    for(i = 0; i < nservices; i++)
+    {
+        for(c = 0; c < ncpus; c++)
+            if(cpus[c] == service[i].cpu)
+                break;
+
+        if(c == ncpus)
+            cpus[ncpus++] = service[i].cpu;
+    }
+
+    printf("Schedulability of %d services from %s, capacity = %s execution time\n", nservices, input,
+           source == WCET_CPU ? "cpu" : (source == WCET_P999 ? "p99.9 wall" : "worst case wall"));
+
+    for(c = 0; c < ncpus; c++)
+        if(!analyze_core(cpus[c], margin_pct))
+            ok = 0;
+
+    if(write_cheddar(output, cpus, ncpus) < 0)
+        exit(EXIT_FAILURE);
+
+    if(!ok)
+    {
+        fprintf(stderr, "\n*** SCHEDULABILITY CHECK FAILED: do not deploy this configuration ***\n");
+        exit(EXIT_NOT_SCHEDULABLE);
+    }
+
+    printf("Schedulability check passed\n");
+    return 0;
+}
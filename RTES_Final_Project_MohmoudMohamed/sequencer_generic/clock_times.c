@@ -3,13 +3,33 @@
  * from the man page - https://man7.org/linux/man-pages/man2/clock_getres.2.html
  *
  *  Licensed under GNU General Public License v2 or later.
+ *
+ * Extended into a timing profiler for picking the sequencer parameters in
+ * seqgen.h from measurements:
+ *
+ *  clock_times [-r]            clock readings around 10 msec nanosleeps
+ *  clock_times -c              clock_gettime() cost per clock ID, vDSO and
+ *                              syscall paths
+ *  clock_times -w [-p usec]... [-n loops] [-s threads]
+ *                              nanosleep() and clock_nanosleep(TIMER_ABSTIME)
+ *                              wake-up latency under SCHED_OTHER and
+ *                              SCHED_FIFO, optionally with a CPU and memory
+ *                              load of background threads
 */
-#define _XOPEN_SOURCE 600
+#define _GNU_SOURCE
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "lathist.h"
+#include "seqgen.h"
 
 #define SECS_IN_DAY (24 * 60 * 60)
 
@@ -47,11 +67,11 @@ displayClock(clockid_t clock, char *name, bool showRes)
 #define DELAY_LOOPS (10)
 #define USEC_PER_MSEC (1000)
 
-int main(int argc, char *argv[])
+static void
+displayLoops(bool showRes)
 {
     struct timespec delay_time={0,10000000};
     struct timespec remaining_time={0,1000000};
-    bool showRes = argc > 1;
     int idx=0, rc;
 
     displayClock(CLOCK_REALTIME, "CLOCK_REALTIME", showRes);
@@ -92,7 +112,395 @@ int main(int argc, char *argv[])
             displayClock(CLOCK_MONOTONIC_RAW, "CLOCK_MONOTONIC_RAW", showRes);
 	else {perror("nanosleep"); exit(-1);};
     }
+}
+
+#define NSEC_PER_USEC (1000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+
+#define MIN_PERIOD_USEC (100)
+#define MAX_PERIOD_USEC (1000000)
+#define MAX_PERIODS (16)
+#define MAX_STRESS (64)
+
+#define COST_BATCHES (20)
+#define COST_CALLS (10000)
+
+// default run length when -n is not given, bounded by the loop limits
+#define RUN_NSEC (1000000000ULL)
+#define MIN_LOOPS (10)
+#define MAX_LOOPS (10000)
+
+#define STRESS_BYTES (4 * 1024 * 1024)
+
+struct clock_id
+{
+    clockid_t clock;
+    char *name;
+};
+
+static const struct clock_id clock_ids[] = {
+    { CLOCK_REALTIME, "CLOCK_REALTIME" },
+    { CLOCK_REALTIME_COARSE, "CLOCK_REALTIME_COARSE" },
+    { CLOCK_MONOTONIC, "CLOCK_MONOTONIC" },
+    { CLOCK_MONOTONIC_COARSE, "CLOCK_MONOTONIC_COARSE" },
+    { CLOCK_MONOTONIC_RAW, "CLOCK_MONOTONIC_RAW" },
+#ifdef CLOCK_BOOTTIME
+    { CLOCK_BOOTTIME, "CLOCK_BOOTTIME" },
+#endif
+#ifdef CLOCK_TAI
+    { CLOCK_TAI, "CLOCK_TAI" },
+#endif
+    { CLOCK_PROCESS_CPUTIME_ID, "CLOCK_PROCESS_CPUTIME_ID" },
+    { CLOCK_THREAD_CPUTIME_ID, "CLOCK_THREAD_CPUTIME_ID" },
+};
+
+static volatile int stress_stop = 0;
+
+// keeps the timed loops from being optimized away
+static volatile long cost_sink;
+
+
+static unsigned long long
+nowNs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+
+static struct timespec
+toTimespec(unsigned long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / NSEC_PER_SEC;
+    ts.tv_nsec = ns % NSEC_PER_SEC;
+    return ts;
+}
+
+
+// cheapest batch average in nsec per call, the batches absorb preemptions
+static double
+callCost(clockid_t clock, bool viaSyscall)
+{
+    struct timespec ts;
+    unsigned long long start, elapsed, best = ~0ULL;
+    long sink = 0;
+    int batch, i;
+
+    for (batch = 0; batch < COST_BATCHES; batch++) {
+        start = nowNs(CLOCK_MONOTONIC_RAW);
+
+        if (viaSyscall) {
+            for (i = 0; i < COST_CALLS; i++) {
+                syscall(SYS_clock_gettime, clock, &ts);
+                sink += ts.tv_nsec;
+            }
+        } else {
+            for (i = 0; i < COST_CALLS; i++) {
+                clock_gettime(clock, &ts);
+                sink += ts.tv_nsec;
+            }
+        }
+
+        elapsed = nowNs(CLOCK_MONOTONIC_RAW) - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    cost_sink = sink;
+    return (double)best / COST_CALLS;
+}
+
+
+static void
+displayCost(void)
+{
+    struct timespec res;
+    unsigned int i;
+
+    printf("clock_gettime() cost, best of %d batches of %d calls\n", COST_BATCHES, COST_CALLS);
+    printf("%-26s %12s %10s %10s %s\n", "clock", "res nsec", "libc nsec", "sys nsec", "path");
+
+    for (i = 0; i < sizeof(clock_ids) / sizeof(clock_ids[0]); i++) {
+        double libc, sys;
+
+        if (clock_getres(clock_ids[i].clock, &res) == -1) {
+            printf("%-26s not supported\n", clock_ids[i].name);
+            continue;
+        }
+
+        libc = callCost(clock_ids[i].clock, false);
+        sys = callCost(clock_ids[i].clock, true);
+
+        // libc only beats the syscall when it reads the vDSO data page
+        printf("%-26s %12ld %10.1lf %10.1lf %s\n", clock_ids[i].name,
+                (long)res.tv_sec * 1000000000L + res.tv_nsec, libc, sys,
+                libc < sys / 2 ? "vDSO" : "syscall");
+    }
+}
+
+
+// background load in the style of a cyclictest run under stress: spin over a
+// buffer larger than the caches so the measuring thread sees both preemption
+// and cache pressure
+static void *
+stressThread(void *arg)
+{
+    unsigned char *buf;
+    unsigned long long sum = 0;
+    size_t i;
+
+    (void)arg;
+
+    if ((buf = malloc(STRESS_BYTES)) == NULL)
+        return NULL;
+
+    memset(buf, 1, STRESS_BYTES);
+
+    while (!stress_stop) {
+        for (i = 0; i < STRESS_BYTES; i += 64) {
+            buf[i]++;
+            sum += buf[i];
+        }
+    }
+
+    cost_sink = (long)sum;
+    free(buf);
+    return NULL;
+}
+
+
+static unsigned long long
+relativeWake(unsigned long long period_ns)
+{
+    struct timespec delay = toTimespec(period_ns);
+    unsigned long long start = nowNs(CLOCK_MONOTONIC);
+
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+        ;
+
+    return nowNs(CLOCK_MONOTONIC) - start - period_ns;
+}
+
+
+static unsigned long long
+absoluteWake(unsigned long long deadline_ns)
+{
+    struct timespec deadline = toTimespec(deadline_ns);
+    unsigned long long now;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+
+    now = nowNs(CLOCK_MONOTONIC);
+    return now > deadline_ns ? now - deadline_ns : 0;
+}
+
+
+// wake-up latency of both sleep calls for one period, in the calling thread's
+// policy; the relative sleep's drift is how far it falls behind the ideal
+// release over the whole run, which is what CLOCK_BIAS_NANOSEC corrects
+static void
+measureWake(unsigned long long period_ns, int loops, struct lat_hist *rel,
+            struct lat_hist *abs, long long *drift_ns)
+{
+    unsigned long long start, deadline;
+    int i;
+
+    lat_hist_reset(rel);
+    lat_hist_reset(abs);
+
+    start = nowNs(CLOCK_MONOTONIC);
+    for (i = 0; i < loops; i++)
+        lat_hist_add(rel, relativeWake(period_ns));
+    *drift_ns = (long long)(nowNs(CLOCK_MONOTONIC) - start) - (long long)(period_ns * loops);
+
+    deadline = nowNs(CLOCK_MONOTONIC);
+    for (i = 0; i < loops; i++) {
+        deadline += period_ns;
+        lat_hist_add(abs, absoluteWake(deadline));
+    }
+}
+
+
+static void
+displayHist(char *what, const struct lat_hist *h)
+{
+    printf("    %-16s min=%9.1lf avg=%9.1lf p50=%9.1lf p99=%9.1lf p99.9=%9.1lf max=%9.1lf usec\n", what,
+            h->min / 1000.0, lat_hist_mean(h) / 1000.0,
+            lat_hist_percentile(h, 50.0) / 1000.0, lat_hist_percentile(h, 99.0) / 1000.0,
+            lat_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+}
+
+
+static unsigned long long
+periodDistance(unsigned long long period_ns)
+{
+    return period_ns > RTSEQ_DELAY_NSEC ? period_ns - RTSEQ_DELAY_NSEC : RTSEQ_DELAY_NSEC - period_ns;
+}
+
+
+static int
+setPolicy(int policy)
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    if (policy == SCHED_FIFO)
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+
+    return pthread_setschedparam(pthread_self(), policy, &param);
+}
+
+
+static void
+displayWake(unsigned long long *period_ns, int periods, int loops, int stress)
+{
+    static const int policy[] = { SCHED_OTHER, SCHED_FIFO };
+    pthread_t stress_threads[MAX_STRESS];
+    struct lat_hist rel, abs, seq_rel;
+    unsigned long long seq_period = 0;
+    long long drift, seq_drift = 0;
+    int seq_policy = SCHED_OTHER, started = 0, p, i, rc;
+
+    // the background load is started first so it stays SCHED_OTHER
+    for (i = 0; i < stress; i++) {
+        if (pthread_create(&stress_threads[i], NULL, stressThread, NULL) != 0)
+            break;
+        started++;
+    }
+
+    printf("Wake-up latency past the requested time, %d background load thread%s\n",
+            started, started == 1 ? "" : "s");
+
+    for (p = 0; p < 2; p++) {
+        if ((rc = setPolicy(policy[p])) != 0) {
+            printf("\n%s: %s, skipped\n", policy[p] == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER", strerror(rc));
+            continue;
+        }
+
+        for (i = 0; i < periods; i++) {
+            int n = loops;
+
+            if (n == 0) {
+                n = (int)(RUN_NSEC / period_ns[i]);
+                n = n < MIN_LOOPS ? MIN_LOOPS : (n > MAX_LOOPS ? MAX_LOOPS : n);
+            }
+
+            measureWake(period_ns[i], n, &rel, &abs, &drift);
+
+            printf("\n%s, T=%.1lf msec, %d loops\n", policy[p] == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER",
+                    period_ns[i] / 1000000.0, n);
+            displayHist("nanosleep", &rel);
+            displayHist("clock_nanosleep", &abs);
+            printf("    nanosleep drift %.1lf usec over the run, %.2lf usec per period\n",
+                    drift / 1000.0, drift / 1000.0 / n);
+
+            // the sequencers run SCHED_FIFO, keep the run closest to theirs
+            if (seq_period == 0 || policy[p] != seq_policy ||
+                periodDistance(period_ns[i]) < periodDistance(seq_period)) {
+                seq_period = period_ns[i];
+                seq_policy = policy[p];
+                seq_rel = rel;
+                seq_drift = drift / n;
+            }
+        }
+    }
+
+    if (seq_period != 0) {
+        unsigned long long p50 = lat_hist_percentile(&seq_rel, 50.0);
+        unsigned long long p999 = lat_hist_percentile(&seq_rel, 99.9);
+
+        printf("\nFrom the %s nanosleep run at T=%.1lf msec (seqgen.h has T=%.1lf msec):\n",
+                seq_policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER",
+                seq_period / 1000000.0, RTSEQ_DELAY_NSEC / 1000000.0);
+        printf("    CLOCK_BIAS_NANOSEC             ~ %lld (mean overshoot per period, now %d)\n",
+                seq_drift < 0 ? 0 : seq_drift, CLOCK_BIAS_NANOSEC);
+        printf("    DT_SCALING_UNCERTAINTY_NANOSEC ~ %llu (p99.9 - p50 wake-up spread, now %d)\n",
+                p999 - p50, DT_SCALING_UNCERTAINTY_NANOSEC);
+    }
+
+    stress_stop = 1;
+    for (i = 0; i < started; i++)
+        pthread_join(stress_threads[i], NULL);
+
+    setPolicy(SCHED_OTHER);
+}
+
+
+static void
+usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-r] [-c] [-w] [-p usec]... [-n loops] [-s threads]\n"
+            "  -r        show clock resolutions with the readings\n"
+            "  -c        clock_gettime() cost per clock ID, vDSO and syscall\n"
+            "  -w        wake-up latency of nanosleep() and clock_nanosleep(TIMER_ABSTIME)\n"
+            "  -p usec   sleep period for -w, %d to %d, may be repeated (default 100, 1000, 10000)\n"
+            "  -n loops  sleeps per period and call (default about 1 sec worth)\n"
+            "  -s n      background load threads during -w\n",
+            prog, MIN_PERIOD_USEC, MAX_PERIOD_USEC);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned long long period_ns[MAX_PERIODS];
+    bool showRes = false, cost = false, wake = false;
+    int periods = 0, loops = 0, stress = 0, opt;
+    long usec;
+
+    while ((opt = getopt(argc, argv, "rcwp:n:s:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            showRes = true;
+            break;
+        case 'c':
+            cost = true;
+            break;
+        case 'w':
+            wake = true;
+            break;
+        case 'p':
+            usec = strtol(optarg, NULL, 0);
+            if (usec < MIN_PERIOD_USEC || usec > MAX_PERIOD_USEC || periods == MAX_PERIODS)
+                usage(argv[0]);
+            period_ns[periods++] = usec * NSEC_PER_USEC;
+            break;
+        case 'n':
+            if ((loops = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 's':
+            if ((stress = atoi(optarg)) < 0 || stress > MAX_STRESS)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // any other argument shows the resolutions, as it always did
+    if (optind < argc)
+        showRes = true;
+
+    if (periods == 0) {
+        period_ns[periods++] = 100 * NSEC_PER_USEC;
+        period_ns[periods++] = 1000 * NSEC_PER_USEC;
+        period_ns[periods++] = 10000 * NSEC_PER_USEC;
+    }
+
+    if (cost)
+        displayCost();
+
+    if (wake)
+        displayWake(period_ns, periods, loops, stress);
 
+    if (!cost && !wake)
+        displayLoops(showRes);
 
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,95 @@
+// Phase locked drift control for the sequencer period, see driftctl.h
+
+#include <string.h>
+
+#include "driftctl.h"
+
+
+void drift_ctl_init(struct drift_ctl *ctl, long long period_ns, double kp, double ki)
+{
+    memset(ctl, 0, sizeof(*ctl));
+
+    ctl->period_ns = period_ns;
+    ctl->kp = kp;
+    ctl->ki = ki;
+    ctl->delay_ns = period_ns;
+
+    lat_hist_reset(&ctl->phase);
+}
+
+
+long long drift_ctl_update(struct drift_ctl *ctl, unsigned long long wake_ns)
+{
+    long long period = ctl->period_ns;
+    long long err, skipped;
+    double corr;
+
+    ctl->updates++;
+
+    if(!ctl->locked)
+    {
+        ctl->locked = 1;
+        ctl->ideal_ns = wake_ns;
+        ctl->phase_err_ns = 0;
+        ctl->delay_ns = period;
+        return period;
+    }
+
+    ctl->ideal_ns += period;
+    err = (long long)(wake_ns - ctl->ideal_ns);
+
+    // whole periods lost (or a clock step), move the reference instead of
+    // releasing a burst to catch up
+    if((skipped = err / period) != 0)
+    {
+        ctl->ideal_ns += skipped * period;
+        ctl->slips += skipped < 0 ? -skipped : skipped;
+        err -= skipped * period;
+    }
+
+    ctl->phase_err_ns = err;
+    lat_hist_add(&ctl->phase, err < 0 ? -err : err);
+
+    // integrate first so a step in overshoot is answered in the same cycle
+    corr = ctl->kp * err + ctl->freq_corr_ns + ctl->ki * err;
+
+    if(corr > period / 2)
+    {
+        corr = period / 2;
+        ctl->saturations++;
+    }
+    else if(corr < -period / 2)
+    {
+        corr = -period / 2;
+        ctl->saturations++;
+    }
+    else
+        ctl->freq_corr_ns += ctl->ki * err;
+
+    ctl->delay_ns = period - (long long)corr;
+    return ctl->delay_ns;
+}
+
+
+double drift_ctl_ppm(const struct drift_ctl *ctl)
+{
+    return ctl->freq_corr_ns * 1000000.0 / (double)ctl->period_ns;
+}
+
+
+void drift_ctl_report(FILE *fp, const struct drift_ctl *ctl)
+{
+    const struct lat_hist *h = &ctl->phase;
+
+    fprintf(fp, "\nDrift control, T=%.3lf msec, kp=%.4lf, ki=%.4lf\n",
+            (double)ctl->period_ns / 1000000.0, ctl->kp, ctl->ki);
+    fprintf(fp, "    updates=%llu, slipped periods=%llu, saturated=%llu\n",
+            ctl->updates, ctl->slips, ctl->saturations);
+    fprintf(fp, "    frequency correction %.1lf nsec per period (%.1lf ppm), last phase error %lld nsec\n",
+            ctl->freq_corr_ns, drift_ctl_ppm(ctl), ctl->phase_err_ns);
+
+    if(h->count)
+        fprintf(fp, "    |phase error| avg=%.1lf p99=%.1lf p99.9=%.1lf max=%.1lf usec\n",
+                lat_hist_mean(h) / 1000.0, lat_hist_percentile(h, 99.0) / 1000.0,
+                lat_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+}
@@ -0,0 +1,67 @@
+#ifndef _DRIFTCTL_H_
+#define _DRIFTCTL_H_
+
+#include <stdio.h>
+
+#include "lathist.h"
+
+// Phase locked drift control for a sequencer that sleeps once per period
+//
+// The reference is absolute: release k is ideally at t0 + k * T, t0 being the
+// first wake-up.  Each wake-up reports its time to drift_ctl_update(), which
+// measures the phase error e = wake - ideal and returns how long to sleep
+// from now until the next release:
+//
+//   delay = T - (kp * e + F)        F += ki * e
+//
+// F is the frequency correction, it converges to the mean overshoot of a
+// sleep plus the loop's own overhead, so the long-run drift goes to zero
+// while kp pulls the phase back in.  With sleeps measured from the wake-up
+// the loop is a type 2 PLL, its characteristic polynomial is
+//
+//   z^2 + (kp + ki - 2) z + (1 - kp)
+//
+// which is stable for 0 < kp < 2, ki > 0, 2 kp + ki < 4, and free of ringing
+// (both roots real and positive) when (kp + ki - 2)^2 >= 4 (1 - kp) and
+// kp < 1.  The defaults kp = 1/2, ki = 1/16 put the roots at 0.85 and 0.59.
+//
+// The correction is clamped to half a period either way so the delay never
+// goes negative, the integrator holds while clamped (no wind-up).  A wake-up
+// a whole period or more late is a slip: the reference skips the lost
+// periods instead of the sequencer bursting releases to catch up.
+
+#define DRIFT_CTL_KP (0.5)
+#define DRIFT_CTL_KI (0.0625)
+
+struct drift_ctl
+{
+    long long period_ns;
+    double kp;
+    double ki;
+
+    int locked;                     // reference anchored at the first wake-up
+    unsigned long long ideal_ns;    // ideal time of the current release
+
+    // state, readable as metrics after every update
+    long long phase_err_ns;         // last wake-up minus its ideal time
+    double freq_corr_ns;            // integrator, correction per period
+    long long delay_ns;             // sleep returned by the last update
+
+    unsigned long long updates;
+    unsigned long long slips;       // periods skipped by late wake-ups
+    unsigned long long saturations; // updates with the correction clamped
+    struct lat_hist phase;          // |phase error| once locked
+};
+
+void drift_ctl_init(struct drift_ctl *ctl, long long period_ns, double kp, double ki);
+
+// wake_ns is the wake-up time on any monotonic nanosecond timeline, returns
+// the delay to the next release in nanoseconds
+long long drift_ctl_update(struct drift_ctl *ctl, unsigned long long wake_ns);
+
+// frequency correction expressed as parts per million of the period
+double drift_ctl_ppm(const struct drift_ctl *ctl);
+
+void drift_ctl_report(FILE *fp, const struct drift_ctl *ctl);
+
+#endif
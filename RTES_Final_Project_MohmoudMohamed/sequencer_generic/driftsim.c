@@ -0,0 +1,287 @@
+// driftsim - closed loop simulation of the sequencer drift control
+//
+// Runs drift_ctl (driftctl.h) against a model of the sequencer loop: each
+// cycle wakes, reads the clock, computes its delay, spends a fixed overhead
+// arming the timer and then wakes up late by an overshoot drawn from one of
+// several distributions:
+//
+//   constant      fixed 50 usec overshoot
+//   uniform       10 to 90 usec
+//   exponential   10 usec plus an exponential tail of mean 30 usec
+//   preempted     20 usec, 2% of the cycles 3 msec (a higher priority burst)
+//   stalled       20 usec, 0.1% of the cycles 25 msec (whole periods lost)
+//   rate          timer running 500 ppm slow plus 20 usec
+//   step          20 usec, then 200 usec from half way through
+//
+// Each scenario passes when, after the settling cycles, the loop is stable
+// and drift free:
+//
+//   - the mean phase error is within 1 usec of zero (no long-run drift)
+//   - |phase error| stays under a quarter period outside the disturbance
+//     cycles themselves and the correction never saturates
+//   - the constant case converges without ringing: at most one zero crossing
+//     and an undershoot under 10% of the initial error
+//
+// The seqgen.h constant correction (CLOCK_BIAS_NANOSEC and
+// DT_SCALING_UNCERTAINTY_NANOSEC) is run on the same overshoots for
+// comparison, its drift is printed but not judged.
+//
+// usage: driftsim [-n cycles] [-p kp] [-i ki] [-s seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "driftctl.h"
+#include "seqgen.h"
+
+#define PERIOD_NSEC (RTSEQ_DELAY_NSEC)
+#define OVERHEAD_NSEC (4000)
+#define SETTLE_CYCLES (200)
+#define DEFAULT_CYCLES (20000)
+
+#define MAX_MEAN_NSEC (1000.0)
+#define MAX_UNDERSHOOT (0.10)
+
+enum scenario
+{
+    CONSTANT = 0,
+    UNIFORM,
+    EXPONENTIAL,
+    PREEMPTED,
+    STALLED,
+    RATE,
+    STEP,
+    SCENARIOS
+};
+
+static const char *scenario_name[SCENARIOS] =
+{
+    "constant", "uniform", "exponential", "preempted", "stalled", "rate", "step"
+};
+
+struct sim_result
+{
+    double mean_ns;                 // mean phase error after settling
+    long long max_ns;               // max |phase error| after settling, disturbances excluded
+    long long drift_ns;             // last wake-up minus its ideal time, slipped periods excluded
+    double freq_ns;
+    unsigned long long slips;
+    unsigned long long saturations;
+    int crossings;                  // sign changes before settling within 1 usec
+    double undershoot;              // largest error opposite the first one, relative
+};
+
+static unsigned long long rng_state;
+
+
+static double uniform01(void)
+{
+    // xorshift64*, so a seed gives the same run on every machine
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return (double)((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+
+// overshoot of cycle k of n
+static long long overshoot(enum scenario sc, long long k, long long n)
+{
+    switch(sc)
+    {
+        case CONSTANT:
+            return 50000;
+
+        case UNIFORM:
+            return 10000 + (long long)(80000.0 * uniform01());
+
+        case EXPONENTIAL:
+            return 10000 + (long long)(-30000.0 * log(1.0 - uniform01()));
+
+        case PREEMPTED:
+            if(uniform01() < 0.02)
+                return 3000000;
+            return 20000;
+
+        case STALLED:
+            if(uniform01() < 0.001)
+                return 25000000;
+            return 20000;
+
+        case RATE:
+            return 20000;
+
+        case STEP:
+            return k < n / 2 ? 20000 : 200000;
+
+        default:
+            return 0;
+    }
+}
+
+
+// the delay seqgen.h's constants produced, from the last cycle's dt alone
+static long long legacy_delay(long long dt_ns)
+{
+    double scale_dt = (double)(dt_ns - PERIOD_NSEC) / NANOSEC_PER_SEC;
+    long long delay = PERIOD_NSEC - (long long)(scale_dt * (NANOSEC_PER_SEC + DT_SCALING_UNCERTAINTY_NANOSEC)) - CLOCK_BIAS_NANOSEC;
+
+    // a negative nanosleep fails with EINVAL, count it as no sleep
+    return delay < 0 ? 0 : delay;
+}
+
+
+static long long sleep_for(enum scenario sc, long long delay)
+{
+    return sc == RATE ? delay + delay / 2000 : delay;
+}
+
+
+static void run(enum scenario sc, long long n, double kp, double ki, unsigned long long seed,
+                struct sim_result *res, long long *legacy_drift)
+{
+    struct drift_ctl ctl;
+    unsigned long long wake = 1000000000ULL, t0 = wake, last_wake = wake;
+    long long k, delay, first = 0, peak = 0, last_slips = 0, settled_at = -1;
+    double sum = 0.0;
+    int sign = 0;
+
+    memset(res, 0, sizeof(*res));
+    drift_ctl_init(&ctl, PERIOD_NSEC, kp, ki);
+    rng_state = seed;
+
+    for(k = 0; k < n; k++)
+    {
+        delay = drift_ctl_update(&ctl, wake);
+
+        if(k > 0)
+        {
+            long long err = ctl.phase_err_ns;
+            long long abs_err = err < 0 ? -err : err;
+            int was_disturbed = (long long)ctl.slips != last_slips || abs_err > PERIOD_NSEC / 4;
+
+            // ringing is judged on the first error and what follows it
+            if(first == 0 && err != 0)
+            {
+                first = err;
+                sign = err > 0 ? 1 : -1;
+            }
+            else if(first != 0 && settled_at < 0)
+            {
+                if(abs_err <= 1000 && k > 1)
+                    settled_at = k;
+                else if((err > 0 ? 1 : -1) != sign && err != 0)
+                {
+                    res->crossings++;
+                    sign = -sign;
+                }
+            }
+
+            if(first != 0 && (err > 0) != (first > 0) && abs_err > peak)
+                peak = abs_err;
+
+            if(k >= SETTLE_CYCLES)
+            {
+                sum += (double)err;
+                if(!was_disturbed && abs_err > res->max_ns)
+                    res->max_ns = abs_err;
+            }
+        }
+
+        last_slips = (long long)ctl.slips;
+        last_wake = wake;
+        wake += OVERHEAD_NSEC + sleep_for(sc, delay) + overshoot(sc, k, n);
+    }
+
+    res->mean_ns = sum / (double)(n - SETTLE_CYCLES);
+    res->drift_ns = (long long)(last_wake - t0) - (n - 1 + (long long)ctl.slips) * PERIOD_NSEC;
+    res->freq_ns = ctl.freq_corr_ns;
+    res->slips = ctl.slips;
+    res->saturations = ctl.saturations;
+    res->undershoot = first != 0 ? (double)peak / (double)(first < 0 ? -first : first) : 0.0;
+
+    // the same overshoots through the seqgen.h correction
+    rng_state = seed;
+    wake = t0;
+    last_wake = t0 - PERIOD_NSEC;
+    for(k = 0; k < n; k++)
+    {
+        long long dt = (long long)(wake - last_wake);
+
+        last_wake = wake;
+        wake += OVERHEAD_NSEC + sleep_for(sc, legacy_delay(dt)) + overshoot(sc, k, n);
+    }
+    *legacy_drift = (long long)(last_wake - t0) - (n - 1) * PERIOD_NSEC;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n cycles] [-p kp] [-i ki] [-s seed]\n", prog);
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    double kp = DRIFT_CTL_KP, ki = DRIFT_CTL_KI, a1, a0, disc;
+    long long n = DEFAULT_CYCLES, legacy;
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+    struct sim_result res;
+    int opt, sc, failed = 0;
+
+    while((opt = getopt(argc, argv, "n:p:i:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': n = atoll(optarg); break;
+            case 'p': kp = atof(optarg); break;
+            case 'i': ki = atof(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0) | 1; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if(n <= 2 * SETTLE_CYCLES)
+        usage(argv[0]);
+
+    // roots of z^2 + a1 z + a0, see driftctl.h
+    a1 = kp + ki - 2.0;
+    a0 = 1.0 - kp;
+    disc = a1 * a1 - 4.0 * a0;
+
+    printf("kp=%.4lf ki=%.4lf T=%.1lf msec, %lld cycles\n", kp, ki, PERIOD_NSEC / 1000000.0, n);
+    if(disc >= 0.0)
+        printf("closed loop poles %.4lf and %.4lf\n", (-a1 + sqrt(disc)) / 2.0, (-a1 - sqrt(disc)) / 2.0);
+    else
+        printf("closed loop poles %.4lf +/- %.4lfi (|z|=%.4lf, rings)\n", -a1 / 2.0, sqrt(-disc) / 2.0, sqrt(a0));
+
+    printf("\n%-12s %10s %10s %10s %10s %6s %6s %6s %12s  %s\n", "overshoot", "mean usec", "max usec",
+           "drift usec", "freq usec", "slips", "sat", "cross", "seqgen.h ms", "result");
+
+    for(sc = 0; sc < SCENARIOS; sc++)
+    {
+        int ok;
+
+        run((enum scenario)sc, n, kp, ki, seed, &res, &legacy);
+
+        ok = fabs(res.mean_ns) < MAX_MEAN_NSEC && res.max_ns < PERIOD_NSEC / 4 && res.saturations == 0;
+
+        if(sc == CONSTANT)
+            ok = ok && res.crossings <= 1 && res.undershoot < MAX_UNDERSHOOT;
+
+        if(!ok)
+            failed++;
+
+        printf("%-12s %10.3lf %10.1lf %10.1lf %10.1lf %6llu %6llu %6d %12.1lf  %s\n", scenario_name[sc],
+               res.mean_ns / 1000.0, res.max_ns / 1000.0, res.drift_ns / 1000.0, res.freq_ns / 1000.0,
+               res.slips, res.saturations, res.crossings, legacy / 1000000.0, ok ? "PASS" : "FAIL");
+    }
+
+    printf("\n%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
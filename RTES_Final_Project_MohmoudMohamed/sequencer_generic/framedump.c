@@ -0,0 +1,323 @@
+// PGM/PPM frame dumps, see framedump.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "framedump.h"
+
+
+// header and pixels in one system call, the rest after a short write
+static int pwritev_all(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    ssize_t written;
+    int total = 0;
+
+    while(iovcnt > 0)
+    {
+        written = pwritev(fd, iov, iovcnt, offset);
+
+        if(written < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN)
+                continue;
+
+            return -1;
+        }
+
+        total += (int)written;
+        offset += written;
+
+        while(iovcnt > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (unsigned char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+
+    return total;
+}
+
+
+int frame_dump_header(char *header, size_t size, char magic, int width, int height, const struct timespec *time)
+{
+    return snprintf(header, size, "P%c\n#%010d sec %010d msec \n%d %d\n255\n",
+                    magic, (int)time->tv_sec, (int)((time->tv_nsec) / 1000000), width, height);
+}
+
+
+int frame_dump_fd(int fd, char magic, const void *p, int width, int height, const struct timespec *time)
+{
+    char header[FRAME_DUMP_HEADER_MAX];
+    struct iovec iov[2];
+    int header_len, total;
+
+    header_len = frame_dump_header(header, sizeof(header), magic, width, height, time);
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)header_len;
+    iov[1].iov_base = (void *)p;
+    iov[1].iov_len = (size_t)width * height * (magic == '6' ? 3 : 1);
+
+    if((total = pwritev_all(fd, iov, 2, 0)) < 0)
+        return -1;
+
+    return total - header_len;
+}
+
+
+static int dump_pnm(const char *path, char magic, const void *p, int width, int height, const struct timespec *time)
+{
+    int dumpfd, total, err;
+
+    dumpfd = open(path, O_WRONLY | O_NONBLOCK | O_CREAT | O_TRUNC, 0644);
+
+    if(dumpfd < 0)
+        return -1;
+
+    if((total = frame_dump_fd(dumpfd, magic, p, width, height, time)) < 0)
+    {
+        err = errno;
+        close(dumpfd);
+        errno = err;
+        return -1;
+    }
+
+    close(dumpfd);
+    return total;
+}
+
+
+int frame_dump_pgm(const char *path, const void *p, int width, int height, const struct timespec *time)
+{
+    return dump_pnm(path, '5', p, width, height, time);
+}
+
+
+int frame_dump_ppm(const char *path, const void *p, int width, int height, const struct timespec *time)
+{
+    return dump_pnm(path, '6', p, width, height, time);
+}
+
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+
+// the comment line padded so header and pixels end on a block boundary
+static int padded_header(char *header, char magic, int width, int height, const struct timespec *time,
+                         size_t payload)
+{
+    char tail[32];
+    int head_len, tail_len, len;
+
+    head_len = snprintf(header, FRAME_DUMP_HEADER_MAX, "P%c\n#%010d sec %010d msec ",
+                        magic, (int)time->tv_sec, (int)((time->tv_nsec) / 1000000));
+    tail_len = snprintf(tail, sizeof(tail), "\n%d %d\n255\n", width, height);
+
+    len = (int)(round_up((size_t)head_len + tail_len + payload, FRAME_DUMP_ALIGN) - payload);
+
+    memset(header + head_len, ' ', (size_t)(len - head_len - tail_len));
+    memcpy(header + len - tail_len, tail, (size_t)tail_len);
+
+    return len;
+}
+
+
+static int dump_direct(struct frame_dumper *d, int fd, char magic, const void *p, int width, int height,
+                       const struct timespec *time, size_t payload)
+{
+    struct iovec iov[2];
+    int header_len, total;
+
+    header_len = padded_header((char *)d->header, magic, width, height, time, payload);
+
+    // straight from the frame when it is aligned in memory and in the file
+    if(((uintptr_t)p % FRAME_DUMP_ALIGN) == 0 && header_len % FRAME_DUMP_ALIGN == 0)
+    {
+        iov[0].iov_base = d->header;
+        iov[0].iov_len = (size_t)header_len;
+        iov[1].iov_base = (void *)p;
+        iov[1].iov_len = payload;
+
+        total = pwritev_all(fd, iov, 2, 0);
+    }
+    else
+    {
+        memcpy(d->bounce, d->header, (size_t)header_len);
+        memcpy(d->bounce + header_len, p, payload);
+        d->bounced++;
+
+        iov[0].iov_base = d->bounce;
+        iov[0].iov_len = (size_t)header_len + payload;
+
+        total = pwritev_all(fd, iov, 1, 0);
+    }
+
+    return total < 0 ? -1 : total - header_len;
+}
+
+
+// waits for the previous file's writeback, which had a frame period to
+// finish, and drops its pages
+static void smooth_pending(struct frame_dumper *d)
+{
+    if(d->pending_fd < 0)
+        return;
+
+    sync_file_range(d->pending_fd, 0, 0,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(d->pending_fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(d->pending_fd);
+    d->pending_fd = -1;
+}
+
+
+static int dumper_pnm(struct frame_dumper *d, const char *path, char magic, const void *p, int width, int height,
+                      const struct timespec *time)
+{
+    size_t payload = (size_t)width * height * (magic == '6' ? 3 : 1);
+    int fd, total, err;
+
+    if(d->mode == FRAME_DUMP_BUFFERED)
+    {
+        if((total = dump_pnm(path, magic, p, width, height, time)) >= 0)
+            d->frames++;
+
+        return total;
+    }
+
+    if(payload > d->bounce_size - 2 * FRAME_DUMP_ALIGN)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if(d->mode == FRAME_DUMP_DIRECT)
+    {
+        if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644)) >= 0)
+        {
+            total = dump_direct(d, fd, magic, p, width, height, time, payload);
+            err = errno;
+            close(fd);
+
+            if(total >= 0 || err != EINVAL)
+            {
+                d->frames += total >= 0;
+                errno = err;
+                return total;
+            }
+        }
+        else if(errno != EINVAL)
+            return -1;
+
+        // the file system takes no O_DIRECT, this and later frames are smoothed
+        fprintf(stderr, "%s: no O_DIRECT here, smoothing writeback instead\n", path);
+        d->mode = FRAME_DUMP_SMOOTH;
+        d->fallbacks++;
+    }
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+
+    if((total = frame_dump_fd(fd, magic, p, width, height, time)) < 0)
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    // start this file on its way to the device, then settle the last one
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    smooth_pending(d);
+    d->pending_fd = fd;
+    d->frames++;
+
+    return total;
+}
+
+
+int frame_dumper_init(struct frame_dumper *d, enum frame_dump_mode mode, size_t max_bytes)
+{
+    memset(d, 0, sizeof(*d));
+    d->mode = mode;
+    d->pending_fd = -1;
+
+    // room for the padded header in front of the largest frame
+    d->bounce_size = round_up(max_bytes, FRAME_DUMP_ALIGN) + 2 * FRAME_DUMP_ALIGN;
+
+    if(posix_memalign((void **)&d->header, FRAME_DUMP_ALIGN, 2 * FRAME_DUMP_ALIGN) != 0 ||
+       posix_memalign((void **)&d->bounce, FRAME_DUMP_ALIGN, d->bounce_size) != 0)
+    {
+        fprintf(stderr, "frame dumper: no memory for %zu byte frames\n", max_bytes);
+        free(d->header);
+        return -1;
+    }
+
+    // fault the buffers in now rather than on the first frames
+    memset(d->header, 0, 2 * FRAME_DUMP_ALIGN);
+    memset(d->bounce, 0, d->bounce_size);
+
+    return 0;
+}
+
+
+void frame_dumper_free(struct frame_dumper *d)
+{
+    smooth_pending(d);
+    free(d->header);
+    free(d->bounce);
+    d->header = d->bounce = NULL;
+}
+
+
+int frame_dumper_pgm(struct frame_dumper *d, const char *path, const void *p, int width, int height,
+                     const struct timespec *time)
+{
+    return dumper_pnm(d, path, '5', p, width, height, time);
+}
+
+
+int frame_dumper_ppm(struct frame_dumper *d, const char *path, const void *p, int width, int height,
+                     const struct timespec *time)
+{
+    return dumper_pnm(d, path, '6', p, width, height, time);
+}
+
+
+static const char *mode_name[] = { "buffered", "direct", "smooth" };
+
+
+int frame_dump_mode_parse(const char *name)
+{
+    int i;
+
+    for(i = 0; i < (int)(sizeof(mode_name) / sizeof(mode_name[0])); i++)
+        if(strcmp(name, mode_name[i]) == 0)
+            return i;
+
+    return -1;
+}
+
+
+const char *frame_dump_mode_name(enum frame_dump_mode mode)
+{
+    return (unsigned int)mode < sizeof(mode_name) / sizeof(mode_name[0]) ? mode_name[mode] : "unknown";
+}
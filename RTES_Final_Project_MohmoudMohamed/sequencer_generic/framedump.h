@@ -0,0 +1,88 @@
+#ifndef _FRAMEDUMP_H_
+#define _FRAMEDUMP_H_
+
+#include <stddef.h>
+#include <time.h>
+
+// Write one frame as a binary PGM (gray) or PPM (RGB24) image
+//
+// The header carries the frame time stamp in the comment line the way the
+// capture programs have always written it,
+//
+//   P5
+//   #0000001234 sec 0000000567 msec
+//   640 480
+//   255
+//
+// so recorded frames can be replayed with their original timing.  Returns
+// the number of pixel bytes written, -1 with errno set on failure.
+//
+// Nothing is shared between calls: the header is built in the caller's
+// buffer (on the stack for the dumps) and written with the pixels in one
+// pwritev(), so any number of threads may dump frames at once, each into
+// its own files.
+
+#define FRAME_DUMP_HEADER_MAX (64)
+
+int frame_dump_pgm(const char *path, const void *p, int width, int height, const struct timespec *time);
+int frame_dump_ppm(const char *path, const void *p, int width, int height, const struct timespec *time);
+
+// magic '5' for PGM or '6' for PPM, returns the header length
+int frame_dump_header(char *header, size_t size, char magic, int width, int height, const struct timespec *time);
+
+// the whole image from offset 0 of a file the caller opened
+int frame_dump_fd(int fd, char magic, const void *p, int width, int height, const struct timespec *time);
+
+// A frame dumper stores frames in one of three ways:
+//
+//   buffered  through the page cache, as frame_dump_pgm() does
+//   direct    O_DIRECT, bypassing the page cache, so a long run never builds
+//             up the dirty pages whose writeback stalls the capture loop.
+//             The comment line of the header is padded with spaces so
+//             header and pixels fill whole FRAME_DUMP_ALIGN blocks, pixels
+//             that are not block aligned in memory are copied to an aligned
+//             buffer first.
+//   smooth    through the page cache, but each file's writeback is started
+//             with sync_file_range() right after it is written and waited
+//             for (and its pages dropped) before the next file, so there are
+//             never more than two frames dirty.  For file systems without
+//             O_DIRECT, which direct falls back to.
+//
+// A dumper and its buffers belong to one thread, give each writer its own.
+
+#define FRAME_DUMP_ALIGN (4096)
+
+enum frame_dump_mode
+{
+    FRAME_DUMP_BUFFERED = 0,
+    FRAME_DUMP_DIRECT,
+    FRAME_DUMP_SMOOTH
+};
+
+struct frame_dumper
+{
+    enum frame_dump_mode mode;
+    unsigned char *header;              // FRAME_DUMP_ALIGN aligned, two blocks
+    unsigned char *bounce;              // aligned copy of unaligned frames
+    size_t bounce_size;
+    int pending_fd;                     // smooth: last file, still being written back
+
+    unsigned long long frames;
+    unsigned long long bounced;         // direct: frames copied to the bounce buffer
+    unsigned long long fallbacks;       // direct: O_DIRECT refused, smooth instead
+};
+
+// max_bytes is the largest frame (pixels only) that will be dumped
+int frame_dumper_init(struct frame_dumper *d, enum frame_dump_mode mode, size_t max_bytes);
+void frame_dumper_free(struct frame_dumper *d);
+
+int frame_dumper_pgm(struct frame_dumper *d, const char *path, const void *p, int width, int height,
+                     const struct timespec *time);
+int frame_dumper_ppm(struct frame_dumper *d, const char *path, const void *p, int width, int height,
+                     const struct timespec *time);
+
+// "buffered", "direct" or "smooth", -1 for anything else
+int frame_dump_mode_parse(const char *name);
+const char *frame_dump_mode_name(enum frame_dump_mode mode);
+
+#endif
@@ -0,0 +1,276 @@
+// Pool of worker threads encoding frames to QOI files, see frameencode.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "frameencode.h"
+#include "qoi.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+
+
+static unsigned long long cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static int write_file(const char *path, const unsigned char *data, size_t size)
+{
+    ssize_t n;
+    int fd, rc = 0;
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+
+    while(size > 0)
+    {
+        if((n = write(fd, data, size)) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            rc = -1;
+            break;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+
+    if(close(fd) < 0)
+        rc = -1;
+
+    return rc;
+}
+
+
+static void *worker_thread(void *arg)
+{
+    struct frame_encoder_worker *wk = arg;
+    struct frame_encoder *e = wk->e;
+    struct frame_encoder_job job;
+    unsigned long long start, took;
+    size_t size;
+    int rc;
+
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+
+    pthread_mutex_lock(&e->lock);
+
+    for(;;)
+    {
+        while(e->count == 0 && !e->stop)
+            pthread_cond_wait(&e->ready, &e->lock);
+
+        if(e->count == 0)
+            break;
+
+        job = e->job[e->head];
+        e->head = (e->head + 1) % FRAME_POOL_MAX_SLOTS;
+        e->count--;
+
+        pthread_mutex_unlock(&e->lock);
+
+        start = cpu_ns();
+        size = qoi_encode(job.frame, e->width, e->height, e->bytes_per_pixel, wk->out);
+        took = cpu_ns() - start;
+
+        // the slot is free once encoded, the write works from the worker's buffer
+        frame_pool_put(&e->pool, job.frame);
+        rc = write_file(job.path, wk->out, size);
+
+        pthread_mutex_lock(&e->lock);
+
+        wk->frames++;
+        wk->cpu_ns += took;
+        wk->bytes += size;
+
+        if(rc < 0 && e->failed++ == 0)
+            fprintf(stderr, "frame encoder %s: %s\n", job.path, strerror(errno));
+    }
+
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+
+int frame_encoder_start(struct frame_encoder *e, int width, int height, int bytes_per_pixel, unsigned int slots,
+                        unsigned int threads, int rt_core)
+{
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN), i, rc;
+    struct sched_param param;
+    pthread_attr_t attr;
+    cpu_set_t cpu;
+
+    if(threads < 1 || threads > FRAME_ENCODER_MAX_THREADS)
+    {
+        fprintf(stderr, "frame encoder: 1 to %d threads, not %u\n", FRAME_ENCODER_MAX_THREADS, threads);
+        return -1;
+    }
+
+    memset(e, 0, sizeof(*e));
+    e->width = width;
+    e->height = height;
+    e->bytes_per_pixel = bytes_per_pixel;
+    e->frame_bytes = (size_t)width * height * bytes_per_pixel;
+
+    if(frame_pool_init(&e->pool, slots, e->frame_bytes) < 0)
+        return -1;
+
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->ready, NULL);
+
+    // threads would inherit SCHED_FIFO from an RT creator
+    pthread_attr_init(&attr);
+    param.sched_priority = 0;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+
+    if(cores > 1 && rt_core >= 0 && rt_core < cores)
+    {
+        CPU_ZERO(&cpu);
+        for(i = 0; i < cores; i++)
+            if(i != rt_core)
+                CPU_SET(i, &cpu);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+    }
+
+    for(e->threads = 0; e->threads < threads; e->threads++)
+    {
+        struct frame_encoder_worker *wk = &e->worker[e->threads];
+
+        wk->e = e;
+        if((wk->out = malloc(qoi_max_size(width, height))) == NULL)
+        {
+            perror("frame encoder buffer");
+            break;
+        }
+
+        if((rc = pthread_create(&wk->thread, &attr, worker_thread, wk)) != 0)
+        {
+            fprintf(stderr, "frame encoder thread: %s\n", strerror(rc));
+            free(wk->out);
+            break;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if(e->threads < threads)
+    {
+        frame_encoder_stop(e);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void frame_encoder_stop(struct frame_encoder *e)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&e->lock);
+    e->stop = 1;
+    pthread_cond_broadcast(&e->ready);
+    pthread_mutex_unlock(&e->lock);
+
+    for(i = 0; i < e->threads; i++)
+    {
+        pthread_join(e->worker[i].thread, NULL);
+        free(e->worker[i].out);
+        e->worker[i].out = NULL;
+    }
+
+    pthread_cond_destroy(&e->ready);
+    pthread_mutex_destroy(&e->lock);
+    frame_pool_free(&e->pool);
+}
+
+
+int frame_encoder_put(struct frame_encoder *e, const char *path, const void *frame)
+{
+    struct frame_encoder_job *job;
+    unsigned char *slot;
+
+    // a truncated name would store the frame somewhere else
+    if(strlen(path) >= FRAME_ENCODER_PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if((slot = frame_pool_get(&e->pool)) == NULL)
+    {
+        __atomic_add_fetch(&e->dropped, 1, __ATOMIC_RELAXED);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy(slot, frame, e->frame_bytes);
+
+    pthread_mutex_lock(&e->lock);
+
+    // never full, there are no more jobs than pool slots
+    job = &e->job[(e->head + e->count) % FRAME_POOL_MAX_SLOTS];
+    job->frame = slot;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    e->queued++;
+
+    if(++e->count > e->max_queued)
+        e->max_queued = e->count;
+
+    pthread_cond_signal(&e->ready);
+    pthread_mutex_unlock(&e->lock);
+
+    return 0;
+}
+
+
+void frame_encoder_report(const struct frame_encoder *e, FILE *fp)
+{
+    const struct frame_encoder_worker *wk;
+    unsigned long long frames = 0, cpu = 0, bytes = 0;
+    double fps;
+    unsigned int i;
+
+    fprintf(fp, "\nQOI encoding of %d x %d %s frames, %u workers, %u slots on %s\n", e->width, e->height,
+            e->bytes_per_pixel == 3 ? "RGB" : "gray", e->threads, e->pool.slots, frame_pool_backing_name(&e->pool));
+
+    for(i = 0; i < e->threads; i++)
+    {
+        wk = &e->worker[i];
+        frames += wk->frames;
+        cpu += wk->cpu_ns;
+        bytes += wk->bytes;
+
+        if(wk->frames > 0)
+            fprintf(fp, "    worker %u   %llu frames, %.2lf ms each, %.1lf frames/s a core\n", i, wk->frames,
+                    wk->cpu_ns / 1e6 / wk->frames, wk->frames * 1e9 / wk->cpu_ns);
+    }
+
+    fprintf(fp, "    frames     queued=%llu encoded=%llu dropped=%llu failed=%llu max queued=%u\n", e->queued, frames,
+            e->dropped, e->failed, e->max_queued);
+
+    if(frames > 0 && cpu > 0)
+    {
+        fps = frames * 1e9 / cpu;
+        fprintf(fp, "    size       %.1lf kB a frame, %.2lf:1 against %s\n", bytes / 1e3 / frames,
+                (double)e->frame_bytes * frames / bytes, e->bytes_per_pixel == 3 ? "PPM" : "PGM");
+        fprintf(fp, "    throughput %.1lf frames/s a core, 10 Hz needs %.2lf cores, 30 Hz %.2lf\n", fps, 10.0 / fps,
+                30.0 / fps);
+    }
+}
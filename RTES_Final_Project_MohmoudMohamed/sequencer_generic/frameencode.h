@@ -0,0 +1,83 @@
+#ifndef _FRAMEENCODE_H_
+#define _FRAMEENCODE_H_
+
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "framepool.h"
+
+// Pool of worker threads encoding frames to QOI files
+//
+// frame_encoder_put() copies a frame into a slot of a frame pool and queues
+// it with the path it is to be stored under; the capture side pays for the
+// copy only.  Worker threads at normal priority, niced and kept off the
+// real time core, take the frames in order, encode them (see qoi.h) into a
+// buffer of their own and write the file.  With several workers frames are
+// finished out of order, the file names the caller gives them keep the
+// frame order.  When every slot is still waiting, the frame is dropped
+// rather than stalling capture.
+//
+// Each worker times its encodes on its own CPU clock, so the report gives
+// the frames a second one core encodes at this frame size and the cores a
+// capture rate needs, whatever else shares the core.
+
+#define FRAME_ENCODER_MAX_THREADS (8)
+#define FRAME_ENCODER_PATH_MAX (PATH_MAX)
+
+struct frame_encoder_job
+{
+    unsigned char *frame;
+    char path[FRAME_ENCODER_PATH_MAX];
+};
+
+struct frame_encoder_worker
+{
+    struct frame_encoder *e;
+    pthread_t thread;
+    unsigned char *out;                 // qoi_max_size() bytes
+
+    unsigned long long frames;
+    unsigned long long cpu_ns;          // encoding only, thread CPU time
+    unsigned long long bytes;           // encoded
+};
+
+struct frame_encoder
+{
+    int width;
+    int height;
+    int bytes_per_pixel;                // 1 gray, 3 RGB
+    size_t frame_bytes;
+
+    struct frame_pool pool;
+
+    struct frame_encoder_worker worker[FRAME_ENCODER_MAX_THREADS];
+    unsigned int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct frame_encoder_job job[FRAME_POOL_MAX_SLOTS];
+    unsigned int head, count;
+    int stop;
+
+    unsigned long long queued;
+    unsigned long long dropped;
+    unsigned long long failed;
+    unsigned int max_queued;
+};
+
+// the workers run on every core but rt_core, on all of them with one core
+// or rt_core < 0
+int frame_encoder_start(struct frame_encoder *e, int width, int height, int bytes_per_pixel, unsigned int slots,
+                        unsigned int threads, int rt_core);
+
+// encodes everything queued, then stops the workers and frees the slots
+void frame_encoder_stop(struct frame_encoder *e);
+
+// copies the frame in; -1 with errno ENOBUFS when it was dropped, or
+// ENAMETOOLONG when the path does not fit FRAME_ENCODER_PATH_MAX
+int frame_encoder_put(struct frame_encoder *e, const char *path, const void *frame);
+
+// per worker and total encode throughput, with the cores 10 and 30 Hz need
+void frame_encoder_report(const struct frame_encoder *e, FILE *fp);
+
+#endif
@@ -0,0 +1,158 @@
+// Pool of fixed size frame buffers, see framepool.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "framepool.h"
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+#define HEAD_INDEX(head) ((unsigned int)((head) & 0xffffffffULL))
+#define HEAD_COUNT(head) ((head) >> 32)
+#define HEAD(count, index) (((unsigned long long)(count) << 32) | (index))
+
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+
+static void *map_storage(struct frame_pool *pool, size_t size)
+{
+    void *p;
+
+#ifdef MAP_HUGETLB
+    pool->map_size = round_up(size, HUGE_PAGE_SIZE);
+    p = mmap(NULL, pool->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED)
+    {
+        pool->backing = FRAME_POOL_HUGETLB;
+        return p;
+    }
+#endif
+
+    pool->map_size = size;
+    p = mmap(NULL, pool->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        return NULL;
+
+    pool->backing = FRAME_POOL_PAGES;
+
+#ifdef MADV_HUGEPAGE
+    if(size >= HUGE_PAGE_SIZE && madvise(p, pool->map_size, MADV_HUGEPAGE) == 0)
+        pool->backing = FRAME_POOL_THP;
+#endif
+
+    return p;
+}
+
+
+int frame_pool_init(struct frame_pool *pool, unsigned int slots, size_t slot_size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned int i;
+
+    memset(pool, 0, sizeof(*pool));
+
+    if(slots == 0 || slots > FRAME_POOL_MAX_SLOTS || slot_size == 0)
+    {
+        fprintf(stderr, "frame pool: %u slots of %zu bytes not supported\n", slots, slot_size);
+        return -1;
+    }
+
+    pool->slots = slots;
+    pool->slot_size = round_up(slot_size, page);
+
+    if((pool->storage = map_storage(pool, pool->slots * pool->slot_size)) == NULL)
+    {
+        perror("frame pool mmap");
+        return -1;
+    }
+
+    // fault every page in now rather than on the first frame
+    memset(pool->storage, 0, pool->slots * pool->slot_size);
+
+    for(i = 0; i < slots; i++)
+        pool->next[i] = i + 1 < slots ? i + 2 : 0;
+
+    pool->head = HEAD(0, 1);
+    return 0;
+}
+
+
+void frame_pool_free(struct frame_pool *pool)
+{
+    if(pool->storage)
+        munmap(pool->storage, pool->map_size);
+
+    pool->storage = NULL;
+    pool->head = 0;
+}
+
+
+void *frame_pool_get(struct frame_pool *pool)
+{
+    unsigned long long head, next;
+    unsigned int idx, used;
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+
+    do
+    {
+        if((idx = HEAD_INDEX(head)) == 0)
+        {
+            __atomic_add_fetch(&pool->exhausted, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        next = HEAD(HEAD_COUNT(head) + 1, __atomic_load_n(&pool->next[idx - 1], __ATOMIC_RELAXED));
+
+    } while(!__atomic_compare_exchange_n(&pool->head, &head, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    // high water mark, only a statistic so a lost race is harmless
+    used = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+    if(used > pool->max_in_use)
+        pool->max_in_use = used;
+
+    return pool->storage + (size_t)(idx - 1) * pool->slot_size;
+}
+
+
+void frame_pool_put(struct frame_pool *pool, void *slot)
+{
+    unsigned long long head, next;
+    unsigned int idx;
+
+    if(slot == NULL)
+        return;
+
+    idx = (unsigned int)(((unsigned char *)slot - pool->storage) / pool->slot_size) + 1;
+
+    // before the push, so in_use never counts a slot twice
+    __atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+
+    do
+    {
+        __atomic_store_n(&pool->next[idx - 1], HEAD_INDEX(head), __ATOMIC_RELAXED);
+        next = HEAD(HEAD_COUNT(head) + 1, idx);
+
+    } while(!__atomic_compare_exchange_n(&pool->head, &head, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+const char *frame_pool_backing_name(const struct frame_pool *pool)
+{
+    switch(pool->backing)
+    {
+        case FRAME_POOL_HUGETLB: return "hugetlb";
+        case FRAME_POOL_THP: return "transparent huge pages";
+        default: return "pages";
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+
+#include <stddef.h>
+
+// Pool of fixed size frame buffers for the per-frame working stages
+//
+// All slots are mapped once by frame_pool_init(), sized from the negotiated
+// format, and every slot starts on a page boundary.  The mapping is backed by
+// huge pages when the kernel has some reserved (MAP_HUGETLB), otherwise it
+// asks for transparent huge pages (MADV_HUGEPAGE) and falls back to normal
+// pages.  The slots are written once so none faults in the frame loop.
+//
+// frame_pool_get() and frame_pool_put() are O(1) and lock-free: the free
+// slots form a Treiber stack whose head carries a change count next to the
+// slot index, so a compare and swap cannot succeed on a head that was popped
+// and pushed back in between (ABA).  Any thread may get or put, a slot must
+// be put back into the pool it came from.
+
+#define FRAME_POOL_MAX_SLOTS (64)
+
+enum frame_pool_backing
+{
+    FRAME_POOL_PAGES = 0,
+    FRAME_POOL_THP,                 // transparent huge pages requested
+    FRAME_POOL_HUGETLB              // reserved huge pages
+};
+
+struct frame_pool
+{
+    unsigned int slots;
+    size_t slot_size;               // requested size rounded up to a page
+
+    unsigned char *storage;
+    size_t map_size;
+    enum frame_pool_backing backing;
+
+    // head: change count << 32 | slot index + 1, 0 when empty
+    unsigned long long head;
+    unsigned int next[FRAME_POOL_MAX_SLOTS];
+    unsigned int in_use;
+    unsigned int max_in_use;
+    unsigned long long exhausted;   // gets that found the pool empty
+};
+
+int frame_pool_init(struct frame_pool *pool, unsigned int slots, size_t slot_size);
+void frame_pool_free(struct frame_pool *pool);
+
+// NULL when every slot is in use
+void *frame_pool_get(struct frame_pool *pool);
+void frame_pool_put(struct frame_pool *pool, void *slot);
+
+const char *frame_pool_backing_name(const struct frame_pool *pool);
+
+#endif
@@ -0,0 +1,77 @@
+// Ring of saved frame copies, see framering.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framering.h"
+
+
+int frame_ring_init(struct frame_ring *ring, unsigned int slots, size_t frame_size)
+{
+    unsigned int i;
+
+    memset(ring, 0, sizeof(*ring));
+
+    if(slots == 0 || slots > FRAME_RING_MAX_SLOTS)
+    {
+        fprintf(stderr, "frame ring of %u slots, at most %d supported\n", slots, FRAME_RING_MAX_SLOTS);
+        return -1;
+    }
+
+    if((ring->storage = malloc(slots * frame_size)) == NULL)
+    {
+        perror("frame ring");
+        return -1;
+    }
+
+    ring->ring_size = slots;
+    ring->frame_size = frame_size;
+
+    for(i = 0; i < slots; i++)
+    {
+        ring->slot[i].frame = ring->storage + i * frame_size;
+        ring->slot[i].frame_num = -1;
+    }
+
+    return 0;
+}
+
+
+void frame_ring_free(struct frame_ring *ring)
+{
+    free(ring->storage);
+    memset(ring, 0, sizeof(*ring));
+}
+
+
+struct frame_ring_slot *frame_ring_push(struct frame_ring *ring, const void *frame, size_t bytes, int frame_num)
+{
+    struct frame_ring_slot *slot = &ring->slot[ring->tail_idx];
+
+    if(bytes > ring->frame_size)
+        bytes = ring->frame_size;
+
+    memcpy(slot->frame, frame, bytes);
+    slot->bytes = bytes;
+    slot->frame_num = frame_num;
+    clock_gettime(CLOCK_MONOTONIC, &slot->time_stamp);
+
+    ring->tail_idx = (ring->tail_idx + 1) % ring->ring_size;
+    ring->count++;
+
+    return slot;
+}
+
+
+struct frame_ring_slot *frame_ring_peek(struct frame_ring *ring, int offset)
+{
+    return &ring->slot[(ring->head_idx + offset) % ring->ring_size];
+}
+
+
+void frame_ring_advance(struct frame_ring *ring, int n)
+{
+    ring->head_idx = (ring->head_idx + n) % ring->ring_size;
+    ring->count -= n;
+}
@@ -0,0 +1,50 @@
+#ifndef _FRAMERING_H_
+#define _FRAMERING_H_
+
+#include <stddef.h>
+#include <time.h>
+
+// Ring of saved frame copies between acquisition and processing
+//
+// The acquisition side copies each frame it reads in at the tail, the
+// processing side looks at a frame some distance past the head and then
+// advances the head past the frames it consumed or skipped.  Storage for all
+// slots is allocated once by frame_ring_init(), nothing is allocated per
+// frame.  There is no locking, one thread pushes and one advances the head.
+
+#define FRAME_RING_MAX_SLOTS (64)
+
+struct frame_ring_slot
+{
+    unsigned char  *frame;
+    size_t          bytes;
+    struct timespec time_stamp;
+    int             frame_num;
+};
+
+struct frame_ring
+{
+    unsigned int ring_size;
+
+    int tail_idx;
+    int head_idx;
+    int count;
+
+    size_t frame_size;
+    unsigned char *storage;
+    struct frame_ring_slot slot[FRAME_RING_MAX_SLOTS];
+};
+
+int frame_ring_init(struct frame_ring *ring, unsigned int slots, size_t frame_size);
+void frame_ring_free(struct frame_ring *ring);
+
+// copy a frame in at the tail, frames larger than the slot are truncated
+struct frame_ring_slot *frame_ring_push(struct frame_ring *ring, const void *frame, size_t bytes, int frame_num);
+
+// slot offset frames past the head
+struct frame_ring_slot *frame_ring_peek(struct frame_ring *ring, int offset);
+
+// consume n frames at the head
+void frame_ring_advance(struct frame_ring *ring, int n);
+
+#endif
@@ -0,0 +1,305 @@
+// framerx - receiver for the frames sent by frametx.c
+//
+// Listens for a sender, one connection at a time, reads every frame header
+// and payload (see frametx.h) and prints once a second and at the end
+//
+//   throughput  - frames/s and MB/s of payload
+//   latency     - capture time stamp to complete receipt on CLOCK_MONOTONIC,
+//                 only meaningful with the sender on this host (loopback),
+//                 and sender start to complete receipt on CLOCK_REALTIME,
+//                 across hosts when their clocks are synchronized
+//
+// With --dir every payload is saved as DIR/rxNNNNNNNN.pgm or .ppm under the
+// sender's frame number.  The receiver exits after --count frames (0 runs
+// until interrupted) and with --once when the first sender disconnects.
+//
+// usage: framerx [--port N] [--count frames] [--dir frames] [--once]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "frametx.h"
+#include "lathist.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define MAX_PAYLOAD (64 * 1024 * 1024)
+
+static volatile sig_atomic_t interrupted = 0;
+
+static struct lat_hist capture_latency;
+static struct lat_hist send_latency;
+static unsigned long long frames = 0, bytes = 0, lost = 0;
+static unsigned long long next_frame_num = 0;
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+
+static unsigned long long clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// 1 when all len bytes arrived, 0 on a clean close before the first, -1 otherwise
+static int recv_all(int sock, void *buf, size_t len)
+{
+    char *p = buf;
+    size_t got = 0;
+    ssize_t n;
+
+    while(got < len)
+    {
+        if((n = recv(sock, p + got, len - got, 0)) < 0)
+        {
+            if(errno == EINTR && !interrupted)
+                continue;
+
+            return -1;
+        }
+
+        if(n == 0)
+            return got == 0 ? 0 : -1;
+
+        got += (size_t)n;
+    }
+
+    return 1;
+}
+
+
+static void save(const char *dir, unsigned long long frame_num, const unsigned char *payload, size_t size)
+{
+    char path[512];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/rx%08llu.%s", dir, frame_num,
+             size > 1 && payload[0] == 'P' && payload[1] == '6' ? "ppm" : "pgm");
+
+    if((fp = fopen(path, "wb")) == NULL || fwrite(payload, 1, size, fp) != size)
+        perror(path);
+
+    if(fp)
+        fclose(fp);
+}
+
+
+static void report(FILE *fp, const char *what, unsigned long long n, unsigned long long nbytes, double seconds)
+{
+    fprintf(fp, "%-8s %8llu frames %9.2lf frames/s %9.2lf MB/s", what, n, seconds > 0.0 ? n / seconds : 0.0,
+            seconds > 0.0 ? nbytes / seconds / 1e6 : 0.0);
+
+    if(capture_latency.count > 0)
+        fprintf(fp, "  capture->rx p50=%.1lf p99=%.1lf max=%.1lf us",
+                lat_hist_percentile(&capture_latency, 50.0) / 1000.0,
+                lat_hist_percentile(&capture_latency, 99.0) / 1000.0, capture_latency.max / 1000.0);
+
+    if(send_latency.count > 0)
+        fprintf(fp, "  send->rx p50=%.1lf us", lat_hist_percentile(&send_latency, 50.0) / 1000.0);
+
+    fprintf(fp, "\n");
+}
+
+
+// frames of one connection, -1 when the receiver should stop
+static int serve(int sock, const char *dir, unsigned long long count)
+{
+    static unsigned char *payload = NULL;
+    static size_t payload_max = 0;
+    unsigned long long second_start = clock_ns(CLOCK_MONOTONIC), second_frames = 0, second_bytes = 0;
+    unsigned long long now, frame_num, capture_ns, send_ns;
+    struct frame_tx_header header;
+    uint32_t size;
+    int rc;
+
+    while(!interrupted && (count == 0 || frames < count))
+    {
+        if((rc = recv_all(sock, &header, sizeof(header))) <= 0)
+            return rc;
+
+        if(ntohl(header.magic) != FRAME_TX_MAGIC || ntohl(header.header_size) != sizeof(header))
+        {
+            fprintf(stderr, "not a frame header, dropping the connection\n");
+            return 0;
+        }
+
+        if((size = ntohl(header.payload_size)) > MAX_PAYLOAD)
+        {
+            fprintf(stderr, "frame of %u bytes too large, dropping the connection\n", size);
+            return 0;
+        }
+
+        if(size > payload_max)
+        {
+            free(payload);
+            if((payload = malloc(size)) == NULL)
+            {
+                payload_max = 0;
+                return -1;
+            }
+            payload_max = size;
+        }
+
+        if(recv_all(sock, payload, size) <= 0)
+            return size == 0 ? 0 : -1;
+
+        now = clock_ns(CLOCK_MONOTONIC);
+        frame_num = be64toh(header.frame_num);
+        capture_ns = be64toh(header.capture_ns);
+        send_ns = be64toh(header.send_ns);
+
+        if(capture_ns > 0 && capture_ns <= now)
+            lat_hist_add(&capture_latency, now - capture_ns);
+
+        if(send_ns <= clock_ns(CLOCK_REALTIME))
+            lat_hist_add(&send_latency, clock_ns(CLOCK_REALTIME) - send_ns);
+
+        // the sender drops frames when it falls behind
+        if(frames > 0 && frame_num > next_frame_num)
+            lost += frame_num - next_frame_num;
+        next_frame_num = frame_num + 1;
+
+        if(dir)
+            save(dir, frame_num, payload, size);
+
+        frames++;
+        bytes += size;
+        second_frames++;
+        second_bytes += size;
+
+        if(now - second_start >= NSEC_PER_SEC)
+        {
+            report(stdout, "second", second_frames, second_bytes, (double)(now - second_start) / NSEC_PER_SEC);
+            fflush(stdout);
+            second_start = now;
+            second_frames = second_bytes = 0;
+        }
+    }
+
+    return -1;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--port N] [--count frames] [--dir frames] [--once]\n", prog);
+    fprintf(stderr, "  default port %d, count 0 runs until interrupted\n", FRAME_TX_PORT);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "port",  required_argument, NULL, 'p' },
+        { "count", required_argument, NULL, 'c' },
+        { "dir",   required_argument, NULL, 'D' },
+        { "once",  no_argument,       NULL, '1' },
+        { "help",  no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    struct sockaddr_in addr;
+    struct sigaction sa;
+    unsigned long long count = 0, start = 0;
+    const char *dir = NULL;
+    int port = FRAME_TX_PORT, once = 0, opt, listener, sock, one = 1;
+
+    while((opt = getopt_long(argc, argv, "p:c:D:1h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'c': count = strtoull(optarg, NULL, 0); break;
+            case 'D': dir = optarg; break;
+            case '1': once = 1; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // no SA_RESTART, so a blocked accept or recv returns on ^C
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    lat_hist_reset(&capture_latency);
+    lat_hist_reset(&send_latency);
+
+    if((listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    if(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("listening on port %d\n", port);
+    fflush(stdout);
+
+    while(!interrupted)
+    {
+        if((sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            perror("accept");
+            break;
+        }
+
+        if(start == 0)
+            start = clock_ns(CLOCK_MONOTONIC);
+
+        printf("sender connected\n");
+        fflush(stdout);
+
+        if(serve(sock, dir, count) < 0 || once)
+        {
+            close(sock);
+            break;
+        }
+
+        close(sock);
+        printf("sender disconnected\n");
+        fflush(stdout);
+    }
+
+    close(listener);
+
+    report(stdout, "total", frames, bytes, start ? (double)(clock_ns(CLOCK_MONOTONIC) - start) / NSEC_PER_SEC : 0.0);
+    printf("%llu frames missing in the sequence numbers\n", lost);
+
+    return 0;
+}
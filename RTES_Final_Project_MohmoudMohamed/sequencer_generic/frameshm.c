@@ -0,0 +1,279 @@
+// Frames published in POSIX shared memory, see frameshm.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "frameshm.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define NSEC_PER_MSEC (1000000ULL)
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+
+static unsigned long long clock_ns(const struct timespec *ts)
+{
+    return (unsigned long long)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+
+static long futex(uint32_t *word, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+
+int frame_shm_create(struct frame_shm *shm, const char *name, int width, int height, int bytes_per_pixel)
+{
+    struct frame_shm_header *h;
+    size_t slot_size = round_up((size_t)width * height * bytes_per_pixel, FRAME_SHM_ALIGN);
+    size_t data = round_up(sizeof(*h), FRAME_SHM_ALIGN);
+    unsigned int i;
+
+    memset(shm, 0, sizeof(*shm));
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+    shm->map_size = data + FRAME_SHM_SLOTS * slot_size;
+
+    // a stale ring from an earlier run would keep its old size
+    shm_unlink(name);
+
+    if((shm->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0)
+    {
+        perror(name);
+        return -1;
+    }
+
+    if(ftruncate(shm->fd, (off_t)shm->map_size) < 0 ||
+       (h = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0)) == MAP_FAILED)
+    {
+        perror(name);
+        close(shm->fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    // fault the whole ring in now rather than on the first frames
+    memset(h, 0, shm->map_size);
+
+    h->header_size = sizeof(*h);
+    h->slots = FRAME_SHM_SLOTS;
+    h->width = (uint32_t)width;
+    h->height = (uint32_t)height;
+    h->bytes_per_pixel = (uint32_t)bytes_per_pixel;
+    h->slot_size = slot_size;
+    h->map_size = shm->map_size;
+    h->publisher_pid = getpid();
+
+    for(i = 0; i < FRAME_SHM_SLOTS; i++)
+        h->slot[i].data_offset = data + i * slot_size;
+
+    // readers check the magic last
+    h->latest = FRAME_SHM_SLOTS - 1;
+    STORE(&h->magic, FRAME_SHM_MAGIC);
+
+    shm->header = h;
+    return 0;
+}
+
+
+void frame_shm_destroy(struct frame_shm *shm)
+{
+    if(shm->header == NULL)
+        return;
+
+    munmap(shm->header, shm->map_size);
+    close(shm->fd);
+    shm_unlink(shm->name);
+    shm->header = NULL;
+}
+
+
+unsigned char *frame_shm_begin(struct frame_shm *shm)
+{
+    struct frame_shm_header *h = shm->header;
+    struct frame_shm_slot *slot;
+
+    shm->writing = (h->latest + 1) % FRAME_SHM_SLOTS;
+    slot = &h->slot[shm->writing];
+
+    // odd: readers that copy this slot now will see the count move
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return (unsigned char *)h + slot->data_offset;
+}
+
+
+void frame_shm_commit(struct frame_shm *shm, unsigned int bytes, unsigned long long frame_num,
+                      const struct timespec *capture_time)
+{
+    struct frame_shm_header *h = shm->header;
+    struct frame_shm_slot *slot = &h->slot[shm->writing];
+    uint32_t generation = h->generation + 1;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    slot->bytes = bytes;
+    slot->generation = generation;
+    slot->frame_num = frame_num;
+    slot->capture_ns = capture_time ? clock_ns(capture_time) : 0;
+    slot->publish_ns = clock_ns(&now);
+
+    STORE(&slot->seq, slot->seq + 1);
+    STORE(&h->latest, shm->writing);
+    STORE(&h->generation, generation);
+
+    // readers map the ring read-only and cannot say whether they sleep, a
+    // wake nobody waits for costs a system call and no more
+    futex(&h->generation, FUTEX_WAKE, INT_MAX, NULL);
+    shm->published++;
+}
+
+
+int frame_shm_publish(struct frame_shm *shm, const void *frame, unsigned int bytes, unsigned long long frame_num,
+                      const struct timespec *capture_time)
+{
+    if(bytes > shm->header->slot_size)
+        return -1;
+
+    memcpy(frame_shm_begin(shm), frame, bytes);
+    frame_shm_commit(shm, bytes, frame_num, capture_time);
+    return 0;
+}
+
+
+int frame_shm_open(struct frame_shm_reader *r, const char *name)
+{
+    const struct frame_shm_header *h;
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+
+    if((r->fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if(fstat(r->fd, &st) < 0 || (size_t)st.st_size < sizeof(*h))
+    {
+        close(r->fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    r->map_size = (size_t)st.st_size;
+
+    if((h = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, r->fd, 0)) == MAP_FAILED)
+    {
+        close(r->fd);
+        return -1;
+    }
+
+    if(LOAD(&h->magic) != FRAME_SHM_MAGIC || h->header_size != sizeof(*h) || h->map_size != r->map_size)
+    {
+        munmap((void *)h, r->map_size);
+        close(r->fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    r->header = h;
+    r->last_generation = LOAD(&h->generation);
+    return 0;
+}
+
+
+void frame_shm_close(struct frame_shm_reader *r)
+{
+    if(r->header == NULL)
+        return;
+
+    munmap((void *)r->header, r->map_size);
+    close(r->fd);
+    r->header = NULL;
+}
+
+
+int frame_shm_read(struct frame_shm_reader *r, void *buf, size_t size, struct frame_shm_frame *frame)
+{
+    const struct frame_shm_header *h = r->header;
+    const struct frame_shm_slot *slot;
+    uint32_t generation, seq;
+
+    for(;;)
+    {
+        if(LOAD(&h->generation) == r->last_generation)
+            return 0;
+
+        // latest may already be newer than the generation just loaded, the
+        // slot's own generation is the one that counts
+
+        slot = &h->slot[LOAD(&h->latest) % FRAME_SHM_SLOTS];
+
+        if((seq = LOAD(&slot->seq)) & 1)
+        {
+            r->retries++;
+            continue;
+        }
+
+        generation = slot->generation;
+        frame->bytes = slot->bytes;
+        frame->frame_num = slot->frame_num;
+        frame->capture_ns = slot->capture_ns;
+        frame->publish_ns = slot->publish_ns;
+
+        if(frame->bytes > size || frame->bytes > h->slot_size)
+            return -1;
+
+        memcpy(buf, (const unsigned char *)h + slot->data_offset, frame->bytes);
+
+        // the copy must be complete before the count is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            break;
+
+        r->retries++;
+    }
+
+    frame->generation = generation;
+    r->missed += generation - r->last_generation - 1;
+    r->last_generation = generation;
+    r->reads++;
+    return 1;
+}
+
+
+int frame_shm_wait(struct frame_shm_reader *r, int timeout_ms)
+{
+    uint32_t *generation = (uint32_t *)&r->header->generation;
+    struct timespec timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * (long)NSEC_PER_MSEC;
+
+    // the kernel compares the word again before sleeping, a frame published
+    // in between is not missed
+    while(LOAD(generation) == r->last_generation)
+    {
+        if(futex(generation, FUTEX_WAIT, r->last_generation, &timeout) < 0 && errno == ETIMEDOUT)
+            return LOAD(generation) != r->last_generation;
+    }
+
+    return 1;
+}
@@ -0,0 +1,121 @@
+#ifndef _FRAMESHM_H_
+#define _FRAMESHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Frames published in POSIX shared memory for any number of local readers
+//
+// The capture program creates a named ring of FRAME_SHM_SLOTS frame slots
+// (shm_open, so /dev/shm/NAME) and publishes every frame into the slot after
+// the latest one, other processes open it by name and read the latest frame
+// whenever they like.  Readers never write to the mapping, take no lock and
+// cannot slow the publisher down, however many there are or however slowly
+// they read.
+//
+// Each slot carries a sequence count (seqlock): odd while the publisher
+// fills the slot, bumped to even once it is done.  A reader copies the frame
+// out and compares the count before and after, a change means the slot was
+// overwritten under it and it copies again.  With several slots a slot is
+// only reused FRAME_SHM_SLOTS - 1 frames after it was published, so a
+// reader copying the latest frame has that long before it has to retry.
+//
+// The header's generation counts published frames, latest says which slot
+// holds the newest.  frame_shm_wait() sleeps on the generation with a
+// shared futex, which the publisher wakes after every frame.
+//
+// The publisher may fill a slot in place (frame_shm_begin() and
+// frame_shm_commit(), e.g. converting straight into it) or have a frame
+// copied in (frame_shm_publish()).
+
+#define FRAME_SHM_MAGIC (0x46534d31)    // "FSM1"
+#define FRAME_SHM_SLOTS (4)
+#define FRAME_SHM_ALIGN (4096)
+
+struct frame_shm_slot
+{
+    uint32_t seq;                       // odd while being written
+    uint32_t bytes;
+    uint32_t generation;                // of the frame in the slot
+    uint32_t reserved;
+    uint64_t frame_num;
+    uint64_t capture_ns;                // CLOCK_MONOTONIC
+    uint64_t publish_ns;                // CLOCK_MONOTONIC when committed
+    uint64_t data_offset;               // from the start of the mapping
+};
+
+struct frame_shm_header
+{
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t slots;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_pixel;
+    uint64_t slot_size;
+    uint64_t map_size;
+    int32_t publisher_pid;
+
+    uint32_t generation;                // frames published, futex word
+    uint32_t latest;                    // slot of the newest frame
+    struct frame_shm_slot slot[FRAME_SHM_SLOTS];
+};
+
+// publisher side
+struct frame_shm
+{
+    char name[64];
+    int fd;
+    struct frame_shm_header *header;
+    size_t map_size;
+    unsigned int writing;               // slot between begin and commit
+
+    unsigned long long published;
+};
+
+// reader side
+struct frame_shm_reader
+{
+    int fd;
+    const struct frame_shm_header *header;
+    size_t map_size;
+    uint32_t last_generation;
+
+    unsigned long long reads;
+    unsigned long long retries;         // slot overwritten while copying
+    unsigned long long missed;          // frames published between two reads
+};
+
+struct frame_shm_frame
+{
+    unsigned long long frame_num;
+    unsigned long long capture_ns;
+    unsigned long long publish_ns;
+    unsigned int bytes;
+    unsigned int generation;
+};
+
+// name like "/frames10hz", an existing ring of that name is replaced
+int frame_shm_create(struct frame_shm *shm, const char *name, int width, int height, int bytes_per_pixel);
+void frame_shm_destroy(struct frame_shm *shm);
+
+// the next slot to fill, at most width * height * bytes_per_pixel bytes
+unsigned char *frame_shm_begin(struct frame_shm *shm);
+void frame_shm_commit(struct frame_shm *shm, unsigned int bytes, unsigned long long frame_num,
+                      const struct timespec *capture_time);
+
+int frame_shm_publish(struct frame_shm *shm, const void *frame, unsigned int bytes, unsigned long long frame_num,
+                      const struct timespec *capture_time);
+
+int frame_shm_open(struct frame_shm_reader *r, const char *name);
+void frame_shm_close(struct frame_shm_reader *r);
+
+// copies the latest frame into buf, 1 when it is newer than the last one
+// read, 0 when there is nothing new, -1 when it does not fit
+int frame_shm_read(struct frame_shm_reader *r, void *buf, size_t size, struct frame_shm_frame *frame);
+
+// 1 once a frame newer than the last one read is published, 0 on timeout
+int frame_shm_wait(struct frame_shm_reader *r, int timeout_ms);
+
+#endif
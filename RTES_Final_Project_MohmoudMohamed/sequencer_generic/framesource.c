@@ -0,0 +1,1069 @@
+// Synthetic and replay frame sources, see framesource.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "framesource.h"
+
+#define NSEC_PER_MSEC (1000000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+
+#define SYNTHETIC_PREFIX "synthetic:"
+#define REPLAY_PREFIX "replay:"
+#define V4L2_PREFIX "v4l2:"
+
+#define DEFAULT_FPS (30.0)
+#define CLOCK_HAND_FRAMES (60)      // frames per turn of the synthetic clock hand
+#define COUNTER_BITS (32)           // frame number bar across the top of the pattern
+
+enum frame_source_type
+{
+    SOURCE_SYNTHETIC = 0,
+    SOURCE_REPLAY
+};
+
+struct replay_frame
+{
+    char *path;                     // file holding the image, shared for a stream
+    off_t offset;                   // start of the pixel data
+    int color;                      // P6 when set, else P5
+    unsigned long long ts_ns;       // header time stamp, 0 when there is none
+};
+
+struct frame_source
+{
+    enum frame_source_type type;
+    int fd;                         // timerfd when paced, eventfd when unthrottled
+    int paced;
+
+    struct v4l2_pix_format pix;
+
+    unsigned int nbuffers;
+    void *start[FRAME_SOURCE_MAX_BUFFERS];
+
+    // V4L2_MEMORY_USERPTR after VIDIOC_REQBUFS asked for it, frames then go
+    // straight into the application buffer queued with each index
+    int userptr;
+    unsigned int nuser;
+    unsigned long user[FRAME_SOURCE_MAX_BUFFERS];
+    unsigned int user_length[FRAME_SOURCE_MAX_BUFFERS];
+
+    // buffers owned by the source waiting to be filled, and filled ones
+    // waiting to be dequeued, both in FIFO order
+    unsigned int queued[FRAME_SOURCE_MAX_BUFFERS], queued_head, queued_count;
+    unsigned int done[FRAME_SOURCE_MAX_BUFFERS], done_head, done_count;
+    unsigned long long done_seq[FRAME_SOURCE_MAX_BUFFERS];
+    unsigned long long done_ts[FRAME_SOURCE_MAX_BUFFERS];
+
+    int streaming;
+    unsigned long long start_ns;
+    unsigned long long sequence;    // next frame to come due
+    unsigned long long dropped;
+
+    unsigned long long period_ns;   // synthetic rate, or replay rate without time stamps
+    double speed;                   // replay speed up, 0 as fast as possible
+    unsigned int seed;
+
+    struct replay_frame *frames;
+    unsigned int nframes;
+    unsigned int replay_width, replay_height;
+    unsigned long long loop_ns;     // length of one pass through the recording
+    int replay_timestamps;
+    unsigned char *scratch;         // one frame as read from the file
+};
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+
+static unsigned char clip(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : (unsigned char)value);
+}
+
+
+// deterministic per frame noise
+static unsigned int xorshift32(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+
+const char *frame_source_v4l2_device(const char *spec)
+{
+    if(strncmp(spec, SYNTHETIC_PREFIX, strlen(SYNTHETIC_PREFIX)) == 0 ||
+       strncmp(spec, REPLAY_PREFIX, strlen(REPLAY_PREFIX)) == 0)
+        return NULL;
+
+    if(strncmp(spec, V4L2_PREFIX, strlen(V4L2_PREFIX)) == 0)
+        return spec + strlen(V4L2_PREFIX);
+
+    return spec;
+}
+
+
+static void set_format(struct frame_source *src, unsigned int width, unsigned int height, unsigned int pixelformat)
+{
+    unsigned int bpp;
+
+    switch(pixelformat)
+    {
+        case V4L2_PIX_FMT_GREY:  bpp = 1; break;
+        case V4L2_PIX_FMT_RGB24: bpp = 3; break;
+        default:                 bpp = 2; pixelformat = V4L2_PIX_FMT_YUYV; break;
+    }
+
+    // YUYV carries chroma for pixel pairs
+    if(pixelformat == V4L2_PIX_FMT_YUYV)
+        width &= ~1U;
+
+    memset(&src->pix, 0, sizeof(src->pix));
+    src->pix.width = width;
+    src->pix.height = height;
+    src->pix.pixelformat = pixelformat;
+    src->pix.field = V4L2_FIELD_NONE;
+    src->pix.bytesperline = width * bpp;
+    src->pix.sizeimage = width * height * bpp;
+    src->pix.colorspace = V4L2_COLORSPACE_SMPTE170M;
+    src->pix.ycbcr_enc = V4L2_YCBCR_ENC_601;
+    src->pix.quantization = V4L2_QUANTIZATION_LIM_RANGE;
+}
+
+
+/* Synthetic pattern */
+
+// chroma of the color bars along the bottom of the pattern, U and V pairs
+static const unsigned char bar_uv[8][2] =
+{
+    { 128, 128 }, { 44, 142 }, { 156, 44 }, { 72, 58 },
+    { 184, 198 }, { 100, 212 }, { 212, 114 }, { 128, 128 }
+};
+
+
+static void synthetic_frame(struct frame_source *src, unsigned char *out, unsigned long long frame)
+{
+    unsigned int width = src->pix.width, height = src->pix.height;
+    unsigned int x, y, bar_top = height - height / 8, counter_h = height / 24 + 1;
+    unsigned int noise = src->seed ^ (unsigned int)(frame * 2654435761ULL) ^ 0x9e3779b9U;
+    int yuyv = (src->pix.pixelformat == V4L2_PIX_FMT_YUYV);
+    int rgb = (src->pix.pixelformat == V4L2_PIX_FMT_RGB24);
+    unsigned int bpp = src->pix.bytesperline / width;
+    double angle, radius, r, cx = width / 2.0, cy = height / 2.0;
+
+    if(noise == 0)
+        noise = 1;
+
+    // scrolling gradient with noise
+    for(y = 0; y < height; y++)
+    {
+        unsigned char *row = out + (size_t)y * src->pix.bytesperline;
+
+        for(x = 0; x < width; x++)
+        {
+            int luma = 32 + (int)((x + y + frame * 4) % 384) / 2;
+            unsigned char u = 128, v = 128;
+
+            luma += (int)(xorshift32(&noise) & 15) - 8;
+
+            if(y < counter_h)
+            {
+                int bit = COUNTER_BITS - 1 - (int)(x * COUNTER_BITS / width);
+                luma = (frame >> bit) & 1 ? 235 : 16;
+            }
+            else if(y >= bar_top)
+            {
+                u = bar_uv[x * 8 / width][0];
+                v = bar_uv[x * 8 / width][1];
+            }
+
+            if(yuyv)
+            {
+                row[x * 2] = clip(luma);
+                row[x * 2 + 1] = (x & 1) ? v : u;
+            }
+            else if(rgb)
+            {
+                row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = clip(luma);
+            }
+            else
+            {
+                row[x] = clip(luma);
+            }
+        }
+    }
+
+    // clock hand, 3 pixels wide, turning once every CLOCK_HAND_FRAMES
+    angle = 2.0 * M_PI * (double)(frame % CLOCK_HAND_FRAMES) / CLOCK_HAND_FRAMES;
+    radius = (width < height ? width : height) * 0.4;
+
+    for(r = 0.0; r < radius; r += 0.5)
+    {
+        int px = (int)(cx + r * sin(angle)), py = (int)(cy - r * cos(angle));
+        int dx, dy;
+
+        for(dy = -1; dy <= 1; dy++)
+        {
+            for(dx = -1; dx <= 1; dx++)
+            {
+                unsigned int hx = px + dx, hy = py + dy;
+
+                if(hx >= width || hy >= height)
+                    continue;
+
+                if(rgb)
+                    memset(out + (size_t)hy * src->pix.bytesperline + hx * 3, 235, 3);
+                else
+                    out[(size_t)hy * src->pix.bytesperline + hx * bpp] = 235;
+            }
+        }
+    }
+}
+
+
+static int synthetic_open(struct frame_source *src, const char *arg, struct v4l2_format *fmt)
+{
+    unsigned int width = fmt->fmt.pix.width, height = fmt->fmt.pix.height, pixelformat = fmt->fmt.pix.pixelformat;
+    double fps = DEFAULT_FPS;
+    char *copy, *opt, *save;
+
+    copy = strdup(arg);
+
+    opt = strtok_r(copy, ",", &save);
+
+    if(opt == NULL || sscanf(opt, "%ux%u@%lf", &width, &height, &fps) < 2 || width == 0 || height == 0 || fps < 0.0)
+    {
+        fprintf(stderr, "synthetic source wants WxH@FPS, got '%s'\n", arg);
+        free(copy);
+        return -1;
+    }
+
+    while((opt = strtok_r(NULL, ",", &save)) != NULL)
+    {
+        if(strcmp(opt, "yuyv") == 0) pixelformat = V4L2_PIX_FMT_YUYV;
+        else if(strcmp(opt, "grey") == 0 || strcmp(opt, "gray") == 0) pixelformat = V4L2_PIX_FMT_GREY;
+        else if(strcmp(opt, "rgb") == 0) pixelformat = V4L2_PIX_FMT_RGB24;
+        else if(strncmp(opt, "seed=", 5) == 0) src->seed = (unsigned int)strtoul(opt + 5, NULL, 0);
+        else
+        {
+            fprintf(stderr, "synthetic source option '%s' unknown\n", opt);
+            free(copy);
+            return -1;
+        }
+    }
+
+    free(copy);
+
+    set_format(src, width, height, pixelformat);
+    src->period_ns = fps > 0.0 ? (unsigned long long)(NSEC_PER_SEC / fps) : 0;
+
+    fprintf(stderr, "synthetic source %ux%u at %.2lf fps, seed %u\n", width, height, fps, src->seed);
+    return 0;
+}
+
+
+/* Replay of recorded PGM/PPM frames */
+
+// reads a PNM header, leaves fp at the pixel data
+static int read_pnm_header(FILE *fp, int *color, unsigned int *width, unsigned int *height, unsigned long long *ts_ns)
+{
+    unsigned int value[3];
+    int c, n = 0;
+
+    if(fgetc(fp) != 'P')
+        return -1;
+
+    c = fgetc(fp);
+    if(c != '5' && c != '6')
+        return -1;
+
+    *color = (c == '6');
+    *ts_ns = 0;
+
+    while(n < 3)
+    {
+        c = fgetc(fp);
+
+        if(c == EOF)
+            return -1;
+
+        if(c == '#')
+        {
+            char comment[128];
+            unsigned long long sec, msec;
+
+            if(fgets(comment, sizeof(comment), fp) == NULL)
+                return -1;
+
+            // "#0000000012 sec 0000000345 msec" from dump_pgm()/dump_ppm()
+            if(sscanf(comment, "%llu sec %llu msec", &sec, &msec) == 2)
+                *ts_ns = sec * NSEC_PER_SEC + msec * NSEC_PER_MSEC;
+
+            continue;
+        }
+
+        if(c >= '0' && c <= '9')
+        {
+            ungetc(c, fp);
+            if(fscanf(fp, "%u", &value[n]) != 1)
+                return -1;
+            n++;
+        }
+    }
+
+    // single white space before the raster
+    fgetc(fp);
+
+    if(value[2] == 0 || value[2] > 255)
+        return -1;
+
+    *width = value[0];
+    *height = value[1];
+    return 0;
+}
+
+
+// 1 when the frame was indexed and src->frames owns path, 0 when it was
+// skipped, -1 when it is no image
+static int replay_add(struct frame_source *src, char *path, FILE *fp)
+{
+    struct replay_frame *frame, *frames;
+    struct stat st;
+    unsigned int width, height;
+    int color;
+    unsigned long long ts_ns;
+
+    if(read_pnm_header(fp, &color, &width, &height, &ts_ns) < 0)
+        return -1;
+
+    // a frame cut short by the end of the recording
+    if(fstat(fileno(fp), &st) < 0 || ftello(fp) + (off_t)width * height * (color ? 3 : 1) > st.st_size)
+        return -1;
+
+    if(src->nframes == 0)
+    {
+        src->replay_width = width;
+        src->replay_height = height;
+    }
+    else if(width != src->replay_width || height != src->replay_height)
+    {
+        fprintf(stderr, "replay: skipping %ux%u frame in %s, recording is %ux%u\n",
+                width, height, path, src->replay_width, src->replay_height);
+        fseeko(fp, (off_t)width * height * (color ? 3 : 1), SEEK_CUR);
+        return 0;
+    }
+
+    if((src->nframes & 255) == 0)
+    {
+        if((frames = realloc(src->frames, (src->nframes + 256) * sizeof(*src->frames))) == NULL)
+        {
+            perror("replay index");
+            return -1;
+        }
+        src->frames = frames;
+    }
+
+    frame = &src->frames[src->nframes++];
+    frame->path = path;
+    frame->offset = ftello(fp);
+    frame->color = color;
+    frame->ts_ns = ts_ns;
+
+    // skip the raster to the next image of a stream
+    fseeko(fp, (off_t)width * height * (color ? 3 : 1), SEEK_CUR);
+    return 1;
+}
+
+
+static int pnm_name(const struct dirent *entry)
+{
+    size_t len = strlen(entry->d_name);
+
+    return len > 4 && (strcmp(entry->d_name + len - 4, ".pgm") == 0 || strcmp(entry->d_name + len - 4, ".ppm") == 0);
+}
+
+
+static int replay_index(struct frame_source *src, const char *path)
+{
+    struct stat st;
+    FILE *fp;
+
+    if(stat(path, &st) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if(S_ISDIR(st.st_mode))
+    {
+        struct dirent **names;
+        int i, n;
+
+        if((n = scandir(path, &names, pnm_name, alphasort)) < 0)
+        {
+            perror(path);
+            return -1;
+        }
+
+        for(i = 0; i < n; i++)
+        {
+            char *file;
+            int rc;
+
+            if(asprintf(&file, "%s/%s", path, names[i]->d_name) < 0)
+                file = NULL;
+
+            free(names[i]);
+
+            if(file == NULL || (fp = fopen(file, "r")) == NULL)
+            {
+                free(file);
+                continue;
+            }
+
+            if((rc = replay_add(src, file, fp)) < 0)
+                fprintf(stderr, "replay: %s is not a PGM/PPM image\n", file);
+
+            fclose(fp);
+
+            // only an indexed frame keeps its path
+            if(rc <= 0)
+                free(file);
+        }
+
+        free(names);
+    }
+    else
+    {
+        char *file = strdup(path);
+        int c, rc, stored = 0;
+
+        if((fp = fopen(file, "r")) == NULL)
+        {
+            perror(path);
+            free(file);
+            return -1;
+        }
+
+        // concatenated images, e.g. cat frames/*.pgm > run.pnm
+        while((c = fgetc(fp)) != EOF)
+        {
+            if(c == ' ' || c == '\n' || c == '\r' || c == '\t')
+                continue;
+
+            ungetc(c, fp);
+
+            if((rc = replay_add(src, file, fp)) < 0)
+            {
+                fprintf(stderr, "replay: %s is not a PGM/PPM stream after %u frames\n", path, src->nframes);
+                break;
+            }
+            stored |= rc;
+        }
+
+        fclose(fp);
+
+        // every frame of the stream shares the path, none may have kept it
+        if(!stored)
+            free(file);
+    }
+
+    return src->nframes > 0 ? 0 : -1;
+}
+
+
+// convert one recorded image into the delivered format
+static int replay_frame(struct frame_source *src, unsigned char *out, unsigned long long frame)
+{
+    const struct replay_frame *rf = &src->frames[frame % src->nframes];
+    unsigned int i, x, y, pixels = src->replay_width * src->replay_height;
+    size_t size = (size_t)pixels * (rf->color ? 3 : 1);
+    unsigned char *in = src->scratch;
+    ssize_t got;
+    int fd;
+
+    if((fd = open(rf->path, O_RDONLY)) < 0)
+        return -1;
+
+    got = pread(fd, in, size, rf->offset);
+    close(fd);
+
+    if(got != (ssize_t)size)
+        return -1;
+
+    switch(src->pix.pixelformat)
+    {
+        case V4L2_PIX_FMT_GREY:
+            if(!rf->color)
+            {
+                memcpy(out, in, pixels);
+                break;
+            }
+
+            for(i = 0; i < pixels; i++)
+                out[i] = (unsigned char)((77 * in[i * 3] + 150 * in[i * 3 + 1] + 29 * in[i * 3 + 2] + 128) >> 8);
+            break;
+
+        case V4L2_PIX_FMT_RGB24:
+            if(rf->color)
+            {
+                memcpy(out, in, size);
+                break;
+            }
+
+            for(i = 0; i < pixels; i++)
+                out[i * 3] = out[i * 3 + 1] = out[i * 3 + 2] = in[i];
+            break;
+
+        default:
+            // YUYV, BT.601 limited range for color recordings; an odd width
+            // loses its last column, set_format() rounded it to pixel pairs
+            for(y = 0; y < src->pix.height; y++)
+            {
+                const unsigned char *row = in + (size_t)y * src->replay_width * (rf->color ? 3 : 1);
+                unsigned char *o = out + (size_t)y * src->pix.bytesperline;
+
+                for(x = 0; x + 1 < src->pix.width; x += 2)
+                {
+                    if(!rf->color)
+                    {
+                        o[x * 2] = row[x];
+                        o[x * 2 + 1] = 128;
+                        o[x * 2 + 2] = row[x + 1];
+                        o[x * 2 + 3] = 128;
+                    }
+                    else
+                    {
+                        const unsigned char *p = &row[x * 3];
+                        int r = (p[0] + p[3]) / 2, g = (p[1] + p[4]) / 2, b = (p[2] + p[5]) / 2;
+
+                        o[x * 2] = clip(16 + ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8));
+                        o[x * 2 + 1] = clip(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+                        o[x * 2 + 2] = clip(16 + ((66 * p[3] + 129 * p[4] + 25 * p[5] + 128) >> 8));
+                        o[x * 2 + 3] = clip(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+                    }
+                }
+            }
+            break;
+    }
+
+    return 0;
+}
+
+
+static int replay_open(struct frame_source *src, const char *arg, struct v4l2_format *fmt)
+{
+    double fps = DEFAULT_FPS;
+    char *copy, *opt, *save, *at, *end;
+    unsigned int i;
+
+    src->speed = 1.0;
+    copy = strdup(arg);
+
+    opt = strtok_r(copy, ",", &save);
+
+    if(opt == NULL)
+    {
+        fprintf(stderr, "replay source wants PATH[@SPEED][,fps=N]\n");
+        free(copy);
+        return -1;
+    }
+
+    if((at = strrchr(opt, '@')) != NULL)
+    {
+        src->speed = strtod(at + 1, &end);
+
+        if(*end != '\0' || src->speed < 0.0)
+        {
+            fprintf(stderr, "replay speed '%s' is not a number\n", at + 1);
+            free(copy);
+            return -1;
+        }
+
+        *at = '\0';
+    }
+
+    if(replay_index(src, opt) < 0)
+    {
+        fprintf(stderr, "replay: no PGM/PPM frames in %s\n", opt);
+        free(copy);
+        return -1;
+    }
+
+    while((opt = strtok_r(NULL, ",", &save)) != NULL)
+    {
+        if(strncmp(opt, "fps=", 4) == 0 && (fps = atof(opt + 4)) > 0.0)
+            continue;
+
+        fprintf(stderr, "replay source option '%s' unknown\n", opt);
+        free(copy);
+        return -1;
+    }
+
+    free(copy);
+
+    // pace by the recorded time stamps when every frame has a later one
+    src->replay_timestamps = src->nframes > 1;
+    for(i = 0; i < src->nframes; i++)
+        if(src->frames[i].ts_ns == 0 || (i > 0 && src->frames[i].ts_ns <= src->frames[i - 1].ts_ns))
+            src->replay_timestamps = 0;
+
+    src->period_ns = (unsigned long long)(NSEC_PER_SEC / fps);
+
+    if(src->replay_timestamps)
+    {
+        unsigned long long span = src->frames[src->nframes - 1].ts_ns - src->frames[0].ts_ns;
+
+        // one average frame time from the last frame back to the first
+        src->loop_ns = span + span / (src->nframes - 1);
+    }
+    else
+    {
+        src->loop_ns = src->period_ns * src->nframes;
+    }
+
+    set_format(src, src->replay_width, src->replay_height, fmt->fmt.pix.pixelformat);
+
+    src->scratch = malloc((size_t)src->replay_width * src->replay_height * 3);
+    if(src->scratch == NULL)
+        return -1;
+
+    fprintf(stderr, "replay source %u frames %ux%u, %s, speed %.2lf\n", src->nframes, src->replay_width, src->replay_height,
+           src->replay_timestamps ? "recorded timing" : "fixed rate", src->speed);
+    return 0;
+}
+
+
+/* Pacing and buffer handling shared by the sources */
+
+// time frame n is due relative to STREAMON, before speed up
+static unsigned long long frame_offset_ns(const struct frame_source *src, unsigned long long n)
+{
+    if(src->type == SOURCE_REPLAY && src->replay_timestamps)
+    {
+        const struct replay_frame *rf = &src->frames[n % src->nframes];
+
+        return (n / src->nframes) * src->loop_ns + (rf->ts_ns - src->frames[0].ts_ns);
+    }
+
+    return n * src->period_ns;
+}
+
+
+static unsigned long long frame_due_ns(const struct frame_source *src, unsigned long long n)
+{
+    double offset = (double)frame_offset_ns(src, n);
+
+    if(src->type == SOURCE_REPLAY)
+        offset /= src->speed;
+
+    return src->start_ns + (unsigned long long)offset;
+}
+
+
+static void arm_timer(struct frame_source *src, unsigned long long abs_ns)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+
+    // zero would disarm, anything in the past fires at once
+    if(abs_ns == 0)
+        abs_ns = 1;
+
+    its.it_value.tv_sec = abs_ns / NSEC_PER_SEC;
+    its.it_value.tv_nsec = abs_ns % NSEC_PER_SEC;
+
+    timerfd_settime(src->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+
+static int produce(struct frame_source *src, unsigned long long ts_ns)
+{
+    unsigned int index, slot;
+    unsigned char *out;
+    int rc;
+
+    index = src->queued[src->queued_head];
+    src->queued_head = (src->queued_head + 1) % FRAME_SOURCE_MAX_BUFFERS;
+    src->queued_count--;
+
+    out = src->userptr ? (unsigned char *)src->user[index] : src->start[index];
+
+    if(src->type == SOURCE_SYNTHETIC)
+    {
+        synthetic_frame(src, out, src->sequence);
+        rc = 0;
+    }
+    else
+    {
+        rc = replay_frame(src, out, src->sequence);
+    }
+
+    slot = (src->done_head + src->done_count) % FRAME_SOURCE_MAX_BUFFERS;
+    src->done[slot] = index;
+    src->done_seq[slot] = src->sequence;
+    src->done_ts[slot] = ts_ns;
+    src->done_count++;
+
+    src->sequence++;
+    return rc;
+}
+
+
+// fill queued buffers with every frame that has come due since the last
+// call, frames finding no queued buffer are dropped like a driver would
+static int catch_up(struct frame_source *src)
+{
+    unsigned long long now = now_ns(), due;
+
+    if(!src->paced)
+    {
+        if(src->done_count == 0 && src->queued_count > 0)
+            return produce(src, now);
+
+        return 0;
+    }
+
+    while((due = frame_due_ns(src, src->sequence)) <= now)
+    {
+        if(src->queued_count == 0)
+        {
+            src->dropped++;
+            src->sequence++;
+            continue;
+        }
+
+        if(produce(src, due) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int dqbuf(struct frame_source *src, struct v4l2_buffer *buf)
+{
+    unsigned long long expirations;
+    unsigned int slot;
+
+    if(!src->streaming)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(src->paced && read(src->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        return -1;
+
+    if(catch_up(src) < 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    if(src->done_count == 0)
+    {
+        if(src->paced)
+            arm_timer(src, frame_due_ns(src, src->sequence));
+
+        errno = EAGAIN;
+        return -1;
+    }
+
+    slot = src->done_head;
+    src->done_head = (src->done_head + 1) % FRAME_SOURCE_MAX_BUFFERS;
+    src->done_count--;
+
+    buf->index = src->done[slot];
+    buf->bytesused = src->pix.sizeimage;
+    buf->length = src->pix.sizeimage;
+    if(src->userptr)
+    {
+        buf->memory = V4L2_MEMORY_USERPTR;
+        buf->m.userptr = src->user[buf->index];
+        buf->length = src->user_length[buf->index];
+    }
+    buf->field = V4L2_FIELD_NONE;
+    buf->sequence = (unsigned int)src->done_seq[slot];
+    buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf->timestamp.tv_sec = src->done_ts[slot] / NSEC_PER_SEC;
+    buf->timestamp.tv_usec = (src->done_ts[slot] % NSEC_PER_SEC) / 1000;
+
+    // keep the descriptor readable while filled buffers remain
+    if(src->paced)
+        arm_timer(src, src->done_count ? 1 : frame_due_ns(src, src->sequence));
+
+    return 0;
+}
+
+
+static int qbuf(struct frame_source *src, const struct v4l2_buffer *buf)
+{
+    unsigned int i;
+
+    if(buf->index >= (src->userptr ? src->nuser : src->nbuffers))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // already owned by the source
+    for(i = 0; i < src->queued_count; i++)
+        if(src->queued[(src->queued_head + i) % FRAME_SOURCE_MAX_BUFFERS] == buf->index)
+            break;
+
+    if(i < src->queued_count)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(src->userptr)
+    {
+        if(buf->memory != V4L2_MEMORY_USERPTR || buf->m.userptr == 0 || buf->length < src->pix.sizeimage)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        src->user[buf->index] = buf->m.userptr;
+        src->user_length[buf->index] = buf->length;
+    }
+
+    src->queued[(src->queued_head + src->queued_count) % FRAME_SOURCE_MAX_BUFFERS] = buf->index;
+    src->queued_count++;
+    return 0;
+}
+
+
+// MMAP reports the buffers made at open, USERPTR switches to application
+// buffers, as many indexes as asked for up to FRAME_SOURCE_MAX_BUFFERS
+static int reqbufs(struct frame_source *src, struct v4l2_requestbuffers *req)
+{
+    if(src->streaming)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    switch(req->memory)
+    {
+        case V4L2_MEMORY_MMAP:
+            src->userptr = 0;
+            req->count = src->nbuffers;
+            break;
+
+        case V4L2_MEMORY_USERPTR:
+            if(req->count > FRAME_SOURCE_MAX_BUFFERS)
+                req->count = FRAME_SOURCE_MAX_BUFFERS;
+
+            src->userptr = req->count > 0;
+            src->nuser = req->count;
+            memset(src->user, 0, sizeof(src->user));
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    src->queued_count = 0;
+    src->done_count = 0;
+    return 0;
+}
+
+
+int frame_source_ioctl(struct frame_source *src, unsigned int request, void *arg)
+{
+    switch(request)
+    {
+        case VIDIOC_DQBUF:
+            return dqbuf(src, arg);
+
+        case VIDIOC_QBUF:
+            return qbuf(src, arg);
+
+        case VIDIOC_REQBUFS:
+            return reqbufs(src, arg);
+
+        case VIDIOC_STREAMON:
+            src->streaming = 1;
+            src->sequence = 0;
+            src->done_count = 0;
+            src->start_ns = now_ns();
+            if(src->paced)
+                arm_timer(src, src->start_ns);
+            return 0;
+
+        case VIDIOC_STREAMOFF:
+            // like the driver, every buffer goes back to the application
+            src->streaming = 0;
+            src->queued_count = 0;
+            src->done_count = 0;
+            if(src->paced)
+            {
+                struct itimerspec off;
+
+                memset(&off, 0, sizeof(off));
+                timerfd_settime(src->fd, 0, &off, NULL);
+            }
+            return 0;
+
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+
+struct frame_source *frame_source_open(const char *spec, struct v4l2_format *fmt, unsigned int nbuffers)
+{
+    struct frame_source *src;
+    int rc;
+
+    if((src = calloc(1, sizeof(*src))) == NULL)
+        return NULL;
+
+    src->fd = -1;
+
+    if(strncmp(spec, SYNTHETIC_PREFIX, strlen(SYNTHETIC_PREFIX)) == 0)
+    {
+        src->type = SOURCE_SYNTHETIC;
+        rc = synthetic_open(src, spec + strlen(SYNTHETIC_PREFIX), fmt);
+    }
+    else if(strncmp(spec, REPLAY_PREFIX, strlen(REPLAY_PREFIX)) == 0)
+    {
+        src->type = SOURCE_REPLAY;
+        rc = replay_open(src, spec + strlen(REPLAY_PREFIX), fmt);
+    }
+    else
+    {
+        fprintf(stderr, "%s is not a synthetic: or replay: frame source\n", spec);
+        rc = -1;
+    }
+
+    if(rc < 0)
+    {
+        frame_source_close(src);
+        return NULL;
+    }
+
+    src->paced = src->type == SOURCE_SYNTHETIC ? src->period_ns > 0 : src->speed > 0.0;
+
+    if(src->paced)
+    {
+        src->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+    else
+    {
+        // unthrottled, always readable
+        src->fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    if(src->fd < 0)
+    {
+        perror("frame source descriptor");
+        frame_source_close(src);
+        return NULL;
+    }
+
+    if(nbuffers < 2) nbuffers = 2;
+    if(nbuffers > FRAME_SOURCE_MAX_BUFFERS) nbuffers = FRAME_SOURCE_MAX_BUFFERS;
+
+    for(src->nbuffers = 0; src->nbuffers < nbuffers; src->nbuffers++)
+    {
+        void *start = mmap(NULL, src->pix.sizeimage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if(start == MAP_FAILED)
+        {
+            perror("frame source buffer");
+            frame_source_close(src);
+            return NULL;
+        }
+
+        src->start[src->nbuffers] = start;
+    }
+
+    fmt->fmt.pix = src->pix;
+
+    return src;
+}
+
+
+void frame_source_close(struct frame_source *src)
+{
+    unsigned int i;
+
+    if(src == NULL)
+        return;
+
+    for(i = 0; i < src->nbuffers; i++)
+        munmap(src->start[i], src->pix.sizeimage);
+
+    if(src->fd >= 0)
+        close(src->fd);
+
+    // frames of a directory each own their path, a stream shares one
+    for(i = 0; i < src->nframes; i++)
+        if(i == 0 || src->frames[i].path != src->frames[i - 1].path)
+            free(src->frames[i].path);
+
+    free(src->frames);
+    free(src->scratch);
+    free(src);
+}
+
+
+int frame_source_fd(const struct frame_source *src)
+{
+    return src->fd;
+}
+
+
+unsigned int frame_source_buffers(const struct frame_source *src)
+{
+    return src->nbuffers;
+}
+
+
+void *frame_source_buffer(const struct frame_source *src, unsigned int index, size_t *length)
+{
+    if(index >= src->nbuffers)
+        return NULL;
+
+    if(length)
+        *length = src->pix.sizeimage;
+
+    return src->start[index];
+}
+
+
+unsigned long long frame_source_dropped(const struct frame_source *src)
+{
+    return src->dropped;
+}
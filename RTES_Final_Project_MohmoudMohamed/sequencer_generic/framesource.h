@@ -0,0 +1,64 @@
+#ifndef _FRAMESOURCE_H_
+#define _FRAMESOURCE_H_
+
+#include <linux/videodev2.h>
+
+// Camera substitutes for running the pipeline without a video device
+//
+// A frame source looks to the capture code like a V4L2 streaming device:
+// it is opened with a requested v4l2_format (adjusted like VIDIOC_S_FMT
+// would), has a file descriptor that select()/poll() report readable when a
+// frame is ready, and is driven with the VIDIOC_STREAMON/OFF, VIDIOC_QBUF and
+// VIDIOC_DQBUF requests through frame_source_ioctl().  Frames are delivered
+// into buffers owned by the source, dequeued in the order they were queued,
+// and dropped when the application holds every buffer, as a driver would.
+// After VIDIOC_REQBUFS with V4L2_MEMORY_USERPTR the frames are written
+// straight into the application buffers passed with VIDIOC_QBUF instead.
+//
+// The source is selected by a spec string used in place of the device name:
+//
+//   /dev/video0, v4l2:/dev/video0
+//       the real camera, handled by the existing V4L2 code
+//
+//   synthetic:WxH@FPS[,yuyv|grey][,seed=N]
+//       generated test pattern, a gradient with a clock hand turning once
+//       every 60 frames, a frame counter bar and pseudo random noise.  The
+//       content depends only on the frame number and seed, so runs are
+//       repeatable.  FPS 0 delivers frames as fast as they are dequeued.
+//
+//   replay:PATH[@SPEED][,fps=N]
+//       recorded frames, PATH is a directory of .pgm/.ppm files (played in
+//       name order) or one file of concatenated PGM/PPM images.  Frames are
+//       paced by the "sec msec" time stamp in the header comment written by
+//       dump_pgm()/dump_ppm(), or at fps=N (default 30) when there is none,
+//       SPEED scales that (2.0 plays twice as fast, 0 as fast as possible).
+//       Playback wraps around at the end.
+//
+// Frames carry a CLOCK_MONOTONIC time stamp with V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+// set and an increasing sequence number.
+
+#define FRAME_SOURCE_MAX_BUFFERS (32)
+
+struct frame_source;
+
+// device path for a V4L2 spec, NULL when the spec names a frame source
+const char *frame_source_v4l2_device(const char *spec);
+
+// fmt holds the requested width, height and pixel format on entry and the
+// format actually delivered on return, NULL with a message on bad specs
+struct frame_source *frame_source_open(const char *spec, struct v4l2_format *fmt, unsigned int nbuffers);
+void frame_source_close(struct frame_source *src);
+
+int frame_source_fd(const struct frame_source *src);
+unsigned int frame_source_buffers(const struct frame_source *src);
+void *frame_source_buffer(const struct frame_source *src, unsigned int index, size_t *length);
+
+// VIDIOC_REQBUFS, VIDIOC_STREAMON, VIDIOC_STREAMOFF, VIDIOC_QBUF and
+// VIDIOC_DQBUF, returns -1 with errno set like the driver would (EAGAIN when
+// no frame is ready)
+int frame_source_ioctl(struct frame_source *src, unsigned int request, void *arg);
+
+// frames lost because no buffer was queued when they were due
+unsigned long long frame_source_dropped(const struct frame_source *src);
+
+#endif
@@ -0,0 +1,265 @@
+// RAM staging tier in front of the frame files, see framestage.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "framestage.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define NSEC_PER_MSEC (1000000ULL)
+
+// no glibc wrapper, see ioprio_set(2)
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_CLASS_BE (2)
+#define IOPRIO_WHO_PROCESS (1)
+#define IOPRIO_LOWEST_BE ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// threads inherit SCHED_FIFO from an RT creator, the flusher must not
+static void lower_priority(void)
+{
+    struct sched_param param;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+    setpriority(PRIO_PROCESS, (id_t)tid, 10);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_LOWEST_BE);
+}
+
+
+static void *flusher_thread(void *arg)
+{
+    struct frame_stage *st = arg;
+    struct frame_stage_job job;
+    unsigned long long next_ns = 0, start, t;
+    struct timespec deadline;
+    int rc, flat_out;
+
+    lower_priority();
+
+    pthread_mutex_lock(&st->lock);
+
+    for(;;)
+    {
+        while(st->count == 0 && !st->stop)
+            pthread_cond_wait(&st->ready, &st->lock);
+
+        if(st->count == 0)
+            break;
+
+        flat_out = st->stop || st->count >= st->high_water;
+
+        // paced below the high watermark, a put or the stop wakes it early
+        if(!flat_out && st->arrival_ns && (t = now_ns()) < next_ns)
+        {
+            deadline.tv_sec = (time_t)(next_ns / NSEC_PER_SEC);
+            deadline.tv_nsec = (long)(next_ns % NSEC_PER_SEC);
+            pthread_cond_timedwait(&st->ready, &st->lock, &deadline);
+            continue;
+        }
+
+        job = st->job[st->head];
+        st->head = (st->head + 1) % FRAME_POOL_MAX_SLOTS;
+        st->count--;
+
+        pthread_mutex_unlock(&st->lock);
+
+        start = now_ns();
+        if(st->bytes_per_pixel == 3)
+            rc = frame_dumper_ppm(&st->dumper, job.path, job.frame, st->width, st->height, &job.time_stamp);
+        else
+            rc = frame_dumper_pgm(&st->dumper, job.path, job.frame, st->width, st->height, &job.time_stamp);
+
+        pthread_mutex_lock(&st->lock);
+
+        next_ns = start + st->arrival_ns * 3 / 4;
+
+        if(rc < 0)
+        {
+            if(st->failed++ == 0)
+                fprintf(stderr, "frame stage %s: %s\n", job.path, strerror(errno));
+        }
+        else
+        {
+            st->flushed++;
+            st->flat_out += flat_out;
+            lat_hist_add(&st->lag, now_ns() - job.staged_ns);
+        }
+
+        frame_pool_put(&st->pool, job.frame);
+        st->buffered_bytes -= st->frame_bytes;
+    }
+
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+
+int frame_stage_start(struct frame_stage *st, int width, int height, int bytes_per_pixel, unsigned int slots,
+                      enum frame_stage_policy policy, enum frame_dump_mode mode)
+{
+    pthread_condattr_t attr;
+    int rc;
+
+    memset(st, 0, sizeof(*st));
+    st->width = width;
+    st->height = height;
+    st->bytes_per_pixel = bytes_per_pixel;
+    st->frame_bytes = (size_t)width * height * bytes_per_pixel;
+    st->policy = policy;
+    lat_hist_reset(&st->lag);
+
+    if(frame_pool_init(&st->pool, slots, st->frame_bytes) < 0)
+        return -1;
+
+    if(frame_dumper_init(&st->dumper, mode, st->frame_bytes) < 0)
+    {
+        frame_pool_free(&st->pool);
+        return -1;
+    }
+
+    st->high_water = (st->pool.slots * FRAME_STAGE_HIGH_PCT + 99) / 100;
+
+    // the pacing deadlines are CLOCK_MONOTONIC
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&st->ready, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&st->lock, NULL);
+
+    if((rc = pthread_create(&st->thread, NULL, flusher_thread, st)) != 0)
+    {
+        fprintf(stderr, "frame stage flusher: %s\n", strerror(rc));
+        frame_dumper_free(&st->dumper);
+        frame_pool_free(&st->pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void frame_stage_stop(struct frame_stage *st)
+{
+    pthread_mutex_lock(&st->lock);
+    st->stop = 1;
+    pthread_cond_signal(&st->ready);
+    pthread_mutex_unlock(&st->lock);
+
+    pthread_join(st->thread, NULL);
+
+    pthread_cond_destroy(&st->ready);
+    pthread_mutex_destroy(&st->lock);
+    frame_dumper_free(&st->dumper);
+    frame_pool_free(&st->pool);
+}
+
+
+int frame_stage_put(struct frame_stage *st, const char *path, const void *frame, const struct timespec *time_stamp)
+{
+    struct frame_stage_job *job;
+    unsigned long long now = now_ns();
+    unsigned char *slot;
+
+    // a truncated name would store the frame somewhere else
+    if(strlen(path) >= FRAME_STAGE_PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    pthread_mutex_lock(&st->lock);
+
+    if(st->last_put_ns)
+        st->arrival_ns = st->arrival_ns ? (st->arrival_ns * 7 + (now - st->last_put_ns)) / 8 : now - st->last_put_ns;
+    st->last_put_ns = now;
+
+    if((slot = frame_pool_get(&st->pool)) == NULL)
+    {
+        st->dropped++;
+
+        if(st->policy != FRAME_STAGE_DROP_OLDEST || st->count == 0)
+        {
+            pthread_mutex_unlock(&st->lock);
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        // the oldest staged frame gives up its slot
+        slot = st->job[st->head].frame;
+        st->head = (st->head + 1) % FRAME_POOL_MAX_SLOTS;
+        st->count--;
+        st->buffered_bytes -= st->frame_bytes;
+    }
+
+    pthread_mutex_unlock(&st->lock);
+
+    // the only cost the capture side sees, outside the lock
+    memcpy(slot, frame, st->frame_bytes);
+
+    pthread_mutex_lock(&st->lock);
+
+    // never full, there are no more jobs than pool slots
+    job = &st->job[(st->head + st->count) % FRAME_POOL_MAX_SLOTS];
+    job->frame = slot;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->time_stamp = *time_stamp;
+    job->staged_ns = now;
+    st->count++;
+    st->staged++;
+
+    st->buffered_bytes += st->frame_bytes;
+    if(st->buffered_bytes > st->peak_bytes)
+        st->peak_bytes = st->buffered_bytes;
+
+    pthread_cond_signal(&st->ready);
+    pthread_mutex_unlock(&st->lock);
+
+    return 0;
+}
+
+
+void frame_stage_counters(struct frame_stage *st, unsigned long long *buffered_bytes, unsigned long long *lag_ns)
+{
+    pthread_mutex_lock(&st->lock);
+
+    *buffered_bytes = st->buffered_bytes;
+    *lag_ns = st->count ? now_ns() - st->job[st->head].staged_ns : 0;
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+
+void frame_stage_report(const struct frame_stage *st, FILE *fp)
+{
+    fprintf(fp, "\nRAM staging, %u slots of %zu bytes on %s, stored %s\n", st->pool.slots, st->frame_bytes,
+            frame_pool_backing_name(&st->pool), frame_dump_mode_name(st->dumper.mode));
+    fprintf(fp, "    frames     staged=%llu flushed=%llu (%llu flat out) dropped=%llu (%s) failed=%llu\n",
+            st->staged, st->flushed, st->flat_out, st->dropped,
+            st->policy == FRAME_STAGE_DROP_OLDEST ? "oldest" : "newest", st->failed);
+    fprintf(fp, "    buffered   peak %.1lf MB of %.1lf MB, high watermark %u slots\n", st->peak_bytes / 1e6,
+            (double)st->pool.slots * st->frame_bytes / 1e6, st->high_water);
+
+    if(st->lag.count > 0)
+        fprintf(fp, "    flush lag  p50=%.1lf ms p99=%.1lf ms max=%.1lf ms\n",
+                lat_hist_percentile(&st->lag, 50.0) / (double)NSEC_PER_MSEC,
+                lat_hist_percentile(&st->lag, 99.0) / (double)NSEC_PER_MSEC, st->lag.max / (double)NSEC_PER_MSEC);
+}
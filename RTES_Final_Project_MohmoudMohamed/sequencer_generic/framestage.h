@@ -0,0 +1,96 @@
+#ifndef _FRAMESTAGE_H_
+#define _FRAMESTAGE_H_
+
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "framepool.h"
+#include "framedump.h"
+#include "lathist.h"
+
+// RAM staging tier in front of the frame files
+//
+// frame_stage_put() copies a frame into a slot of a frame pool (huge pages
+// where the kernel has them, see framepool.h) and queues it, so the capture
+// side only ever pays for a memcpy, however slow the card is right now.  A
+// flusher thread at normal priority, niced and at the lowest best-effort
+// I/O priority, drains the queue in order and stores each frame under the
+// path it was put with (see framedump.h for the write modes).
+//
+// The flusher adapts its rate: below the high watermark (FRAME_STAGE_HIGH_PCT
+// of the slots) it writes a frame every 3/4 of the mean time between
+// arrivals, keeping the card busy steadily instead of in bursts and still
+// draining any backlog; at or above it, it writes flat out until the queue
+// is below again.  When every slot is taken the policy decides: drop the
+// new frame, or drop the oldest staged one to keep the most recent footage.
+//
+// Counters for the bytes staged, the flush lag (staged to stored) and the
+// frames dropped are kept, frame_stage_counters() reads the live ones.
+
+#define FRAME_STAGE_HIGH_PCT (75)
+#define FRAME_STAGE_PATH_MAX (PATH_MAX)
+
+enum frame_stage_policy
+{
+    FRAME_STAGE_DROP_NEWEST = 0,
+    FRAME_STAGE_DROP_OLDEST
+};
+
+struct frame_stage_job
+{
+    unsigned char *frame;
+    char path[FRAME_STAGE_PATH_MAX];
+    struct timespec time_stamp;
+    unsigned long long staged_ns;
+};
+
+struct frame_stage
+{
+    int width;
+    int height;
+    int bytes_per_pixel;                // 1 stored as PGM, 3 as PPM
+    size_t frame_bytes;
+    enum frame_stage_policy policy;
+
+    struct frame_pool pool;
+    struct frame_dumper dumper;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct frame_stage_job job[FRAME_POOL_MAX_SLOTS];
+    unsigned int head, count;
+    unsigned int high_water;
+    int stop;
+
+    unsigned long long arrival_ns;      // mean time between puts
+    unsigned long long last_put_ns;
+
+    unsigned long long staged;
+    unsigned long long flushed;
+    unsigned long long flat_out;        // flushed at or above the high watermark
+    unsigned long long dropped;
+    unsigned long long failed;
+    unsigned long long buffered_bytes;
+    unsigned long long peak_bytes;
+    struct lat_hist lag;                // staged to stored, ns
+};
+
+int frame_stage_start(struct frame_stage *st, int width, int height, int bytes_per_pixel, unsigned int slots,
+                      enum frame_stage_policy policy, enum frame_dump_mode mode);
+
+// flushes everything staged, then stops the flusher and frees the slots
+void frame_stage_stop(struct frame_stage *st);
+
+// copies the frame in; -1 with errno ENOBUFS when it was dropped, or
+// ENAMETOOLONG when the path does not fit FRAME_STAGE_PATH_MAX
+int frame_stage_put(struct frame_stage *st, const char *path, const void *frame, const struct timespec *time_stamp);
+
+// bytes staged now and the age of the oldest staged frame
+void frame_stage_counters(struct frame_stage *st, unsigned long long *buffered_bytes, unsigned long long *lag_ns);
+
+void frame_stage_report(const struct frame_stage *st, FILE *fp);
+
+#endif
@@ -0,0 +1,210 @@
+// Cross-camera frame set assembly by driver time stamp, see framesync.h
+
+#include <string.h>
+
+#include "framesync.h"
+
+
+// index of camera pair i < j in the pair table
+static int pair_index(int i, int j)
+{
+    return i * (2 * FRAME_SYNC_MAX_SOURCES - i - 1) / 2 + (j - i - 1);
+}
+
+
+static struct frame_sync_entry *oldest(struct frame_sync_source *src, unsigned int n)
+{
+    return &src->entry[(src->head + n) % FRAME_SYNC_DEPTH];
+}
+
+
+static void drop_oldest(struct frame_sync *sync, int s)
+{
+    struct frame_sync_source *src = &sync->source[s];
+
+    if(sync->release && oldest(src, 0)->frame)
+        sync->release(sync->ctx, s, oldest(src, 0)->frame);
+
+    src->head = (src->head + 1) % FRAME_SYNC_DEPTH;
+    src->count--;
+}
+
+
+static void emit_set(struct frame_sync *sync)
+{
+    struct frame_sync_set set;
+    unsigned long long first = ~0ULL, last = 0, ti, tj;
+    int i, j;
+
+    set.set_num = sync->sets++;
+
+    for(i = 0; i < sync->nsources; i++)
+    {
+        struct frame_sync_source *src = &sync->source[i];
+
+        set.entry[i] = *oldest(src, 0);
+        src->head = (src->head + 1) % FRAME_SYNC_DEPTH;
+        src->count--;
+        src->matched++;
+
+        if(set.entry[i].ts_ns < first) first = set.entry[i].ts_ns;
+        if(set.entry[i].ts_ns > last) last = set.entry[i].ts_ns;
+    }
+
+    set.skew_ns = last - first;
+
+    for(i = 0; i < sync->nsources; i++)
+        for(j = i + 1; j < sync->nsources; j++)
+        {
+            struct frame_sync_pair *pair = &sync->pair[pair_index(i, j)];
+
+            ti = set.entry[i].ts_ns;
+            tj = set.entry[j].ts_ns;
+            lat_hist_add(&pair->skew, ti > tj ? ti - tj : tj - ti);
+            pair->signed_sum += (long long)(tj - ti);
+        }
+
+    if(sync->emit)
+        sync->emit(sync->ctx, sync->nsources, &set);
+}
+
+
+// emit every set the queued frames make up
+static void match(struct frame_sync *sync)
+{
+    unsigned long long pivot;
+    int i, again;
+
+    for(;;)
+    {
+        pivot = 0;
+
+        for(i = 0; i < sync->nsources; i++)
+        {
+            if(sync->source[i].count == 0)
+                return;
+
+            if(oldest(&sync->source[i], 0)->ts_ns > pivot)
+                pivot = oldest(&sync->source[i], 0)->ts_ns;
+        }
+
+        again = 0;
+
+        for(i = 0; i < sync->nsources; i++)
+        {
+            struct frame_sync_source *src = &sync->source[i];
+
+            if(oldest(src, 0)->ts_ns + sync->tolerance_ns < pivot ||
+               (src->count > 1 && oldest(src, 1)->ts_ns <= pivot))
+            {
+                drop_oldest(sync, i);
+                src->expired++;
+                again = 1;
+            }
+        }
+
+        if(!again)
+            emit_set(sync);
+    }
+}
+
+
+int frame_sync_init(struct frame_sync *sync, int nsources, unsigned long long tolerance_ns,
+                    frame_sync_emit_fn emit, frame_sync_release_fn release, void *ctx)
+{
+    int p;
+
+    if(nsources < 1 || nsources > FRAME_SYNC_MAX_SOURCES)
+        return -1;
+
+    memset(sync, 0, sizeof(*sync));
+    sync->nsources = nsources;
+    sync->tolerance_ns = tolerance_ns;
+    sync->emit = emit;
+    sync->release = release;
+    sync->ctx = ctx;
+
+    for(p = 0; p < FRAME_SYNC_PAIRS; p++)
+        lat_hist_reset(&sync->pair[p].skew);
+
+    pthread_mutex_init(&sync->lock, NULL);
+    return 0;
+}
+
+
+void frame_sync_destroy(struct frame_sync *sync)
+{
+    int i;
+
+    pthread_mutex_lock(&sync->lock);
+
+    for(i = 0; i < sync->nsources; i++)
+        while(sync->source[i].count > 0)
+            drop_oldest(sync, i);
+
+    pthread_mutex_unlock(&sync->lock);
+    pthread_mutex_destroy(&sync->lock);
+}
+
+
+void frame_sync_push(struct frame_sync *sync, int source, unsigned long long ts_ns, unsigned long long frame_num,
+                     void *frame)
+{
+    struct frame_sync_source *src = &sync->source[source];
+    struct frame_sync_entry *entry;
+
+    pthread_mutex_lock(&sync->lock);
+
+    src->pushed++;
+
+    if(src->count == FRAME_SYNC_DEPTH)
+    {
+        drop_oldest(sync, source);
+        src->evicted++;
+    }
+
+    entry = oldest(src, src->count);
+    entry->ts_ns = ts_ns;
+    entry->frame_num = frame_num;
+    entry->frame = frame;
+    src->count++;
+
+    match(sync);
+
+    pthread_mutex_unlock(&sync->lock);
+}
+
+
+void frame_sync_report(const struct frame_sync *sync, FILE *fp)
+{
+    int i, j;
+
+    fprintf(fp, "\nFrame sets within %.1lf us: %llu\n", sync->tolerance_ns / 1000.0, sync->sets);
+    fprintf(fp, "    %-8s %10s %10s %10s %10s\n", "camera", "frames", "matched", "expired", "evicted");
+
+    for(i = 0; i < sync->nsources; i++)
+    {
+        const struct frame_sync_source *src = &sync->source[i];
+
+        fprintf(fp, "    %-8d %10llu %10llu %10llu %10llu\n", i, src->pushed, src->matched, src->expired, src->evicted);
+    }
+
+    if(sync->nsources > 1 && sync->sets > 0)
+    {
+        fprintf(fp, "    %-8s %12s %10s %10s %10s\n", "pair", "mean us", "p50 us", "p99 us", "max us");
+
+        for(i = 0; i < sync->nsources; i++)
+            for(j = i + 1; j < sync->nsources; j++)
+            {
+                const struct frame_sync_pair *pair = &sync->pair[pair_index(i, j)];
+                char name[32];
+
+                // signed mean, positive when camera j captures after camera i
+                snprintf(name, sizeof(name), "%d-%d", i, j);
+                fprintf(fp, "    %-8s %+12.1lf %10.1lf %10.1lf %10.1lf\n", name,
+                        (double)pair->signed_sum / pair->skew.count / 1000.0,
+                        lat_hist_percentile(&pair->skew, 50.0) / 1000.0,
+                        lat_hist_percentile(&pair->skew, 99.0) / 1000.0, pair->skew.max / 1000.0);
+            }
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef _FRAMESYNC_H_
+#define _FRAMESYNC_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "lathist.h"
+
+// Cross-camera frame set assembly by driver time stamp
+//
+// Each camera pushes every frame it captures with its CLOCK_MONOTONIC time
+// stamp.  Frames wait in a small per-camera queue until every camera has
+// one, then the synchronizer takes the latest of the oldest frames as the
+// pivot and
+//
+//   - drops frames older than pivot - tolerance, nothing at or after the
+//     pivot can match them any more (expired)
+//   - moves on to a camera's next frame when that one is still no later
+//     than the pivot, it is closer (expired as well)
+//   - otherwise emits the oldest frame of every camera as one set, all of
+//     them within the tolerance of each other
+//
+// A push never waits.  When a camera stalls, the queues of the others fill
+// up and their oldest frames are dropped (evicted), so memory stays at
+// FRAME_SYNC_DEPTH frames per camera and the faster cameras keep running.
+// Dropped frames go back through the release callback, emitted sets through
+// the emit callback, both called by the pushing thread with the
+// synchronizer locked, so they must not push.
+//
+// The skew of every camera pair within each set (|t_i - t_j|) is kept in a
+// histogram per pair, together with the signed mean, which shows a constant
+// offset between two cameras.
+
+#define FRAME_SYNC_MAX_SOURCES (8)
+#define FRAME_SYNC_DEPTH (4)
+#define FRAME_SYNC_PAIRS (FRAME_SYNC_MAX_SOURCES * (FRAME_SYNC_MAX_SOURCES - 1) / 2)
+
+struct frame_sync_entry
+{
+    unsigned long long ts_ns;
+    unsigned long long frame_num;
+    void *frame;
+};
+
+struct frame_sync_source
+{
+    struct frame_sync_entry entry[FRAME_SYNC_DEPTH];
+    unsigned int head, count;
+
+    unsigned long long pushed;
+    unsigned long long matched;
+    unsigned long long expired;     // no partner within the tolerance
+    unsigned long long evicted;     // queue full while another camera lagged
+};
+
+struct frame_sync_set
+{
+    unsigned long long set_num;
+    unsigned long long skew_ns;     // latest - earliest time stamp
+    struct frame_sync_entry entry[FRAME_SYNC_MAX_SOURCES];
+};
+
+struct frame_sync_pair
+{
+    struct lat_hist skew;           // |t_i - t_j| in ns
+    long long signed_sum;           // of t_j - t_i
+};
+
+typedef void (*frame_sync_emit_fn)(void *ctx, int nsources, const struct frame_sync_set *set);
+typedef void (*frame_sync_release_fn)(void *ctx, int source, void *frame);
+
+struct frame_sync
+{
+    int nsources;
+    unsigned long long tolerance_ns;
+
+    frame_sync_emit_fn emit;
+    frame_sync_release_fn release;
+    void *ctx;
+
+    pthread_mutex_t lock;
+    struct frame_sync_source source[FRAME_SYNC_MAX_SOURCES];
+    struct frame_sync_pair pair[FRAME_SYNC_PAIRS];
+    unsigned long long sets;
+};
+
+int frame_sync_init(struct frame_sync *sync, int nsources, unsigned long long tolerance_ns,
+                    frame_sync_emit_fn emit, frame_sync_release_fn release, void *ctx);
+
+// releases the frames still waiting for a partner
+void frame_sync_destroy(struct frame_sync *sync);
+
+void frame_sync_push(struct frame_sync *sync, int source, unsigned long long ts_ns, unsigned long long frame_num,
+                     void *frame);
+
+// counts and skew statistics, once nothing pushes any more
+void frame_sync_report(const struct frame_sync *sync, FILE *fp);
+
+#endif
@@ -0,0 +1,234 @@
+// Per-frame pipeline latency tracing, see frametrace.h
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "frametrace.h"
+#include "lathist.h"
+#include "hrtime.h"
+
+#define NSEC_PER_USEC (1000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+
+struct trace_interval
+{
+    const char *name;
+    enum frame_trace_stage from;
+    enum frame_trace_stage to;
+    int lane;               // Chrome trace thread row, 0 = summary only
+};
+
+static const struct trace_interval trace_interval[] =
+{
+    { "sensor->dqbuf",     TRACE_SENSOR,       TRACE_DQBUF,        1 },
+    { "dqbuf->process",    TRACE_DQBUF,        TRACE_PROC_START,   0 },
+    { "process",           TRACE_PROC_START,   TRACE_PROC_END,     2 },
+    { "process->write",    TRACE_PROC_END,     TRACE_WRITE_SUBMIT, 0 },
+    { "write",             TRACE_WRITE_SUBMIT, TRACE_WRITE_DONE,   3 },
+    { "buffer held",       TRACE_DQBUF,        TRACE_QBUF,         4 },
+    { "dqbuf->written",    TRACE_DQBUF,        TRACE_WRITE_DONE,   0 },
+    { "sensor->written",   TRACE_SENSOR,       TRACE_WRITE_DONE,   0 }
+};
+
+#define TRACE_INTERVALS ((int)(sizeof(trace_interval) / sizeof(trace_interval[0])))
+
+static const char *lane_name[] = { "", "driver", "process", "write", "buffer" };
+
+static struct frame_trace_record trace_ring[FRAME_TRACE_RECORDS];
+
+// intervals of records already evicted from the ring
+static struct lat_hist evicted_hist[TRACE_INTERVALS];
+
+// scratch for the report so it can be printed more than once
+static struct lat_hist report_hist[TRACE_INTERVALS];
+
+
+static void aggregate(const struct frame_trace_record *rec, struct lat_hist *hist)
+{
+    int i;
+
+    for(i = 0; i < TRACE_INTERVALS; i++)
+    {
+        unsigned long long from = rec->ts[trace_interval[i].from];
+        unsigned long long to = rec->ts[trace_interval[i].to];
+
+        if(from && to && to >= from)
+            lat_hist_add(&hist[i], to - from);
+    }
+}
+
+
+void frame_trace_init(void)
+{
+    int i;
+
+    hrtime_init();
+
+    for(i = 0; i < FRAME_TRACE_RECORDS; i++)
+    {
+        memset(&trace_ring[i], 0, sizeof(trace_ring[i]));
+        trace_ring[i].frame = -1;
+    }
+
+    for(i = 0; i < TRACE_INTERVALS; i++)
+        lat_hist_reset(&evicted_hist[i]);
+}
+
+
+unsigned long long frame_trace_now(void)
+{
+    return hrtime_now();
+}
+
+
+void frame_trace_mark(int frame, enum frame_trace_stage stage, unsigned long long ts_ns)
+{
+    struct frame_trace_record *rec;
+
+    // startup frames while the camera settles are not traced
+    if(frame < 0 || stage >= TRACE_STAGES)
+        return;
+
+    rec = &trace_ring[frame % FRAME_TRACE_RECORDS];
+
+    if(rec->frame != frame)
+    {
+        if(rec->frame >= 0)
+            aggregate(rec, evicted_hist);
+
+        memset(rec, 0, sizeof(*rec));
+        rec->frame = frame;
+    }
+
+    rec->ts[stage] = ts_ns;
+}
+
+
+void frame_trace_mark_now(int frame, enum frame_trace_stage stage)
+{
+    frame_trace_mark(frame, stage, frame_trace_now());
+}
+
+
+void frame_trace_sensor(int frame, const struct timeval *tv)
+{
+    unsigned long long ts_ns, mono_ns, age_ns, now_ns;
+    struct timespec ts;
+
+    ts_ns = (unsigned long long)tv->tv_sec * NSEC_PER_SEC + (unsigned long long)tv->tv_usec * NSEC_PER_USEC;
+
+    if(ts_ns == 0)
+        return;
+
+    // the driver stamps CLOCK_MONOTONIC, which NTP slews against the raw
+    // timeline of the other stages, so carry over only the age of the frame
+    now_ns = frame_trace_now();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    mono_ns = (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+    age_ns = mono_ns > ts_ns ? mono_ns - ts_ns : 0;
+
+    frame_trace_mark(frame, TRACE_SENSOR, now_ns > age_ns ? now_ns - age_ns : 1);
+}
+
+
+void frame_trace_report(FILE *fp)
+{
+    int i, frames = 0;
+
+    for(i = 0; i < TRACE_INTERVALS; i++)
+        report_hist[i] = evicted_hist[i];
+
+    for(i = 0; i < FRAME_TRACE_RECORDS; i++)
+    {
+        if(trace_ring[i].frame >= 0)
+        {
+            aggregate(&trace_ring[i], report_hist);
+            frames++;
+        }
+    }
+
+    fprintf(fp, "\nFrame pipeline latency (%d frames in trace ring), microseconds\n", frames);
+    fprintf(fp, "%-18s %8s %10s %10s %10s %10s %10s\n", "interval", "count", "min", "avg", "p50", "p99", "max");
+
+    for(i = 0; i < TRACE_INTERVALS; i++)
+    {
+        const struct lat_hist *h = &report_hist[i];
+
+        if(h->count == 0)
+        {
+            fprintf(fp, "%-18s %8d %10s %10s %10s %10s %10s\n", trace_interval[i].name, 0, "-", "-", "-", "-", "-");
+            continue;
+        }
+
+        fprintf(fp, "%-18s %8llu %10.1lf %10.1lf %10.1lf %10.1lf %10.1lf\n", trace_interval[i].name, h->count,
+                (double)h->min / 1000.0, lat_hist_mean(h) / 1000.0,
+                (double)lat_hist_percentile(h, 50.0) / 1000.0,
+                (double)lat_hist_percentile(h, 99.0) / 1000.0,
+                (double)h->max / 1000.0);
+    }
+}
+
+
+int frame_trace_export_chrome(const char *path)
+{
+    FILE *fp;
+    unsigned long long base = ~0ULL;
+    int i, j, lane, first = 1;
+
+    for(i = 0; i < FRAME_TRACE_RECORDS; i++)
+    {
+        if(trace_ring[i].frame < 0)
+            continue;
+
+        for(j = 0; j < TRACE_STAGES; j++)
+            if(trace_ring[i].ts[j] && trace_ring[i].ts[j] < base)
+                base = trace_ring[i].ts[j];
+    }
+
+    if(base == ~0ULL)
+        return 0;
+
+    if((fp = fopen(path, "w")) == NULL)
+    {
+        perror("frame trace export");
+        return -1;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for(lane = 1; lane < (int)(sizeof(lane_name) / sizeof(lane_name[0])); lane++)
+    {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", lane, lane_name[lane]);
+        first = 0;
+    }
+
+    for(i = 0; i < FRAME_TRACE_RECORDS; i++)
+    {
+        const struct frame_trace_record *rec = &trace_ring[i];
+
+        if(rec->frame < 0)
+            continue;
+
+        for(j = 0; j < TRACE_INTERVALS; j++)
+        {
+            unsigned long long from = rec->ts[trace_interval[j].from];
+            unsigned long long to = rec->ts[trace_interval[j].to];
+
+            if(trace_interval[j].lane == 0 || !from || !to || to < from)
+                continue;
+
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                        "\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"frame\":%d}}",
+                    trace_interval[j].name, trace_interval[j].lane,
+                    (double)(from - base) / 1000.0, (double)(to - from) / 1000.0, rec->frame);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    printf("Frame trace written to %s\n", path);
+    return 0;
+}
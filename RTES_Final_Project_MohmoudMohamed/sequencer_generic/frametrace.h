@@ -0,0 +1,52 @@
+#ifndef _FRAMETRACE_H_
+#define _FRAMETRACE_H_
+
+#include <stdio.h>
+#include <sys/time.h>
+
+// Per-frame pipeline latency tracing
+//
+// Every stage of the acquisition pipeline stamps the frame it is working on.
+// Records are kept in a ring of the last FRAME_TRACE_RECORDS frames, and the
+// time between stages is accumulated into per-interval latency histograms
+// when a record is evicted or the report is printed, so long runs keep
+// constant memory.  The ring can be exported as Chrome trace event JSON,
+// which chrome://tracing and ui.perfetto.dev both load, to see how frames
+// overlap in the pipeline.
+//
+// Each stage of a frame is written by one thread only, so no locking is done.
+
+#define FRAME_TRACE_RECORDS (4096)
+
+enum frame_trace_stage
+{
+    TRACE_SENSOR = 0,       // driver timestamp of the frame (start of exposure/readout)
+    TRACE_DQBUF,            // VIDIOC_DQBUF returned the buffer
+    TRACE_PROC_START,       // processing (color conversion etc.) started
+    TRACE_PROC_END,         // processing done
+    TRACE_WRITE_SUBMIT,     // storage of the frame started
+    TRACE_WRITE_DONE,       // frame is in the file
+    TRACE_QBUF,             // buffer given back to the driver
+    TRACE_STAGES
+};
+
+struct frame_trace_record
+{
+    int frame;
+    unsigned long long ts[TRACE_STAGES];    // nanoseconds, 0 when not reached
+};
+
+void frame_trace_init(void);
+unsigned long long frame_trace_now(void);
+
+void frame_trace_mark(int frame, enum frame_trace_stage stage, unsigned long long ts_ns);
+void frame_trace_mark_now(int frame, enum frame_trace_stage stage);
+
+// V4L2 buffer timestamp, only usable with V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC,
+// the other stages are stamped with hrtime_now()
+void frame_trace_sensor(int frame, const struct timeval *tv);
+
+void frame_trace_report(FILE *fp);
+int frame_trace_export_chrome(const char *path);
+
+#endif
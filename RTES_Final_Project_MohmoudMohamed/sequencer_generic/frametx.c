@@ -0,0 +1,422 @@
+// Transmission of stored frames to a remote server over TCP, see frametx.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "frametx.h"
+
+#define NSEC_PER_MSEC (1000000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+#define SEND_TIMEOUT_SEC (2)        // a stalled server counts as a lost connection
+
+
+static unsigned long long clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static int connect_addr(const struct addrinfo *ai)
+{
+    struct timeval timeout = { SEND_TIMEOUT_SEC, 0 };
+    struct pollfd pfd;
+    socklen_t len = sizeof(int);
+    int sock, err = 0, one = 1;
+
+    if((sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+        return -1;
+
+    // non-blocking only to bound the connect, sends block with a timeout
+    if(connect(sock, ai->ai_addr, ai->ai_addrlen) < 0)
+    {
+        if(errno != EINPROGRESS)
+            goto fail;
+
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+
+        if(poll(&pfd, 1, FRAME_TX_CONNECT_MS) <= 0)
+        {
+            errno = ETIMEDOUT;
+            goto fail;
+        }
+
+        if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            errno = err ? err : errno;
+            goto fail;
+        }
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+
+fail:
+    err = errno;
+    close(sock);
+    errno = err;
+    return -1;
+}
+
+
+static int connect_server(struct frame_tx *tx)
+{
+    struct addrinfo hints, *res, *ai;
+    char port[16];
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", tx->port);
+
+    if((rc = getaddrinfo(tx->host, port, &hints, &res)) != 0)
+    {
+        fprintf(stderr, "frame tx %s: %s\n", tx->host, gai_strerror(rc));
+        return -1;
+    }
+
+    for(ai = res; ai; ai = ai->ai_next)
+        if((tx->sock = connect_addr(ai)) >= 0)
+            break;
+
+    freeaddrinfo(res);
+    return tx->sock >= 0 ? 0 : -1;
+}
+
+
+static int send_all(int sock, const void *buf, size_t len, int flags)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while(len > 0)
+    {
+        if((n = send(sock, p, len, flags | MSG_NOSIGNAL)) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+
+// header and file, -1 when the connection is unusable, 1 when only the file was
+static int send_frame(struct frame_tx *tx, const struct frame_tx_job *job)
+{
+    struct frame_tx_header header;
+    struct stat st;
+    off_t offset = 0;
+    ssize_t n;
+    int fd;
+
+    if((fd = open(job->path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "frame tx %s: %s\n", job->path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    header.magic = htonl(FRAME_TX_MAGIC);
+    header.header_size = htonl(sizeof(header));
+    header.frame_num = htobe64(job->frame_num);
+    header.capture_ns = htobe64(job->capture_ns);
+    header.send_ns = htobe64(clock_ns(CLOCK_REALTIME));
+    header.payload_size = htonl((uint32_t)st.st_size);
+    header.reserved = 0;
+
+    if(send_all(tx->sock, &header, sizeof(header), MSG_MORE) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // a file that shrank leaves the stream short, the connection has to go
+    while(offset < st.st_size)
+    {
+        if((n = sendfile(tx->sock, fd, &offset, (size_t)(st.st_size - offset))) <= 0)
+        {
+            if(n < 0 && errno == EINTR)
+                continue;
+
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+    tx->bytes += sizeof(header) + (unsigned long long)st.st_size;
+    return 0;
+}
+
+
+// frames not sent go back to the front of the queue, as far as there is room
+static void requeue(struct frame_tx *tx, const struct frame_tx_job *batch, unsigned int n)
+{
+    while(n-- > 0)
+    {
+        if(tx->count == FRAME_TX_QUEUE)
+        {
+            tx->dropped++;
+            continue;
+        }
+
+        tx->head = (tx->head + FRAME_TX_QUEUE - 1) % FRAME_TX_QUEUE;
+        tx->job[tx->head] = batch[n];
+        tx->count++;
+    }
+}
+
+
+static void disconnect(struct frame_tx *tx)
+{
+    close(tx->sock);
+    tx->sock = -1;
+    tx->backoff_ms = FRAME_TX_BACKOFF_MIN_MS;
+    tx->retry_ns = clock_ns(CLOCK_MONOTONIC) + tx->backoff_ms * NSEC_PER_MSEC;
+}
+
+
+// called without the lock, returns how many frames of the batch were used up
+static unsigned int send_batch(struct frame_tx *tx, const struct frame_tx_job *batch, unsigned int n)
+{
+    int on = 1, off = 0, rc = 0;
+    unsigned int i;
+
+    setsockopt(tx->sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+    for(i = 0; i < n; i++)
+    {
+        if((rc = send_frame(tx, &batch[i])) < 0)
+            break;
+
+        if(rc > 0)
+        {
+            tx->failed++;
+            continue;
+        }
+
+        tx->sent++;
+        lat_hist_add(&tx->queue_delay, clock_ns(CLOCK_MONOTONIC) - batch[i].submit_ns);
+    }
+
+    if(rc < 0)
+    {
+        fprintf(stderr, "frame tx %s:%d: %s, reconnecting\n", tx->host, tx->port, strerror(errno));
+        tx->failed++;
+        disconnect(tx);
+        return i + 1;
+    }
+
+    // pushes out the last partial segment
+    setsockopt(tx->sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    tx->batches++;
+    return n;
+}
+
+
+static void *sender_thread(void *arg)
+{
+    struct frame_tx *tx = arg;
+    struct frame_tx_job batch[FRAME_TX_QUEUE];
+    struct timespec until;
+    unsigned int n, used;
+
+    pthread_mutex_lock(&tx->lock);
+
+    for(;;)
+    {
+        while(tx->count == 0 && !tx->stop)
+            pthread_cond_wait(&tx->ready, &tx->lock);
+
+        if(tx->count == 0)
+            break;
+
+        if(tx->sock < 0)
+        {
+            // no new connection just to flush at shutdown
+            if(tx->stop)
+            {
+                tx->failed += tx->count;
+                tx->count = 0;
+                break;
+            }
+
+            if(clock_ns(CLOCK_MONOTONIC) < tx->retry_ns)
+            {
+                until.tv_sec = tx->retry_ns / NSEC_PER_SEC;
+                until.tv_nsec = tx->retry_ns % NSEC_PER_SEC;
+                pthread_cond_timedwait(&tx->ready, &tx->lock, &until);
+                continue;
+            }
+
+            pthread_mutex_unlock(&tx->lock);
+
+            if(connect_server(tx) == 0)
+            {
+                tx->connects++;
+                tx->backoff_ms = FRAME_TX_BACKOFF_MIN_MS;
+            }
+            else
+            {
+                if(tx->backoff_ms == FRAME_TX_BACKOFF_MIN_MS)
+                    fprintf(stderr, "frame tx %s:%d: %s, retrying up to every %d ms\n", tx->host, tx->port,
+                            strerror(errno), FRAME_TX_BACKOFF_MAX_MS);
+
+                tx->retry_ns = clock_ns(CLOCK_MONOTONIC) + tx->backoff_ms * NSEC_PER_MSEC;
+                tx->backoff_ms = tx->backoff_ms * 2 > FRAME_TX_BACKOFF_MAX_MS ? FRAME_TX_BACKOFF_MAX_MS : tx->backoff_ms * 2;
+            }
+
+            pthread_mutex_lock(&tx->lock);
+            continue;
+        }
+
+        // everything queued goes out as one corked batch
+        for(n = 0; tx->count > 0; n++)
+        {
+            batch[n] = tx->job[tx->head];
+            tx->head = (tx->head + 1) % FRAME_TX_QUEUE;
+            tx->count--;
+        }
+
+        pthread_mutex_unlock(&tx->lock);
+        used = send_batch(tx, batch, n);
+        pthread_mutex_lock(&tx->lock);
+
+        requeue(tx, batch + used, n - used);
+    }
+
+    pthread_mutex_unlock(&tx->lock);
+    return NULL;
+}
+
+
+int frame_tx_start(struct frame_tx *tx, const char *host, int port)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    int rc;
+
+    memset(tx, 0, sizeof(*tx));
+    snprintf(tx->host, sizeof(tx->host), "%s", host);
+    tx->port = port > 0 ? port : FRAME_TX_PORT;
+    tx->sock = -1;
+    tx->backoff_ms = FRAME_TX_BACKOFF_MIN_MS;
+    lat_hist_reset(&tx->queue_delay);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // the services submitting run SCHED_FIFO above the sender
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&tx->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&tx->ready, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    if((rc = pthread_create(&tx->thread, NULL, sender_thread, tx)) != 0)
+    {
+        fprintf(stderr, "frame tx thread: %s\n", strerror(rc));
+        pthread_cond_destroy(&tx->ready);
+        pthread_mutex_destroy(&tx->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void frame_tx_stop(struct frame_tx *tx)
+{
+    pthread_mutex_lock(&tx->lock);
+    tx->stop = 1;
+    pthread_cond_signal(&tx->ready);
+    pthread_mutex_unlock(&tx->lock);
+
+    pthread_join(tx->thread, NULL);
+
+    if(tx->sock >= 0)
+        close(tx->sock);
+    tx->sock = -1;
+
+    pthread_cond_destroy(&tx->ready);
+    pthread_mutex_destroy(&tx->lock);
+}
+
+
+int frame_tx_submit(struct frame_tx *tx, const char *path, unsigned long long frame_num,
+                    const struct timespec *capture_time)
+{
+    struct frame_tx_job *job;
+    int rc = 0;
+
+    pthread_mutex_lock(&tx->lock);
+
+    if(tx->count == FRAME_TX_QUEUE)
+    {
+        tx->head = (tx->head + 1) % FRAME_TX_QUEUE;
+        tx->count--;
+        tx->dropped++;
+        rc = 1;
+    }
+
+    job = &tx->job[(tx->head + tx->count) % FRAME_TX_QUEUE];
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->frame_num = frame_num;
+    job->capture_ns = (unsigned long long)capture_time->tv_sec * NSEC_PER_SEC + capture_time->tv_nsec;
+    job->submit_ns = clock_ns(CLOCK_MONOTONIC);
+
+    tx->count++;
+    tx->submitted++;
+
+    pthread_cond_signal(&tx->ready);
+    pthread_mutex_unlock(&tx->lock);
+
+    return rc;
+}
+
+
+void frame_tx_report(struct frame_tx *tx, FILE *fp)
+{
+    fprintf(fp, "\nFrame transmission to %s:%d\n", tx->host, tx->port);
+    fprintf(fp, "    frames     submitted=%llu sent=%llu dropped=%llu failed=%llu\n", tx->submitted, tx->sent,
+            tx->dropped, tx->failed);
+    fprintf(fp, "    network    %.2lf MB in %llu batches, %llu connections\n", tx->bytes / 1e6, tx->batches,
+            tx->connects);
+
+    if(tx->queue_delay.count > 0)
+        fprintf(fp, "    queued     p50=%.1lf us p99=%.1lf us max=%.1lf us (submit to sent)\n",
+                lat_hist_percentile(&tx->queue_delay, 50.0) / 1000.0,
+                lat_hist_percentile(&tx->queue_delay, 99.0) / 1000.0, tx->queue_delay.max / 1000.0);
+}
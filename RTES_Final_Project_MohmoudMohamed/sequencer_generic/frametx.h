@@ -0,0 +1,102 @@
+#ifndef _FRAMETX_H_
+#define _FRAMETX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lathist.h"
+
+// Transmission of stored frames to a remote server over TCP
+//
+// A service hands over the path of each frame file it has written with
+// frame_tx_submit().  That only copies the path into a bounded queue under a
+// priority inheritance mutex, it never waits for the network: when the
+// queue is full the oldest frame is dropped.  A sender thread at normal
+// priority owns the socket and sends each file as a header followed by the
+// file contents with sendfile(), straight from the page cache without a
+// copy through user space.  All frames queued at once are sent as one batch
+// with TCP_CORK set, so small frames share segments instead of each going
+// out with its own partly filled one.
+//
+// When the server is not there or the connection breaks, the sender retries
+// with an exponential backoff (FRAME_TX_BACKOFF_MIN_MS doubling up to
+// FRAME_TX_BACKOFF_MAX_MS), frames queued meanwhile wait and the frame that
+// failed is counted and not sent again.  SIGPIPE is ignored from
+// frame_tx_start() on, a broken connection shows up as an error instead.
+//
+// Each frame on the wire is a struct frame_tx_header, all fields in network
+// byte order, followed by payload_size bytes of the file (a PGM or PPM
+// image as written by framedump.c).  capture_ns is the frame time stamp on
+// the sender's CLOCK_MONOTONIC, send_ns the CLOCK_REALTIME when the sender
+// started on the frame; see framerx.c for a receiver.
+
+#define FRAME_TX_MAGIC (0x46545831)     // "FTX1"
+#define FRAME_TX_PORT (5600)
+#define FRAME_TX_QUEUE (16)
+#define FRAME_TX_PATH_MAX (256)
+#define FRAME_TX_BACKOFF_MIN_MS (100)
+#define FRAME_TX_BACKOFF_MAX_MS (5000)
+#define FRAME_TX_CONNECT_MS (1000)
+
+struct frame_tx_header
+{
+    uint32_t magic;
+    uint32_t header_size;           // sizeof(struct frame_tx_header)
+    uint64_t frame_num;
+    uint64_t capture_ns;
+    uint64_t send_ns;
+    uint32_t payload_size;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct frame_tx_job
+{
+    char path[FRAME_TX_PATH_MAX];
+    unsigned long long frame_num;
+    unsigned long long capture_ns;
+    unsigned long long submit_ns;
+};
+
+struct frame_tx
+{
+    char host[128];
+    int port;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct frame_tx_job job[FRAME_TX_QUEUE];
+    unsigned int head, count;
+    int stop;
+
+    // sender thread only
+    int sock;
+    unsigned int backoff_ms;
+    unsigned long long retry_ns;
+
+    unsigned long long submitted;
+    unsigned long long sent;
+    unsigned long long dropped;     // queue full, oldest frame given up
+    unsigned long long failed;      // file unreadable or connection lost
+    unsigned long long batches;
+    unsigned long long connects;
+    unsigned long long bytes;
+    struct lat_hist queue_delay;    // submit to last byte handed to TCP
+};
+
+// host is a name or address, the sender connects in the background
+int frame_tx_start(struct frame_tx *tx, const char *host, int port);
+
+// sends what is queued while connected, then stops the sender thread
+void frame_tx_stop(struct frame_tx *tx);
+
+// never blocks on the network, 0 when queued, 1 when an older frame had
+// to be dropped to make room
+int frame_tx_submit(struct frame_tx *tx, const char *path, unsigned long long frame_num,
+                    const struct timespec *capture_time);
+
+void frame_tx_report(struct frame_tx *tx, FILE *fp);
+
+#endif
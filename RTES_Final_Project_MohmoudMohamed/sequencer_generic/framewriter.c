@@ -0,0 +1,154 @@
+// Asynchronous PGM writer shared by several capture pipelines, see framewriter.h
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "framewriter.h"
+#include "framedump.h"
+
+
+static void *writer_thread(void *arg)
+{
+    struct frame_writer *w = arg;
+    struct frame_writer_job job;
+    char path[512];
+    int rc;
+
+    pthread_mutex_lock(&w->lock);
+
+    for(;;)
+    {
+        while(w->count == 0 && !w->stop)
+            pthread_cond_wait(&w->ready, &w->lock);
+
+        if(w->count == 0)
+            break;
+
+        job = w->job[w->head];
+        w->head = (w->head + 1) % FRAME_POOL_MAX_SLOTS;
+        w->count--;
+
+        // the disk is slow, capture threads may submit and the other writers
+        // take the next jobs meanwhile
+        pthread_mutex_unlock(&w->lock);
+
+        snprintf(path, sizeof(path), "%s/cam%d-%08llu.pgm", w->dir, job.camera, job.frame_num);
+        rc = frame_dump_pgm(path, job.frame, w->width, w->height, &job.time_stamp);
+        frame_pool_put(&w->pool, job.frame);
+
+        pthread_mutex_lock(&w->lock);
+
+        if(rc < 0)
+        {
+            if(w->failed++ == 0)
+                fprintf(stderr, "frame writer %s: %s\n", path, strerror(errno));
+        }
+        else
+        {
+            w->written[job.camera]++;
+            w->bytes += (unsigned long long)rc;
+        }
+    }
+
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+int frame_writer_start(struct frame_writer *w, const char *dir, int width, int height, unsigned int slots,
+                       unsigned int threads)
+{
+    pthread_mutexattr_t mattr;
+    int rc;
+
+    if(threads < 1 || threads > FRAME_WRITER_MAX_THREADS)
+    {
+        fprintf(stderr, "frame writer: 1 to %d threads, not %u\n", FRAME_WRITER_MAX_THREADS, threads);
+        return -1;
+    }
+
+    memset(w, 0, sizeof(*w));
+    w->dir = dir;
+    w->width = width;
+    w->height = height;
+
+    if(frame_pool_init(&w->pool, slots, (size_t)width * height) < 0)
+        return -1;
+
+    // the camera threads submitting run SCHED_FIFO above the writers
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&w->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_cond_init(&w->ready, NULL);
+
+    for(w->threads = 0; w->threads < threads; w->threads++)
+    {
+        if((rc = pthread_create(&w->thread[w->threads], NULL, writer_thread, w)) != 0)
+        {
+            fprintf(stderr, "frame writer thread: %s\n", strerror(rc));
+            frame_writer_stop(w);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void frame_writer_stop(struct frame_writer *w)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+
+    for(i = 0; i < w->threads; i++)
+        pthread_join(w->thread[i], NULL);
+
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->lock);
+    frame_pool_free(&w->pool);
+}
+
+
+unsigned char *frame_writer_get(struct frame_writer *w, int camera)
+{
+    unsigned char *frame = frame_pool_get(&w->pool);
+
+    if(frame == NULL)
+        __atomic_add_fetch(&w->dropped[camera], 1, __ATOMIC_RELAXED);
+
+    return frame;
+}
+
+
+void frame_writer_submit(struct frame_writer *w, unsigned char *frame, int camera, unsigned long long frame_num,
+                         const struct timespec *time_stamp)
+{
+    struct frame_writer_job *job;
+
+    pthread_mutex_lock(&w->lock);
+
+    // never full, there are no more jobs than pool slots
+    job = &w->job[(w->head + w->count) % FRAME_POOL_MAX_SLOTS];
+    job->frame = frame;
+    job->camera = camera;
+    job->frame_num = frame_num;
+    job->time_stamp = *time_stamp;
+
+    if(++w->count > w->max_queued)
+        w->max_queued = w->count;
+
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+void frame_writer_put(struct frame_writer *w, unsigned char *frame)
+{
+    frame_pool_put(&w->pool, frame);
+}
@@ -0,0 +1,75 @@
+#ifndef _FRAMEWRITER_H_
+#define _FRAMEWRITER_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "framepool.h"
+
+// Asynchronous PGM writer shared by several capture pipelines
+//
+// Capture threads take a frame sized slot with frame_writer_get(), fill it
+// and hand it over with frame_writer_submit(), tagged with the camera it came
+// from.  Writer threads, at normal priority, take the frames in submission
+// order and save them as
+//
+//   DIR/camC-NNNNNNNN.pgm
+//
+// with the capture time stamp in the PGM header (see framedump.h) and put
+// the slot back.  Each thread opens its own files and builds its own
+// headers, so with more than one they write in parallel, which pays on
+// storage with several queues (SSDs) more than on an SD card; frames may
+// then complete out of order.  Slots come from a frame pool, so nothing is allocated per
+// frame; when the disk falls behind and every slot is still waiting,
+// frame_writer_get() returns NULL and the frame is counted as dropped for
+// its camera rather than stalling capture.
+
+#define FRAME_WRITER_MAX_CAMERAS (8)
+#define FRAME_WRITER_MAX_THREADS (4)
+
+struct frame_writer_job
+{
+    unsigned char *frame;
+    int camera;
+    unsigned long long frame_num;
+    struct timespec time_stamp;
+};
+
+struct frame_writer
+{
+    const char *dir;
+    int width;
+    int height;
+
+    struct frame_pool pool;
+
+    pthread_t thread[FRAME_WRITER_MAX_THREADS];
+    unsigned int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct frame_writer_job job[FRAME_POOL_MAX_SLOTS];
+    unsigned int head, count;
+    int stop;
+
+    unsigned long long written[FRAME_WRITER_MAX_CAMERAS];
+    unsigned long long dropped[FRAME_WRITER_MAX_CAMERAS];
+    unsigned long long failed;
+    unsigned long long bytes;
+    unsigned int max_queued;
+};
+
+int frame_writer_start(struct frame_writer *w, const char *dir, int width, int height, unsigned int slots,
+                       unsigned int threads);
+
+// drains the queue, then stops the threads and frees the slots
+void frame_writer_stop(struct frame_writer *w);
+
+// a slot for one width x height gray frame, NULL when none is free
+unsigned char *frame_writer_get(struct frame_writer *w, int camera);
+void frame_writer_submit(struct frame_writer *w, unsigned char *frame, int camera, unsigned long long frame_num,
+                         const struct timespec *time_stamp);
+
+// a slot that is not going to be written after all
+void frame_writer_put(struct frame_writer *w, unsigned char *frame);
+
+#endif
@@ -0,0 +1,190 @@
+// High resolution time stamps from the CPU's counter, see hrtime.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include "hrtime.h"
+
+#define NSEC_PER_MSEC (1000000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+
+#define CALIBRATION_NSEC (20 * NSEC_PER_MSEC)
+#define CALIBRATION_TRIES (8)
+#define COST_CALLS (100000)
+
+struct hrtime_clock hrtime_clock = { "clock_gettime", 0, 0, 0, 0, 0 };
+
+static int initialized = 0;
+
+// keeps the timed loops of hrtime_report() from being optimized away
+static volatile unsigned long long cost_sink;
+
+
+unsigned long long hrtime_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// the kernel only keeps the TSC as clocksource when it is invariant and in
+// sync across cores, otherwise reading it on another core may go backwards
+static const char *probe_counter(void)
+{
+    char clocksource[32] = "";
+    FILE *fp;
+
+    if((fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r")) == NULL)
+        return NULL;
+
+    if(fscanf(fp, "%31s", clocksource) != 1)
+        clocksource[0] = '\0';
+    fclose(fp);
+
+    return strcmp(clocksource, "tsc") == 0 ? "tsc" : NULL;
+}
+
+#elif defined(__aarch64__)
+
+static const char *probe_counter(void)
+{
+    return "cntvct";
+}
+
+#elif defined(__arm__)
+
+static sigjmp_buf probe_env;
+
+static void probe_sigill(int sig)
+{
+    (void)sig;
+    siglongjmp(probe_env, 1);
+}
+
+// CNTVCT traps unless the kernel's arch timer driver enabled user access
+static const char *probe_counter(void)
+{
+    struct sigaction sa, old;
+    const char *source = NULL;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = probe_sigill;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGILL, &sa, &old);
+
+    if(sigsetjmp(probe_env, 1) == 0)
+    {
+        (void)hrtime_ticks();
+        source = "cntvct";
+    }
+
+    sigaction(SIGILL, &old, NULL);
+    return source;
+}
+
+#else
+
+static const char *probe_counter(void)
+{
+    return NULL;
+}
+
+#endif
+
+
+// counter and CLOCK_MONOTONIC_RAW read as close together as possible, the
+// tightest of a few brackets of two clock reads around the counter
+static void sample(unsigned long long *ticks, unsigned long long *ns)
+{
+    unsigned long long best = ~0ULL;
+    int i;
+
+    for(i = 0; i < CALIBRATION_TRIES; i++)
+    {
+        unsigned long long t0 = hrtime_clock_ns();
+        unsigned long long c = hrtime_ticks();
+        unsigned long long t1 = hrtime_clock_ns();
+
+        if(t1 - t0 < best)
+        {
+            best = t1 - t0;
+            *ticks = c;
+            *ns = t0 + (t1 - t0) / 2;
+        }
+    }
+}
+
+
+void hrtime_init(void)
+{
+    unsigned long long c0, n0, c1, n1, mult;
+    struct timespec delay = { 0, CALIBRATION_NSEC };
+    const char *source;
+
+    if(initialized)
+        return;
+    initialized = 1;
+
+    if((source = probe_counter()) == NULL)
+        return;
+
+    sample(&c0, &n0);
+    while(nanosleep(&delay, &delay) != 0)
+        ;
+    sample(&c1, &n1);
+
+    if(c1 <= c0 || n1 <= n0)
+        return;
+
+    // counters slower than about 4 MHz are no better than clock_gettime()
+    mult = ((n1 - n0) << HRTIME_SHIFT) / (c1 - c0);
+    if(mult == 0 || mult >= (1ULL << 32))
+        return;
+
+    hrtime_clock.source = source;
+    hrtime_clock.freq_hz = (c1 - c0) * NSEC_PER_SEC / (n1 - n0);
+    hrtime_clock.base_ticks = c1;
+    hrtime_clock.base_ns = n1;
+    hrtime_clock.mult = mult;
+    hrtime_clock.counter = 1;
+}
+
+
+void hrtime_report(FILE *fp)
+{
+    unsigned long long start, sink = 0;
+    double hr_ns, cg_ns;
+    struct timespec ts;
+    int i;
+
+    hrtime_init();
+
+    start = hrtime_clock_ns();
+    for(i = 0; i < COST_CALLS; i++)
+        sink += hrtime_now();
+    hr_ns = (double)(hrtime_clock_ns() - start) / COST_CALLS;
+
+    start = hrtime_clock_ns();
+    for(i = 0; i < COST_CALLS; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        sink += (unsigned long long)ts.tv_nsec;
+    }
+    cg_ns = (double)(hrtime_clock_ns() - start) / COST_CALLS;
+    cost_sink = sink;
+
+    if(hrtime_clock.counter)
+        fprintf(fp, "time stamps from %s at %.3lf MHz, %.1lf ns per hrtime_now(), %.1lf ns per clock_gettime()\n",
+                hrtime_clock.source, (double)hrtime_clock.freq_hz / 1000000.0, hr_ns, cg_ns);
+    else
+        fprintf(fp, "time stamps from %s, %.1lf ns per call\n", hrtime_clock.source, hr_ns);
+}
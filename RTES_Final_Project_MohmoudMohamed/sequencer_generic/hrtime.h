@@ -0,0 +1,87 @@
+#ifndef _HRTIME_H_
+#define _HRTIME_H_
+
+#include <stdio.h>
+
+// High resolution time stamps from the CPU's free running counter
+//
+// hrtime_now() returns nanoseconds on the CLOCK_MONOTONIC_RAW timeline, read
+// from the counter and converted with an integer multiply and shift instead
+// of a clock_gettime() call:
+//
+//   x86      TSC (rdtsc), used only when the kernel itself runs on the TSC
+//            clocksource, so it is invariant and synchronized across cores
+//   aarch64  CNTVCT_EL0, the generic timer virtual count (Pi 3, 4 and 5)
+//   ARMv7    CNTVCT through CP15, when the kernel gives user space access
+//
+// The CCNT cycle counter of the ARM11 is not used, it needs a kernel module to
+// be readable and counts at a clock that changes with frequency scaling.
+// Without a usable counter hrtime_now() falls back to clock_gettime().
+//
+// hrtime_init() calibrates the counter against CLOCK_MONOTONIC_RAW (about
+// 20 ms), call it from main() before starting threads.
+
+#define HRTIME_SHIFT (24)
+
+struct hrtime_clock
+{
+    const char *source;             // "tsc", "cntvct" or "clock_gettime"
+    int counter;                    // hrtime_now() reads the counter
+    unsigned long long freq_hz;     // counter ticks per second
+    unsigned long long base_ticks;  // counter at calibration
+    unsigned long long base_ns;     // CLOCK_MONOTONIC_RAW at calibration
+    unsigned long long mult;        // nanoseconds per tick << HRTIME_SHIFT
+};
+
+extern struct hrtime_clock hrtime_clock;
+
+void hrtime_init(void);
+unsigned long long hrtime_clock_ns(void);
+
+// source, frequency and cost of hrtime_now() and clock_gettime()
+void hrtime_report(FILE *fp);
+
+
+// raw counter, ticks of hrtime_clock.freq_hz, 0 without a counter
+static inline unsigned long long hrtime_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int lo, hi;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return (unsigned long long)hi << 32 | lo;
+#elif defined(__aarch64__)
+    unsigned long long cnt;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (cnt) :: "memory");
+    return cnt;
+#elif defined(__arm__)
+    unsigned long long cnt;
+
+    asm volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r" (cnt) :: "memory");
+    return cnt;
+#else
+    return 0;
+#endif
+}
+
+
+// split so the multiply does not overflow 64 bits for any mult below 2^32
+static inline unsigned long long hrtime_to_ns(unsigned long long ticks)
+{
+    unsigned long long delta = ticks - hrtime_clock.base_ticks;
+
+    return hrtime_clock.base_ns + (((delta >> 32) * hrtime_clock.mult) << (32 - HRTIME_SHIFT)) +
+           (((delta & 0xffffffffULL) * hrtime_clock.mult) >> HRTIME_SHIFT);
+}
+
+
+static inline unsigned long long hrtime_now(void)
+{
+    if(hrtime_clock.counter)
+        return hrtime_to_ns(hrtime_ticks());
+
+    return hrtime_clock_ns();
+}
+
+#endif
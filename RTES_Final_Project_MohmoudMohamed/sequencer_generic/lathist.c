@@ -0,0 +1,113 @@
+// Log-linear latency histogram, see lathist.h
+
+#include <string.h>
+
+#include "lathist.h"
+
+#define SUB_COUNT (1 << LAT_HIST_SUB_BITS)
+
+
+static int bucket_index(unsigned long long value)
+{
+    int msb;
+
+    if(value < SUB_COUNT)
+        return (int)value;
+
+    msb = 63 - __builtin_clzll(value);
+
+    return ((msb - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS) +
+           (int)((value >> (msb - LAT_HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+
+// largest value that maps into bucket idx
+static unsigned long long bucket_upper(int idx)
+{
+    int msb, sub;
+    unsigned long long width;
+
+    if(idx < SUB_COUNT)
+        return (unsigned long long)idx;
+
+    msb = (idx >> LAT_HIST_SUB_BITS) + LAT_HIST_SUB_BITS - 1;
+    sub = idx & (SUB_COUNT - 1);
+    width = 1ULL << (msb - LAT_HIST_SUB_BITS);
+
+    return ((unsigned long long)(SUB_COUNT + sub) * width) + width - 1;
+}
+
+
+void lat_hist_reset(struct lat_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = ~0ULL;
+}
+
+
+void lat_hist_add(struct lat_hist *h, unsigned long long value)
+{
+    h->bucket[bucket_index(value)]++;
+    h->count++;
+    h->sum += value;
+
+    if(value < h->min) h->min = value;
+    if(value > h->max) h->max = value;
+}
+
+
+void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+    int i;
+
+    if(src->count == 0)
+        return;
+
+    for(i = 0; i < LAT_HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+
+    if(src->min < dst->min) dst->min = src->min;
+    if(src->max > dst->max) dst->max = src->max;
+}
+
+
+unsigned long long lat_hist_percentile(const struct lat_hist *h, double pct)
+{
+    unsigned long long rank, seen = 0, upper;
+    int i;
+
+    if(h->count == 0)
+        return 0;
+
+    // rank of the sample at or above pct, 1 based
+    rank = (unsigned long long)((pct / 100.0) * (double)h->count + 0.999999);
+    if(rank < 1) rank = 1;
+    if(rank > h->count) rank = h->count;
+
+    for(i = 0; i < LAT_HIST_BUCKETS; i++)
+    {
+        seen += h->bucket[i];
+
+        if(seen >= rank)
+        {
+            upper = bucket_upper(i);
+            if(upper > h->max) upper = h->max;
+            if(upper < h->min) upper = h->min;
+            return upper;
+        }
+    }
+
+    return h->max;
+}
+
+
+double lat_hist_mean(const struct lat_hist *h)
+{
+    if(h->count == 0)
+        return 0.0;
+
+    return (double)h->sum / (double)h->count;
+}
@@ -0,0 +1,32 @@
+#ifndef _LATHIST_H_
+#define _LATHIST_H_
+
+// Log-linear latency histogram
+//
+// Values (normally nanoseconds) below 16 get their own bucket, above that each
+// power of two is split into 16 linear sub-buckets, so any percentile is
+// reported within 1/16 (6.25%) of the true value with a fixed 4 KB footprint
+// and O(1) insert.  Count, sum, min and max are tracked exactly.
+
+#define LAT_HIST_SUB_BITS (4)
+#define LAT_HIST_BUCKETS (64 << LAT_HIST_SUB_BITS)
+
+struct lat_hist
+{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned int bucket[LAT_HIST_BUCKETS];
+};
+
+void lat_hist_reset(struct lat_hist *h);
+void lat_hist_add(struct lat_hist *h, unsigned long long value);
+void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src);
+
+// pct is 0.0 to 100.0, returns the upper edge of the bucket holding that
+// percentile clamped to the exact max, so it never under-reports
+unsigned long long lat_hist_percentile(const struct lat_hist *h, double pct);
+double lat_hist_mean(const struct lat_hist *h);
+
+#endif
@@ -0,0 +1,115 @@
+// Heap allocation counter, see malloccount.h
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "malloccount.h"
+
+// glibc's allocator under its internal names
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __vsyslog_chk(int priority, int flag, const char *format, va_list ap);
+
+static unsigned long long calls = 0;
+static unsigned long long syslog_calls = 0;
+static __thread int in_syslog = 0;
+
+
+static void count(void)
+{
+    __atomic_add_fetch(in_syslog ? &syslog_calls : &calls, 1, __ATOMIC_RELAXED);
+}
+
+
+unsigned long long malloc_count(void)
+{
+    return __atomic_load_n(&calls, __ATOMIC_RELAXED);
+}
+
+
+unsigned long long malloc_count_syslog(void)
+{
+    return __atomic_load_n(&syslog_calls, __ATOMIC_RELAXED);
+}
+
+
+void syslog(int priority, const char *format, ...)
+{
+    va_list ap;
+
+    in_syslog++;
+    va_start(ap, format);
+    vsyslog(priority, format, ap);
+    va_end(ap);
+    in_syslog--;
+}
+
+
+// what syslog() compiles to with _FORTIFY_SOURCE
+void __syslog_chk(int priority, int flag, const char *format, ...)
+{
+    va_list ap;
+
+    in_syslog++;
+    va_start(ap, format);
+    __vsyslog_chk(priority, flag, format, ap);
+    va_end(ap);
+    in_syslog--;
+}
+
+
+void *malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t n, size_t size)
+{
+    count();
+    return __libc_calloc(n, size);
+}
+
+
+void *realloc(void *p, size_t size)
+{
+    count();
+    return __libc_realloc(p, size);
+}
+
+
+void *memalign(size_t align, size_t size)
+{
+    count();
+    return __libc_memalign(align, size);
+}
+
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    count();
+    return __libc_memalign(align, size);
+}
+
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+    void *mem;
+
+    if(align < sizeof(void *) || (align & (align - 1)) != 0)
+        return EINVAL;
+
+    count();
+    if((mem = __libc_memalign(align, size)) == NULL)
+        return ENOMEM;
+
+    *p = mem;
+    return 0;
+}
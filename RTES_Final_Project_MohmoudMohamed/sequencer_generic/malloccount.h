@@ -0,0 +1,22 @@
+#ifndef _MALLOCCOUNT_H_
+#define _MALLOCCOUNT_H_
+
+// Heap allocation counter, a test hook for allocation free frame loops
+//
+// Linking malloccount.o into a program replaces malloc(), calloc(),
+// realloc(), memalign(), posix_memalign() and aligned_alloc() with wrappers
+// around glibc's own allocator that count every call, including the calls
+// made inside the C library (fopen, printf buffers, ...).  free() is not
+// counted.
+//
+// glibc's syslog() allocates a buffer for every message, those allocations
+// are counted apart (syslog() is wrapped as well), so the frame path itself
+// can be held to zero while it still logs every frame.
+//
+// Take malloc_count() when the steady state starts and compare at the end,
+// anything other than zero is an allocation in the frame loop.
+
+unsigned long long malloc_count(void);
+unsigned long long malloc_count_syslog(void);
+
+#endif
@@ -0,0 +1,539 @@
+// multicap - capture from several cameras in one process
+//
+// Every camera named on the command line gets its own capture context (see
+// camera.h) and pipeline: dequeue a frame, convert YUYV to gray into a slot
+// of the shared writer (see framewriter.h) tagged with the camera number,
+// queue the buffer again.  The writer threads (one, or --writers of them)
+// save the frames of all cameras in the background.
+//
+// By default one thread serves every camera, waiting on all of them with
+// epoll and draining whichever is ready.  With --threads each camera gets
+// its own SCHED_FIFO thread pinned to core (camera % cores) instead, the
+// writer stays at normal priority on whatever core is free.
+//
+// With --sync the frames are not written as they come but matched across
+// cameras by their driver time stamps (see framesync.h), only complete sets
+// are written, the frames of one set under the same number, and the skew
+// between every camera pair is reported.
+//
+// With --stream the frames are not written either but sent live as RTP over
+// UDP (see rtpsend.h) to a unicast or multicast address, paced at --rate
+// Mbit/s, receive them with rtprecv.
+//
+// At the end each pipeline reports frames, rate, frames lost by the driver
+// or dropped because the writer fell behind, and the delay from the capture
+// time stamp to the dequeue.  The aggregate rate should grow with every
+// camera added until the bus (or the cores) are saturated, compare
+//
+//   multicap -n synthetic:640x480@0
+//   multicap -n synthetic:640x480@0 synthetic:640x480@0,seed=1
+//
+// usage: multicap [--count frames] [--dir frames] [--size WxH] [--threads] [--no-write] [--writers N]
+//                 [--sync usec] [--stream addr[:port]] [--rate mbps] spec...
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#include "camera.h"
+#include "framewriter.h"
+#include "framesync.h"
+#include "rtpsend.h"
+#include "lathist.h"
+#include "yuvlut.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define NSEC_PER_USEC (1000ULL)
+
+#define MAX_CAMERAS (FRAME_WRITER_MAX_CAMERAS)
+#define CAMERA_BUFFERS (6)
+#define WRITER_SLOTS_PER_CAMERA (4) // plus FRAME_SYNC_DEPTH waiting for a set
+#define STREAM_SLOTS_PER_CAMERA (3)
+#define WAIT_MSEC (1000)
+#define MAX_IDLE_WAITS (5)          // give up when no camera delivers for this long
+
+struct pipeline
+{
+    struct camera camera;
+    pthread_t thread;
+    int done;
+    int rc;
+
+    unsigned long long start_ns;    // first and last frame dequeued
+    unsigned long long end_ns;
+    struct lat_hist latency;        // capture time stamp to dequeue
+    unsigned char *scratch;         // gray frame when nothing is written
+};
+
+static struct pipeline pipeline[MAX_CAMERAS];
+static int ncameras = 0;
+static unsigned long long frames_per_camera = 300;
+static int writing = 1;
+static struct frame_writer writer;
+
+// frame set assembly, tolerance 0 when off
+static struct frame_sync frame_sets;
+static unsigned long long sync_tolerance_ns = 0;
+
+// live stream instead of files
+static struct rtp_sender streamer;
+static int streaming = 0;
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// a complete set, written under the set number
+static void write_set(void *ctx, int nsources, const struct frame_sync_set *set)
+{
+    struct timespec time_stamp;
+    int i;
+
+    (void)ctx;
+
+    for(i = 0; i < nsources; i++)
+    {
+        if(set->entry[i].frame == NULL)
+            continue;
+
+        time_stamp.tv_sec = set->entry[i].ts_ns / NSEC_PER_SEC;
+        time_stamp.tv_nsec = set->entry[i].ts_ns % NSEC_PER_SEC;
+        frame_writer_submit(&writer, set->entry[i].frame, i, set->set_num, &time_stamp);
+    }
+}
+
+
+// a frame that found no partners
+static void put_frame(void *ctx, int camera, void *frame)
+{
+    (void)ctx;
+    (void)camera;
+
+    frame_writer_put(&writer, frame);
+}
+
+
+// every frame that is ready, 0 once none is left or the count is reached
+static int serve(struct pipeline *p)
+{
+    struct camera *cam = &p->camera;
+    int pixels = (int)(cam->fmt.fmt.pix.width * cam->fmt.fmt.pix.height);
+    unsigned long long now, captured;
+    struct v4l2_buffer buf;
+    struct timespec time_stamp;
+    unsigned char *frame, *out;
+
+    while(!p->done)
+    {
+        if((frame = camera_dequeue(cam, &buf)) == NULL)
+            return errno == EAGAIN ? 0 : -1;
+
+        now = now_ns();
+        if(cam->frames == 1)
+            p->start_ns = now;
+
+        captured = (unsigned long long)buf.timestamp.tv_sec * NSEC_PER_SEC + buf.timestamp.tv_usec * NSEC_PER_USEC;
+        if(captured > 0 && captured <= now)
+            lat_hist_add(&p->latency, now - captured);
+
+        if(streaming)
+            out = rtp_sender_get(&streamer, cam->id);
+        else
+            out = writing ? frame_writer_get(&writer, cam->id) : p->scratch;
+
+        if(out)
+        {
+            yuyv2y(frame, out, pixels * 2);
+
+            if(streaming)
+                rtp_sender_submit(&streamer, out, cam->id, cam->frames - 1, captured);
+            else if(writing && !sync_tolerance_ns)
+            {
+                time_stamp.tv_sec = buf.timestamp.tv_sec;
+                time_stamp.tv_nsec = buf.timestamp.tv_usec * NSEC_PER_USEC;
+                frame_writer_submit(&writer, out, cam->id, cam->frames - 1, &time_stamp);
+            }
+        }
+
+        // a frame the writer had no slot for still takes part in the timing
+        if(sync_tolerance_ns)
+            frame_sync_push(&frame_sets, cam->id, captured, cam->frames - 1, writing ? out : NULL);
+
+        if(camera_requeue(cam, &buf) < 0)
+            return -1;
+
+        if(cam->frames >= frames_per_camera)
+        {
+            p->end_ns = now;
+            p->done = 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int run_epoll(void)
+{
+    struct epoll_event ev, events[MAX_CAMERAS];
+    int epfd, i, n, done = 0, idle = 0;
+
+    if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    for(i = 0; i < ncameras; i++)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = (unsigned int)i;
+
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, pipeline[i].camera.fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            close(epfd);
+            return -1;
+        }
+    }
+
+    while(done < ncameras)
+    {
+        if((n = epoll_wait(epfd, events, MAX_CAMERAS, WAIT_MSEC)) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            perror("epoll_wait");
+            break;
+        }
+
+        if(n == 0 && ++idle == MAX_IDLE_WAITS)
+        {
+            fprintf(stderr, "no frames for %d ms, giving up\n", WAIT_MSEC * MAX_IDLE_WAITS);
+            break;
+        }
+
+        for(i = 0; i < n; i++)
+        {
+            struct pipeline *p = &pipeline[events[i].data.u32];
+
+            idle = 0;
+
+            if(serve(p) < 0)
+            {
+                p->rc = -1;
+                p->done = 1;
+            }
+
+            if(p->done)
+            {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, p->camera.fd, NULL);
+                done++;
+            }
+        }
+    }
+
+    close(epfd);
+    return done == ncameras ? 0 : -1;
+}
+
+
+static void *camera_thread(void *arg)
+{
+    struct pipeline *p = arg;
+    struct pollfd pfd;
+    int idle = 0, n;
+
+    pfd.fd = p->camera.fd;
+    pfd.events = POLLIN;
+
+    while(!p->done)
+    {
+        if((n = poll(&pfd, 1, WAIT_MSEC)) < 0 && errno != EINTR)
+            break;
+
+        if(n == 0 && ++idle == MAX_IDLE_WAITS)
+        {
+            fprintf(stderr, "camera %d: no frames for %d ms, giving up\n", p->camera.id, WAIT_MSEC * MAX_IDLE_WAITS);
+            break;
+        }
+
+        if(n > 0)
+        {
+            idle = 0;
+            if(serve(p) < 0)
+                break;
+        }
+    }
+
+    p->rc = p->done ? 0 : -1;
+    return NULL;
+}
+
+
+static int run_threads(void)
+{
+    struct sched_param param;
+    pthread_attr_t attr;
+    cpu_set_t cpu;
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN), i, rc, rt = 1, failed = 0;
+
+    for(i = 0; i < ncameras; i++)
+    {
+        pthread_attr_init(&attr);
+
+        if(rt)
+        {
+            CPU_ZERO(&cpu);
+            CPU_SET(i % cores, &cpu);
+            param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            pthread_attr_setschedparam(&attr, &param);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+        }
+
+        rc = pthread_create(&pipeline[i].thread, &attr, camera_thread, &pipeline[i]);
+
+        if(rc == EPERM && rt)
+        {
+            fprintf(stderr, "no permission for SCHED_FIFO, camera threads run at normal priority\n");
+            rt = 0;
+            pthread_attr_destroy(&attr);
+            i--;
+            continue;
+        }
+
+        pthread_attr_destroy(&attr);
+
+        if(rc != 0)
+        {
+            fprintf(stderr, "camera %d thread: %s\n", i, strerror(rc));
+            ncameras = i;
+            break;
+        }
+    }
+
+    for(i = 0; i < ncameras; i++)
+    {
+        pthread_join(pipeline[i].thread, NULL);
+        if(pipeline[i].rc < 0)
+            failed++;
+    }
+
+    return failed ? -1 : 0;
+}
+
+
+static void report(void)
+{
+    unsigned long long first = 0, last = 0, frames = 0;
+    double seconds, fps;
+    int i;
+
+    printf("\n%-6s %-32s %8s %9s %6s %8s %8s %10s %10s %10s\n", "camera", "source", "frames", "fps",
+           "lost", "dropped", "written", "p50 us", "p99 us", "max us");
+
+    for(i = 0; i < ncameras; i++)
+    {
+        struct pipeline *p = &pipeline[i];
+        struct camera *cam = &p->camera;
+
+        seconds = p->end_ns > p->start_ns ? (double)(p->end_ns - p->start_ns) / NSEC_PER_SEC : 0.0;
+        fps = seconds > 0.0 ? (double)(cam->frames - 1) / seconds : 0.0;
+
+        printf("%-6d %-32.32s %8llu %9.2lf %6llu %8llu %8llu %10.1lf %10.1lf %10.1lf\n", cam->id, cam->spec,
+               cam->frames, fps, cam->lost, writer.dropped[cam->id], writer.written[cam->id],
+               lat_hist_percentile(&p->latency, 50.0) / 1000.0, lat_hist_percentile(&p->latency, 99.0) / 1000.0,
+               p->latency.max / 1000.0);
+
+        if(first == 0 || p->start_ns < first) first = p->start_ns;
+        if(p->end_ns > last) last = p->end_ns;
+        frames += cam->frames;
+    }
+
+    seconds = last > first ? (double)(last - first) / NSEC_PER_SEC : 0.0;
+    printf("all    %d cameras, %llu frames in %.3lf s, %.2lf frames/s\n", ncameras, frames, seconds,
+           seconds > 0.0 ? (double)(frames - ncameras) / seconds : 0.0);
+
+    if(writing)
+        printf("writer %.1lf MB written by %u threads, queue peak %u of %u slots, %llu failed\n", writer.bytes / 1e6,
+               writer.threads, writer.max_queued, writer.pool.slots, writer.failed);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--count frames] [--dir frames] [--size WxH] [--threads] [--no-write] [--writers N]\n"
+                    "       [--sync usec] [--stream addr[:port]] [--rate mbps] spec...\n", prog);
+    fprintf(stderr, "  spec is /dev/videoN or a synthetic:/replay: source, up to %d cameras\n", MAX_CAMERAS);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "count",    required_argument, NULL, 'c' },
+        { "dir",      required_argument, NULL, 'D' },
+        { "size",     required_argument, NULL, 's' },
+        { "threads",  no_argument,       NULL, 't' },
+        { "no-write", no_argument,       NULL, 'n' },
+        { "writers",  required_argument, NULL, 'w' },
+        { "sync",     required_argument, NULL, 'y' },
+        { "stream",   required_argument, NULL, 'S' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *dir = "frames";
+    unsigned int width = 640, height = 480;
+    char stream_addr[64], *colon;
+    unsigned int rate_mbps = RTP_SEND_RATE_MBPS, writers = 1;
+    int stream_port = RTP_SEND_PORT, threads = 0, opt, i, rc;
+
+    while((opt = getopt_long(argc, argv, "c:D:s:tnw:y:S:r:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'c': frames_per_camera = strtoull(optarg, NULL, 0); break;
+            case 'D': dir = optarg; break;
+            case 't': threads = 1; break;
+            case 'n': writing = 0; break;
+            case 'w': writers = (unsigned int)atoi(optarg); break;
+            case 'y': sync_tolerance_ns = (unsigned long long)(atof(optarg) * 1000.0); break;
+            case 'r': rate_mbps = (unsigned int)atoi(optarg); break;
+            case 'S':
+                snprintf(stream_addr, sizeof(stream_addr), "%s", optarg);
+                if((colon = strchr(stream_addr, ':')) != NULL)
+                {
+                    *colon = '\0';
+                    stream_port = atoi(colon + 1);
+                }
+                streaming = 1;
+                writing = 0;
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2 || width == 0 || height == 0 || (width & 1))
+                {
+                    fprintf(stderr, "bad size %s, want an even width WxH\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(optind == argc || argc - optind > MAX_CAMERAS || frames_per_camera < 2 || (streaming && sync_tolerance_ns))
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    yuv_lut_init(YUV_MATRIX_BT601, YUV_RANGE_LIMITED);
+
+    for(i = optind; i < argc; i++, ncameras++)
+    {
+        struct pipeline *p = &pipeline[ncameras];
+
+        if(camera_open(&p->camera, ncameras, argv[i], width, height, CAMERA_BUFFERS) < 0)
+            exit(EXIT_FAILURE);
+
+        // the writer slots are one size for all cameras
+        if(p->camera.fmt.fmt.pix.width != width || p->camera.fmt.fmt.pix.height != height)
+        {
+            fprintf(stderr, "camera %d: %s delivers %ux%u frames, not %ux%u\n", ncameras, argv[i],
+                    p->camera.fmt.fmt.pix.width, p->camera.fmt.fmt.pix.height, width, height);
+            exit(EXIT_FAILURE);
+        }
+
+        lat_hist_reset(&p->latency);
+
+        if(!writing && !streaming && (p->scratch = malloc((size_t)width * height)) == NULL)
+        {
+            fprintf(stderr, "no memory for %ux%u frames\n", width, height);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(writing)
+    {
+        if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+        {
+            perror(dir);
+            exit(EXIT_FAILURE);
+        }
+
+        if(frame_writer_start(&writer, dir, (int)width, (int)height,
+                              ncameras * (WRITER_SLOTS_PER_CAMERA + (sync_tolerance_ns ? FRAME_SYNC_DEPTH : 0)),
+                              writers) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    if(streaming && rtp_sender_start(&streamer, stream_addr, stream_port, (int)width, (int)height,
+                                     ncameras * STREAM_SLOTS_PER_CAMERA, rate_mbps) < 0)
+        exit(EXIT_FAILURE);
+
+    if(sync_tolerance_ns)
+        frame_sync_init(&frame_sets, ncameras, sync_tolerance_ns, writing ? write_set : NULL, writing ? put_frame : NULL, NULL);
+
+    printf("%d cameras, %llu frames each, %s, %s\n", ncameras, frames_per_camera,
+           threads ? "one SCHED_FIFO thread per camera" : "one epoll loop",
+           streaming ? "streamed" : writing ? dir : "not written");
+
+    for(i = 0; i < ncameras; i++)
+        if(camera_start(&pipeline[i].camera) < 0)
+            exit(EXIT_FAILURE);
+
+    rc = threads ? run_threads() : run_epoll();
+
+    for(i = 0; i < ncameras; i++)
+        camera_stop(&pipeline[i].camera);
+
+    if(sync_tolerance_ns)
+        frame_sync_destroy(&frame_sets);
+
+    if(writing)
+        frame_writer_stop(&writer);
+
+    if(streaming)
+        rtp_sender_stop(&streamer);
+
+    report();
+
+    if(streaming)
+        rtp_sender_report(&streamer, ncameras, stdout);
+
+    if(sync_tolerance_ns)
+        frame_sync_report(&frame_sets, stdout);
+
+    for(i = 0; i < ncameras; i++)
+    {
+        camera_close(&pipeline[i].camera);
+        free(pipeline[i].scratch);
+    }
+
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
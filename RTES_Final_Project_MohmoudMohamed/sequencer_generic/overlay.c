@@ -0,0 +1,158 @@
+// Text burned into frames, see overlay.h
+
+#include <stdio.h>
+#include <string.h>
+
+#include "overlay.h"
+
+#define FG_FULL (255)
+#define BG_FULL (0)
+#define FG_VIDEO (235)                  // BT.601 limited range for YUYV
+#define BG_VIDEO (16)
+#define CHROMA_NONE (128)
+
+// one byte per glyph row, most significant bit leftmost, a blank right
+// column and bottom row keep the cells apart
+static const unsigned char font[128][OVERLAY_GLYPH] =
+{
+    ['#'] = { 0x24, 0x24, 0xfc, 0x24, 0xfc, 0x24, 0x24, 0x00 },
+    ['-'] = { 0x00, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x00, 0x00 },
+    ['.'] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00 },
+    ['/'] = { 0x04, 0x08, 0x08, 0x10, 0x20, 0x20, 0x40, 0x00 },
+    ['0'] = { 0x78, 0x84, 0x8c, 0x94, 0xa4, 0xc4, 0x78, 0x00 },
+    ['1'] = { 0x10, 0x30, 0x50, 0x10, 0x10, 0x10, 0x7c, 0x00 },
+    ['2'] = { 0x78, 0x84, 0x04, 0x18, 0x20, 0x40, 0xfc, 0x00 },
+    ['3'] = { 0x78, 0x84, 0x04, 0x38, 0x04, 0x84, 0x78, 0x00 },
+    ['4'] = { 0x08, 0x18, 0x28, 0x48, 0xfc, 0x08, 0x08, 0x00 },
+    ['5'] = { 0xfc, 0x80, 0xf8, 0x04, 0x04, 0x84, 0x78, 0x00 },
+    ['6'] = { 0x38, 0x40, 0x80, 0xf8, 0x84, 0x84, 0x78, 0x00 },
+    ['7'] = { 0xfc, 0x04, 0x08, 0x10, 0x20, 0x20, 0x20, 0x00 },
+    ['8'] = { 0x78, 0x84, 0x84, 0x78, 0x84, 0x84, 0x78, 0x00 },
+    ['9'] = { 0x78, 0x84, 0x84, 0x7c, 0x04, 0x08, 0x70, 0x00 },
+    [':'] = { 0x00, 0x30, 0x30, 0x00, 0x30, 0x30, 0x00, 0x00 }
+};
+
+
+static void put_pixel(enum overlay_format format, unsigned char *row, int i, int on)
+{
+    switch(format)
+    {
+        case OVERLAY_GRAY:
+            row[i] = on ? FG_FULL : BG_FULL;
+            break;
+
+        case OVERLAY_YUYV:
+            row[2 * i] = on ? FG_VIDEO : BG_VIDEO;
+            row[2 * i + 1] = CHROMA_NONE;
+            break;
+
+        case OVERLAY_RGB:
+            row[3 * i] = row[3 * i + 1] = row[3 * i + 2] = on ? FG_FULL : BG_FULL;
+            break;
+    }
+}
+
+
+// renders one character into its cell of the run, each glyph row is built
+// once and copied to the rows below it when scaled
+static void render_cell(struct overlay *ov, int cell, char ch)
+{
+    const unsigned char *glyph = font[(unsigned char)ch < 128 ? (unsigned char)ch : ' '];
+    size_t cell_bytes = (size_t)OVERLAY_GLYPH * ov->scale * ov->format;
+    unsigned char *row;
+    int r, bit, s, i;
+
+    for(r = 0; r < OVERLAY_GLYPH; r++)
+    {
+        row = &ov->run[r * ov->scale][cell * cell_bytes];
+
+        for(bit = 0, i = 0; bit < OVERLAY_GLYPH; bit++)
+            for(s = 0; s < ov->scale; s++, i++)
+                put_pixel(ov->format, row, i, glyph[r] & (0x80 >> bit));
+
+        for(s = 1; s < ov->scale; s++)
+            memcpy(&ov->run[r * ov->scale + s][cell * cell_bytes], row, cell_bytes);
+    }
+
+    ov->cells_drawn++;
+}
+
+
+int overlay_init(struct overlay *ov, enum overlay_format format, int x, int y, int scale)
+{
+    if(scale < 1 || scale > OVERLAY_MAX_SCALE || x < 0 || y < 0 ||
+       (format != OVERLAY_GRAY && format != OVERLAY_YUYV && format != OVERLAY_RGB))
+    {
+        fprintf(stderr, "overlay: bad format %d, position %d,%d or scale %d\n", (int)format, x, y, scale);
+        return -1;
+    }
+
+    memset(ov, 0, sizeof(*ov));
+    ov->format = format;
+    ov->x = format == OVERLAY_YUYV ? x & ~1 : x;
+    ov->y = y;
+    ov->scale = scale;
+
+    return 0;
+}
+
+
+int overlay_set_text(struct overlay *ov, const char *text)
+{
+    int i, len, drawn = 0;
+
+    for(len = 0; len < OVERLAY_MAX_CHARS && text[len]; len++)
+        ;
+
+    // cells past the old end hold stale pixels whatever their character
+    for(i = 0; i < len; i++)
+    {
+        if(i < ov->len && ov->text[i] == text[i])
+            continue;
+
+        render_cell(ov, i, text[i]);
+        ov->text[i] = text[i];
+        drawn++;
+    }
+
+    ov->text[len] = '\0';
+    ov->len = len;
+
+    return drawn;
+}
+
+
+void overlay_draw(const struct overlay *ov, unsigned char *frame, int width, int height)
+{
+    int rows = OVERLAY_GLYPH * ov->scale, cols = ov->len * OVERLAY_GLYPH * ov->scale, r;
+
+    if(ov->x >= width || ov->y >= height)
+        return;
+
+    if(cols > width - ov->x)
+        cols = width - ov->x;
+    if(rows > height - ov->y)
+        rows = height - ov->y;
+
+    // never half a pixel pair
+    if(ov->format == OVERLAY_YUYV)
+        cols &= ~1;
+
+    for(r = 0; r < rows; r++)
+        memcpy(frame + ((size_t)(ov->y + r) * width + ov->x) * ov->format, ov->run[r], (size_t)cols * ov->format);
+}
+
+
+int overlay_stamp(struct overlay *ov, unsigned char *frame, int width, int height, unsigned long long frame_num,
+                  const struct timespec *time)
+{
+    char text[OVERLAY_MAX_CHARS + 1];
+    int drawn;
+
+    snprintf(text, sizeof(text), "#%06llu %lld.%03ld", frame_num, (long long)time->tv_sec, time->tv_nsec / 1000000);
+
+    drawn = overlay_set_text(ov, text);
+    overlay_draw(ov, frame, width, height);
+
+    return drawn;
+}
@@ -0,0 +1,56 @@
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+#include <time.h>
+
+// Text burned into frames, the frame count and time stamp of stored frames
+//
+// Replaces the OpenCV putText() the design called for with a built in 8x8
+// bitmap font (digits and # - . / : only, anything else is a blank cell)
+// scaled by a whole number, white on a black box so it reads on any scene.
+//
+// The overlay keeps the text it last rendered as a glyph run: a small image
+// of the whole string already in the frame's pixel format.  Setting new text
+// renders only the cells whose character changed, which for a time stamp and
+// frame count is the last few digits, and drawing copies the run into the
+// frame a row at a time.  Stamping a frame is a few microseconds however
+// large the frame is.
+
+#define OVERLAY_GLYPH (8)
+#define OVERLAY_MAX_CHARS (32)
+#define OVERLAY_MAX_SCALE (4)
+
+// values are the bytes per pixel, YUYV cells always cover whole pixel pairs
+enum overlay_format
+{
+    OVERLAY_GRAY = 1,
+    OVERLAY_YUYV = 2,
+    OVERLAY_RGB = 3
+};
+
+struct overlay
+{
+    enum overlay_format format;
+    int x, y;                           // top left corner in the frame
+    int scale;
+
+    char text[OVERLAY_MAX_CHARS + 1];
+    int len;
+    unsigned long long cells_drawn;     // cells rendered into the run so far
+
+    unsigned char run[OVERLAY_GLYPH * OVERLAY_MAX_SCALE][OVERLAY_MAX_CHARS * OVERLAY_GLYPH * OVERLAY_MAX_SCALE * 3];
+};
+
+int overlay_init(struct overlay *ov, enum overlay_format format, int x, int y, int scale);
+
+// longer text is cut at OVERLAY_MAX_CHARS, returns the cells rendered
+int overlay_set_text(struct overlay *ov, const char *text);
+
+// copies the run into a width x height frame, clipped at its edges
+void overlay_draw(const struct overlay *ov, unsigned char *frame, int width, int height);
+
+// "#frame sec.msec" set and drawn
+int overlay_stamp(struct overlay *ov, unsigned char *frame, int width, int height, unsigned long long frame_num,
+                  const struct timespec *time);
+
+#endif
@@ -0,0 +1,265 @@
+// Hardware performance counters per thread, see perfctr.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+#define CHOICES (2)
+
+// the counter group of one thread, opened on its first sample
+struct perfctr_group
+{
+    int opened;
+    int leader;                     // group leader fd, -1 without counters
+    int nr;
+    int slot[PERFCTR_EVENTS];       // index in the group read, -1 when not counted
+};
+
+struct event_choice
+{
+    unsigned int type;
+    unsigned long long config;
+};
+
+#define HW_CACHE(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// preferred event first, type 0 config 0 (cycles) is never a fallback
+static const struct event_choice event_choice[PERFCTR_EVENTS][CHOICES] =
+{
+    { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },       { 0, 0 } },
+    { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },     { 0, 0 } },
+    { { PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D) }, { 0, 0 } },
+    { { PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_LL) },  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES } },
+    { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },    { 0, 0 } }
+};
+
+static __thread struct perfctr_group thread_group;
+static int enabled = 0;
+
+
+static int open_event(const struct event_choice *ev, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = ev->type;
+    attr.config = ev->config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+
+static void open_group(struct perfctr_group *g)
+{
+    int e, c;
+
+    g->opened = 1;
+    g->leader = -1;
+    g->nr = 0;
+
+    for(e = 0; e < PERFCTR_EVENTS; e++)
+    {
+        g->slot[e] = -1;
+
+        for(c = 0; c < CHOICES; c++)
+        {
+            const struct event_choice *ev = &event_choice[e][c];
+            int fd;
+
+            if(c > 0 && ev->type == 0 && ev->config == 0)
+                break;
+
+            if((fd = open_event(ev, g->leader)) < 0)
+                continue;
+
+            // the members stay open with the thread, reads go to the leader
+            if(g->leader < 0)
+                g->leader = fd;
+            g->slot[e] = g->nr++;
+            break;
+        }
+    }
+}
+
+
+int perfctr_enable(void)
+{
+    int paranoid = -1;
+    FILE *fp;
+
+    enabled = 1;
+
+    if(!thread_group.opened)
+        open_group(&thread_group);
+
+    if(thread_group.nr == 0)
+    {
+        if((fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r")) != NULL)
+        {
+            if(fscanf(fp, "%d", &paranoid) != 1)
+                paranoid = -1;
+            fclose(fp);
+        }
+
+        fprintf(stderr, "perf_event_open: %s, no hardware counters (perf_event_paranoid=%d)\n", strerror(errno), paranoid);
+    }
+
+    return thread_group.nr;
+}
+
+
+int perfctr_enabled(void)
+{
+    return enabled;
+}
+
+
+void perfctr_stats_init(struct perfctr_stats *st, const char *name)
+{
+    memset(st, 0, sizeof(*st));
+    st->name = name;
+}
+
+
+void perfctr_sample(struct perfctr_sample *s)
+{
+    struct perfctr_group *g = &thread_group;
+    unsigned long long buf[3 + PERFCTR_EVENTS];
+    int e;
+
+    s->valid = 0;
+
+    if(!enabled)
+        return;
+
+    if(!g->opened)
+        open_group(g);
+
+    if(g->leader < 0)
+        return;
+
+    if(read(g->leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(buf[0])) || buf[0] != (unsigned long long)g->nr)
+        return;
+
+    s->time_enabled = buf[1];
+    s->time_running = buf[2];
+
+    for(e = 0; e < PERFCTR_EVENTS; e++)
+        s->value[e] = g->slot[e] >= 0 ? buf[3 + g->slot[e]] : 0;
+
+    s->valid = 1;
+}
+
+
+void perfctr_account(struct perfctr_stats *st, const struct perfctr_sample *start)
+{
+    struct perfctr_group *g = &thread_group;
+    struct perfctr_sample now;
+    unsigned int counted = 0;
+    int e;
+
+    if(!start->valid)
+        return;
+
+    perfctr_sample(&now);
+    if(!now.valid)
+        return;
+
+    for(e = 0; e < PERFCTR_EVENTS; e++)
+    {
+        unsigned long long delta = now.value[e] - start->value[e];
+
+        if(g->slot[e] < 0)
+            continue;
+
+        counted |= 1U << e;
+        st->sum[e] += delta;
+        if(delta > st->max[e])
+            st->max[e] = delta;
+    }
+
+    st->counted = st->samples ? (st->counted & counted) : counted;
+    st->time_enabled += now.time_enabled - start->time_enabled;
+    st->time_running += now.time_running - start->time_running;
+    st->samples++;
+}
+
+
+// average per sample, scaled up when the kernel multiplexed the group
+static double per_sample(const struct perfctr_stats *st, enum perfctr_event e)
+{
+    double scale = 1.0;
+
+    if(st->time_running > 0 && st->time_running < st->time_enabled)
+        scale = (double)st->time_enabled / (double)st->time_running;
+
+    return (double)st->sum[e] * scale / (double)st->samples;
+}
+
+
+static void print_value(FILE *fp, const struct perfctr_stats *st, enum perfctr_event e)
+{
+    if(st->counted & (1U << e))
+        fprintf(fp, " %12.0lf", per_sample(st, e));
+    else
+        fprintf(fp, " %12s", "-");
+}
+
+
+void perfctr_report(FILE *fp, const char *title, const struct perfctr_stats *st, int count)
+{
+    unsigned long long samples = 0;
+    int i;
+
+    if(!enabled)
+        return;
+
+    for(i = 0; i < count; i++)
+        samples += st[i].samples;
+
+    if(samples == 0)
+    {
+        fprintf(fp, "\nHardware counters per %s: none counted\n", title);
+        return;
+    }
+
+    fprintf(fp, "\nHardware counters per %s, user space averages\n", title);
+    fprintf(fp, "%-22s %8s %12s %12s %6s %12s %12s %12s\n", "name", "samples",
+            "cycles", "instructions", "IPC", "L1D misses", "LLC misses", "br misses");
+
+    for(i = 0; i < count; i++)
+    {
+        const unsigned int ipc = (1U << PERFCTR_CYCLES) | (1U << PERFCTR_INSTRUCTIONS);
+
+        if(st[i].samples == 0)
+        {
+            fprintf(fp, "%-22s %8s\n", st[i].name, "-");
+            continue;
+        }
+
+        fprintf(fp, "%-22s %8llu", st[i].name, st[i].samples);
+        print_value(fp, &st[i], PERFCTR_CYCLES);
+        print_value(fp, &st[i], PERFCTR_INSTRUCTIONS);
+
+        if((st[i].counted & ipc) == ipc && st[i].sum[PERFCTR_CYCLES] > 0)
+            fprintf(fp, " %6.2lf", (double)st[i].sum[PERFCTR_INSTRUCTIONS] / (double)st[i].sum[PERFCTR_CYCLES]);
+        else
+            fprintf(fp, " %6s", "-");
+
+        print_value(fp, &st[i], PERFCTR_L1D_MISSES);
+        print_value(fp, &st[i], PERFCTR_LLC_MISSES);
+        print_value(fp, &st[i], PERFCTR_BRANCH_MISSES);
+        fprintf(fp, "\n");
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _PERFCTR_H_
+#define _PERFCTR_H_
+
+#include <stdio.h>
+
+// Hardware performance counters per thread and per unit of work
+//
+// Every thread that brackets work with perfctr_sample() / perfctr_account()
+// gets its own perf_event_open() counter group, opened on its first sample:
+//
+//   cycles, instructions, L1D read misses, last level cache read misses
+//   (generic cache misses when the LL cache event is not offered) and branch
+//   misses, counting user space of the calling thread only
+//
+// perfctr_account() adds the counter deltas since the sample to a
+// perfctr_stats, so each service release or pipeline stage is charged only
+// for its own work.  Events the CPU, the kernel or perf_event_paranoid do not
+// allow are left out and reported as "-", with no counters at all the calls
+// cost a branch.  Nothing is counted until perfctr_enable() is called.
+//
+// A stats is written by one thread, sampling is async-signal-safe.
+
+enum perfctr_event
+{
+    PERFCTR_CYCLES = 0,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_EVENTS
+};
+
+struct perfctr_sample
+{
+    int valid;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+    unsigned long long value[PERFCTR_EVENTS];
+};
+
+struct perfctr_stats
+{
+    const char *name;
+    unsigned long long samples;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+    unsigned long long sum[PERFCTR_EVENTS];
+    unsigned long long max[PERFCTR_EVENTS];
+    unsigned int counted;           // bit per perfctr_event seen in every sample
+};
+
+// turn counting on, call before the threads start; returns the number of
+// events the calling thread could open, 0 when there are no counters
+int perfctr_enable(void);
+int perfctr_enabled(void);
+
+void perfctr_stats_init(struct perfctr_stats *st, const char *name);
+
+void perfctr_sample(struct perfctr_sample *s);
+void perfctr_account(struct perfctr_stats *st, const struct perfctr_sample *start);
+
+// per unit averages: cycles, instructions, IPC and misses per sample
+void perfctr_report(FILE *fp, const char *title, const struct perfctr_stats *st, int count);
+
+#endif
@@ -0,0 +1,610 @@
+// preview - MJPEG over HTTP preview of the frames a capture program publishes
+//
+// Reads the latest frame from the shared memory ring a capture program
+// publishes (10Hz --shm, see frameshm.h), at most --rate times a second,
+// scales it down by --scale with a box filter, encodes it to JPEG once and
+// serves that one encoded frame to every connected browser:
+//
+//   http://host:port/             page showing the stream
+//   http://host:port/stream       multipart/x-mixed-replace MJPEG stream
+//   http://host:port/snapshot.jpg latest preview frame
+//
+// Reading the ring takes no lock and cannot hold the capture thread up, so
+// however many viewers there are and however slow their links, the capture
+// loop never waits on the preview.  The cost here does not grow with the
+// viewers either: one encode per preview frame, and all clients are served
+// by one poll() loop with non-blocking sends of the same buffer.  A client
+// that is still busy with an older frame skips straight to the newest one
+// when it is done.
+//
+// The process runs niced and pinned to every core except --rt-core, where
+// the capture services run; with a single core it stays where it is.
+//
+// usage: preview [--shm name] [--port N] [--rate fps] [--scale 1|2|4] [--quality q] [--rt-core N]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <jpeglib.h>
+
+#include "frameshm.h"
+#include "lathist.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define NSEC_PER_MSEC (1000000ULL)
+#define MAX_CLIENTS (16)
+#define REQUEST_MAX (2048)
+#define REOPEN_MSEC (2000)              // no frame for this long, open the ring again
+#define BOUNDARY "previewframe"
+
+enum client_state
+{
+    CLIENT_FREE = 0,
+    CLIENT_REQUEST,                     // reading the request
+    CLIENT_REPLY,                       // sending a reply, closed after it
+    CLIENT_STREAM                       // sending stream parts
+};
+
+// one encoded preview frame as a complete multipart part, shared by the clients
+struct part
+{
+    unsigned char *data;
+    size_t len;
+    size_t jpeg_offset, jpeg_len;       // the bare JPEG inside, for snapshots
+    unsigned long long number;          // preview frames encoded before it
+    int refs;
+};
+
+struct client
+{
+    enum client_state state;
+    int fd;
+
+    char request[REQUEST_MAX];
+    size_t request_len;
+
+    char header[256];                   // reply or stream header, sent first
+    size_t header_len, header_sent;
+
+    struct part *part;                  // frame being sent
+    size_t start, end, sent;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static struct client client[MAX_CLIENTS];
+static struct part *latest = NULL;
+
+static const char *page =
+    "<!DOCTYPE html>\n<html><head><title>Camera preview</title></head>\n"
+    "<body style=\"margin:0;background:#000\"><img src=\"/stream\" style=\"width:100%\"></body></html>\n";
+
+static unsigned long long encoded = 0, parts_sent = 0, parts_skipped = 0, bytes_sent = 0, clients_served = 0;
+static struct lat_hist encode_time;
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static void part_put(struct part *p)
+{
+    if(p && --p->refs == 0)
+    {
+        free(p->data);
+        free(p);
+    }
+}
+
+
+// box filter, each output pixel the mean of a scale x scale block
+static void scale_down(const unsigned char *src, int width, int height, int bpp, int scale, unsigned char *dst)
+{
+    int x, y, dx, dy, c, sum, w = width / scale, h = height / scale;
+
+    for(y = 0; y < h; y++)
+        for(x = 0; x < w; x++)
+            for(c = 0; c < bpp; c++)
+            {
+                for(sum = 0, dy = 0; dy < scale; dy++)
+                    for(dx = 0; dx < scale; dx++)
+                        sum += src[((y * scale + dy) * width + x * scale + dx) * bpp + c];
+
+                dst[(y * w + x) * bpp + c] = (unsigned char)(sum / (scale * scale));
+            }
+}
+
+
+static struct part *encode(const unsigned char *pixels, int width, int height, int bpp, int quality)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *jpeg = NULL;
+    unsigned long jpeg_len = 0;
+    JSAMPROW row;
+    struct part *p;
+    char head[128];
+    int head_len;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &jpeg, &jpeg_len);
+
+    cinfo.image_width = (JDIMENSION)width;
+    cinfo.image_height = (JDIMENSION)height;
+    cinfo.input_components = bpp;
+    cinfo.in_color_space = bpp == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while(cinfo.next_scanline < cinfo.image_height)
+    {
+        row = (JSAMPROW)&pixels[cinfo.next_scanline * width * bpp];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    head_len = snprintf(head, sizeof(head), "--" BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\n\r\n",
+                        jpeg_len);
+
+    if((p = calloc(1, sizeof(*p))) == NULL || (p->data = malloc(head_len + jpeg_len + 2)) == NULL)
+    {
+        free(p);
+        free(jpeg);
+        return NULL;
+    }
+
+    memcpy(p->data, head, head_len);
+    memcpy(p->data + head_len, jpeg, jpeg_len);
+    memcpy(p->data + head_len + jpeg_len, "\r\n", 2);
+    p->len = head_len + jpeg_len + 2;
+    p->jpeg_offset = head_len;
+    p->jpeg_len = jpeg_len;
+    p->refs = 1;
+
+    free(jpeg);
+    return p;
+}
+
+
+static void client_close(struct client *c)
+{
+    part_put(c->part);
+    close(c->fd);
+    memset(c, 0, sizeof(*c));
+}
+
+
+static void start_part(struct client *c)
+{
+    if(c->part)
+    {
+        // frames encoded while this client was busy with its last one
+        parts_skipped += latest->number - c->part->number - 1;
+        parts_sent++;
+        part_put(c->part);
+    }
+
+    c->part = latest;
+    c->part->refs++;
+    c->start = 0;
+    c->end = latest->len;
+    c->sent = 0;
+}
+
+
+static void reply(struct client *c, const char *status, const char *type, const char *body, size_t len)
+{
+    c->header_len = (size_t)snprintf(c->header, sizeof(c->header),
+                                     "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                                     "Cache-Control: no-cache\r\nConnection: close\r\n\r\n", status, type, len);
+    c->header_sent = 0;
+    c->state = CLIENT_REPLY;
+
+    // a static body goes out as a part of its own
+    if(body)
+    {
+        struct part *p = calloc(1, sizeof(*p));
+
+        if(p && (p->data = malloc(len)) != NULL)
+        {
+            memcpy(p->data, body, len);
+            p->len = len;
+            p->refs = 1;
+            c->part = p;
+            c->start = 0;
+            c->end = len;
+        }
+        else
+            free(p);
+    }
+}
+
+
+static void request(struct client *c)
+{
+    if(strncmp(c->request, "GET ", 4) != 0)
+        reply(c, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+    else if(strncmp(c->request + 4, "/stream", 7) == 0)
+    {
+        c->header_len = (size_t)snprintf(c->header, sizeof(c->header),
+                                         "HTTP/1.0 200 OK\r\nContent-Type: multipart/x-mixed-replace;boundary="
+                                         BOUNDARY "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n");
+        c->header_sent = 0;
+        c->state = CLIENT_STREAM;
+        clients_served++;
+    }
+    else if(strncmp(c->request + 4, "/snapshot.jpg", 13) == 0)
+    {
+        if(latest == NULL)
+            reply(c, "503 Service Unavailable", "text/plain", "no frame yet\n", 13);
+        else
+        {
+            reply(c, "200 OK", "image/jpeg", NULL, latest->jpeg_len);
+            c->part = latest;
+            c->part->refs++;
+            c->start = latest->jpeg_offset;
+            c->end = latest->jpeg_offset + latest->jpeg_len;
+        }
+    }
+    else if(strncmp(c->request + 4, "/ ", 2) == 0)
+        reply(c, "200 OK", "text/html", page, strlen(page));
+    else
+        reply(c, "404 Not Found", "text/plain", "not found\n", 10);
+}
+
+
+// reads what the client sent, 0 while it should stay open
+static int client_read(struct client *c)
+{
+    char discard[256];
+    ssize_t n;
+
+    if(c->state != CLIENT_REQUEST)
+    {
+        // anything after the request is ignored, a close ends the stream
+        n = recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        return n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) ? -1 : 0;
+    }
+
+    n = recv(c->fd, c->request + c->request_len, REQUEST_MAX - 1 - c->request_len, MSG_DONTWAIT);
+    if(n <= 0)
+        return n < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+    c->request_len += (size_t)n;
+    c->request[c->request_len] = '\0';
+
+    if(strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n"))
+        request(c);
+    else if(c->request_len == REQUEST_MAX - 1)
+        return -1;
+
+    return 0;
+}
+
+
+// sends as much as the socket takes, 0 while it should stay open
+static int client_write(struct client *c)
+{
+    ssize_t n;
+
+    while(c->header_sent < c->header_len)
+    {
+        if((n = send(c->fd, c->header + c->header_sent, c->header_len - c->header_sent, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+        c->header_sent += (size_t)n;
+        bytes_sent += (unsigned long long)n;
+    }
+
+    for(;;)
+    {
+        if(c->part && c->start + c->sent < c->end)
+        {
+            n = send(c->fd, c->part->data + c->start + c->sent, c->end - c->start - c->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if(n < 0)
+                return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+            c->sent += (size_t)n;
+            bytes_sent += (unsigned long long)n;
+            continue;
+        }
+
+        // done with what it had
+        if(c->state == CLIENT_REPLY)
+            return -1;
+
+        if(c->state != CLIENT_STREAM || latest == NULL || c->part == latest)
+            return 0;
+
+        start_part(c);
+    }
+}
+
+
+static int wants_write(const struct client *c)
+{
+    if(c->state == CLIENT_REQUEST)
+        return 0;
+
+    if(c->header_sent < c->header_len || (c->part && c->start + c->sent < c->end))
+        return 1;
+
+    return c->state == CLIENT_STREAM && latest != NULL && c->part != latest;
+}
+
+
+static void pin(int rt_core)
+{
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN), i;
+    cpu_set_t set;
+
+    setpriority(PRIO_PROCESS, 0, 10);
+
+    if(cores < 2)
+    {
+        fprintf(stderr, "one core only, preview shares it with the capture services\n");
+        return;
+    }
+
+    CPU_ZERO(&set);
+    for(i = 0; i < cores; i++)
+        if(i != rt_core)
+            CPU_SET(i, &set);
+
+    if(sched_setaffinity(0, sizeof(set), &set) < 0)
+        perror("sched_setaffinity");
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--shm name] [--port N] [--rate fps] [--scale 1|2|4] [--quality q] [--rt-core N]\n", prog);
+    fprintf(stderr, "  defaults /frames10hz, port 8080, 2 fps, scale 2, quality 70, RT core 2\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "shm",     required_argument, NULL, 'm' },
+        { "port",    required_argument, NULL, 'p' },
+        { "rate",    required_argument, NULL, 'r' },
+        { "scale",   required_argument, NULL, 's' },
+        { "quality", required_argument, NULL, 'q' },
+        { "rt-core", required_argument, NULL, 'C' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    struct pollfd pfd[MAX_CLIENTS + 1];
+    struct frame_shm_reader ring;
+    struct frame_shm_frame frame;
+    struct sockaddr_in addr;
+    struct sigaction sa;
+    unsigned long long next_ns, last_frame_ns, now, start;
+    unsigned char *pixels = NULL, *small = NULL;
+    size_t frame_size = 0;
+    const char *shm_name = "/frames10hz";
+    double rate = 2.0;
+    int port = 8080, scale = 2, quality = 70, rt_core = 2, opened = 0;
+    int listener, opt, one = 1, i, n, timeout_ms, width = 0, height = 0, bpp = 1;
+
+    while((opt = getopt_long(argc, argv, "m:p:r:s:q:C:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'm': shm_name = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 's': scale = atoi(optarg); break;
+            case 'q': quality = atoi(optarg); break;
+            case 'C': rt_core = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(rate <= 0.0 || (scale != 1 && scale != 2 && scale != 4) || quality < 1 || quality > 100)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pin(rt_core);
+    lat_hist_reset(&encode_time);
+
+    if((listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    if(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, MAX_CLIENTS) < 0)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("preview of %s on http://0.0.0.0:%d/ at %.1lf fps, 1/%d size, quality %d\n", shm_name, port, rate,
+           scale, quality);
+    fflush(stdout);
+
+    start = next_ns = last_frame_ns = now_ns();
+
+    while(!interrupted)
+    {
+        now = now_ns();
+
+        // a new preview frame when it is time and the ring has one
+        if(now >= next_ns)
+        {
+            next_ns += (unsigned long long)(NSEC_PER_SEC / rate);
+            if(next_ns < now)
+                next_ns = now + (unsigned long long)(NSEC_PER_SEC / rate);
+
+            if(opened && now - last_frame_ns > REOPEN_MSEC * NSEC_PER_MSEC)
+            {
+                // the publisher may have restarted with a new ring
+                frame_shm_close(&ring);
+                opened = 0;
+            }
+
+            if(!opened && frame_shm_open(&ring, shm_name) == 0)
+            {
+                opened = 1;
+                last_frame_ns = now;
+                width = (int)ring.header->width;
+                height = (int)ring.header->height;
+                bpp = (int)ring.header->bytes_per_pixel;
+                frame_size = (size_t)width * height * bpp;
+
+                free(pixels);
+                free(small);
+                pixels = malloc(frame_size);
+                small = malloc(frame_size / (scale * scale) + 1);
+                if(pixels == NULL || small == NULL)
+                {
+                    fprintf(stderr, "no memory for %dx%d frames\n", width, height);
+                    break;
+                }
+            }
+
+            if(opened && frame_shm_read(&ring, pixels, frame_size, &frame) > 0)
+            {
+                unsigned long long t0 = now_ns();
+                struct part *p;
+
+                last_frame_ns = now;
+
+                if(scale > 1)
+                    scale_down(pixels, width, height, bpp, scale, small);
+
+                if((p = encode(scale > 1 ? small : pixels, width / scale, height / scale, bpp, quality)) != NULL)
+                {
+                    part_put(latest);
+                    latest = p;
+                    p->number = encoded++;
+                    lat_hist_add(&encode_time, now_ns() - t0);
+                }
+            }
+        }
+
+        n = 0;
+        pfd[n].fd = listener;
+        pfd[n++].events = POLLIN;
+
+        for(i = 0; i < MAX_CLIENTS; i++)
+        {
+            if(client[i].state == CLIENT_FREE)
+                continue;
+
+            pfd[n].fd = client[i].fd;
+            pfd[n++].events = POLLIN | (wants_write(&client[i]) ? POLLOUT : 0);
+        }
+
+        now = now_ns();
+        timeout_ms = next_ns > now ? (int)((next_ns - now) / NSEC_PER_MSEC) + 1 : 0;
+
+        if(poll(pfd, (nfds_t)n, timeout_ms) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            perror("poll");
+            break;
+        }
+
+        if(pfd[0].revents & POLLIN)
+        {
+            int fd;
+
+            while((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            {
+                for(i = 0; i < MAX_CLIENTS && client[i].state != CLIENT_FREE; i++)
+                    ;
+
+                if(i == MAX_CLIENTS)
+                {
+                    close(fd);
+                    continue;
+                }
+
+                client[i].fd = fd;
+                client[i].state = CLIENT_REQUEST;
+            }
+        }
+
+        for(i = 0; i < MAX_CLIENTS; i++)
+        {
+            struct client *c = &client[i];
+
+            if(c->state == CLIENT_FREE)
+                continue;
+
+            if(client_read(c) < 0 || (c->state != CLIENT_REQUEST && client_write(c) < 0))
+                client_close(c);
+        }
+    }
+
+    for(i = 0; i < MAX_CLIENTS; i++)
+        if(client[i].state != CLIENT_FREE)
+            client_close(&client[i]);
+
+    part_put(latest);
+    close(listener);
+    if(opened)
+        frame_shm_close(&ring);
+    free(pixels);
+    free(small);
+
+    printf("%llu preview frames encoded in %.1lf s, encode p50=%.2lf ms max=%.2lf ms\n", encoded,
+           (double)(now_ns() - start) / NSEC_PER_SEC, lat_hist_percentile(&encode_time, 50.0) / 1e6,
+           encode_time.max / 1e6);
+    printf("%llu stream clients, %llu frames sent, %llu skipped by slow clients, %.1lf MB\n", clients_served,
+           parts_sent, parts_skipped, bytes_sent / 1e6);
+
+    return 0;
+}
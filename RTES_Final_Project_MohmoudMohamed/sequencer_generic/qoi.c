@@ -0,0 +1,119 @@
+// QOI encoder for captured frames, see qoi.h
+
+#include <string.h>
+#include <stdint.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX (0x00)
+#define QOI_OP_DIFF  (0x40)
+#define QOI_OP_LUMA  (0x80)
+#define QOI_OP_RUN   (0xc0)
+#define QOI_OP_RGB   (0xfe)
+
+#define QOI_RUN_MAX (62)
+
+// alpha is always 255, its share of the hash is a constant
+#define QOI_ALPHA (0xff000000u)
+#define QOI_HASH(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+
+static unsigned char *put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+    return p + 4;
+}
+
+
+// one pixel that differs from the last, after any run has been flushed
+static inline unsigned char *encode_pixel(unsigned char *p, uint32_t *index, uint32_t px, uint32_t prev)
+{
+    int r = px & 0xff, g = (px >> 8) & 0xff, b = (px >> 16) & 0xff;
+    int hash = QOI_HASH(r, g, b), vr, vg, vb, vg_r, vg_b;
+
+    if(index[hash] == px)
+    {
+        *p++ = (unsigned char)(QOI_OP_INDEX | hash);
+        return p;
+    }
+    index[hash] = px;
+
+    // the deltas wrap around as in the reference encoder
+    vr = (signed char)(r - (int)(prev & 0xff));
+    vg = (signed char)(g - (int)((prev >> 8) & 0xff));
+    vb = (signed char)(b - (int)((prev >> 16) & 0xff));
+    vg_r = vr - vg;
+    vg_b = vb - vg;
+
+    if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+        *p++ = (unsigned char)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+    else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+    {
+        *p++ = (unsigned char)(QOI_OP_LUMA | (vg + 32));
+        *p++ = (unsigned char)((vg_r + 8) << 4 | (vg_b + 8));
+    }
+    else
+    {
+        *p++ = QOI_OP_RGB;
+        *p++ = (unsigned char)r;
+        *p++ = (unsigned char)g;
+        *p++ = (unsigned char)b;
+    }
+
+    return p;
+}
+
+
+size_t qoi_encode(const unsigned char *frame, int width, int height, int bytes_per_pixel, unsigned char *out)
+{
+    static const unsigned char end[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    uint32_t index[64], px, prev = QOI_ALPHA;
+    size_t pixels = (size_t)width * height, i;
+    unsigned char *p = out;
+    int run = 0;
+
+    // transparent black, which no opaque pixel matches
+    memset(index, 0, sizeof(index));
+
+    memcpy(p, "qoif", 4);
+    p = put_be32(p + 4, (uint32_t)width);
+    p = put_be32(p, (uint32_t)height);
+    *p++ = 3;                           // RGB
+    *p++ = 0;                           // sRGB
+
+    for(i = 0; i < pixels; i++)
+    {
+        if(bytes_per_pixel == 1)
+            px = QOI_ALPHA | frame[i] * 0x010101u;
+        else
+            px = QOI_ALPHA | frame[3 * i] | frame[3 * i + 1] << 8 | (uint32_t)frame[3 * i + 2] << 16;
+
+        if(px == prev)
+        {
+            if(++run == QOI_RUN_MAX)
+            {
+                *p++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+
+        if(run > 0)
+        {
+            *p++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        p = encode_pixel(p, index, px, prev);
+        prev = px;
+    }
+
+    if(run > 0)
+        *p++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+
+    memcpy(p, end, sizeof(end));
+    return (size_t)(p - out) + sizeof(end);
+}
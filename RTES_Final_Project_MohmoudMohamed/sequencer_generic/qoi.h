@@ -0,0 +1,31 @@
+#ifndef _QOI_H_
+#define _QOI_H_
+
+#include <stddef.h>
+
+// QOI ("Quite OK Image") encoder for captured frames
+//
+// QOI is lossless and encodes in a single pass with a 64 entry color cache
+// and small per-pixel deltas, no entropy coder, so it costs a few ns a pixel
+// where PNG's deflate costs tens.  The format is at https://qoiformat.org.
+//
+// Gray frames (1 byte a pixel) are stored as RGB with R = G = B, QOI has no
+// gray channel layout.  Small steps between gray pixels take one byte and
+// larger ones two, so a noisy gray frame comes out as big as its PGM or
+// bigger; QOI pays off on RGB frames and on clean gray ones.  QOI has no
+// comment field, the capture time stamp of a PGM/PPM dump is not kept.
+
+#define QOI_HEADER_SIZE (14)
+#define QOI_END_SIZE (8)
+
+// worst case encoded size, every pixel a full RGB op
+static inline size_t qoi_max_size(int width, int height)
+{
+    return (size_t)width * height * 4 + QOI_HEADER_SIZE + QOI_END_SIZE;
+}
+
+// encodes a width x height frame of 1 (gray) or 3 (RGB) bytes a pixel into
+// out, which holds qoi_max_size(); returns the encoded size
+size_t qoi_encode(const unsigned char *frame, int width, int height, int bytes_per_pixel, unsigned char *out);
+
+#endif
@@ -0,0 +1,495 @@
+// qoibench - QOI encode throughput per core, to size the encoder pool
+//
+// Encodes gray and RGB test frames of each size (640x480 and 1280x720 unless
+// --size is given) on one core until --min-time has passed and prints the
+// time a frame takes, the frames a second one core encodes, the compression
+// against PGM/PPM and how many cores 10 Hz and 30 Hz capture need.
+//
+// QOI's speed and size depend on the picture: the test frames are smooth
+// gradients with --noise levels of random sensor noise added to each pixel,
+// 0 is the best case and 255 white noise the worst.  Dump a few real frames
+// as PGM/PPM and compare the size with --noise until they agree.
+//
+// With --workers N it then runs the encoder pool of 10Hz (see frameencode.h)
+// on --frames frames of each size, written to --dir, and prints the frames
+// a second the pool sustains including the file writes.
+//
+// --verify checks the encoder instead of timing it: every test frame and a
+// pattern frame made to hit each QOI op (index hits, small and luma deltas,
+// full RGB, runs up to and past the 62 pixel limit, a run ending the frame)
+// is encoded, decoded again by the small reference decoder below and
+// compared pixel for pixel, header and end marker included.
+//
+// usage: qoibench [--size WxH]... [--min-time sec] [--noise levels] [--workers N] [--frames N] [--dir frames]
+//                 [--verify]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "qoi.h"
+#include "frameencode.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define MAX_SIZES (8)
+#define TEST_FRAMES (4)
+#define POOL_SLOTS (16)
+
+#define QOI_OP_INDEX (0x00)
+#define QOI_OP_DIFF  (0x40)
+#define QOI_OP_LUMA  (0x80)
+#define QOI_OP_RUN   (0xc0)
+#define QOI_OP_RGB   (0xfe)
+#define QOI_RUN_MAX (62)
+
+
+struct frame_size
+{
+    int width;
+    int height;
+};
+
+
+// how often the decoder met each op, runs of QOI_RUN_MAX counted apart
+enum qoi_op_count
+{
+    OPS_INDEX = 0,
+    OPS_DIFF,
+    OPS_LUMA,
+    OPS_RGB,
+    OPS_RUN,
+    OPS_RUN_MAX,
+    OPS_COUNT
+};
+
+static const char *op_names[OPS_COUNT] = { "index", "diff", "luma", "rgb", "run", "run 62" };
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// diagonal gradients, a different one per channel, plus uniform noise
+static void make_frame(unsigned char *frame, int width, int height, int bytes_per_pixel, int noise, unsigned int seed)
+{
+    int x, y, c, v;
+
+    for(y = 0; y < height; y++)
+        for(x = 0; x < width; x++)
+            for(c = 0; c < bytes_per_pixel; c++)
+            {
+                v = (x * 255 / width * (c + 1) + y * 255 / height * (3 - c)) / 4;
+                if(noise > 0)
+                    v += (int)(rand_r(&seed) % (unsigned int)(noise + 1)) - noise / 2;
+                *frame++ = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+}
+
+
+// rows of each kind in turn: flat (runs across the row ends), a few colors
+// in short blocks (index hits), steps of 1 (diff), steps of 9 (luma) and
+// far jumps (rgb); the last row is flat so the frame ends in a run
+static void make_pattern(unsigned char *frame, int width, int height, int bytes_per_pixel)
+{
+    static const unsigned char palette[4][3] = { { 200, 10, 10 }, { 10, 200, 10 }, { 10, 10, 200 }, { 90, 90, 90 } };
+    int x, y, c, v;
+
+    for(y = 0; y < height; y++)
+        for(x = 0; x < width; x++)
+            for(c = 0; c < bytes_per_pixel; c++)
+            {
+                switch(y == height - 1 ? 0 : y % 5)
+                {
+                    case 0:  v = 40 + y / 5 % 3 * 60; break;
+                    case 1:  v = palette[x / 3 % 4][c]; break;
+                    case 2:  v = x + c; break;
+                    case 3:  v = x * 9 + c * 3; break;
+                    default: v = x * 97 + c * 71 + y * 13; break;
+                }
+                *frame++ = (unsigned char)v;
+            }
+}
+
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+
+// reference decoder, follows the spec rather than qoi.c; returns 0 when the
+// image decodes to exactly frame and fills in the ops it used
+static int qoi_check(const unsigned char *qoi, size_t size, const unsigned char *frame, int width, int height,
+                     int bytes_per_pixel, unsigned long long ops[OPS_COUNT])
+{
+    static const unsigned char end_marker[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    unsigned char index[64][3], px[3] = { 0, 0, 0 };
+    size_t pixels = (size_t)width * height, i, p = QOI_HEADER_SIZE, end;
+    int run = 0, b1, b2, vg, c;
+
+    memset(index, 0, sizeof(index));
+
+    if(size < QOI_HEADER_SIZE + QOI_END_SIZE || memcmp(qoi, "qoif", 4) != 0 ||
+       get_be32(qoi + 4) != (uint32_t)width || get_be32(qoi + 8) != (uint32_t)height || qoi[12] != 3 || qoi[13] != 0)
+    {
+        fprintf(stderr, "bad QOI header\n");
+        return -1;
+    }
+
+    end = size - QOI_END_SIZE;
+
+    for(i = 0; i < pixels; i++)
+    {
+        if(run > 0)
+            run--;
+        else
+        {
+            if(p >= end)
+            {
+                fprintf(stderr, "QOI data ends at pixel %zu of %zu\n", i, pixels);
+                return -1;
+            }
+
+            b1 = qoi[p++];
+
+            if(b1 == QOI_OP_RGB)
+            {
+                if(p + 3 > end)
+                {
+                    fprintf(stderr, "QOI RGB op cut short at pixel %zu\n", i);
+                    return -1;
+                }
+                px[0] = qoi[p++];
+                px[1] = qoi[p++];
+                px[2] = qoi[p++];
+                ops[OPS_RGB]++;
+            }
+            else if(b1 == 0xff)
+            {
+                fprintf(stderr, "QOI RGBA op at pixel %zu, the frames are opaque\n", i);
+                return -1;
+            }
+            else if((b1 & 0xc0) == QOI_OP_INDEX)
+            {
+                memcpy(px, index[b1], 3);
+                ops[OPS_INDEX]++;
+            }
+            else if((b1 & 0xc0) == QOI_OP_DIFF)
+            {
+                px[0] = (unsigned char)(px[0] + ((b1 >> 4) & 3) - 2);
+                px[1] = (unsigned char)(px[1] + ((b1 >> 2) & 3) - 2);
+                px[2] = (unsigned char)(px[2] + (b1 & 3) - 2);
+                ops[OPS_DIFF]++;
+            }
+            else if((b1 & 0xc0) == QOI_OP_LUMA)
+            {
+                if(p >= end)
+                {
+                    fprintf(stderr, "QOI luma op cut short at pixel %zu\n", i);
+                    return -1;
+                }
+                b2 = qoi[p++];
+                vg = (b1 & 0x3f) - 32;
+                px[0] = (unsigned char)(px[0] + vg - 8 + ((b2 >> 4) & 0x0f));
+                px[1] = (unsigned char)(px[1] + vg);
+                px[2] = (unsigned char)(px[2] + vg - 8 + (b2 & 0x0f));
+                ops[OPS_LUMA]++;
+            }
+            else
+            {
+                run = b1 & 0x3f;
+                ops[run == QOI_RUN_MAX - 1 ? OPS_RUN_MAX : OPS_RUN]++;
+            }
+
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64], px, 3);
+        }
+
+        for(c = 0; c < 3; c++)
+            if(px[c] != frame[i * bytes_per_pixel + (bytes_per_pixel == 3 ? c : 0)])
+            {
+                fprintf(stderr, "pixel %zu (%zu, %zu) decodes to %d %d %d\n", i, i % width, i / width, px[0], px[1],
+                        px[2]);
+                return -1;
+            }
+    }
+
+    if(run > 0 || p != end || memcmp(qoi + end, end_marker, QOI_END_SIZE) != 0)
+    {
+        fprintf(stderr, "QOI image does not end after the last pixel with the end marker\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int verify(struct frame_size *s, int bytes_per_pixel, int noise, unsigned long long ops[OPS_COUNT])
+{
+    size_t frame_bytes = (size_t)s->width * s->height * bytes_per_pixel, size;
+    unsigned char *frame, *out;
+    int i, failed = 0;
+
+    if((out = malloc(qoi_max_size(s->width, s->height))) == NULL || (frame = malloc(frame_bytes)) == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // the test frames the benchmark times, then the pattern
+    for(i = 0; i <= TEST_FRAMES; i++)
+    {
+        if(i < TEST_FRAMES)
+            make_frame(frame, s->width, s->height, bytes_per_pixel, noise, (unsigned int)i + 1);
+        else
+            make_pattern(frame, s->width, s->height, bytes_per_pixel);
+
+        size = qoi_encode(frame, s->width, s->height, bytes_per_pixel, out);
+
+        if(size > qoi_max_size(s->width, s->height) ||
+           qoi_check(out, size, frame, s->width, s->height, bytes_per_pixel, ops) < 0)
+        {
+            fprintf(stderr, "%d x %d %s %s frame does not round trip\n", s->width, s->height,
+                    bytes_per_pixel == 3 ? "RGB" : "gray", i < TEST_FRAMES ? "test" : "pattern");
+            failed = 1;
+        }
+    }
+
+    printf("%5d x %-5d %-5s %s\n", s->width, s->height, bytes_per_pixel == 3 ? "RGB" : "gray",
+           failed ? "FAILED" : "ok");
+
+    free(frame);
+    free(out);
+
+    return failed ? -1 : 0;
+}
+
+
+static int bench_core(struct frame_size *s, int bytes_per_pixel, int noise, double min_time)
+{
+    size_t frame_bytes = (size_t)s->width * s->height * bytes_per_pixel;
+    unsigned long long n = 0, bytes = 0, start, elapsed, min_ns = (unsigned long long)(min_time * NSEC_PER_SEC);
+    unsigned char *frame[TEST_FRAMES], *out;
+    double ms, fps;
+    int i;
+
+    if((out = malloc(qoi_max_size(s->width, s->height))) == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+
+    for(i = 0; i < TEST_FRAMES; i++)
+    {
+        if((frame[i] = malloc(frame_bytes)) == NULL)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        make_frame(frame[i], s->width, s->height, bytes_per_pixel, noise, (unsigned int)i + 1);
+    }
+
+    start = now_ns();
+    do
+    {
+        bytes += qoi_encode(frame[n % TEST_FRAMES], s->width, s->height, bytes_per_pixel, out);
+        n++;
+    } while((elapsed = now_ns() - start) < min_ns);
+
+    ms = elapsed / 1e6 / n;
+    fps = 1000.0 / ms;
+    printf("%5d x %-5d %-5s %9.2lf %9.1lf %9.1lf %8.2lf %8.2lf %8.2lf\n", s->width, s->height,
+           bytes_per_pixel == 3 ? "RGB" : "gray", ms, fps, frame_bytes * fps / 1e6,
+           (double)frame_bytes * n / bytes, 10.0 / fps, 30.0 / fps);
+    fflush(stdout);
+
+    for(i = 0; i < TEST_FRAMES; i++)
+        free(frame[i]);
+    free(out);
+
+    return 0;
+}
+
+
+static int bench_pool(const char *dir, struct frame_size *s, int bytes_per_pixel, int noise, unsigned int workers,
+                      unsigned long long frames)
+{
+    size_t frame_bytes = (size_t)s->width * s->height * bytes_per_pixel;
+    unsigned long long i, start, elapsed, retries = 0;
+    struct frame_encoder e;
+    unsigned char *frame[TEST_FRAMES];
+    char path[512];
+    int j;
+
+    for(j = 0; j < TEST_FRAMES; j++)
+    {
+        if((frame[j] = malloc(frame_bytes)) == NULL)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        make_frame(frame[j], s->width, s->height, bytes_per_pixel, noise, (unsigned int)j + 1);
+    }
+
+    if(frame_encoder_start(&e, s->width, s->height, bytes_per_pixel, POOL_SLOTS, workers, -1) < 0)
+        exit(EXIT_FAILURE);
+
+    start = now_ns();
+
+    // as fast as the pool takes them, waiting rather than dropping
+    for(i = 0; i < frames; i++)
+    {
+        snprintf(path, sizeof(path), "%s/test%08llu.qoi", dir, i);
+        while(frame_encoder_put(&e, path, frame[i % TEST_FRAMES]) < 0)
+        {
+            if(errno != ENOBUFS)
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            retries++;
+            sched_yield();
+        }
+    }
+
+    frame_encoder_stop(&e);
+    elapsed = now_ns() - start;
+    e.dropped -= retries;
+
+    frame_encoder_report(&e, stdout);
+    printf("    pool       %.1lf frames/s with the writes, %.2lf s for %llu frames\n",
+           frames * (double)NSEC_PER_SEC / elapsed, elapsed / 1e9, frames);
+    fflush(stdout);
+
+    for(i = 0; i < frames; i++)
+    {
+        snprintf(path, sizeof(path), "%s/test%08llu.qoi", dir, i);
+        unlink(path);
+    }
+
+    for(j = 0; j < TEST_FRAMES; j++)
+        free(frame[j]);
+
+    return e.failed ? -1 : 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--size WxH]... [--min-time sec] [--noise levels] [--workers N] [--frames N] "
+            "[--dir frames] [--verify]\n", prog);
+    fprintf(stderr, "  default 640x480 and 1280x720, 1 s each, noise 8, no pool run; "
+            "the pool takes 1 to %d workers\n", FRAME_ENCODER_MAX_THREADS);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "size",     required_argument, NULL, 's' },
+        { "min-time", required_argument, NULL, 't' },
+        { "noise",    required_argument, NULL, 'N' },
+        { "workers",  required_argument, NULL, 'n' },
+        { "frames",   required_argument, NULL, 'c' },
+        { "dir",      required_argument, NULL, 'D' },
+        { "verify",   no_argument,       NULL, 'v' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    struct frame_size size[MAX_SIZES] = { { 640, 480 }, { 1280, 720 } };
+    const char *dir = "qoibench";
+    unsigned long long frames = 300;
+    unsigned int workers = 0;
+    double min_time = 1.0;
+    unsigned long long ops[OPS_COUNT] = { 0 };
+    int nsizes = 0, noise = 8, check = 0, opt, i, bpp, failed = 0;
+
+    while((opt = getopt_long(argc, argv, "s:t:N:n:c:D:vh", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                if(nsizes == MAX_SIZES || sscanf(optarg, "%dx%d", &size[nsizes].width, &size[nsizes].height) != 2 ||
+                   size[nsizes].width <= 0 || size[nsizes].height <= 0)
+                {
+                    fprintf(stderr, "bad size %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                nsizes++;
+                break;
+            case 't': min_time = atof(optarg); break;
+            case 'N': noise = atoi(optarg); break;
+            case 'n': workers = (unsigned int)atoi(optarg); break;
+            case 'c': frames = strtoull(optarg, NULL, 0); break;
+            case 'D': dir = optarg; break;
+            case 'v': check = 1; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(nsizes == 0)
+        nsizes = 2;
+
+    if(noise < 0 || noise > 255 || workers > FRAME_ENCODER_MAX_THREADS || frames == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(check)
+    {
+        printf("QOI round trip, test frames with %d levels of noise and a pattern frame\n\n", noise);
+
+        for(i = 0; i < nsizes; i++)
+            for(bpp = 1; bpp <= 3; bpp += 2)
+                if(verify(&size[i], bpp, noise, ops) < 0)
+                    failed = 1;
+
+        printf("\nops decoded:");
+        for(i = 0; i < OPS_COUNT; i++)
+            printf(" %s=%llu", op_names[i], ops[i]);
+        printf("\n");
+
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    printf("QOI encode on one core, test frames with %d levels of noise\n\n", noise);
+    printf("%-13s %-5s %9s %9s %9s %8s %8s %8s\n", "size", "frame", "ms", "frames/s", "MB/s", "ratio", "10 Hz",
+           "30 Hz");
+
+    for(i = 0; i < nsizes; i++)
+        for(bpp = 1; bpp <= 3; bpp += 2)
+            bench_core(&size[i], bpp, noise, min_time);
+
+    if(workers == 0)
+        return EXIT_SUCCESS;
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < nsizes; i++)
+        for(bpp = 1; bpp <= 3; bpp += 2)
+            if(bench_pool(dir, &size[i], bpp, noise, workers, frames) < 0)
+                failed = 1;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+// Real-time memory locking, prefaulting and page fault counts, see rtmem.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "rtmem.h"
+
+static int locked = 0;
+static int marked = 0;
+static struct rusage steady_usage;
+
+
+static size_t page_size(void)
+{
+    static size_t page = 0;
+
+    if(page == 0)
+        page = (size_t)sysconf(_SC_PAGESIZE);
+
+    return page;
+}
+
+
+void rtmem_prefault(void *buf, size_t len)
+{
+    volatile unsigned char *p = buf;
+    size_t i;
+
+    if(len == 0)
+        return;
+
+    // a write, reading a never written page would only map the zero page
+    for(i = 0; i < len; i += page_size())
+        p[i] = p[i];
+
+    p[len - 1] = p[len - 1];
+}
+
+
+// kept out of line so the array is below the caller's frame
+__attribute__((noinline)) void rtmem_prefault_stack(size_t len)
+{
+    unsigned char stack[len];
+
+    rtmem_prefault(stack, len);
+    __asm__ __volatile__("" : : "r"(stack) : "memory");
+}
+
+
+int rtmem_init(size_t heap_reserve)
+{
+    void *heap;
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        locked = 1;
+    else
+        fprintf(stderr, "mlockall: %s, memory not locked (needs CAP_IPC_LOCK or ulimit -l)\n", strerror(errno));
+
+    // grow the heap once, with trimming off it stays mapped after the free
+    if(heap_reserve > 0 && (heap = malloc(heap_reserve)) != NULL)
+    {
+        rtmem_prefault(heap, heap_reserve);
+        free(heap);
+    }
+
+    rtmem_prefault_stack(RTMEM_STACK_PREFAULT);
+
+    return locked ? 0 : -1;
+}
+
+
+int rtmem_thread_attr(pthread_attr_t *attr, size_t stack_size)
+{
+    if(stack_size < (size_t)PTHREAD_STACK_MIN)
+        stack_size = (size_t)PTHREAD_STACK_MIN;
+
+    return pthread_attr_setstacksize(attr, stack_size);
+}
+
+
+void rtmem_mark_steady(void)
+{
+    getrusage(RUSAGE_SELF, &steady_usage);
+    marked = 1;
+}
+
+
+int rtmem_locked(void)
+{
+    return locked;
+}
+
+
+void rtmem_report(FILE *fp)
+{
+    struct rusage now;
+
+    getrusage(RUSAGE_SELF, &now);
+
+    fprintf(fp, "\nPage faults, memory %s\n", locked ? "locked" : "not locked");
+
+    if(!marked)
+    {
+        fprintf(fp, "    whole run     minor=%ld major=%ld\n", now.ru_minflt, now.ru_majflt);
+        return;
+    }
+
+    fprintf(fp, "    startup       minor=%ld major=%ld\n", steady_usage.ru_minflt, steady_usage.ru_majflt);
+    fprintf(fp, "    steady state  minor=%ld major=%ld\n",
+            now.ru_minflt - steady_usage.ru_minflt, now.ru_majflt - steady_usage.ru_majflt);
+}
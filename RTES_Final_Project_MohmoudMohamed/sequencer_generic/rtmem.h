@@ -0,0 +1,49 @@
+#ifndef _RTMEM_H_
+#define _RTMEM_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Real-time memory setup: no page faults once the frame loop is running
+//
+// rtmem_init() is the startup phase of an RT program, called from main()
+// before its buffers are in use and before any service thread exists:
+//
+//   - malloc never trims the heap and never mmap()s, so memory freed during
+//     a run stays mapped and a large allocation cannot munmap() on free()
+//   - every thread allocates from the main arena, the one prefaulted here
+//   - mlockall(MCL_CURRENT | MCL_FUTURE) wires what is mapped now and every
+//     later mapping (thread stacks, heap growth) at the time it is made
+//   - heap_reserve bytes of heap and RTMEM_STACK_PREFAULT bytes of the
+//     calling thread's stack are touched
+//
+// Without CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK the lock fails, this
+// is reported and the rest still happens, so first touches are at least not
+// left to the frame loop.  rtmem_prefault() touches working buffers,
+// rtmem_thread_attr() sets a service thread's stack size and each service
+// calls rtmem_prefault_stack() before it waits for its first release.
+//
+// Page faults (getrusage minor and major) are split at rtmem_mark_steady(),
+// called when startup is over, so rtmem_report() shows whether the steady
+// state ran without any.
+
+#define RTMEM_STACK_SIZE (256 * 1024)      // service thread stacks
+#define RTMEM_STACK_PREFAULT (64 * 1024)   // touched below the caller's frame
+
+int rtmem_init(size_t heap_reserve);
+
+void rtmem_prefault(void *buf, size_t len);
+void rtmem_prefault_stack(size_t len);
+
+int rtmem_thread_attr(pthread_attr_t *attr, size_t stack_size);
+
+// start of steady state, later calls move it
+void rtmem_mark_steady(void);
+
+// 1 when the process memory is locked
+int rtmem_locked(void);
+
+void rtmem_report(FILE *fp);
+
+#endif
@@ -0,0 +1,395 @@
+// rtprecv - receiver for the RTP frame stream sent by rtpsend.c
+//
+// Reassembles the frames of every camera (one RTP SSRC each) from their
+// packets, taking up to RECV_BATCH packets per recvmmsg() call, and prints
+// once a second and at the end per camera
+//
+//   frames      complete, and incomplete ones given up when a packet of the
+//               next frame arrived first
+//   packets     received, lost (gaps in the RTP sequence numbers) and out of
+//               order
+//   latency     capture time stamp to the last packet of a complete frame on
+//               CLOCK_MONOTONIC, only meaningful with the sender on this
+//               host (loopback)
+//
+// With --group the receiver joins that multicast group, with --dir every
+// complete frame is saved as DIR/rtpC-NNNNNNNN.pgm.  It stops after --count
+// frames, when no packet arrived for IDLE_SEC once the stream had started,
+// or when interrupted.
+//
+// usage: rtprecv [--port N] [--group addr] [--count frames] [--dir frames]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rtpsend.h"
+#include "framedump.h"
+#include "lathist.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define RECV_BATCH (32)
+#define RECV_BUFFER (8 * 1024 * 1024)
+#define PACKET_MAX (2048)
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+#define IDLE_SEC (3)
+
+struct stream
+{
+    uint32_t ssrc;
+    int camera;
+    unsigned char *frame;
+    uint32_t frame_size;
+    uint32_t frame_num;
+    uint32_t received;              // bytes of frame_num so far
+    int assembling;
+    int started;
+    int width, height;
+
+    uint16_t next_seq;
+    unsigned long long packets;
+    unsigned long long lost;
+    unsigned long long reordered;
+    unsigned long long complete;
+    unsigned long long incomplete;
+    unsigned long long bytes;
+    struct lat_hist latency;
+
+    unsigned long long second_complete;
+    unsigned long long second_bytes;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static struct stream stream[RTP_SEND_MAX_CAMERAS];
+static int nstreams = 0;
+static const char *dir = NULL;
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static struct stream *find_stream(uint32_t ssrc)
+{
+    int i;
+
+    for(i = 0; i < nstreams; i++)
+        if(stream[i].ssrc == ssrc)
+            return &stream[i];
+
+    if(nstreams == RTP_SEND_MAX_CAMERAS)
+        return NULL;
+
+    memset(&stream[nstreams], 0, sizeof(stream[nstreams]));
+    stream[nstreams].ssrc = ssrc;
+    stream[nstreams].camera = (int)(ssrc - RTP_SEND_SSRC_BASE);
+    lat_hist_reset(&stream[nstreams].latency);
+    return &stream[nstreams++];
+}
+
+
+static void frame_done(struct stream *st, unsigned long long capture_ns)
+{
+    unsigned long long now = now_ns();
+    struct timespec time_stamp;
+    char path[512];
+
+    st->assembling = 0;
+    st->complete++;
+    st->second_complete++;
+
+    if(capture_ns > 0 && capture_ns <= now)
+        lat_hist_add(&st->latency, now - capture_ns);
+
+    if(dir)
+    {
+        time_stamp.tv_sec = capture_ns / NSEC_PER_SEC;
+        time_stamp.tv_nsec = capture_ns % NSEC_PER_SEC;
+        snprintf(path, sizeof(path), "%s/rtp%d-%08u.pgm", dir, st->camera, st->frame_num);
+
+        if(frame_dump_pgm(path, st->frame, st->width, st->height, &time_stamp) < 0)
+            perror(path);
+    }
+}
+
+
+static void packet(const unsigned char *p, size_t len)
+{
+    const struct rtp_packet_header *h = (const struct rtp_packet_header *)p;
+    uint32_t frame_num, offset, frame_size, payload;
+    uint16_t seq, gap;
+    struct stream *st;
+
+    if(len < sizeof(*h) || (h->vpxcc & 0xc0) != 0x80 || (h->mpt & 0x7f) != RTP_SEND_PAYLOAD_TYPE)
+        return;
+
+    if((st = find_stream(ntohl(h->ssrc))) == NULL)
+        return;
+
+    seq = ntohs(h->seq);
+    if(st->packets > 0)
+    {
+        // a small step back is a late packet, anything else counts as a gap
+        gap = (uint16_t)(seq - st->next_seq);
+        if(gap >= 0x8000)
+            st->reordered++;
+        else
+            st->lost += gap;
+    }
+    if(st->packets == 0 || (uint16_t)(seq - st->next_seq) < 0x8000)
+        st->next_seq = (uint16_t)(seq + 1);
+    st->packets++;
+
+    frame_num = ntohl(h->frame.frame_num);
+    offset = ntohl(h->frame.offset);
+    frame_size = ntohl(h->frame.frame_size);
+    payload = (uint32_t)(len - sizeof(*h));
+
+    if(frame_size == 0 || frame_size > MAX_FRAME_SIZE || offset + payload > frame_size)
+        return;
+
+    if(!st->assembling || frame_num != st->frame_num)
+    {
+        // a late packet of a frame already done or given up
+        if(st->started && (int32_t)(frame_num - st->frame_num) <= 0)
+            return;
+
+        if(st->assembling)
+            st->incomplete++;
+
+        if(frame_size > st->frame_size)
+        {
+            free(st->frame);
+            if((st->frame = malloc(frame_size)) == NULL)
+            {
+                st->frame_size = 0;
+                st->assembling = 0;
+                return;
+            }
+        }
+
+        st->frame_size = frame_size;
+        st->frame_num = frame_num;
+        st->width = ntohs(h->frame.width);
+        st->height = ntohs(h->frame.height);
+        st->received = 0;
+        st->assembling = 1;
+        st->started = 1;
+    }
+
+    memcpy(st->frame + offset, p + sizeof(*h), payload);
+    st->received += payload;
+    st->bytes += payload;
+    st->second_bytes += payload;
+
+    if(st->received >= st->frame_size)
+        frame_done(st, be64toh(h->frame.capture_ns));
+}
+
+
+static void report(const char *what, double seconds)
+{
+    struct stream *st;
+    int i;
+
+    for(i = 0; i < nstreams; i++)
+    {
+        st = &stream[i];
+
+        if(strcmp(what, "second") == 0)
+            printf("%-6s camera %d %4llu frames %8.2lf MB/s, total %llu complete %llu incomplete, "
+                   "%llu packets lost %llu late, latency p50=%.1lf us\n",
+                   what, st->camera, st->second_complete, st->second_bytes / seconds / 1e6,
+                   st->complete, st->incomplete, st->lost, st->reordered,
+                   lat_hist_percentile(&st->latency, 50.0) / 1000.0);
+        else
+            printf("%-6s camera %d %llu complete %llu incomplete frames, %.2lf frames/s %.2lf MB/s, "
+                   "%llu packets %llu lost %llu late, latency p50=%.1lf p99=%.1lf max=%.1lf us\n",
+                   what, st->camera, st->complete, st->incomplete,
+                   seconds > 0.0 ? st->complete / seconds : 0.0, seconds > 0.0 ? st->bytes / seconds / 1e6 : 0.0,
+                   st->packets, st->lost, st->reordered, lat_hist_percentile(&st->latency, 50.0) / 1000.0,
+                   lat_hist_percentile(&st->latency, 99.0) / 1000.0, st->latency.max / 1000.0);
+
+        st->second_complete = st->second_bytes = 0;
+    }
+
+    fflush(stdout);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--port N] [--group addr] [--count frames] [--dir frames]\n", prog);
+    fprintf(stderr, "  default port %d, count 0 runs until the stream stops\n", RTP_SEND_PORT);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "port",  required_argument, NULL, 'p' },
+        { "group", required_argument, NULL, 'g' },
+        { "count", required_argument, NULL, 'c' },
+        { "dir",   required_argument, NULL, 'D' },
+        { "help",  no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    static unsigned char buffer[RECV_BATCH][PACKET_MAX];
+    struct iovec iov[RECV_BATCH];
+    struct mmsghdr msg[RECV_BATCH];
+    struct timeval timeout = { 1, 0 };
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    struct sigaction sa;
+    socklen_t optlen = sizeof(int);
+    unsigned long long count = 0, start = 0, last = 0, second_start = 0, now, frames;
+    const char *group = NULL;
+    int port = RTP_SEND_PORT, size = RECV_BUFFER, opt, sock, n, i;
+
+    while((opt = getopt_long(argc, argv, "p:g:c:D:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'g': group = optarg; break;
+            case 'c': count = strtoull(optarg, NULL, 0); break;
+            case 'D': dir = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // a whole frame or two of packets may arrive while we are busy
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, &optlen);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    n = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &n, sizeof(n));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    if(group)
+    {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+        if(inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+           setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            perror(group);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("receiving on port %d%s%s, %d KB socket buffer\n", port, group ? " group " : "", group ? group : "",
+           size / 1024);
+    fflush(stdout);
+
+    for(i = 0; i < RECV_BATCH; i++)
+    {
+        iov[i].iov_base = buffer[i];
+        iov[i].iov_len = PACKET_MAX;
+    }
+
+    while(!interrupted)
+    {
+        for(i = 0; i < RECV_BATCH; i++)
+        {
+            memset(&msg[i], 0, sizeof(msg[i]));
+            msg[i].msg_hdr.msg_iov = &iov[i];
+            msg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // block for the first packet, then take whatever else is queued
+        n = recvmmsg(sock, msg, RECV_BATCH, MSG_WAITFORONE, NULL);
+        now = now_ns();
+
+        if(n < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("recvmmsg");
+                break;
+            }
+
+            if(start && now - last > IDLE_SEC * NSEC_PER_SEC)
+                break;
+
+            continue;
+        }
+
+        if(start == 0)
+            start = second_start = now;
+        last = now;
+
+        for(i = 0; i < n; i++)
+            packet(buffer[i], msg[i].msg_len);
+
+        if(now - second_start >= NSEC_PER_SEC)
+        {
+            report("second", (double)(now - second_start) / NSEC_PER_SEC);
+            second_start = now;
+        }
+
+        for(frames = 0, i = 0; i < nstreams; i++)
+            frames += stream[i].complete + stream[i].incomplete;
+
+        if(count && frames >= count)
+            break;
+    }
+
+    close(sock);
+
+    report("total", last > start ? (double)(last - start) / NSEC_PER_SEC : 0.0);
+
+    for(i = 0; i < nstreams; i++)
+        free(stream[i].frame);
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+// Live streaming of gray frames over UDP in RTP packets, see rtpsend.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "rtpsend.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define RTP_CLOCK_HZ (90000ULL)
+#define SEND_BUFFER (4 * 1024 * 1024)
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static void wait_until(unsigned long long t_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = t_ns / NSEC_PER_SEC;
+    ts.tv_nsec = t_ns % NSEC_PER_SEC;
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+
+static void send_frame(struct rtp_sender *s, const struct rtp_send_job *job)
+{
+    struct rtp_packet_header header[RTP_SEND_BURST];
+    struct iovec iov[RTP_SEND_BURST][2];
+    struct mmsghdr msg[RTP_SEND_BURST];
+    uint32_t size = (uint32_t)s->width * (uint32_t)s->height, offset = 0, len;
+    uint32_t timestamp = (uint32_t)(job->capture_ns * RTP_CLOCK_HZ / NSEC_PER_SEC);
+    unsigned long long now, burst_bytes;
+    int n, sent, rc;
+
+    while(offset < size)
+    {
+        burst_bytes = 0;
+
+        for(n = 0; n < RTP_SEND_BURST && offset < size; n++, offset += len)
+        {
+            len = size - offset < RTP_SEND_PAYLOAD ? size - offset : RTP_SEND_PAYLOAD;
+
+            header[n].vpxcc = 0x80;
+            header[n].mpt = RTP_SEND_PAYLOAD_TYPE | (offset + len == size ? 0x80 : 0);
+            header[n].seq = htons(s->seq[job->camera]++);
+            header[n].timestamp = htonl(timestamp);
+            header[n].ssrc = htonl(RTP_SEND_SSRC_BASE + job->camera);
+            header[n].frame.frame_num = htonl((uint32_t)job->frame_num);
+            header[n].frame.offset = htonl(offset);
+            header[n].frame.frame_size = htonl(size);
+            header[n].frame.width = htons((uint16_t)s->width);
+            header[n].frame.height = htons((uint16_t)s->height);
+            header[n].frame.capture_ns = htobe64(job->capture_ns);
+
+            // the pixels go to the kernel straight from the slot
+            iov[n][0].iov_base = &header[n];
+            iov[n][0].iov_len = sizeof(header[n]);
+            iov[n][1].iov_base = job->frame + offset;
+            iov[n][1].iov_len = len;
+
+            memset(&msg[n], 0, sizeof(msg[n]));
+            msg[n].msg_hdr.msg_name = &s->dest;
+            msg[n].msg_hdr.msg_namelen = sizeof(s->dest);
+            msg[n].msg_hdr.msg_iov = iov[n];
+            msg[n].msg_hdr.msg_iovlen = 2;
+
+            burst_bytes += sizeof(header[n]) + len;
+        }
+
+        // pace: no burst before its time, and no catching up after idling
+        if(s->rate_bps)
+        {
+            now = now_ns();
+            if(s->next_burst_ns > now)
+                wait_until(s->next_burst_ns);
+            else
+                s->next_burst_ns = now;
+
+            s->next_burst_ns += burst_bytes * 8 * NSEC_PER_SEC / s->rate_bps;
+        }
+
+        for(sent = 0; sent < n; sent += rc)
+        {
+            if((rc = sendmmsg(s->sock, msg + sent, (unsigned int)(n - sent), 0)) < 0)
+            {
+                if(errno == EINTR)
+                {
+                    rc = 0;
+                    continue;
+                }
+
+                if(s->failed == 0)
+                    perror("rtp sender sendmmsg");
+
+                s->failed += (unsigned long long)(n - sent);
+                break;
+            }
+        }
+
+        s->packets += (unsigned long long)sent;
+        s->bursts++;
+        s->bytes += burst_bytes;
+    }
+
+    // a missing or later capture time would be a bogus huge sample
+    now = now_ns();
+    if(job->capture_ns > 0 && job->capture_ns <= now)
+        lat_hist_add(&s->send_delay, now - job->capture_ns);
+}
+
+
+static void *sender_thread(void *arg)
+{
+    struct rtp_sender *s = arg;
+    struct rtp_send_job job;
+
+    pthread_mutex_lock(&s->lock);
+
+    for(;;)
+    {
+        while(s->count == 0 && !s->stop)
+            pthread_cond_wait(&s->ready, &s->lock);
+
+        if(s->count == 0)
+            break;
+
+        job = s->job[s->head];
+        s->head = (s->head + 1) % FRAME_POOL_MAX_SLOTS;
+        s->count--;
+
+        pthread_mutex_unlock(&s->lock);
+
+        send_frame(s, &job);
+        frame_pool_put(&s->pool, job.frame);
+
+        pthread_mutex_lock(&s->lock);
+        s->sent[job.camera]++;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+
+int rtp_sender_start(struct rtp_sender *s, const char *dest, int port, int width, int height,
+                     unsigned int slots, unsigned int rate_mbps)
+{
+    pthread_mutexattr_t mattr;
+    int size = SEND_BUFFER, ttl = 1, loop = 1, rc;
+
+    memset(s, 0, sizeof(*s));
+    s->width = width;
+    s->height = height;
+    s->rate_bps = (unsigned long long)rate_mbps * 1000000ULL;
+    lat_hist_reset(&s->send_delay);
+
+    s->dest.sin_family = AF_INET;
+    s->dest.sin_port = htons((uint16_t)port);
+
+    if(inet_pton(AF_INET, dest, &s->dest.sin_addr) != 1)
+    {
+        fprintf(stderr, "rtp sender: %s is not an IPv4 address\n", dest);
+        return -1;
+    }
+
+    if((s->sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("rtp sender socket");
+        return -1;
+    }
+
+    // room for a few bursts in flight, the kernel may grant less
+    setsockopt(s->sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    if(IN_MULTICAST(ntohl(s->dest.sin_addr.s_addr)))
+    {
+        setsockopt(s->sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        setsockopt(s->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    }
+
+    if(frame_pool_init(&s->pool, slots, (size_t)width * height) < 0)
+    {
+        close(s->sock);
+        return -1;
+    }
+
+    // the capture thread submitting runs SCHED_FIFO above the sender
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&s->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_cond_init(&s->ready, NULL);
+
+    if((rc = pthread_create(&s->thread, NULL, sender_thread, s)) != 0)
+    {
+        fprintf(stderr, "rtp sender thread: %s\n", strerror(rc));
+        frame_pool_free(&s->pool);
+        close(s->sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void rtp_sender_stop(struct rtp_sender *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_join(s->thread, NULL);
+
+    pthread_cond_destroy(&s->ready);
+    pthread_mutex_destroy(&s->lock);
+    frame_pool_free(&s->pool);
+    close(s->sock);
+}
+
+
+unsigned char *rtp_sender_get(struct rtp_sender *s, int camera)
+{
+    unsigned char *frame = frame_pool_get(&s->pool);
+
+    if(frame == NULL)
+        __atomic_add_fetch(&s->dropped[camera], 1, __ATOMIC_RELAXED);
+
+    return frame;
+}
+
+
+void rtp_sender_submit(struct rtp_sender *s, unsigned char *frame, int camera, unsigned long long frame_num,
+                       unsigned long long capture_ns)
+{
+    struct rtp_send_job *job;
+
+    pthread_mutex_lock(&s->lock);
+
+    // never full, there are no more jobs than pool slots
+    job = &s->job[(s->head + s->count) % FRAME_POOL_MAX_SLOTS];
+    job->frame = frame;
+    job->camera = camera;
+    job->frame_num = frame_num;
+    job->capture_ns = capture_ns;
+    s->count++;
+
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+void rtp_sender_report(const struct rtp_sender *s, int ncameras, FILE *fp)
+{
+    char dest[INET_ADDRSTRLEN];
+    int i;
+
+    inet_ntop(AF_INET, &s->dest.sin_addr, dest, sizeof(dest));
+
+    fprintf(fp, "\nRTP stream to %s:%d, ", dest, ntohs(s->dest.sin_port));
+    if(s->rate_bps)
+        fprintf(fp, "paced at %llu Mbit/s\n", s->rate_bps / 1000000ULL);
+    else
+        fprintf(fp, "unpaced\n");
+
+    for(i = 0; i < ncameras; i++)
+        fprintf(fp, "    camera %d   sent=%llu dropped=%llu\n", i, s->sent[i], s->dropped[i]);
+
+    fprintf(fp, "    network    %llu packets in %llu bursts, %.1lf MB, %llu failed\n", s->packets, s->bursts,
+            s->bytes / 1e6, s->failed);
+
+    if(s->send_delay.count > 0)
+        fprintf(fp, "    delay      p50=%.1lf us p99=%.1lf us max=%.1lf us (capture to last packet)\n",
+                lat_hist_percentile(&s->send_delay, 50.0) / 1000.0,
+                lat_hist_percentile(&s->send_delay, 99.0) / 1000.0, s->send_delay.max / 1000.0);
+}
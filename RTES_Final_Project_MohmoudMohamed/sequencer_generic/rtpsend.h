@@ -0,0 +1,117 @@
+#ifndef _RTPSEND_H_
+#define _RTPSEND_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "framepool.h"
+#include "lathist.h"
+
+// Live streaming of gray frames over UDP in RTP packets
+//
+// Capture threads take a frame sized slot with rtp_sender_get(), convert
+// the frame straight into it and hand it over with rtp_sender_submit(), the
+// same way as for the frame writer (see framewriter.h), so the capture path
+// copies nothing extra.  When the network falls behind and every slot is
+// still queued, rtp_sender_get() returns NULL and the frame is counted as
+// dropped, a late frame is worth nothing to a live view.
+//
+// A sender thread at normal priority cuts each frame into packets of at
+// most RTP_SEND_PAYLOAD bytes, each an RTP header (payload type
+// RTP_SEND_PAYLOAD_TYPE, one SSRC per camera, 90 kHz time stamp of the
+// capture time, marker on the last packet of a frame) followed by a struct
+// rtp_frame_header and the pixels, gathered from the slot with an iovec.
+// RTP_SEND_BURST packets at a time go out with one sendmmsg() call, the
+// bursts spaced so the average rate stays at the configured bit rate: a
+// frame leaves as an even stream of small bursts instead of one burst of a
+// few hundred packets that overflows switch and receiver queues.
+//
+// The destination may be a multicast group, packets are then sent with TTL
+// 1 so they stay on the LAN.  See rtprecv.c for a receiver.
+
+#define RTP_SEND_PAYLOAD (1400)         // pixels per packet, fits a 1500 byte MTU
+#define RTP_SEND_BURST (16)             // packets per sendmmsg() call
+#define RTP_SEND_PAYLOAD_TYPE (96)      // first dynamic type
+#define RTP_SEND_SSRC_BASE (0x52545030) // "RTP0", plus the camera number
+#define RTP_SEND_PORT (5004)
+#define RTP_SEND_RATE_MBPS (200)
+#define RTP_SEND_MAX_CAMERAS (8)
+
+// after the 12 byte RTP header, in network byte order
+struct rtp_frame_header
+{
+    uint32_t frame_num;
+    uint32_t offset;                // of this packet's pixels in the frame
+    uint32_t frame_size;
+    uint16_t width;
+    uint16_t height;
+    uint64_t capture_ns;            // CLOCK_MONOTONIC of the sender
+} __attribute__((packed));
+
+struct rtp_packet_header
+{
+    uint8_t  vpxcc;                 // version 2, no padding, extension or CSRC
+    uint8_t  mpt;                   // marker bit and payload type
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    struct rtp_frame_header frame;
+} __attribute__((packed));
+
+struct rtp_send_job
+{
+    unsigned char *frame;
+    int camera;
+    unsigned long long frame_num;
+    unsigned long long capture_ns;
+};
+
+struct rtp_sender
+{
+    int width;
+    int height;
+    unsigned long long rate_bps;
+
+    int sock;
+    struct sockaddr_in dest;
+
+    struct frame_pool pool;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct rtp_send_job job[FRAME_POOL_MAX_SLOTS];
+    unsigned int head, count;
+    int stop;
+
+    // sender thread only
+    uint16_t seq[RTP_SEND_MAX_CAMERAS];
+    unsigned long long next_burst_ns;
+
+    unsigned long long sent[RTP_SEND_MAX_CAMERAS];
+    unsigned long long dropped[RTP_SEND_MAX_CAMERAS];
+    unsigned long long packets;
+    unsigned long long bursts;
+    unsigned long long failed;      // packets the kernel refused
+    unsigned long long bytes;
+    struct lat_hist send_delay;     // capture to the last packet of the frame sent
+};
+
+// dest is an IPv4 address, unicast or multicast, rate_mbps 0 sends unpaced
+int rtp_sender_start(struct rtp_sender *s, const char *dest, int port, int width, int height,
+                     unsigned int slots, unsigned int rate_mbps);
+
+// sends what is queued, then stops the thread and frees the slots
+void rtp_sender_stop(struct rtp_sender *s);
+
+// a slot for one width x height gray frame, NULL when none is free
+unsigned char *rtp_sender_get(struct rtp_sender *s, int camera);
+void rtp_sender_submit(struct rtp_sender *s, unsigned char *frame, int camera, unsigned long long frame_num,
+                       unsigned long long capture_ns);
+
+void rtp_sender_report(const struct rtp_sender *s, int ncameras, FILE *fp);
+
+#endif
@@ -118,6 +118,9 @@
 #include <sys/sysinfo.h>
 #include <errno.h>
 
+#include "hrtime.h"
+#include "svctiming.h"
+
 #define USEC_PER_MSEC (1000)
 #define NANOSEC_PER_MSEC (1000000)
 #define NANOSEC_PER_SEC (1000000000)
@@ -141,9 +144,11 @@
 int abortTest=FALSE;
 int abortS1=FALSE, abortS2=FALSE, abortS3=FALSE, abortS4=FALSE, abortS5=FALSE, abortS6=FALSE, abortS7=FALSE;
 sem_t semS1, semS2, semS3, semS4, semS5, semS6, semS7;
-struct timespec start_time_val;
 double start_realtime;
 
+// release, execution and response times of the sequencer (0) and S1 to S7
+static struct svc_timing svc_timing[NUM_THREADS];
+
 typedef struct
 {
     int threadIdx;
@@ -164,6 +169,7 @@ void *Service_7(void *threadp);
 
 double getTimeMsec(void);
 double realtime(struct timespec *tsptr);
+double hrrealtime(void);
 void print_scheduler(void);
 
 
@@ -183,29 +189,14 @@ void print_scheduler(void);
 //
 //
 
-// only works for x64 with proper privileges - has worked in past, but new security measures may
-// prevent use
-static inline unsigned long long tsc_read(void)
-{
-    unsigned int lo, hi;
-
-    // RDTSC copies contents of 64-bit TSC into EDX:EAX
-    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
-    return (unsigned long long)hi << 32 | lo;
-}
-
-// not able to read unless enabled by kernel module
-static inline unsigned ccnt_read (void)
-{
-    unsigned cc;
-    asm volatile ("mrc p15, 0, %0, c15, c12, 1" : "=r" (cc));
-    return cc;
-}
+// hrtime.h reads the x86 TSC or the ARM generic timer (CNTVCT) directly, calibrated against
+// CLOCK_MONOTONIC_RAW.  The ARM11 CCNT is not used, it needs the raspbian-ccr kernel module and
+// its mrc p15 encoding does not exist on aarch64.
 
 
 void main(void)
 {
-    struct timespec current_time_val, current_time_res;
+    struct timespec current_time_res;
     double current_realtime, current_realtime_res;
 
     int i, rc, scope;
@@ -225,15 +216,17 @@ void main(void)
     pid_t mainpid;
 
     printf("Starting High Rate Sequencer Demo\n");
-    clock_gettime(MY_CLOCK_TYPE, &start_time_val); start_realtime=realtime(&start_time_val);
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+
+    // all service time stamps are taken with hrtime_now(), on the same timeline as MY_CLOCK_TYPE
+    hrtime_init();
+    printf("Time stamp counter %s at %llu Hz\n", hrtime_clock.source, hrtime_clock.freq_hz);
+
+    start_realtime=hrrealtime();
+    current_realtime=hrrealtime();
     clock_getres(MY_CLOCK_TYPE, &current_time_res); current_realtime_res=realtime(&current_time_res);
     printf("START High Rate Sequencer @ sec=%6.9lf with resolution %6.9lf\n", (current_realtime - start_realtime), current_realtime_res);
     syslog(LOG_CRIT, "START High Rate Sequencer @ sec=%6.9lf with resolution %6.9lf\n", (current_realtime - start_realtime), current_realtime_res);
 
-   //timestamp = ccnt_read();
-   //printf("timestamp=%u\n", timestamp);
-
    printf("System has %d processors configured and %d available.\n", get_nprocs_conf(), get_nprocs());
 
    CPU_ZERO(&allcpuset);
@@ -278,6 +271,15 @@ void main(void)
     printf("rt_max_prio=%d\n", rt_max_prio);
     printf("rt_min_prio=%d\n", rt_min_prio);
 
+    svc_timing_init(&svc_timing[0], "Sequencer", 10 * NANOSEC_PER_MSEC, rt_max_prio, 1);
+    svc_timing_init(&svc_timing[1], "S1", 20 * NANOSEC_PER_MSEC, rt_max_prio-1, 3);
+    svc_timing_init(&svc_timing[2], "S2", 50 * NANOSEC_PER_MSEC, rt_max_prio-2, 2);
+    svc_timing_init(&svc_timing[3], "S3", 100 * NANOSEC_PER_MSEC, rt_max_prio-3, 3);
+    svc_timing_init(&svc_timing[4], "S4", 200 * NANOSEC_PER_MSEC, rt_max_prio-4, 2);
+    svc_timing_init(&svc_timing[5], "S5", 500ULL * NANOSEC_PER_MSEC, rt_max_prio-5, 3);
+    svc_timing_init(&svc_timing[6], "S6", NANOSEC_PER_SEC, rt_max_prio-6, 2);
+    svc_timing_init(&svc_timing[7], "S7", NANOSEC_PER_SEC, rt_min_prio, 3);
+
 
     for(i=0; i < NUM_THREADS; i++)
     {
@@ -428,13 +430,14 @@ void main(void)
    for(i=0;i<NUM_THREADS;i++)
        pthread_join(threads[i], NULL);
 
+   svc_timing_report(stdout, svc_timing, NUM_THREADS);
+
    printf("\nTEST COMPLETE\n");
 }
 
 
 void *Sequencer(void *threadp)
 {
-    struct timespec current_time_val;
     struct timespec delay_time = {0,10000000}; // delay for 10.0 msec, 100 Hz
     struct timespec remaining_time;
     double current_realtime;
@@ -442,7 +445,7 @@ void *Sequencer(void *threadp)
     unsigned long long seqCnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "Sequencer thread @ sec=%6.9lf\n", current_realtime);
 
     do
@@ -454,6 +457,9 @@ void *Sequencer(void *threadp)
             perror("Sequencer nanosleep");
             exit(-1);
         }
+
+        svc_timing_release(&svc_timing[0]);
+        svc_timing_start(&svc_timing[0]);
            
         seqCnt++;
 
@@ -471,36 +477,67 @@ void *Sequencer(void *threadp)
         // Release each service at a sub-rate of the generic sequencer rate
 
         // Servcie_1 = RT_MAX-1	@ 50 Hz
-        if((seqCnt % 2) == 0) sem_post(&semS1);
+        if((seqCnt % 2) == 0)
+        {
+            svc_timing_release(&svc_timing[1]);
+            sem_post(&semS1);
+        }
 
         // Service_2 = RT_MAX-2	@ 20 Hz
-        if((seqCnt % 5) == 0) sem_post(&semS2);
+        if((seqCnt % 5) == 0)
+        {
+            svc_timing_release(&svc_timing[2]);
+            sem_post(&semS2);
+        }
 
         // Service_3 = RT_MAX-3	@ 10 Hz
-        if((seqCnt % 10) == 0) sem_post(&semS3);
+        if((seqCnt % 10) == 0)
+        {
+            svc_timing_release(&svc_timing[3]);
+            sem_post(&semS3);
+        }
 
         // Service_4 = RT_MAX-4	@ 5 Hz
-        if((seqCnt % 20) == 0) sem_post(&semS4);
+        if((seqCnt % 20) == 0)
+        {
+            svc_timing_release(&svc_timing[4]);
+            sem_post(&semS4);
+        }
 
         // Service_5 = RT_MAX-5	@ 2 Hz
-        if((seqCnt % 50) == 0) sem_post(&semS5);
+        if((seqCnt % 50) == 0)
+        {
+            svc_timing_release(&svc_timing[5]);
+            sem_post(&semS5);
+        }
 
         // Service_6 = RT_MAX-6	@ 1 Hz
-        if((seqCnt % 100) == 0) sem_post(&semS6);
+        if((seqCnt % 100) == 0)
+        {
+            svc_timing_release(&svc_timing[6]);
+            sem_post(&semS6);
+        }
 
         // Service_7 = RT_MIN	1 Hz
-        if((seqCnt % 100) == 0) sem_post(&semS7);
+        if((seqCnt % 100) == 0)
+        {
+            svc_timing_release(&svc_timing[7]);
+            sem_post(&semS7);
+        }
 
-    } while(!abortTest && (seqCnt < threadParams->sequencePeriods));
+        svc_timing_end(&svc_timing[0]);
 
-    sem_post(&semS1); sem_post(&semS2); sem_post(&semS3);
-    sem_post(&semS4); sem_post(&semS5); sem_post(&semS6);
-    sem_post(&semS7);
+    } while(!abortTest && (seqCnt < threadParams->sequencePeriods));
 
+    // set before the posts, so a woken service sees it and is not timed again
     abortS1=TRUE; abortS2=TRUE; abortS3=TRUE;
     abortS4=TRUE; abortS5=TRUE; abortS6=TRUE;
     abortS7=TRUE;
 
+    sem_post(&semS1); sem_post(&semS2); sem_post(&semS3);
+    sem_post(&semS4); sem_post(&semS5); sem_post(&semS6);
+    sem_post(&semS7);
+
     pthread_exit((void *)0);
 }
 
@@ -508,13 +545,12 @@ void *Sequencer(void *threadp)
 
 void *Service_1(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S1Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
     // Start up processing and resource initialization
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S1 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS1) // check for synchronous abort request
@@ -522,13 +558,16 @@ void *Service_1(void *threadp)
 	// wait for service request from the sequencer, a signal handler or ISR in kernel
         sem_wait(&semS1);
 
+        if(abortS1) break;
         S1Cnt++;
+        svc_timing_start(&svc_timing[1]);
 
 	// DO WORK
 
 	// on order of up to milliseconds of latency to get time
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S1 50 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S1Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[1]);
     }
 
     // Resource shutdown here
@@ -539,21 +578,24 @@ void *Service_1(void *threadp)
 
 void *Service_2(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S2Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S2 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS2)
     {
         sem_wait(&semS2);
+
+        if(abortS2) break;
         S2Cnt++;
+        svc_timing_start(&svc_timing[2]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S2 20 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S2Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[2]);
     }
 
     pthread_exit((void *)0);
@@ -562,21 +604,24 @@ void *Service_2(void *threadp)
 
 void *Service_3(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S3Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S3 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS3)
     {
         sem_wait(&semS3);
+
+        if(abortS3) break;
         S3Cnt++;
+        svc_timing_start(&svc_timing[3]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S3 10 Hz on core %d forrelease %llu @ sec=%6.9lf\n", sched_getcpu(), S3Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[3]);
     }
 
     pthread_exit((void *)0);
@@ -585,21 +630,24 @@ void *Service_3(void *threadp)
 
 void *Service_4(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S4Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S4 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS4)
     {
         sem_wait(&semS4);
+
+        if(abortS4) break;
         S4Cnt++;
+        svc_timing_start(&svc_timing[4]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S4 5 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S4Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[4]);
     }
 
     pthread_exit((void *)0);
@@ -608,21 +656,24 @@ void *Service_4(void *threadp)
 
 void *Service_5(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S5Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S5 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS5)
     {
         sem_wait(&semS5);
+
+        if(abortS5) break;
         S5Cnt++;
+        svc_timing_start(&svc_timing[5]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S5 2 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S5Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[5]);
     }
 
     pthread_exit((void *)0);
@@ -630,21 +681,24 @@ void *Service_5(void *threadp)
 
 void *Service_6(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S6Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S6 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS6)
     {
         sem_wait(&semS6);
+
+        if(abortS6) break;
         S6Cnt++;
+        svc_timing_start(&svc_timing[6]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S6 1 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S6Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[6]);
     }
 
     pthread_exit((void *)0);
@@ -652,21 +706,24 @@ void *Service_6(void *threadp)
 
 void *Service_7(void *threadp)
 {
-    struct timespec current_time_val;
     double current_realtime;
     unsigned long long S7Cnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
-    clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+    current_realtime=hrrealtime();
     syslog(LOG_CRIT, "S7 thread @ sec=%6.9lf\n", current_realtime-start_realtime);
 
     while(!abortS7)
     {
         sem_wait(&semS7);
+
+        if(abortS7) break;
         S7Cnt++;
+        svc_timing_start(&svc_timing[7]);
 
-        clock_gettime(MY_CLOCK_TYPE, &current_time_val); current_realtime=realtime(&current_time_val);
+        current_realtime=hrrealtime();
         syslog(LOG_CRIT, "S7 1 Hz on core %d for release %llu @ sec=%6.9lf\n", sched_getcpu(), S7Cnt, current_realtime-start_realtime);
+        svc_timing_end(&svc_timing[7]);
     }
 
     pthread_exit((void *)0);
@@ -675,10 +732,7 @@ void *Service_7(void *threadp)
 
 double getTimeMsec(void)
 {
-  struct timespec event_ts = {0, 0};
-
-  clock_gettime(MY_CLOCK_TYPE, &event_ts);
-  return ((event_ts.tv_sec)*1000.0) + ((event_ts.tv_nsec)/1000000.0);
+  return (double)hrtime_now() / NANOSEC_PER_MSEC;
 }
 
 
@@ -688,6 +742,13 @@ double realtime(struct timespec *tsptr)
 }
 
 
+// seconds now on the hrtime timeline, a counter read instead of a system call
+double hrrealtime(void)
+{
+    return (double)hrtime_now() / NANOSEC_PER_SEC;
+}
+
+
 void print_scheduler(void)
 {
    int schedType;
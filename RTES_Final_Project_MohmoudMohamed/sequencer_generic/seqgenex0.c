@@ -51,6 +51,7 @@
 #include <sys/time.h>
 #include <errno.h>
 #include "seqgen.h"
+#include "driftctl.h"
 #include <sys/sysinfo.h>
 
 #define ABS_DELAY
@@ -62,6 +63,11 @@ int abortS1=FALSE, abortS2=FALSE, abortS3=FALSE;
 sem_t semS1, semS2, semS3;
 static double start_time = 0;
 
+#ifdef DRIFT_CONTROL
+// phase locked to the first release, see driftctl.h
+struct drift_ctl drift_ctl;
+#endif
+
 pthread_t threads[NUM_THREADS];
 pthread_attr_t rt_sched_attr[NUM_THREADS];
 pthread_attr_t main_attr;
@@ -200,6 +206,10 @@ void main(void)
    for(i=0;i<NUM_THREADS;i++)
        pthread_join(threads[i], NULL);
 
+#ifdef DRIFT_CONTROL
+   drift_ctl_report(stdout, &drift_ctl);
+#endif
+
    printf("\nTEST COMPLETE\n");
 }
 
@@ -207,19 +217,26 @@ void main(void)
 void *Sequencer(void *threadp)
 {
     struct timespec delay_time = {0, RTSEQ_DELAY_NSEC};
+#ifndef DRIFT_CONTROL
     struct timespec std_delay_time = {0, RTSEQ_DELAY_NSEC};
+#endif
     struct timespec current_time_val={0,0};
 
     struct timespec remaining_time;
     double current_time, last_time, scaleDelay;
     double delta_t=(RTSEQ_DELAY_NSEC/(double)NANOSEC_PER_SEC);
     double scale_dt;
+    long long delay_ns;
     int rc, delay_cnt=0;
     unsigned long long seqCnt=0;
     threadParams_t *threadParams = (threadParams_t *)threadp;
 
     current_time=getTimeMsec(); last_time=current_time-delta_t;
 
+#ifdef DRIFT_CONTROL
+    drift_ctl_init(&drift_ctl, RTSEQ_DELAY_NSEC, DRIFT_CTL_KP, DRIFT_CTL_KI);
+#endif
+
     syslog(LOG_CRIT, "RTSEQ: start on cpu=%d @ sec=%lf after %lf with dt=%lf\n", sched_getcpu(), current_time, last_time, delta_t);
 
     do
@@ -227,8 +244,13 @@ void *Sequencer(void *threadp)
         current_time=getTimeMsec(); delay_cnt=0;
 
 #ifdef DRIFT_CONTROL
-        scale_dt = (current_time - last_time) - delta_t;
-        delay_time.tv_nsec = std_delay_time.tv_nsec - (scale_dt * (NANOSEC_PER_SEC+DT_SCALING_UNCERTAINTY_NANOSEC))-CLOCK_BIAS_NANOSEC;
+        // delay to the next release from the phase error against the first
+        // release, replaces trimming by the last dt with fixed bias constants
+        clock_gettime(CLOCK_REALTIME, &current_time_val);
+        delay_ns = drift_ctl_update(&drift_ctl, (unsigned long long)current_time_val.tv_sec * NANOSEC_PER_SEC + current_time_val.tv_nsec);
+        delay_time.tv_sec = delay_ns / NANOSEC_PER_SEC;
+        delay_time.tv_nsec = delay_ns % NANOSEC_PER_SEC;
+        scale_dt = drift_ctl.phase_err_ns / (double)NANOSEC_PER_SEC;
         //syslog(LOG_CRIT, "RTSEQ: scale dt=%lf @ sec=%lf after=%lf with dt=%lf\n", scale_dt, current_time, last_time, delta_t);
 #else
         delay_time=std_delay_time; scale_dt=delta_t;
@@ -237,7 +259,7 @@ void *Sequencer(void *threadp)
 
 #ifdef ABS_DELAY
         clock_gettime(CLOCK_REALTIME, &current_time_val);
-        delay_time.tv_sec = current_time_val.tv_sec;
+        delay_time.tv_sec = current_time_val.tv_sec + delay_time.tv_sec;
         delay_time.tv_nsec = current_time_val.tv_nsec + delay_time.tv_nsec;
 
         if(delay_time.tv_nsec > NANOSEC_PER_SEC)
@@ -275,6 +297,10 @@ void *Sequencer(void *threadp)
 
 
         syslog(LOG_CRIT, "RTSEQ: cycle %08llu @ sec=%lf, last=%lf, dt=%lf, sdt=%lf\n", seqCnt, current_time, last_time, (current_time-last_time), scale_dt);
+#ifdef DRIFT_CONTROL
+        syslog(LOG_CRIT, "RTSEQ: cycle %08llu phase=%lld nsec, freq=%.1lf nsec (%.1lf ppm), delay=%lld nsec, slips=%llu\n", seqCnt,
+               drift_ctl.phase_err_ns, drift_ctl.freq_corr_ns, drift_ctl_ppm(&drift_ctl), drift_ctl.delay_ns, drift_ctl.slips);
+#endif
 
         // Release each service at a sub-rate of the generic sequencer rate
 
@@ -6,12 +6,16 @@
 //                   [gives semaphores to all other services]
 // Service_1 - 25 Hz, every 4th Sequencer loop reads a V4L2 video frame
 // Service_2 -  1 Hz, every 100th Sequencer loop writes out the current video frame
+// Service_4 -  1 Hz, half a second after the store, hands the stored frame
+//              file to the transmission sender (frametx.c)
 //
 // With the above, priorities by RM policy would be:
 //
 // Sequencer = RT_MAX @ 100 Hz
 // Service_1 = RT_MAX-1 @ 25 Hz
 // Service_2 = RT_MIN @ 1 Hz
+// Service_4 = RT_MAX-4 @ 1 Hz, only queues the file, the network I/O runs
+//             in the non-RT sender thread so it never delays the services
 //
 
 // This is necessary for CPU affinity macros in Linux
@@ -19,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <pthread.h>
@@ -33,6 +38,10 @@
 
 #include <signal.h>
 
+#include "svctiming.h"
+#include "rtmem.h"
+#include "frametx.h"
+
 #define USEC_PER_MSEC (1000)
 #define NANOSEC_PER_MSEC (1000000)
 #define NANOSEC_PER_SEC (1000000000)
@@ -42,15 +51,26 @@
 
 #define RT_CORE (2)  // Defines the real-time core to be used for thread execution
 
-#define NUM_THREADS (3)  // Number of service threads
+#define NUM_THREADS (4)  // Number of service threads
+
+// Sequencer interval timer period and the service sub-rates it releases
+#define SEQ_PERIOD_NSEC (10000000)
+#define S1_PERIOD_NSEC (4 * SEQ_PERIOD_NSEC)
+#define S2_PERIOD_NSEC (100ULL * SEQ_PERIOD_NSEC)
+#define S3_PERIOD_NSEC (100ULL * SEQ_PERIOD_NSEC)
+#define S4_PERIOD_NSEC (100ULL * SEQ_PERIOD_NSEC)
+
+// Measured execution and response times, in the format read by cheddar_export
+#define SERVICE_TIMING_CSV "service_timing.csv"
 
 // Clock type used for timing; CLOCK_MONOTONIC_RAW is typically precise
 #define MY_CLOCK_TYPE CLOCK_MONOTONIC_RAW
 
 // Global flags and semaphores for aborting and synchronizing service threads
 int abortTest = FALSE;
-int abortS1 = FALSE, abortS2 = FALSE, abortS3 = FALSE;
-sem_t semS1, semS2, semS3;
+int abortS1 = FALSE, abortS2 = FALSE, abortS3 = FALSE, abortS4 = FALSE;
+sem_t semS1, semS2, semS3, semS4;
+sem_t semStarted;  // Posted by each service once its startup is done
 struct timespec start_time_val;
 double start_realtime;
 
@@ -60,6 +80,13 @@ static struct itimerspec last_itime;
 
 static unsigned long long seqCnt = 0;  // Sequence count
 
+// Frame transmission, only when a server was given on the command line
+static struct frame_tx frame_tx;
+static int transmit = FALSE;
+
+// index 0 is the sequencer itself, 1..NUM_THREADS the services
+static struct svc_timing svc_timing[NUM_THREADS + 1];
+
 typedef struct {
     int threadIdx;  // Thread index
 } threadParams_t;
@@ -70,10 +97,12 @@ void Sequencer(int id);
 void *Service_1_frame_acquisition(void *threadp);
 void *Service_2_frame_process(void *threadp);
 void *Service_3_frame_storage(void *threadp);
+void *Service_4_frame_transmission(void *threadp);
 
 int seq_frame_read(void);    // Function to read a video frame
 int seq_frame_process(void); // Function to process a video frame
 int seq_frame_store(void);   // Function to store a video frame
+int seq_frame_stored(char *path, size_t size, int *frame_num, struct timespec *time_stamp); // Last stored frame file
 
 double getTimeMsec(void);    // Function to get the current time in milliseconds
 double realtime(struct timespec *tsptr); // Function to get the real-time value
@@ -83,13 +112,32 @@ int v4l2_frame_acquisition_initialization(char *dev_name); // V4L2 initializatio
 int v4l2_frame_acquisition_shutdown(void);                 // V4L2 shutdown
 int v4l2_frame_acquisition_loop(char *dev_name);           // V4L2 frame acquisition loop
 
-void main(void) {
+// usage: seqv4l2 [device | synthetic:WxH@FPS | replay:PATH[@SPEED]] [host[:port]]
+void main(int argc, char *argv[]) {
     struct timespec current_time_val, current_time_res;
     double current_realtime, current_realtime_res;
 
-    char *dev_name = "/dev/video0";  // Video device name
+    char *dev_name = "/dev/video0";  // Video device name, or a frame source spec
+
+    if(argc > 1)
+        dev_name = argv[1];
 
-    int i, rc, scope, flags = 0;
+    // Optional frame transmission server, port FRAME_TX_PORT by default
+    if(argc > 2) {
+        char host[128], *colon;
+        int port = FRAME_TX_PORT;
+
+        snprintf(host, sizeof(host), "%s", argv[2]);
+        if((colon = strrchr(host, ':')) != NULL) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+
+        if(frame_tx_start(&frame_tx, host, port) == 0)
+            transmit = TRUE;
+    }
+
+    int i, rc, scope, flags = 0, started = 0;
 
     cpu_set_t threadcpu;
     cpu_set_t allcpuset;
@@ -146,6 +194,14 @@ void main(void) {
         printf("Failed to initialize S3 semaphore\n"); 
         exit(-1); 
     }
+    if (sem_init(&semS4, 0, 0)) { 
+        printf("Failed to initialize S4 semaphore\n"); 
+        exit(-1); 
+    }
+    if (sem_init(&semStarted, 0, 0)) { 
+        printf("Failed to initialize startup semaphore\n"); 
+        exit(-1); 
+    }
 
     mainpid = getpid();
 
@@ -171,6 +227,12 @@ void main(void) {
     printf("rt_max_prio=%d\n", rt_max_prio);
     printf("rt_min_prio=%d\n", rt_min_prio);
 
+    svc_timing_init(&svc_timing[0], "Sequencer", SEQ_PERIOD_NSEC, rt_max_prio, RT_CORE);
+    svc_timing_init(&svc_timing[1], "S1_frame_acquisition", S1_PERIOD_NSEC, rt_max_prio - 1, RT_CORE);
+    svc_timing_init(&svc_timing[2], "S2_frame_process", S2_PERIOD_NSEC, rt_max_prio - 2, RT_CORE);
+    svc_timing_init(&svc_timing[3], "S3_frame_storage", S3_PERIOD_NSEC, rt_max_prio - 3, RT_CORE);
+    svc_timing_init(&svc_timing[4], "S4_frame_transmission", S4_PERIOD_NSEC, rt_max_prio - 4, RT_CORE);
+
     for(i = 0; i < NUM_THREADS; i++) {
         // Run ALL threads on core RT_CORE
         CPU_ZERO(&threadcpu);
@@ -181,6 +243,7 @@ void main(void) {
         rc = pthread_attr_setinheritsched(&rt_sched_attr[i], PTHREAD_EXPLICIT_SCHED);
         rc = pthread_attr_setschedpolicy(&rt_sched_attr[i], SCHED_FIFO);
         rc = pthread_attr_setaffinity_np(&rt_sched_attr[i], sizeof(cpu_set_t), &threadcpu);
+        rc = rtmem_thread_attr(&rt_sched_attr[i], RTMEM_STACK_SIZE);
 
         rt_param[i].sched_priority = rt_max_prio - i;
         pthread_attr_setschedparam(&rt_sched_attr[i], &rt_param[i]);
@@ -196,6 +259,7 @@ void main(void) {
     pthread_attr_setschedparam(&rt_sched_attr[0], &rt_param[0]);
     rc = pthread_create(&threads[0], &rt_sched_attr[0], Service_1_frame_acquisition, 
                         (void *)&(threadParams[0]));
+    started += (rc == 0);
     if(rc < 0)
         perror("pthread_create for service 1 - V4L2 video frame acquisition");
     else
@@ -206,6 +270,7 @@ void main(void) {
     pthread_attr_setschedparam(&rt_sched_attr[1], &rt_param[1]);
     rc = pthread_create(&threads[1], &rt_sched_attr[1], Service_2_frame_process, 
                         (void *)&(threadParams[1]));
+    started += (rc == 0);
     if(rc < 0)
         perror("pthread_create for service 2 - frame processing");
     else
@@ -216,11 +281,23 @@ void main(void) {
     pthread_attr_setschedparam(&rt_sched_attr[2], &rt_param[2]);
     rc = pthread_create(&threads[2], &rt_sched_attr[2], Service_3_frame_storage, 
                         (void *)&(threadParams[2]));
+    started += (rc == 0);
     if(rc < 0)
         perror("pthread_create for service 3 - frame storage");
     else
         printf("pthread_create successful for service 3\n");
 
+    // Service_4 = RT_MAX-4 @ 1 Hz
+    rt_param[3].sched_priority = rt_max_prio - 4;
+    pthread_attr_setschedparam(&rt_sched_attr[3], &rt_param[3]);
+    rc = pthread_create(&threads[3], &rt_sched_attr[3], Service_4_frame_transmission, 
+                        (void *)&(threadParams[3]));
+    started += (rc == 0);
+    if(rc < 0)
+        perror("pthread_create for service 4 - frame transmission");
+    else
+        printf("pthread_create successful for service 4\n");
+
     // Wait for service threads to initialize and await release by the sequencer
     // Note: The sleep is not necessary if RT service threads are created with 
     // correct POSIX SCHED_FIFO priorities compared to the non-RT priority of this main program
@@ -228,6 +305,12 @@ void main(void) {
     // Create Sequencer thread, which like a cyclic executive, is highest priority
     printf("Start sequencer\n");
 
+    // Faults from here on are the steady state; main outranks the services,
+    // so wait until every one that started has logged and touched its stack
+    for(i = 0; i < started; i++)
+        sem_wait(&semStarted);
+    rtmem_mark_steady();
+
     // Sequencer = RT_MAX @ 100 Hz
     // Set up to signal SIGALRM if the timer expires
     timer_create(CLOCK_REALTIME, NULL, &timer_1);
@@ -235,9 +318,9 @@ void main(void) {
 
     // Arm the interval timer
     itime.it_interval.tv_sec = 0;
-    itime.it_interval.tv_nsec = 10000000;
+    itime.it_interval.tv_nsec = SEQ_PERIOD_NSEC;
     itime.it_value.tv_sec = 0;
-    itime.it_value.tv_nsec = 10000000;
+    itime.it_value.tv_nsec = SEQ_PERIOD_NSEC;
 
     timer_settime(timer_1, flags, &itime, &last_itime);
 
@@ -249,6 +332,15 @@ void main(void) {
     }
 
     v4l2_frame_acquisition_shutdown();
+
+    if(transmit) {
+        frame_tx_stop(&frame_tx);
+        frame_tx_report(&frame_tx, stdout);
+    }
+
+    svc_timing_report(stdout, svc_timing, NUM_THREADS + 1);
+    svc_timing_export(SERVICE_TIMING_CSV, svc_timing, NUM_THREADS + 1);
+
     printf("\nTEST COMPLETE\n");
 }
 
@@ -257,6 +349,9 @@ void Sequencer(int id) {
     double current_realtime;
     int rc, flags = 0;
 
+    svc_timing_release(&svc_timing[0]);
+    svc_timing_start(&svc_timing[0]);
+
     // Received interval timer signal
     if(abortTest) {
         // Disable interval timer
@@ -268,24 +363,38 @@ void Sequencer(int id) {
         printf("Disabling sequencer interval timer with abort=%d and %llu\n", abortTest, seqCnt);
 
         // Shutdown all services
-        abortS1 = TRUE; abortS2 = TRUE; abortS3 = TRUE;
-        sem_post(&semS1); sem_post(&semS2); sem_post(&semS3);
+        abortS1 = TRUE; abortS2 = TRUE; abortS3 = TRUE; abortS4 = TRUE;
+        sem_post(&semS1); sem_post(&semS2); sem_post(&semS3); sem_post(&semS4);
     }
 
     seqCnt++;
 
     // Release each service at a sub-rate of the generic sequencer rate
     // Service_1 @ 25 Hz
-    if((seqCnt % 4) == 0) 
+    if((seqCnt % 4) == 0) {
+        svc_timing_release(&svc_timing[1]);
         sem_post(&semS1);
+    }
 
     // Service_2 @ 1 Hz
-    if((seqCnt % 100) == 0) 
+    if((seqCnt % 100) == 0) {
+        svc_timing_release(&svc_timing[2]);
         sem_post(&semS2);
+    }
 
     // Service_3 @ 1 Hz
-    if((seqCnt % 100) == 0) 
+    if((seqCnt % 100) == 0) {
+        svc_timing_release(&svc_timing[3]);
         sem_post(&semS3);
+    }
+
+    // Service_4 @ 1 Hz, offset by half a period from the store
+    if((seqCnt % 100) == 50) {
+        svc_timing_release(&svc_timing[4]);
+        sem_post(&semS4);
+    }
+
+    svc_timing_end(&svc_timing[0]);
 }
 
 void *Service_1_frame_acquisition(void *threadp) {
@@ -299,6 +408,8 @@ void *Service_1_frame_acquisition(void *threadp) {
     current_realtime = realtime(&current_time_val);
     syslog(LOG_CRIT, "S1 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
     printf("S1 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
+    rtmem_prefault_stack(RTMEM_STACK_PREFAULT);
+    sem_post(&semStarted);
 
     while(!abortS1) {
         // Wait for service request from the sequencer
@@ -306,6 +417,7 @@ void *Service_1_frame_acquisition(void *threadp) {
 
         if(abortS1) break;
         S1Cnt++;
+        svc_timing_start(&svc_timing[1]);
 
         // DO WORK - acquire V4L2 frame here or OpenCV frame here
         seq_frame_read();
@@ -315,6 +427,7 @@ void *Service_1_frame_acquisition(void *threadp) {
         current_realtime = realtime(&current_time_val);
         syslog(LOG_CRIT, "S1 at 25 Hz on core %d for release %llu @ sec=%6.9lf\n", 
                 sched_getcpu(), S1Cnt, current_realtime - start_realtime);
+        svc_timing_end(&svc_timing[1]);
 
         if(S1Cnt > 250) {abortTest = TRUE;};
     }
@@ -333,12 +446,15 @@ void *Service_2_frame_process(void *threadp) {
     current_realtime = realtime(&current_time_val);
     syslog(LOG_CRIT, "S2 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
     printf("S2 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
+    rtmem_prefault_stack(RTMEM_STACK_PREFAULT);
+    sem_post(&semStarted);
 
     while(!abortS2) {
         sem_wait(&semS2);
 
         if(abortS2) break;
         S2Cnt++;
+        svc_timing_start(&svc_timing[2]);
 
         // DO WORK - transform frame
         process_cnt = seq_frame_process();
@@ -348,6 +464,7 @@ void *Service_2_frame_process(void *threadp) {
         current_realtime = realtime(&current_time_val);
         syslog(LOG_CRIT, "S2 at 1 Hz on core %d for release %llu @ sec=%6.9lf\n", 
                 sched_getcpu(), S2Cnt, current_realtime - start_realtime);
+        svc_timing_end(&svc_timing[2]);
     }
 
     pthread_exit((void *)0);
@@ -364,12 +481,15 @@ void *Service_3_frame_storage(void *threadp) {
     current_realtime = realtime(&current_time_val);
     syslog(LOG_CRIT, "S3 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
     printf("S3 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
+    rtmem_prefault_stack(RTMEM_STACK_PREFAULT);
+    sem_post(&semStarted);
 
     while(!abortS3) {
         sem_wait(&semS3);
 
         if(abortS3) break;
         S3Cnt++;
+        svc_timing_start(&svc_timing[3]);
 
         // DO WORK - store frame
         store_cnt = seq_frame_store();
@@ -379,6 +499,7 @@ void *Service_3_frame_storage(void *threadp) {
         current_realtime = realtime(&current_time_val);
         syslog(LOG_CRIT, "S3 at 1 Hz on core %d for release %llu @ sec=%6.9lf\n", 
                 sched_getcpu(), S3Cnt, current_realtime - start_realtime);
+        svc_timing_end(&svc_timing[3]);
 
         // After last write, set synchronous abort
         if(store_cnt == 10) {abortTest = TRUE;};
@@ -387,6 +508,47 @@ void *Service_3_frame_storage(void *threadp) {
     pthread_exit((void *)0);
 }
 
+void *Service_4_frame_transmission(void *threadp) {
+    struct timespec current_time_val, frame_time;
+    double current_realtime;
+    unsigned long long S4Cnt = 0;
+    char path[32];
+    int frame_num, last_frame_num = -1;
+
+    (void)threadp;
+
+    clock_gettime(MY_CLOCK_TYPE, &current_time_val); 
+    current_realtime = realtime(&current_time_val);
+    syslog(LOG_CRIT, "S4 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
+    printf("S4 thread @ sec=%6.9lf\n", current_realtime - start_realtime);
+    rtmem_prefault_stack(RTMEM_STACK_PREFAULT);
+    sem_post(&semStarted);
+
+    while(!abortS4) {
+        sem_wait(&semS4);
+
+        if(abortS4) break;
+        S4Cnt++;
+        svc_timing_start(&svc_timing[4]);
+
+        // DO WORK - queue the newest stored frame, each one only once
+        if(transmit && seq_frame_stored(path, sizeof(path), &frame_num, &frame_time) == 0 &&
+           frame_num != last_frame_num) {
+            frame_tx_submit(&frame_tx, path, frame_num, &frame_time);
+            last_frame_num = frame_num;
+        }
+
+        // Log time after queueing
+        clock_gettime(MY_CLOCK_TYPE, &current_time_val); 
+        current_realtime = realtime(&current_time_val);
+        syslog(LOG_CRIT, "S4 at 1 Hz on core %d for release %llu @ sec=%6.9lf\n", 
+                sched_getcpu(), S4Cnt, current_realtime - start_realtime);
+        svc_timing_end(&svc_timing[4]);
+    }
+
+    pthread_exit((void *)0);
+}
+
 double getTimeMsec(void) {
     struct timespec event_ts = {0, 0};
 
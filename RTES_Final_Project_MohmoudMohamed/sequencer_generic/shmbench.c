@@ -0,0 +1,277 @@
+// shmbench - latency of frames published in shared memory to 1..N readers
+//
+// For every reader count from 1 to --readers the benchmark creates a frame
+// ring (see frameshm.h), forks that many reader processes and publishes
+// --frames frames at --rate Hz from the parent, at SCHED_FIFO when it may,
+// the way the capture thread would.  Each reader waits for the next frame
+// (or spins with --poll), copies it out and records how long after the
+// publish it had it.  Per reader count it prints
+//
+//   publish     time the publisher spent per frame, copy in and wake
+//               included, which must not grow with the readers
+//   latency     publish to the copy complete in a reader, all readers
+//   missed      frames a reader never saw because a newer one was
+//               published before it got to read
+//   retries     copies started over because the slot was overwritten
+//
+// usage: shmbench [--readers N] [--frames N] [--rate hz] [--size WxH] [--poll]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "frameshm.h"
+#include "lathist.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define MAX_READERS (8)
+#define WAIT_MSEC (100)
+
+// filled in by the readers, in a shared anonymous mapping
+struct reader_result
+{
+    int ready;
+    struct lat_hist latency;
+    unsigned long long reads;
+    unsigned long long missed;
+    unsigned long long retries;
+};
+
+struct shared
+{
+    int done;
+    struct reader_result reader[MAX_READERS];
+};
+
+static struct shared *shared;
+static int polling = 0;
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static void reader(const char *name, struct reader_result *result, size_t frame_size)
+{
+    struct frame_shm_reader r;
+    struct frame_shm_frame frame;
+    unsigned char *buf;
+    int rc;
+
+    if(frame_shm_open(&r, name) < 0 || (buf = malloc(frame_size)) == NULL)
+    {
+        perror(name);
+        _exit(EXIT_FAILURE);
+    }
+
+    // touch the copy buffer before the first frame is timed
+    memset(buf, 0, frame_size);
+    __atomic_store_n(&result->ready, 1, __ATOMIC_RELEASE);
+
+    while(!__atomic_load_n(&shared->done, __ATOMIC_ACQUIRE))
+    {
+        if(!polling && frame_shm_wait(&r, WAIT_MSEC) == 0)
+            continue;
+
+        if((rc = frame_shm_read(&r, buf, frame_size, &frame)) < 0)
+            _exit(EXIT_FAILURE);
+
+        if(rc > 0)
+            lat_hist_add(&result->latency, now_ns() - frame.publish_ns);
+    }
+
+    result->reads = r.reads;
+    result->missed = r.missed;
+    result->retries = r.retries;
+
+    frame_shm_close(&r);
+    _exit(EXIT_SUCCESS);
+}
+
+
+static int run(int nreaders, unsigned long long frames, unsigned int rate, int width, int height)
+{
+    struct frame_shm shm;
+    struct lat_hist publish, latency;
+    struct timespec next, capture;
+    unsigned long long i, start, reads = 0, missed = 0, retries = 0;
+    size_t frame_size = (size_t)width * height;
+    unsigned char *frame;
+    pid_t pid[MAX_READERS];
+    char name[64];
+    struct sched_param param;
+    int n, status, rt, failed = 0;
+
+    snprintf(name, sizeof(name), "/shmbench-%d", (int)getpid());
+
+    if(frame_shm_create(&shm, name, width, height, 1) < 0 || (frame = malloc(frame_size)) == NULL)
+        return -1;
+
+    memset(frame, 0x80, frame_size);
+    memset(shared, 0, sizeof(*shared));
+
+    for(n = 0; n < nreaders; n++)
+    {
+        lat_hist_reset(&shared->reader[n].latency);
+
+        if((pid[n] = fork()) == 0)
+            reader(name, &shared->reader[n], frame_size);
+
+        if(pid[n] < 0)
+        {
+            perror("fork");
+            nreaders = n;
+            failed = 1;
+            break;
+        }
+    }
+
+    for(n = 0; n < nreaders; n++)
+        while(!__atomic_load_n(&shared->reader[n].ready, __ATOMIC_ACQUIRE))
+            usleep(1000);
+
+    // the readers were forked at normal priority, the publisher runs like
+    // the capture thread if it may
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+    rt = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+
+    lat_hist_reset(&publish);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for(i = 0; i < frames && !failed; i++)
+    {
+        next.tv_nsec += (long)(NSEC_PER_SEC / rate);
+        while(next.tv_nsec >= (long)NSEC_PER_SEC)
+        {
+            next.tv_nsec -= (long)NSEC_PER_SEC;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        frame[0] = (unsigned char)i;
+        clock_gettime(CLOCK_MONOTONIC, &capture);
+
+        start = now_ns();
+        frame_shm_publish(&shm, frame, (unsigned int)frame_size, i, &capture);
+        lat_hist_add(&publish, now_ns() - start);
+    }
+
+    if(rt)
+    {
+        param.sched_priority = 0;
+        sched_setscheduler(0, SCHED_OTHER, &param);
+    }
+
+    // let the last frame reach the readers, then stop them
+    usleep(2 * WAIT_MSEC * 1000);
+    __atomic_store_n(&shared->done, 1, __ATOMIC_RELEASE);
+
+    lat_hist_reset(&latency);
+
+    for(n = 0; n < nreaders; n++)
+    {
+        if(waitpid(pid[n], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+
+        lat_hist_merge(&latency, &shared->reader[n].latency);
+        reads += shared->reader[n].reads;
+        missed += shared->reader[n].missed;
+        retries += shared->reader[n].retries;
+    }
+
+    printf("%7d %9.1lf %9.1lf %9.1lf %10.1lf %10.1lf %10.1lf %8llu %8llu %8llu\n", nreaders,
+           lat_hist_percentile(&publish, 50.0) / 1000.0, lat_hist_percentile(&publish, 99.0) / 1000.0,
+           publish.max / 1000.0, lat_hist_percentile(&latency, 50.0) / 1000.0,
+           lat_hist_percentile(&latency, 99.0) / 1000.0, latency.max / 1000.0, reads, missed, retries);
+    fflush(stdout);
+
+    free(frame);
+    frame_shm_destroy(&shm);
+    return failed ? -1 : 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--readers N] [--frames N] [--rate hz] [--size WxH] [--poll]\n", prog);
+    fprintf(stderr, "  up to %d readers, default 8 readers, 200 frames at 100 Hz of 640x480\n", MAX_READERS);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "readers", required_argument, NULL, 'n' },
+        { "frames",  required_argument, NULL, 'c' },
+        { "rate",    required_argument, NULL, 'r' },
+        { "size",    required_argument, NULL, 's' },
+        { "poll",    no_argument,       NULL, 'p' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    unsigned long long frames = 200;
+    unsigned int rate = 100;
+    int max_readers = MAX_READERS, width = 640, height = 480, opt, n, failed = 0;
+
+    while((opt = getopt_long(argc, argv, "n:c:r:s:ph", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': max_readers = atoi(optarg); break;
+            case 'c': frames = strtoull(optarg, NULL, 0); break;
+            case 'r': rate = (unsigned int)atoi(optarg); break;
+            case 'p': polling = 1; break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                {
+                    fprintf(stderr, "bad size %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(max_readers < 1 || max_readers > MAX_READERS || frames == 0 || rate == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d x %d frames, %llu at %u Hz per run, readers %s\n", width, height, frames, rate,
+           polling ? "spinning" : "waiting on the futex");
+
+    printf("\n%7s %29s %32s %26s\n", "", "publish us", "publish to read us", "");
+    printf("%7s %9s %9s %9s %10s %10s %10s %8s %8s %8s\n", "readers", "p50", "p99", "max", "p50", "p99", "max",
+           "reads", "missed", "retries");
+
+    for(n = 1; n <= max_readers; n++)
+        if(run(n, frames, rate, width, height) < 0)
+            failed = 1;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+// Sobel filter implementation, shared by the capture programs and bench
+
+#include <math.h>
+
+#include "sobel.h"
+
+
+void sobel_filter(const unsigned char *input, unsigned char *output, int width, int height) {
+    int x, y;
+    int gx, gy;
+    int i, j;
+    const int sobel_x[3][3] = {
+        {-1, 0, 1},
+        {-2, 0, 2},
+        {-1, 0, 1}
+    };
+    const int sobel_y[3][3] = {
+        {-1, -2, -1},
+        {0,  0,  0},
+        {1,  2,  1}
+    };
+
+    for (y = 1; y < height - 1; ++y) {
+        for (x = 1; x < width - 1; ++x) {
+            gx = 0;
+            gy = 0;
+
+            for (i = -1; i <= 1; ++i) {
+                for (j = -1; j <= 1; ++j) {
+                    int pixel = input[(y + i) * width + (x + j)];
+                    gx += pixel * sobel_x[i + 1][j + 1];
+                    gy += pixel * sobel_y[i + 1][j + 1];
+                }
+            }
+
+            int magnitude = sqrt(gx * gx + gy * gy);
+            if (magnitude > 255) magnitude = 255;
+            output[y * width + x] = magnitude;
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef _SOBEL_H_
+#define _SOBEL_H_
+
+// Sobel edge magnitude of a width x height gray image, output has the same
+// layout as input, the one pixel border is left untouched
+void sobel_filter(const unsigned char *input, unsigned char *output, int width, int height);
+
+#endif
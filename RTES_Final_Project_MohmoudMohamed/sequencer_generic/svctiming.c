@@ -0,0 +1,211 @@
+// Online execution and response time measurement, see svctiming.h
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "svctiming.h"
+#include "hrtime.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+
+
+static unsigned long long clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+
+unsigned long long svc_timing_now(void)
+{
+    return hrtime_now();
+}
+
+
+void svc_timing_init(struct svc_timing *svc, const char *name, unsigned long long period_ns, int priority, int cpu)
+{
+    hrtime_init();
+
+    memset(svc, 0, sizeof(*svc));
+
+    svc->name = name;
+    svc->period_ns = period_ns;
+    svc->priority = priority;
+    svc->cpu = cpu;
+
+    lat_hist_reset(&svc->exec_cpu);
+    lat_hist_reset(&svc->exec_wall);
+    lat_hist_reset(&svc->jitter);
+    lat_hist_reset(&svc->response);
+
+    perfctr_stats_init(&svc->perf, name);
+}
+
+
+void svc_timing_release(struct svc_timing *svc)
+{
+    unsigned long long now = svc_timing_now();
+
+    if(svc->posted == 0)
+        svc->first_release_ns = now;
+
+    svc->release_ns[svc->posted % SVC_RELEASE_QUEUE] = now;
+
+    // the semaphore post that follows orders this against the service
+    __atomic_store_n(&svc->posted, svc->posted + 1, __ATOMIC_RELEASE);
+}
+
+
+void svc_timing_start(struct svc_timing *svc)
+{
+    unsigned long long posted = __atomic_load_n(&svc->posted, __ATOMIC_ACQUIRE);
+    unsigned long long ideal;
+
+    svc->start_wall_ns = svc_timing_now();
+    svc->start_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    perfctr_sample(&svc->perf_start);
+
+    if(posted == 0)
+    {
+        // released without the sequencer recording it, charge from now
+        svc->cur_release_ns = svc->start_wall_ns;
+        return;
+    }
+
+    // fell so far behind that the release time was overwritten
+    if(posted - svc->consumed > SVC_RELEASE_QUEUE)
+    {
+        svc->release_overflows++;
+        svc->consumed = posted - SVC_RELEASE_QUEUE;
+    }
+
+    if(svc->consumed >= posted)
+        svc->consumed = posted - 1;
+
+    svc->cur_release_ns = svc->release_ns[svc->consumed % SVC_RELEASE_QUEUE];
+
+    ideal = svc->first_release_ns + svc->consumed * svc->period_ns;
+
+    lat_hist_add(&svc->jitter, svc->cur_release_ns > ideal ? svc->cur_release_ns - ideal : ideal - svc->cur_release_ns);
+
+    svc->consumed++;
+}
+
+
+void svc_timing_end(struct svc_timing *svc)
+{
+    unsigned long long end_wall, end_cpu, response;
+
+    perfctr_account(&svc->perf, &svc->perf_start);
+
+    end_wall = svc_timing_now();
+    end_cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    response = end_wall - svc->cur_release_ns;
+
+    lat_hist_add(&svc->exec_wall, end_wall - svc->start_wall_ns);
+    lat_hist_add(&svc->exec_cpu, end_cpu - svc->start_cpu_ns);
+    lat_hist_add(&svc->response, response);
+
+    svc->completions++;
+
+    if(response > svc->period_ns)
+        svc->deadline_misses++;
+}
+
+
+static double usec(unsigned long long ns)
+{
+    return (double)ns / 1000.0;
+}
+
+
+static void report_hist(FILE *fp, const char *what, const struct lat_hist *h)
+{
+    if(h->count == 0)
+    {
+        fprintf(fp, "    %-10s no samples\n", what);
+        return;
+    }
+
+    fprintf(fp, "    %-10s min=%10.1lf avg=%10.1lf max=%10.1lf p99.9=%10.1lf usec\n", what,
+            usec(h->min), lat_hist_mean(h) / 1000.0, usec(h->max), usec(lat_hist_percentile(h, 99.9)));
+}
+
+
+void svc_timing_report(FILE *fp, struct svc_timing *svc, int count)
+{
+    int i;
+
+    fprintf(fp, "\nService timing (execution, release jitter, response)\n");
+
+    for(i = 0; i < count; i++)
+    {
+        fprintf(fp, "%s: T=%.1lf msec, prio=%d, core=%d, releases=%llu, completions=%llu, deadline misses=%llu",
+                svc[i].name, (double)svc[i].period_ns / 1000000.0, svc[i].priority, svc[i].cpu,
+                svc[i].posted, svc[i].completions, svc[i].deadline_misses);
+
+        if(svc[i].release_overflows)
+            fprintf(fp, ", lost release times=%llu", svc[i].release_overflows);
+
+        fprintf(fp, "\n");
+
+        report_hist(fp, "C cpu", &svc[i].exec_cpu);
+        report_hist(fp, "C wall", &svc[i].exec_wall);
+        report_hist(fp, "jitter", &svc[i].jitter);
+        report_hist(fp, "response", &svc[i].response);
+    }
+
+    if(perfctr_enabled())
+    {
+        struct perfctr_stats *perf = malloc(count * sizeof(*perf));
+
+        if(perf == NULL)
+            return;
+
+        for(i = 0; i < count; i++)
+            perf[i] = svc[i].perf;
+
+        perfctr_report(fp, "service release", perf, count);
+        free(perf);
+    }
+}
+
+
+int svc_timing_export(const char *path, struct svc_timing *svc, int count)
+{
+    FILE *fp;
+    int i;
+
+    if((fp = fopen(path, "w")) == NULL)
+    {
+        perror("service timing export");
+        return -1;
+    }
+
+    fprintf(fp, "# name,period_us,priority,cpu,releases,wcet_cpu_us,wcet_wall_us,p999_wall_us,avg_wall_us,max_jitter_us,max_response_us,deadline_misses\n");
+
+    for(i = 0; i < count; i++)
+    {
+        fprintf(fp, "%s,%.3lf,%d,%d,%llu,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%llu\n",
+                svc[i].name, usec(svc[i].period_ns), svc[i].priority, svc[i].cpu,
+                svc[i].posted,
+                usec(svc[i].exec_cpu.count ? svc[i].exec_cpu.max : 0),
+                usec(svc[i].exec_wall.count ? svc[i].exec_wall.max : 0),
+                usec(lat_hist_percentile(&svc[i].exec_wall, 99.9)),
+                lat_hist_mean(&svc[i].exec_wall) / 1000.0,
+                usec(svc[i].jitter.count ? svc[i].jitter.max : 0),
+                usec(svc[i].response.count ? svc[i].response.max : 0),
+                svc[i].deadline_misses);
+    }
+
+    fclose(fp);
+
+    printf("Service timing written to %s\n", path);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef _SVCTIMING_H_
+#define _SVCTIMING_H_
+
+#include <stdio.h>
+
+#include "lathist.h"
+#include "perfctr.h"
+
+// Online execution and response time measurement for sequenced services
+//
+// The sequencer calls svc_timing_release() when it posts a service's
+// semaphore, the service brackets each release with svc_timing_start() and
+// svc_timing_end().  Per release we keep:
+//
+//   execution time  - CLOCK_THREAD_CPUTIME_ID delta (C without preemption)
+//                     and wall clock delta from start to end
+//   release jitter  - |actual release - ideal release|, ideal releases are
+//                     first release + n * period
+//   response time   - completion - actual release, a deadline miss is
+//                     counted whenever it exceeds the period (D = T)
+//
+// Release times are queued so an overrunning service still gets charged
+// from its own release, not the latest one.
+//
+// After perfctr_enable() each release is also charged its hardware counter
+// deltas (cycles, instructions, cache and branch misses), see perfctr.h.
+
+#define SVC_RELEASE_QUEUE (16)
+
+struct svc_timing
+{
+    const char *name;
+    unsigned long long period_ns;
+    int priority;
+    int cpu;
+
+    // written by the sequencer
+    unsigned long long release_ns[SVC_RELEASE_QUEUE];
+    volatile unsigned long long posted;
+    unsigned long long first_release_ns;
+
+    // written by the service thread
+    unsigned long long consumed;
+    unsigned long long cur_release_ns;
+    unsigned long long start_wall_ns;
+    unsigned long long start_cpu_ns;
+
+    unsigned long long completions;
+    unsigned long long deadline_misses;
+    unsigned long long release_overflows;
+
+    struct lat_hist exec_cpu;
+    struct lat_hist exec_wall;
+    struct lat_hist jitter;
+    struct lat_hist response;
+
+    struct perfctr_sample perf_start;
+    struct perfctr_stats perf;
+};
+
+void svc_timing_init(struct svc_timing *svc, const char *name, unsigned long long period_ns, int priority, int cpu);
+
+unsigned long long svc_timing_now(void);
+
+// sequencer side, async-signal-safe so it can be called from a timer handler
+void svc_timing_release(struct svc_timing *svc);
+
+// service side
+void svc_timing_start(struct svc_timing *svc);
+void svc_timing_end(struct svc_timing *svc);
+
+void svc_timing_report(FILE *fp, struct svc_timing *svc, int count);
+
+// one line per service, read by cheddar_export to build the RM model
+int svc_timing_export(const char *path, struct svc_timing *svc, int count);
+
+#endif
@@ -0,0 +1,175 @@
+// writebench - frame storage throughput with 1..N parallel writer threads
+//
+// For every writer count from 1 to --writers the benchmark starts the frame
+// writer (see framewriter.h) with that many threads and submits --frames
+// gray frames as fast as it hands out slots, the way a capture loop that
+// never waits on the disk would if the camera were infinitely fast.  Once
+// the queue is drained the file system is synced, so the rate is what the
+// device took rather than what the page cache swallowed.  Per writer count
+// it prints
+//
+//   queued      MB/s until the last frame was written to the page cache
+//   synced      MB/s including the syncfs() that followed
+//   frames/s    frames per second including the sync
+//
+// Point --dir at each device to compare, e.g. the SD card and an SSD:
+//
+//   writebench --dir /home/pi/frames
+//   writebench --dir /mnt/ssd/frames
+//
+// The frames are deleted after every run.
+//
+// usage: writebench [--dir frames] [--writers N] [--frames N] [--size WxH]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#include "framewriter.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define WRITER_SLOTS (16)
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static int run(const char *dir, unsigned int writers, unsigned long long frames, int width, int height)
+{
+    struct frame_writer w;
+    struct timespec time_stamp;
+    unsigned long long i, start, queued, synced;
+    unsigned char *frame;
+    char path[512];
+    double mb;
+    int dirfd;
+
+    if((dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        perror(dir);
+        return -1;
+    }
+
+    if(frame_writer_start(&w, dir, width, height, WRITER_SLOTS, writers) < 0)
+    {
+        close(dirfd);
+        return -1;
+    }
+
+    // nothing of an earlier run left to write back
+    syncfs(dirfd);
+    start = now_ns();
+
+    for(i = 0; i < frames; i++)
+    {
+        while((frame = frame_writer_get(&w, 0)) == NULL)
+            sched_yield();
+
+        memset(frame, (int)(i & 0xff), (size_t)width * height);
+        clock_gettime(CLOCK_REALTIME, &time_stamp);
+        frame_writer_submit(&w, frame, 0, i, &time_stamp);
+    }
+
+    frame_writer_stop(&w);
+    queued = now_ns() - start;
+
+    syncfs(dirfd);
+    synced = now_ns() - start;
+
+    mb = w.bytes / 1e6;
+    printf("%7u %9llu %10.1lf %10.1lf %10.1lf %8u %8llu\n", writers, w.written[0], mb / ((double)queued / NSEC_PER_SEC),
+           mb / ((double)synced / NSEC_PER_SEC), w.written[0] / ((double)synced / NSEC_PER_SEC), w.max_queued, w.failed);
+    fflush(stdout);
+
+    for(i = 0; i < frames; i++)
+    {
+        snprintf(path, sizeof(path), "%s/cam0-%08llu.pgm", dir, i);
+        unlink(path);
+    }
+
+    close(dirfd);
+    return w.failed ? -1 : 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--dir frames] [--writers N] [--frames N] [--size WxH]\n", prog);
+    fprintf(stderr, "  up to %d writers, default 4 writers, 300 frames of 640x480 in ./writebench\n",
+            FRAME_WRITER_MAX_THREADS);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "dir",     required_argument, NULL, 'D' },
+        { "writers", required_argument, NULL, 'n' },
+        { "frames",  required_argument, NULL, 'c' },
+        { "size",    required_argument, NULL, 's' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *dir = "writebench";
+    unsigned long long frames = 300;
+    unsigned int max_writers = FRAME_WRITER_MAX_THREADS, n;
+    int width = 640, height = 480, opt, failed = 0;
+
+    while((opt = getopt_long(argc, argv, "D:n:c:s:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'D': dir = optarg; break;
+            case 'n': max_writers = (unsigned int)atoi(optarg); break;
+            case 'c': frames = strtoull(optarg, NULL, 0); break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                {
+                    fprintf(stderr, "bad size %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(max_writers < 1 || max_writers > FRAME_WRITER_MAX_THREADS || frames == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%llu frames of %d x %d per run into %s\n", frames, width, height, dir);
+    printf("\n%7s %9s %10s %10s %10s %8s %8s\n", "writers", "frames", "queued", "synced", "frames/s", "peak", "failed");
+    printf("%7s %9s %10s %10s %10s %8s %8s\n", "", "", "MB/s", "MB/s", "", "queue", "");
+
+    for(n = 1; n <= max_writers; n++)
+        if(run(dir, n, frames, width, height) < 0)
+            failed = 1;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
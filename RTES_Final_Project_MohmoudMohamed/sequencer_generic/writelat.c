@@ -0,0 +1,246 @@
+// writelat - write latency tail of frame dumps, buffered, O_DIRECT and smoothed
+//
+// Stores --frames gray frames at --rate Hz the way 10Hz does, once per
+// storage mode (see framedump.h), and times every frame from open to close.
+// The files stay on disk until the mode's run is over, so the page cache
+// fills with dirty frames and the kernel's periodic writeback lands in the
+// middle of the run as it would in a long capture.  Per mode it prints the
+// median and tail of the write time, the frames that took longer than a
+// frame period (stalls) and those that missed their release time because
+// the one before them ran long.
+//
+// With --stage the frames go through the RAM staging tier (see framestage.h)
+// instead, so the time is that of the copy into a slot, and the flush lag
+// and the frames dropped are printed after the table.
+//
+// The default is ten minutes per mode at 10 Hz; --rate 0 writes as fast as
+// the device takes it.
+//
+// usage: writelat [--dir frames] [--frames N] [--rate hz] [--size WxH] [--mode buffered|direct|smooth]
+//                 [--stage slots]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "framedump.h"
+#include "framestage.h"
+#include "lathist.h"
+
+#define NSEC_PER_SEC (1000000000ULL)
+#define NSEC_PER_MSEC (1000000ULL)
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+static int run(const char *dir, enum frame_dump_mode mode, unsigned long long frames, double rate, int width,
+               int height, unsigned int slots)
+{
+    struct frame_dumper d;
+    struct frame_stage st;
+    struct lat_hist latency;
+    struct timespec next, time_stamp;
+    unsigned long long i, start, took, period_ns = rate > 0.0 ? (unsigned long long)(NSEC_PER_SEC / rate) : 0;
+    unsigned long long stalls = 0, late = 0, failed = 0;
+    size_t size = (size_t)width * height;
+    unsigned char *frame;
+    char path[512];
+    int dirfd;
+
+    if((dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        perror(dir);
+        return -1;
+    }
+
+    if(frame_dumper_init(&d, mode, size) < 0 || posix_memalign((void **)&frame, FRAME_DUMP_ALIGN, size) != 0)
+    {
+        close(dirfd);
+        return -1;
+    }
+
+    if(slots && frame_stage_start(&st, width, height, 1, slots, FRAME_STAGE_DROP_NEWEST, mode) < 0)
+    {
+        frame_dumper_free(&d);
+        close(dirfd);
+        free(frame);
+        return -1;
+    }
+
+    // nothing of an earlier run left to write back
+    syncfs(dirfd);
+    lat_hist_reset(&latency);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for(i = 0; i < frames; i++)
+    {
+        if(period_ns)
+        {
+            next.tv_nsec += (long)period_ns;
+            while(next.tv_nsec >= (long)NSEC_PER_SEC)
+            {
+                next.tv_nsec -= (long)NSEC_PER_SEC;
+                next.tv_sec++;
+            }
+
+            // released late when the last frame ran past this one's time
+            if(now_ns() > (unsigned long long)next.tv_sec * NSEC_PER_SEC + next.tv_nsec)
+                late++;
+            else
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        memset(frame, (int)(i & 0xff), size);
+        clock_gettime(CLOCK_REALTIME, &time_stamp);
+        snprintf(path, sizeof(path), "%s/test%08llu.pgm", dir, i);
+
+        start = now_ns();
+        if(slots)
+        {
+            // a full stage drops the frame and counts it, nothing else fails here
+            if(frame_stage_put(&st, path, frame, &time_stamp) < 0 && errno != ENOBUFS && failed++ == 0)
+                perror(path);
+        }
+        else if(frame_dumper_pgm(&d, path, frame, width, height, &time_stamp) < 0)
+        {
+            if(failed++ == 0)
+                perror(path);
+        }
+        took = now_ns() - start;
+
+        lat_hist_add(&latency, took);
+        if(took > (period_ns ? period_ns : 100 * NSEC_PER_MSEC))
+            stalls++;
+    }
+
+    frame_dumper_free(&d);
+    if(slots)
+    {
+        frame_stage_stop(&st);
+        d.bounced = st.dumper.bounced;
+        d.fallbacks = st.dumper.fallbacks;
+        failed = st.failed;
+    }
+
+    printf("%-9s %8llu %9.2lf %9.2lf %9.2lf %9.2lf %7llu %7llu %8llu %s\n", frame_dump_mode_name(mode), latency.count,
+           lat_hist_percentile(&latency, 50.0) / 1e6, lat_hist_percentile(&latency, 99.0) / 1e6,
+           lat_hist_percentile(&latency, 99.9) / 1e6, latency.max / 1e6, stalls, late, d.bounced,
+           d.fallbacks ? "(no O_DIRECT, smoothed)" : "");
+    if(slots)
+        frame_stage_report(&st, stdout);
+    fflush(stdout);
+
+    for(i = 0; i < frames; i++)
+    {
+        snprintf(path, sizeof(path), "%s/test%08llu.pgm", dir, i);
+        unlink(path);
+    }
+
+    syncfs(dirfd);
+    close(dirfd);
+    free(frame);
+
+    return failed ? -1 : 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--dir frames] [--frames N] [--rate hz] [--size WxH] [--mode buffered|direct|smooth]\n"
+            "       [--stage slots]\n", prog);
+    fprintf(stderr, "  default 6000 frames of 640x480 at 10 Hz in ./writelat for every mode\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "dir",    required_argument, NULL, 'D' },
+        { "frames", required_argument, NULL, 'c' },
+        { "rate",   required_argument, NULL, 'r' },
+        { "size",   required_argument, NULL, 's' },
+        { "mode",   required_argument, NULL, 'm' },
+        { "stage",  required_argument, NULL, 'S' },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *dir = "writelat";
+    unsigned long long frames = 6000;
+    double rate = 10.0;
+    int width = 640, height = 480, only = -1, opt, mode, failed = 0;
+    unsigned int slots = 0;
+
+    while((opt = getopt_long(argc, argv, "D:c:r:s:m:S:h", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'D': dir = optarg; break;
+            case 'c': frames = strtoull(optarg, NULL, 0); break;
+            case 'r': rate = atof(optarg); break;
+            case 'S': slots = (unsigned int)strtoul(optarg, NULL, 0); break;
+            case 'm':
+                if((only = frame_dump_mode_parse(optarg)) < 0)
+                {
+                    fprintf(stderr, "unknown mode %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                {
+                    fprintf(stderr, "bad size %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(frames == 0 || rate < 0.0 || slots == 1 || slots > FRAME_POOL_MAX_SLOTS)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%llu frames of %d x %d per mode into %s, %s\n", frames, width, height, dir,
+           rate > 0.0 ? "paced" : "unpaced");
+    if(slots)
+        printf("staged in %u RAM slots, timed from the put to the frame being queued\n", slots);
+    if(rate > 0.0)
+        printf("at %.1lf Hz, a stall is a write longer than the %.1lf ms frame period\n", rate, 1000.0 / rate);
+    else
+        printf("a stall is a write longer than 100 ms\n");
+
+    printf("\n%-9s %8s %9s %9s %9s %9s %7s %7s %8s\n", "mode", "frames", "p50 ms", "p99 ms", "p99.9 ms", "max ms",
+           "stalls", "late", "bounced");
+
+    for(mode = FRAME_DUMP_BUFFERED; mode <= FRAME_DUMP_SMOOTH; mode++)
+        if((only < 0 || only == mode) && run(dir, (enum frame_dump_mode)mode, frames, rate, width, height, slots) < 0)
+            failed = 1;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
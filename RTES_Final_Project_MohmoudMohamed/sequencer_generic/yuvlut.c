@@ -0,0 +1,175 @@
+// Table driven YUV to RGB conversion for YUYV cameras
+//
+// The conversion for one pixel is
+//
+//   R = Ys*(Y-Yoff)                + Cr_r*(V-128)
+//   G = Ys*(Y-Yoff) - Cb_g*(U-128) - Cr_g*(V-128)
+//   B = Ys*(Y-Yoff) + Cb_b*(U-128)
+//
+// where the coefficients follow from Kr/Kb of the matrix (BT.601 or BT.709)
+// and the scale of the quantization range.  Each product only depends on one
+// 8-bit input, so it is precomputed into a 256 entry table in 16.16 fixed
+// point.  The rounding constant is folded into the Y table so a pixel costs
+// 3 adds, 3 shifts and 3 clamp lookups with no multiplies or branches.
+//
+// For YUYV the U and V contributions are shared by both pixels of a pair, so
+// the frame converter computes them once per 4 input bytes.
+
+#include "yuvlut.h"
+
+#define LUT_FRAC_BITS (16)
+#define LUT_ONE (1 << LUT_FRAC_BITS)
+
+// Worst case sums are about -280 (limited range B) to +535 (limited range B),
+// so a clamp table covering -384..639 never needs a bounds check.
+#define CLIP_OFFSET (384)
+#define CLIP_SIZE (1024)
+
+static int y_tab[256];
+static int rv_tab[256];
+static int gu_tab[256];
+static int gv_tab[256];
+static int bu_tab[256];
+
+static unsigned char clip_tab[CLIP_SIZE];
+static const unsigned char *clip = &clip_tab[CLIP_OFFSET];
+
+static enum yuv_matrix lut_matrix = YUV_MATRIX_BT601;
+static enum yuv_range lut_range = YUV_RANGE_LIMITED;
+static int lut_ready = 0;
+
+
+static int fix(double x)
+{
+    x = x * (double)LUT_ONE;
+    return (int)(x >= 0.0 ? x + 0.5 : x - 0.5);
+}
+
+
+void yuv_lut_init(enum yuv_matrix matrix, enum yuv_range range)
+{
+    double kr, kb, kg;
+    double y_scale, c_scale;
+    int y_off, i;
+
+    if(matrix == YUV_MATRIX_BT709)
+    {
+        kr = 0.2126; kb = 0.0722;
+    }
+    else
+    {
+        kr = 0.299; kb = 0.114;
+    }
+    kg = 1.0 - kr - kb;
+
+    if(range == YUV_RANGE_FULL)
+    {
+        y_off = 0;
+        y_scale = 1.0;
+        c_scale = 1.0;
+    }
+    else
+    {
+        y_off = 16;
+        y_scale = 255.0 / 219.0;
+        c_scale = 255.0 / 224.0;
+    }
+
+    for(i = 0; i < 256; i++)
+    {
+        // +0.5 rounds the final >> LUT_FRAC_BITS, only needs adding once
+        y_tab[i]  = fix(y_scale * (i - y_off)) + (LUT_ONE / 2);
+        rv_tab[i] = fix(c_scale * 2.0 * (1.0 - kr) * (i - 128));
+        gu_tab[i] = fix(-c_scale * 2.0 * kb * (1.0 - kb) / kg * (i - 128));
+        gv_tab[i] = fix(-c_scale * 2.0 * kr * (1.0 - kr) / kg * (i - 128));
+        bu_tab[i] = fix(c_scale * 2.0 * (1.0 - kb) * (i - 128));
+    }
+
+    for(i = 0; i < CLIP_SIZE; i++)
+    {
+        int v = i - CLIP_OFFSET;
+        clip_tab[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+    }
+
+    lut_matrix = matrix;
+    lut_range = range;
+    lut_ready = 1;
+}
+
+
+enum yuv_matrix yuv_lut_matrix(void)
+{
+    return lut_matrix;
+}
+
+
+enum yuv_range yuv_lut_range(void)
+{
+    return lut_range;
+}
+
+
+const char *yuv_lut_name(void)
+{
+    if(lut_matrix == YUV_MATRIX_BT709)
+        return (lut_range == YUV_RANGE_FULL) ? "BT.709 full range" : "BT.709 limited range";
+    else
+        return (lut_range == YUV_RANGE_FULL) ? "BT.601 full range" : "BT.601 limited range";
+}
+
+
+void yuv2rgb_lut(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+    int yy;
+
+    if(!lut_ready) yuv_lut_init(YUV_MATRIX_BT601, YUV_RANGE_LIMITED);
+
+    yy = y_tab[y & 0xff];
+
+    *r = clip[(yy + rv_tab[v & 0xff]) >> LUT_FRAC_BITS];
+    *g = clip[(yy + gu_tab[u & 0xff] + gv_tab[v & 0xff]) >> LUT_FRAC_BITS];
+    *b = clip[(yy + bu_tab[u & 0xff]) >> LUT_FRAC_BITS];
+}
+
+
+void yuyv2rgb_lut(const unsigned char *yuyv, unsigned char *rgb, int size)
+{
+    int i;
+
+    if(!lut_ready) yuv_lut_init(YUV_MATRIX_BT601, YUV_RANGE_LIMITED);
+
+    // Pixels are YU and YV alternating, so YUYV which is 4 bytes
+    // We want RGB, so RGBRGB which is 6 bytes
+    //
+    for(i = 0; i < size; i += 4, yuyv += 4, rgb += 6)
+    {
+        int y0 = y_tab[yuyv[0]];
+        int y1 = y_tab[yuyv[2]];
+        int rv = rv_tab[yuyv[3]];
+        int guv = gu_tab[yuyv[1]] + gv_tab[yuyv[3]];
+        int bu = bu_tab[yuyv[1]];
+
+        rgb[0] = clip[(y0 + rv) >> LUT_FRAC_BITS];
+        rgb[1] = clip[(y0 + guv) >> LUT_FRAC_BITS];
+        rgb[2] = clip[(y0 + bu) >> LUT_FRAC_BITS];
+        rgb[3] = clip[(y1 + rv) >> LUT_FRAC_BITS];
+        rgb[4] = clip[(y1 + guv) >> LUT_FRAC_BITS];
+        rgb[5] = clip[(y1 + bu) >> LUT_FRAC_BITS];
+    }
+}
+
+
+void yuyv2y(const unsigned char *yuyv, unsigned char *y, int size)
+{
+    int i, newi;
+
+    // Pixels are YU and YV alternating, so YUYV which is 4 bytes
+    // We want Y, so YY which is 2 bytes
+    //
+    for(i = 0, newi = 0; i < size; i = i + 4, newi = newi + 2)
+    {
+        // Y1=first byte and Y2=third byte
+        y[newi] = yuyv[i];
+        y[newi + 1] = yuyv[i + 2];
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _YUVLUT_H_
+#define _YUVLUT_H_
+
+// Table driven YUV to RGB conversion
+//
+// All per-pixel multiplies of yuv2rgb() and yuv2rgb_float() are replaced by
+// lookups into 256 entry tables of 16.16 fixed point contributions for Y, U
+// and V, followed by a saturating clamp that is also a table lookup.  The
+// tables are rebuilt by yuv_lut_init() so the matrix and quantization range
+// can be changed at runtime, e.g. to match what the driver reports.
+
+enum yuv_matrix
+{
+    YUV_MATRIX_BT601 = 0,
+    YUV_MATRIX_BT709 = 1
+};
+
+enum yuv_range
+{
+    YUV_RANGE_LIMITED = 0,   // Y 16..235, UV 16..240 (studio swing)
+    YUV_RANGE_FULL = 1       // Y, UV 0..255 (JPEG / full swing)
+};
+
+void yuv_lut_init(enum yuv_matrix matrix, enum yuv_range range);
+enum yuv_matrix yuv_lut_matrix(void);
+enum yuv_range yuv_lut_range(void);
+const char *yuv_lut_name(void);
+
+// drop-in replacement for yuv2rgb() using the current tables
+void yuv2rgb_lut(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b);
+
+// convert a packed YUYV (YUV422) buffer of size bytes to packed RGB24
+void yuyv2rgb_lut(const unsigned char *yuyv, unsigned char *rgb, int size);
+
+// extract the luma of a packed YUYV buffer of size bytes, size/2 gray bytes
+void yuyv2y(const unsigned char *yuyv, unsigned char *y, int size);
+
+#endif